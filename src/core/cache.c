@@ -1,148 +1,1745 @@
 #include "cache.h"
 #include "log.h"
+#include "lazy_lock.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <windows.h>
+#include <process.h>
 
-#define CACHE_DIR "cache"
+#define CACHE_INDEX_FILE "cache.idx"
+#define CACHE_DATA_FILE "cache.dat"
 
-// Simple hash function for URL to filename
-static void url_to_filename(const char *url, char *filename, size_t max_len) {
-    if (!url || !filename) return;
+#define CACHE_INDEX_MAGIC 0x58493347u  // "G3IX"
+#define CACHE_ENTRY_MAGIC 0x45343447u  // "G44E"
+#define CACHE_BLOB_MAGIC 0x42343447u   // "G44B"
+#define CACHE_DEAD_MAGIC 0x58343447u   // "G44X": an entry written but never to be indexed
+#define CACHE_FORMAT_VERSION 4
+#define CACHE_INITIAL_SLOTS 4096
+#define CACHE_MAX_LOAD_PERCENT 70
+#define CACHE_MAX_URL 8192
+#define CACHE_RECORD_ALIGN 8
+#define CACHE_COPY_CHUNK (64 * 1024)
 
-    // Extract domain from URL
-    const char *scheme_end = strstr(url, "://");
-    if (!scheme_end) scheme_end = url;
-    else scheme_end += 3;
+// Eviction goes down to this share of the budget, so it runs in batches
+#define CACHE_EVICT_LOW_WATER_PERCENT 90
+// Compact once a quarter of the data file (and at least this much) is garbage
+#define CACHE_COMPACT_MIN_GARBAGE (1024 * 1024)
+// Bytes moved per compaction step; the lock is released between steps
+#define CACHE_COMPACT_STEP (256 * 1024)
+#define CACHE_MAINTENANCE_INTERVAL_MS 5000
 
-    const char *domain_start = scheme_end;
-    const char *domain_end = strchr(domain_start, '/');
-    if (!domain_end) domain_end = domain_start + strlen(domain_start);
+// Queued stores may hold this many body bytes before cache_store waits
+#define CACHE_WRITE_QUEUE_LIMIT (8 * 1024 * 1024)
+// Bytes appended per batch (a single larger record goes alone)
+#define CACHE_WRITE_BATCH (1024 * 1024)
+// Pause after a wakeup so stores from the same page share a batch
+#define CACHE_WRITE_DELAY_MS 50
 
-    // Extract domain (remove port if present)
-    char domain[256] = {0};
-    int domain_len = (int)(domain_end - domain_start);
-    if (domain_len > 255) domain_len = 255;
-    strncpy(domain, domain_start, domain_len);
-    domain[domain_len] = '\0';
+#define RECORD_ALIGN(n) (((n) + CACHE_RECORD_ALIGN - 1) & ~(unsigned long long)(CACHE_RECORD_ALIGN - 1))
+#define ENTRY_LENGTH(url_len) RECORD_ALIGN(sizeof(cache_record_t) + (url_len))
+#define BLOB_LENGTH(body_size) RECORD_ALIGN(sizeof(cache_blob_t) + (body_size))
 
-    // Remove port from domain
-    char *port = strchr(domain, ':');
-    if (port) *port = '\0';
+/*
+ * On-disk layout
+ *
+ * cache.dat is append-only and holds two kinds of record, padded to 8
+ * bytes: blobs (header, body) and entries (header, URL, metadata). Bodies are
+ * content-addressed: an entry names its body by a 64-bit hash of the content,
+ * and a body that arrives under several URLs is written once and shared.
+ * Older records for the same URL simply become unreachable.
+ *
+ * cache.idx is an open-addressing hash table (linear probing) mapped into
+ * memory as a whole. Entry slots are keyed by URL, blob slots by content
+ * hash and count the entries using them, so a lookup is two probes in RAM,
+ * one read of the entry and one mapped view of the blob. Keys only pick
+ * candidates; the URL stored in the entry decides, and the writer compares
+ * the bytes before it shares a blob. If the index is missing, damaged or was
+ * not closed cleanly it is rebuilt by scanning the data file.
+ *
+ * Every store and hit stamps the entry from a counter in the header, which
+ * gives the LRU order for eviction; a blob goes with the last entry using it.
+ * Evicted and replaced records are garbage until compaction slides the live
+ * records down over them (keeping their order) and truncates the file.
+ * Records carry a sequence number and a checksum (of the body or the URL) so
+ * that a rebuild after a crash mid-compaction keeps the newest intact copy of
+ * each URL and stops at the first damaged record.
+ */
 
-    // Create filename from URL hash
-    unsigned int hash = 5381;
-    for (const char *p = url; *p; p++) {
-        hash = ((hash << 5) + hash) + (unsigned char)*p;  // hash * 33 + c
+typedef enum {
+    CACHE_SLOT_EMPTY = 0,
+    CACHE_SLOT_LIVE,               // An entry
+    CACHE_SLOT_DELETED,
+    CACHE_SLOT_BLOB
+} cache_slot_state_t;
+
+typedef struct {
+    unsigned long long key;        // URL key, or content key for a blob
+    unsigned long long blob;       // Entries: content key of the body
+    unsigned long long offset;     // Of the record in cache.dat
+    unsigned int length;           // Whole record, with padding
+    unsigned int state;
+    unsigned int last_used;        // Entries: header clock at the last store or hit
+    unsigned int refs;             // Blobs: entries using the body
+} cache_slot_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slot_count;
+    unsigned int live_count;       // Entries
+    unsigned int used_count;       // Occupied and deleted slots, for the load factor
+    unsigned int clean;            // Set on a proper close; otherwise rebuilt on open
+    unsigned long long data_end;   // Records beyond this were never indexed
+    unsigned long long live_bytes; // Sum of live entry and blob lengths, against the budget
+    unsigned int clock;            // Bumped on every store and hit
+    unsigned int blob_count;
+} cache_index_header_t;
+
+typedef struct {
+    unsigned int magic;            // CACHE_ENTRY_MAGIC or CACHE_DEAD_MAGIC
+    unsigned int url_len;          // URL follows the header, not NUL-terminated
+    unsigned long long key;
+    unsigned long long blob;       // Content key of the body
+    unsigned long long body_size;
+    unsigned int seq;              // Header clock when stored; the highest wins in a rebuild
+    unsigned int checksum;         // FNV-1a of the URL
+    cache_meta_t meta;
+} cache_record_t;
+
+typedef struct {
+    unsigned int magic;            // CACHE_BLOB_MAGIC
+    unsigned int reserved;
+    unsigned long long key;        // Content key
+    unsigned long long body_size;  // Body follows the header
+    unsigned int seq;
+    unsigned int checksum;         // FNV-1a of the body
+} cache_blob_t;
+
+// Either kind of record, told apart by the magic both start with
+typedef union {
+    unsigned int magic;
+    cache_record_t entry;
+    cache_blob_t blob;
+} cache_header_t;
+
+// Where the files live (see cache_set_directory)
+static char g_cache_dir[MAX_PATH] = CACHE_DEFAULT_DIR;
+static char g_index_path[MAX_PATH] = CACHE_DEFAULT_DIR "\\" CACHE_INDEX_FILE;
+static char g_data_path[MAX_PATH] = CACHE_DEFAULT_DIR "\\" CACHE_DATA_FILE;
+
+static HANDLE g_index_file = INVALID_HANDLE_VALUE;
+static HANDLE g_index_map = NULL;
+static cache_index_header_t *g_index = NULL;   // The whole index file, mapped
+static cache_slot_t *g_slots = NULL;
+static HANDLE g_data_file = INVALID_HANDLE_VALUE;
+static HANDLE g_data_map = NULL;
+static unsigned long long g_data_mapped = 0;   // File size when g_data_map was created
+static DWORD g_granularity = 65536;
+static volatile LONG g_open_views = 0;         // Compaction waits until these are closed
+
+// Incremental compaction: records before read have been processed and the
+// live ones now end at write
+static int g_compacting = 0;
+static unsigned long long g_compact_read = 0;
+static unsigned long long g_compact_write = 0;
+
+// Background thread: writes queued stores, then evicts and compacts
+static HANDLE g_worker_thread = NULL;
+static HANDLE g_worker_wake = NULL;
+static volatile LONG g_worker_stop = 0;
+
+static lazy_lock_t g_cache_lock;
+
+static void cache_lock(void) {
+    lazy_lock_enter(&g_cache_lock);
+}
+
+static void cache_unlock(void) {
+    lazy_lock_leave(&g_cache_lock);
+}
+
+/*
+ * Memory tier
+ *
+ * Recently used bodies stay in RAM as refcounted buffers, found through a
+ * chained hash table and kept in LRU order under a byte budget. The tier
+ * holds one reference; evicting an entry only drops that one, so buffers
+ * still in use elsewhere live on until released.
+ *
+ * Buffers are interned by content: creating one with the same bytes as a
+ * live buffer returns that buffer instead, so a body fetched under several
+ * URLs is held once by the tier, the write queue and the DOM alike, and is
+ * counted once against the budget. The intern table does not own buffers;
+ * the last release takes one out.
+ */
+
+#define MEM_BUCKETS 1024
+
+typedef struct mem_entry_s {
+    char *url;
+    unsigned long long key;
+    cache_meta_t meta;
+    cache_buffer_t *buffer;
+    struct mem_entry_s *hash_next;
+    struct mem_entry_s *lru_prev;  // Towards the most recently used
+    struct mem_entry_s *lru_next;
+} mem_entry_t;
+
+typedef struct shared_buffer_s {
+    cache_buffer_t buffer;         // First, so a buffer pointer is also the container
+    unsigned long long hash;       // Content key
+    unsigned int tier_refs;        // Memory tier entries holding it
+    struct shared_buffer_s *next;
+} shared_buffer_t;
+
+static shared_buffer_t *g_shared[MEM_BUCKETS];
+static mem_entry_t *g_mem_buckets[MEM_BUCKETS];
+static mem_entry_t *g_lru_head = NULL;
+static mem_entry_t *g_lru_tail = NULL;
+static cache_stats_t g_stats = {0, 0, 0, 0, 0, CACHE_MEMORY_DEFAULT_BUDGET, 0, 0, 0, 0, 0, CACHE_DISK_DEFAULT_BUDGET, 0, 0, 0, 0, 0,
+                                0, 0, 0};
+
+// 64-bit FNV-1a of a URL or a body; 0 is never returned
+static unsigned long long hash_key(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+// 32-bit FNV-1a, continuing from hash (start with 2166136261)
+static unsigned int body_checksum(unsigned int hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Positional I/O (an OVERLAPPED offset on a synchronous handle), so the
+// writer can append outside the lock while lookups read the same file
+static int read_at(HANDLE file, unsigned long long offset, void *buf, DWORD len) {
+    OVERLAPPED ov;
+    DWORD done = 0;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    return ReadFile(file, buf, len, &done, &ov) && done == len;
+}
+
+static int write_at(HANDLE file, unsigned long long offset, const void *buf, DWORD len) {
+    OVERLAPPED ov;
+    DWORD done = 0;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    return WriteFile(file, buf, len, &done, &ov) && done == len;
+}
+
+static unsigned long long file_size(HANDLE file) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) return 0;
+    return (unsigned long long)size.QuadPart;
+}
+
+static void unmap_index(void) {
+    if (g_index) {
+        FlushViewOfFile(g_index, 0);
+        UnmapViewOfFile(g_index);
+    }
+    if (g_index_map) CloseHandle(g_index_map);
+    g_index = NULL;
+    g_slots = NULL;
+    g_index_map = NULL;
+}
+
+// Size the index file for slot_count slots and map all of it
+static int map_index(unsigned int slot_count) {
+    unsigned long long size = sizeof(cache_index_header_t) + (unsigned long long)slot_count * sizeof(cache_slot_t);
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(g_index_file, end, NULL, FILE_BEGIN) || !SetEndOfFile(g_index_file)) return 0;
+
+    g_index_map = CreateFileMappingA(g_index_file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (!g_index_map) return 0;
+    g_index = MapViewOfFile(g_index_map, FILE_MAP_WRITE, 0, 0, (size_t)size);
+    if (!g_index) {
+        CloseHandle(g_index_map);
+        g_index_map = NULL;
+        return 0;
+    }
+    g_slots = (cache_slot_t *)(g_index + 1);
+    return 1;
+}
+
+static void reset_index(unsigned int slot_count, unsigned long long data_end) {
+    memset(g_slots, 0, (size_t)slot_count * sizeof(cache_slot_t));
+    g_index->magic = CACHE_INDEX_MAGIC;
+    g_index->version = CACHE_FORMAT_VERSION;
+    g_index->slot_count = slot_count;
+    g_index->live_count = 0;
+    g_index->used_count = 0;
+    g_index->clean = 0;
+    g_index->data_end = data_end;
+    g_index->live_bytes = 0;
+    g_index->clock = 0;
+    g_index->blob_count = 0;
+}
+
+// Read the header of the record at offset and work out its whole length.
+// Returns 0 unless it is a plausible record ending by limit.
+static int read_header(unsigned long long offset, unsigned long long limit, cache_header_t *header,
+                       unsigned long long *length) {
+    if (offset + sizeof(cache_blob_t) > limit || !read_at(g_data_file, offset, &header->blob, sizeof(cache_blob_t))) return 0;
+    if (header->magic == CACHE_BLOB_MAGIC) {
+        *length = BLOB_LENGTH(header->blob.body_size);
+    } else if (header->magic == CACHE_ENTRY_MAGIC || header->magic == CACHE_DEAD_MAGIC) {
+        if (offset + sizeof(cache_record_t) > limit || !read_at(g_data_file, offset, &header->entry, sizeof(cache_record_t)) ||
+            header->entry.url_len == 0 || header->entry.url_len > CACHE_MAX_URL) {
+            return 0;
+        }
+        *length = ENTRY_LENGTH(header->entry.url_len);
+    } else {
+        return 0;
+    }
+    return offset + *length <= limit;
+}
+
+// Does the entry at slot belong to url? Its header goes to *record.
+static int read_entry(const cache_slot_t *slot, const char *url, size_t url_len, cache_record_t *record) {
+    if (!read_at(g_data_file, slot->offset, record, sizeof(*record))) return 0;
+    if (record->magic != CACHE_ENTRY_MAGIC || record->url_len != url_len) return 0;
+
+    char stack_buf[1024];
+    char *stored = url_len <= sizeof(stack_buf) ? stack_buf : malloc(url_len);
+    if (!stored) return 0;
+    int match = read_at(g_data_file, slot->offset + sizeof(*record), stored, (DWORD)url_len) &&
+                memcmp(stored, url, url_len) == 0;
+    if (stored != stack_buf) free(stored);
+    return match;
+}
+
+// Entry slot holding url, or NULL; *free_slot (optional) gets where it would go
+static cache_slot_t* find_slot(const char *url, size_t url_len, unsigned long long key, cache_slot_t **free_slot) {
+    unsigned int count = g_index->slot_count;
+    cache_slot_t *first_free = NULL;
+    cache_record_t record;
+    for (unsigned int i = 0, pos = (unsigned int)(key % count); i < count; i++, pos = (pos + 1) % count) {
+        cache_slot_t *slot = &g_slots[pos];
+        if (slot->state == CACHE_SLOT_EMPTY) {
+            if (!first_free) first_free = slot;
+            break;
+        }
+        if (slot->state == CACHE_SLOT_DELETED) {
+            if (!first_free) first_free = slot;
+        } else if (slot->state == CACHE_SLOT_LIVE && slot->key == key && read_entry(slot, url, url_len, &record)) {
+            return slot;
+        }
+    }
+    if (free_slot) *free_slot = first_free;
+    return NULL;
+}
+
+// Blob slot for a content key, or NULL
+static cache_slot_t* find_blob(unsigned long long key) {
+    unsigned int count = g_index->slot_count;
+    for (unsigned int i = 0, pos = (unsigned int)(key % count); i < count; i++, pos = (pos + 1) % count) {
+        cache_slot_t *slot = &g_slots[pos];
+        if (slot->state == CACHE_SLOT_EMPTY) break;
+        if (slot->state == CACHE_SLOT_BLOB && slot->key == key) return slot;
+    }
+    return NULL;
+}
+
+// Insert a copy of from (an entry or a blob) without checking for an
+// existing one: rebuilds, growth and new blobs
+static cache_slot_t* insert_slot(const cache_slot_t *from) {
+    unsigned int count = g_index->slot_count;
+    unsigned int pos = (unsigned int)(from->key % count);
+    while (g_slots[pos].state == CACHE_SLOT_LIVE || g_slots[pos].state == CACHE_SLOT_BLOB) pos = (pos + 1) % count;
+    if (g_slots[pos].state == CACHE_SLOT_EMPTY) g_index->used_count++;
+    g_slots[pos] = *from;
+    if (from->state == CACHE_SLOT_BLOB) g_index->blob_count++;
+    else g_index->live_count++;
+    g_index->live_bytes += from->length;
+    return &g_slots[pos];
+}
+
+// Drop one use of a blob; the last one makes it garbage
+static void release_blob(cache_slot_t *blob) {
+    if (blob->refs > 0) blob->refs--;
+    if (blob->refs > 0) return;
+    blob->state = CACHE_SLOT_DELETED;
+    g_index->blob_count--;
+    g_index->live_bytes -= blob->length;
+}
+
+static void drop_entry(cache_slot_t *slot) {
+    slot->state = CACHE_SLOT_DELETED;
+    g_index->live_count--;
+    g_index->live_bytes -= slot->length;
+    cache_slot_t *blob = find_blob(slot->blob);
+    if (blob) release_blob(blob);
+}
+
+// Double the table (or just drop tombstones) once it passes the load limit
+static int grow_index(void) {
+    unsigned int old_count = g_index->slot_count;
+    unsigned int occupied = g_index->live_count + g_index->blob_count;
+    unsigned int new_count = occupied * 2 >= old_count ? old_count * 2 : old_count;
+    unsigned long long data_end = g_index->data_end;
+    unsigned int clock = g_index->clock;
+
+    cache_slot_t *live = malloc((size_t)occupied * sizeof(cache_slot_t) + 1);
+    if (!live) return 0;
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < old_count; i++) {
+        if (g_slots[i].state == CACHE_SLOT_LIVE || g_slots[i].state == CACHE_SLOT_BLOB) live[n++] = g_slots[i];
+    }
+
+    unmap_index();
+    if (!map_index(new_count)) {
+        new_count = old_count;
+        if (!map_index(new_count)) {
+            LOG_ERROR("Cache: cannot remap %s", g_index_path);
+            free(live);
+            return 0;
+        }
+    }
+    reset_index(new_count, data_end);
+    g_index->clock = clock;
+    for (unsigned int i = 0; i < n; i++) insert_slot(&live[i]);
+    free(live);
+    LOG_DEBUG("Cache index resized to %u slots (%u entries)", g_index->slot_count, n);
+    return 1;
+}
+
+// Does the body at offset match checksum? Read in chunks; rebuilds only.
+static int verify_body(unsigned long long offset, unsigned long long size, unsigned int checksum) {
+    char *chunk = malloc(CACHE_COPY_CHUNK);
+    if (!chunk) return 0;
+    unsigned int hash = 2166136261u;
+    int ok = 1;
+    for (unsigned long long done = 0; ok && done < size; ) {
+        DWORD n = (DWORD)(size - done < CACHE_COPY_CHUNK ? size - done : CACHE_COPY_CHUNK);
+        ok = read_at(g_data_file, offset + done, chunk, n);
+        hash = body_checksum(hash, chunk, n);
+        done += n;
+    }
+    free(chunk);
+    return ok && hash == checksum;
+}
+
+// Count the entries using each blob; entries whose body is missing and
+// blobs nobody uses are dropped
+static void link_blobs(void) {
+    for (unsigned int i = 0; i < g_index->slot_count; i++) {
+        if (g_slots[i].state != CACHE_SLOT_LIVE) continue;
+        cache_slot_t *blob = find_blob(g_slots[i].blob);
+        if (blob) {
+            blob->refs++;
+        } else {
+            g_slots[i].state = CACHE_SLOT_DELETED;
+            g_index->live_count--;
+            g_index->live_bytes -= g_slots[i].length;
+        }
+    }
+    for (unsigned int i = 0; i < g_index->slot_count; i++) {
+        if (g_slots[i].state == CACHE_SLOT_BLOB && g_slots[i].refs == 0) release_blob(&g_slots[i]);
+    }
+}
+
+// Recreate the index from the records in cache.dat; the highest sequence
+// number of each URL wins
+static void rebuild_index(void) {
+    unsigned long long size = file_size(g_data_file);
+    unsigned long long offset = 0;
+    unsigned int records = 0;
+    unsigned int clock = 0;
+    char *url = malloc(CACHE_MAX_URL);
+
+    while (url && offset < size) {
+        cache_header_t header;
+        unsigned long long record_length;
+        if (!read_header(offset, size, &header, &record_length)) {
+            break; // A torn write or interrupted compaction; everything after it is dropped
+        }
+        const cache_record_t *entry = &header.entry;
+        int blob = header.magic == CACHE_BLOB_MAGIC;
+        if (blob ? !verify_body(offset + sizeof(cache_blob_t), header.blob.body_size, header.blob.checksum)
+                 : !read_at(g_data_file, offset + sizeof(cache_record_t), url, entry->url_len) ||
+                   body_checksum(2166136261u, url, entry->url_len) != entry->checksum) {
+            break;
+        }
+        unsigned int length = (unsigned int)record_length;
+        if ((g_index->used_count + 1) * 100 > g_index->slot_count * CACHE_MAX_LOAD_PERCENT && !grow_index()) break;
+
+        cache_slot_t found;
+        memset(&found, 0, sizeof(found));
+        found.offset = offset;
+        found.length = length;
+        unsigned int seq = blob ? header.blob.seq : entry->seq;
+        if (blob) {
+            // Bodies are written once per key; another copy is garbage left by a clear
+            found.key = header.blob.key;
+            found.state = CACHE_SLOT_BLOB;
+            if (!find_blob(found.key)) insert_slot(&found);
+        } else if (header.magic == CACHE_ENTRY_MAGIC) {
+            found.key = hash_key(url, entry->url_len);
+            found.blob = entry->blob;
+            found.state = CACHE_SLOT_LIVE;
+            found.last_used = seq;
+            cache_slot_t *slot = find_slot(url, entry->url_len, found.key, NULL);
+            if (!slot) {
+                insert_slot(&found);
+            } else if (seq >= slot->last_used) {
+                g_index->live_bytes = g_index->live_bytes - slot->length + length;
+                *slot = found;
+            }
+        }
+        if (seq > clock) clock = seq;
+        offset += length;
+        records++;
     }
+    free(url);
+    if (!g_index) return;
+    link_blobs();
+    g_index->data_end = offset;
+    g_index->clock = clock;
 
-    snprintf(filename, max_len, "%s\\%s\\%08x.cache", CACHE_DIR, domain, hash);
+    // Nothing past the last good record is reachable any more
+    if (offset < size) {
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG)offset;
+        if (!SetFilePointerEx(g_data_file, end, NULL, FILE_BEGIN) || !SetEndOfFile(g_data_file)) {
+            LOG_WARN("Cache: cannot truncate %s", g_data_path);
+        }
+    }
+    LOG_INFO("Cache index rebuilt: %u records, %u entries, %u bodies", records, g_index->live_count, g_index->blob_count);
 }
 
-// Create directory if it doesn't exist
-static int ensure_directory_exists(const char *path) {
-    // Find the last backslash
-    char dir[MAX_PATH] = {0};
-    strncpy(dir, path, sizeof(dir) - 1);
+static void close_files(void) {
+    if (g_index && g_data_file != INVALID_HANDLE_VALUE && FlushFileBuffers(g_data_file)) g_index->clean = 1;
+    g_compacting = 0;
+    unmap_index();
+    if (g_data_map) CloseHandle(g_data_map);
+    g_data_map = NULL;
+    g_data_mapped = 0;
+    if (g_index_file != INVALID_HANDLE_VALUE) CloseHandle(g_index_file);
+    if (g_data_file != INVALID_HANDLE_VALUE) CloseHandle(g_data_file);
+    g_index_file = INVALID_HANDLE_VALUE;
+    g_data_file = INVALID_HANDLE_VALUE;
+}
+
+// Open both files, mapping the index; caller holds the lock
+static int ensure_open(void) {
+    if (g_index) return 1;
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    if (si.dwAllocationGranularity) g_granularity = si.dwAllocationGranularity;
 
-    char *last_slash = strrchr(dir, '\\');
-    if (last_slash) {
-        *last_slash = '\0';
+    CreateDirectoryA(g_cache_dir, NULL);
+    g_data_file = CreateFileA(g_data_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    g_index_file = CreateFileA(g_index_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_data_file == INVALID_HANDLE_VALUE || g_index_file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("Cache: cannot open %s / %s", g_data_path, g_index_path);
+        close_files();
+        return 0;
     }
 
-    // Try to create the directory (will fail silently if it exists)
-    CreateDirectoryA(dir, NULL);
+    // Trust an existing index only if it is consistent with the data file
+    cache_index_header_t header;
+    unsigned long long index_size = file_size(g_index_file);
+    int valid = index_size >= sizeof(header) && read_at(g_index_file, 0, &header, sizeof(header)) &&
+                header.magic == CACHE_INDEX_MAGIC && header.version == CACHE_FORMAT_VERSION &&
+                header.clean && header.slot_count > 0 &&
+                index_size == sizeof(header) + (unsigned long long)header.slot_count * sizeof(cache_slot_t) &&
+                header.data_end <= file_size(g_data_file);
+
+    if (!map_index(valid ? header.slot_count : CACHE_INITIAL_SLOTS)) {
+        LOG_ERROR("Cache: cannot map %s", g_index_path);
+        close_files();
+        return 0;
+    }
+    if (!valid) {
+        reset_index(CACHE_INITIAL_SLOTS, 0);
+        rebuild_index();
+        if (!g_index) {
+            close_files();
+            return 0;
+        }
+    }
+    // Until close_files sets it again, a crash leaves the index to be rebuilt
+    g_index->clean = 0;
+    FlushViewOfFile(g_index, sizeof(cache_index_header_t));
     return 1;
 }
 
+static unsigned long long buffer_key(const cache_buffer_t *buffer) {
+    return ((const shared_buffer_t *)buffer)->hash;
+}
+
+// A live buffer holding size bytes equal to data, retained for the caller.
+// One whose last reference is being dropped right now is passed over.
+static cache_buffer_t* find_shared(unsigned long long hash, const void *data, size_t size) {
+    for (shared_buffer_t *s = g_shared[hash % MEM_BUCKETS]; s; s = s->next) {
+        if (s->hash != hash || s->buffer.size != size || memcmp(s->buffer.data, data, size) != 0) continue;
+        LONG refs;
+        while ((refs = s->buffer.refs) > 0) {
+            if (InterlockedCompareExchange(&s->buffer.refs, refs + 1, refs) == refs) return &s->buffer;
+        }
+    }
+    return NULL;
+}
+
+static cache_buffer_t* buffer_create(const void *data, size_t size) {
+    unsigned long long hash = hash_key(data, size);
+    cache_lock();
+    cache_buffer_t *found = find_shared(hash, data, size);
+    if (found) g_stats.buffers_shared++;
+    cache_unlock();
+    if (found) return found;
+
+    shared_buffer_t *s = malloc(sizeof(shared_buffer_t) + size + 1);
+    if (!s) return NULL;
+    char *bytes = (char *)(s + 1);
+    memcpy(bytes, data, size);
+    bytes[size] = '\0';
+    s->buffer.refs = 1;
+    s->buffer.size = size;
+    s->buffer.data = bytes;
+    s->hash = hash;
+    s->tier_refs = 0;
+
+    // Somebody may have created the same body meanwhile
+    cache_lock();
+    found = find_shared(hash, data, size);
+    if (!found) {
+        s->next = g_shared[hash % MEM_BUCKETS];
+        g_shared[hash % MEM_BUCKETS] = s;
+    }
+    cache_unlock();
+    if (found) free(s);
+    return found ? found : &s->buffer;
+}
+
+cache_buffer_t* cache_buffer_create(const void *data, size_t size) {
+    if (!data) return NULL;
+    return buffer_create(data, size);
+}
+
+cache_buffer_t* cache_buffer_retain(cache_buffer_t *buffer) {
+    if (buffer) InterlockedIncrement(&buffer->refs);
+    return buffer;
+}
+
+void cache_buffer_release(cache_buffer_t *buffer) {
+    if (!buffer || InterlockedDecrement(&buffer->refs) > 0) return;
+    shared_buffer_t *s = (shared_buffer_t *)buffer;
+    cache_lock();
+    shared_buffer_t **link = &g_shared[s->hash % MEM_BUCKETS];
+    while (*link != s) link = &(*link)->next;
+    *link = s->next;
+    cache_unlock();
+    free(s);
+}
+
+static mem_entry_t* mem_find(const char *url, unsigned long long key) {
+    for (mem_entry_t *e = g_mem_buckets[key % MEM_BUCKETS]; e; e = e->hash_next) {
+        if (e->key == key && strcmp(e->url, url) == 0) return e;
+    }
+    return NULL;
+}
+
+static void lru_unlink(mem_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else g_lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else g_lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(mem_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = g_lru_head;
+    if (g_lru_head) g_lru_head->lru_prev = e;
+    g_lru_head = e;
+    if (!g_lru_tail) g_lru_tail = e;
+}
+
+static void mem_remove(mem_entry_t *e) {
+    mem_entry_t **link = &g_mem_buckets[e->key % MEM_BUCKETS];
+    while (*link != e) link = &(*link)->hash_next;
+    *link = e->hash_next;
+    lru_unlink(e);
+    if (--((shared_buffer_t *)e->buffer)->tier_refs == 0) g_stats.resident_bytes -= e->buffer->size;
+    g_stats.entries--;
+    cache_buffer_release(e->buffer);
+    free(e->url);
+    free(e);
+}
+
+static void mem_enforce_budget(void) {
+    while (g_lru_tail && g_stats.resident_bytes > g_stats.budget) {
+        mem_remove(g_lru_tail);
+        g_stats.evictions++;
+    }
+}
+
+// Put buffer in the tier under url (replacing what was there); the tier
+// takes its own reference. Bodies over a quarter of the budget are left out
+// so one large download cannot flush everything else.
+static void mem_insert(const char *url, unsigned long long key, cache_buffer_t *buffer, const cache_meta_t *meta) {
+    mem_entry_t *e = mem_find(url, key);
+    if (e) mem_remove(e);
+    if (buffer->size > g_stats.budget / 4) return;
+
+    e = calloc(1, sizeof(mem_entry_t));
+    if (!e || !(e->url = strdup(url))) {
+        free(e);
+        return;
+    }
+    e->key = key;
+    e->meta = *meta;
+    e->buffer = cache_buffer_retain(buffer);
+    e->hash_next = g_mem_buckets[key % MEM_BUCKETS];
+    g_mem_buckets[key % MEM_BUCKETS] = e;
+    lru_push_front(e);
+    // A body shared by several entries is resident once
+    if (((shared_buffer_t *)buffer)->tier_refs++ == 0) g_stats.resident_bytes += buffer->size;
+    g_stats.entries++;
+    mem_enforce_budget();
+}
+
+static void mem_clear(void) {
+    while (g_lru_head) mem_remove(g_lru_head);
+}
+
+/*
+ * Write-behind
+ *
+ * cache_store only puts the body in the memory tier and queues the record;
+ * the background thread appends queued records in batches, each batch one
+ * contiguous write made outside the lock into space reserved at the end of
+ * cache.dat, and then points the index at them. A store replacing one still
+ * queued takes its place. Queued bytes are bounded: past the limit the
+ * storing thread waits for (or does) the writing itself.
+ *
+ * A body already on disk is not written again. The batch pins the blob
+ * under the lock, compares its bytes outside it, and the entry then shares
+ * it. A different body with the same content key is not cached: its entry
+ * is written dead.
+ */
+
+typedef enum {
+    BLOB_NEW,                      // Written just before the entry
+    BLOB_ON_DISK,                  // Already stored; pinned while the batch is written
+    BLOB_IN_BATCH,                 // Written for an earlier entry of the same batch
+    BLOB_CONFLICT                  // Another body with the same content key
+} blob_source_t;
+
+typedef struct pending_write_s {
+    char *url;
+    unsigned long long key;
+    cache_buffer_t *buffer;        // Shared with the memory tier
+    cache_meta_t meta;
+    int in_flight;                 // Taken by write_batch; stays queued until indexed
+    int cancelled;                 // Replaced or cleared while in flight: not indexed
+    int meta_changed;              // Metadata updated while in flight: rewritten after
+    unsigned long long offset;     // Reserved place in cache.dat, once in flight
+    unsigned int length;
+    unsigned int seq;              // Header clock when queued, or when written if the index was closed
+    blob_source_t blob_source;     // Where the body goes, once in flight
+    unsigned long long blob_offset;
+    unsigned int blob_length;
+    struct pending_write_s *blob_owner; // BLOB_IN_BATCH: the entry writing it
+    int conflict;                  // Not the body the blob holds: written dead
+    struct pending_write_s *next;
+} pending_write_t;
+
+static pending_write_t *g_pending_head = NULL;
+static pending_write_t *g_pending_tail = NULL;
+static int g_writing = 0;                      // A batch is being written outside the lock
+
+// Latest queued store of url, if any
+static pending_write_t* pending_find(const char *url, unsigned long long key) {
+    pending_write_t *found = NULL;
+    for (pending_write_t *p = g_pending_head; p; p = p->next) {
+        if (p->key == key && !p->cancelled && strcmp(p->url, url) == 0) found = p;
+    }
+    return found;
+}
+
+static void pending_unlink(pending_write_t *item) {
+    pending_write_t **link = &g_pending_head, *prev = NULL;
+    while (*link != item) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    *link = item->next;
+    if (g_pending_tail == item) g_pending_tail = prev;
+    g_stats.write_queue_bytes -= item->buffer->size;
+    cache_buffer_release(item->buffer);
+    free(item->url);
+    free(item);
+}
+
+// Drop queued stores of url (every one if url is NULL); in-flight ones are
+// only marked, write_batch unlinks them
+static void pending_cancel(const char *url, unsigned long long key) {
+    pending_write_t *p = g_pending_head;
+    while (p) {
+        pending_write_t *next = p->next;
+        if (!url || (p->key == key && strcmp(p->url, url) == 0)) {
+            if (p->in_flight) p->cancelled = 1;
+            else pending_unlink(p);
+        }
+        p = next;
+    }
+}
+
+static int pending_add(const char *url, unsigned long long key, cache_buffer_t *buffer, const cache_meta_t *meta) {
+    // Stamped now so entries touched while others wait in the queue keep
+    // their place in the eviction order
+    unsigned int seq = g_index ? ++g_index->clock : 0;
+    pending_write_t *item = pending_find(url, key);
+    if (item && !item->in_flight) {
+        g_stats.write_queue_bytes = g_stats.write_queue_bytes - item->buffer->size + buffer->size;
+        cache_buffer_release(item->buffer);
+        item->buffer = cache_buffer_retain(buffer);
+        item->meta = *meta;
+        item->seq = seq;
+        g_stats.writes_coalesced++;
+        return 1;
+    }
+
+    item = calloc(1, sizeof(pending_write_t));
+    if (!item || !(item->url = strdup(url))) {
+        free(item);
+        return 0;
+    }
+    item->key = key;
+    item->buffer = cache_buffer_retain(buffer);
+    item->meta = *meta;
+    item->seq = seq;
+    if (g_pending_tail) g_pending_tail->next = item;
+    else g_pending_head = item;
+    g_pending_tail = item;
+    g_stats.write_queue_bytes += buffer->size;
+    g_stats.writes_queued++;
+    return 1;
+}
+
+// Make room for one more slot; caller holds the lock
+static int reserve_slot(void) {
+    if ((g_index->used_count + 1) * 100 > g_index->slot_count * CACHE_MAX_LOAD_PERCENT && !grow_index() && !g_index) {
+        close_files();
+        return 0;
+    }
+    return 1;
+}
+
+// Point the index at an entry now on disk, using the blob with content key
+// blob; caller holds the lock
+static int index_record(const pending_write_t *item, unsigned long long blob) {
+    if (!reserve_slot()) return 0;
+    cache_slot_t *body = find_blob(blob);
+    if (!body) return 0;
+    cache_slot_t *free_slot = NULL;
+    cache_slot_t *slot = find_slot(item->url, strlen(item->url), item->key, &free_slot);
+    unsigned long long old_blob = 0;
+    if (slot) {
+        g_index->live_bytes = g_index->live_bytes - slot->length + item->length;
+        old_blob = slot->blob;
+    } else if (free_slot) {
+        slot = free_slot;
+        if (slot->state == CACHE_SLOT_EMPTY) g_index->used_count++;
+        slot->key = item->key;
+        slot->state = CACHE_SLOT_LIVE;
+        g_index->live_count++;
+        g_index->live_bytes += item->length;
+    } else {
+        return 0;
+    }
+    slot->blob = blob;
+    slot->offset = item->offset;
+    slot->length = item->length;
+    slot->last_used = item->seq;
+    body->refs++;
+    // Released after the new use, in case the body is the same
+    if (old_blob && (body = find_blob(old_blob)) != NULL) release_blob(body);
+    return 1;
+}
+
+// Does the blob at offset hold exactly the bytes of buffer? Called outside
+// the lock while the blob is pinned.
+static int blob_equals(unsigned long long offset, const cache_buffer_t *buffer, char *chunk) {
+    cache_blob_t record;
+    if (!read_at(g_data_file, offset, &record, sizeof(record)) || record.magic != CACHE_BLOB_MAGIC ||
+        record.body_size != buffer->size) {
+        return 0;
+    }
+    for (size_t done = 0; done < buffer->size; ) {
+        DWORD n = (DWORD)(buffer->size - done < CACHE_COPY_CHUNK ? buffer->size - done : CACHE_COPY_CHUNK);
+        if (!read_at(g_data_file, offset + sizeof(record) + done, chunk, n) || memcmp(chunk, buffer->data + done, n) != 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+// Append the oldest queued stores as one write and index them. Returns 1
+// if more are queued.
+static int write_batch(void) {
+    cache_lock();
+    if (g_writing || !g_pending_head) {
+        cache_unlock();
+        return 0;
+    }
+    if (!ensure_open()) {
+        LOG_WARN("Cache: data file unavailable, dropping queued writes");
+        pending_cancel(NULL, 0);
+        cache_unlock();
+        return 0;
+    }
+
+    // Reserve space for the batch and lay out the headers and URLs under the
+    // lock; bodies are immutable and copied after it is released. The batch
+    // is sized as if every body were new.
+    int n = 0;
+    unsigned long long limit = 0;
+    for (pending_write_t *p = g_pending_head; p; p = p->next) {
+        unsigned long long worst = ENTRY_LENGTH(strlen(p->url)) + BLOB_LENGTH(p->buffer->size);
+        if (n > 0 && limit + worst > CACHE_WRITE_BATCH) break;
+        limit += worst;
+        n++;
+    }
+    pending_write_t **batch = malloc(n * sizeof(pending_write_t *));
+    char *block = batch ? calloc(1, (size_t)limit) : NULL;
+    char *chunk = block ? malloc(CACHE_COPY_CHUNK) : NULL;
+    if (!chunk) {
+        // Give up on the oldest store so waiters still make progress
+        LOG_ERROR("Cache: cannot allocate a %lu KB write batch, dropping %s", (unsigned long)(limit / 1024),
+                  g_pending_head->url);
+        free(block);
+        free(batch);
+        pending_unlink(g_pending_head);
+        int more = g_pending_head != NULL;
+        cache_unlock();
+        return more;
+    }
+    unsigned long long start = g_index->data_end;
+    unsigned long long end = start;
+    pending_write_t *p = g_pending_head;
+    for (int i = 0; i < n; i++, p = p->next) {
+        size_t url_len = strlen(p->url);
+        unsigned long long blob = buffer_key(p->buffer);
+        p->in_flight = 1;
+        if (!p->seq) p->seq = ++g_index->clock;
+        batch[i] = p;
+
+        // The first entry of the batch with this content key decides for the rest
+        p->blob_source = BLOB_NEW;
+        for (int j = 0; j < i; j++) {
+            const cache_buffer_t *other = batch[j]->buffer;
+            if (buffer_key(other) != blob) continue;
+            int same = other == p->buffer || (other->size == p->buffer->size && memcmp(other->data, p->buffer->data, other->size) == 0);
+            p->blob_source = same ? BLOB_IN_BATCH : BLOB_CONFLICT;
+            p->blob_owner = batch[j];
+            break;
+        }
+        cache_slot_t *stored = p->blob_source == BLOB_NEW ? find_blob(blob) : NULL;
+        if (stored) {
+            p->blob_source = BLOB_ON_DISK;
+            p->blob_offset = stored->offset;
+            p->blob_length = stored->length;
+            stored->refs++;
+        } else if (p->blob_source == BLOB_NEW) {
+            p->blob_offset = end;
+            p->blob_length = (unsigned int)BLOB_LENGTH(p->buffer->size);
+            cache_blob_t *header = (cache_blob_t *)(block + (end - start));
+            header->magic = CACHE_BLOB_MAGIC;
+            header->key = blob;
+            header->body_size = p->buffer->size;
+            header->seq = p->seq;
+            end += p->blob_length;
+        }
+
+        p->offset = end;
+        p->length = (unsigned int)ENTRY_LENGTH(url_len);
+        cache_record_t *record = (cache_record_t *)(block + (end - start));
+        record->magic = CACHE_ENTRY_MAGIC;
+        record->url_len = (unsigned int)url_len;
+        record->key = p->key;
+        record->blob = blob;
+        record->body_size = p->buffer->size;
+        record->seq = p->seq;
+        record->checksum = body_checksum(2166136261u, p->url, url_len);
+        record->meta = p->meta;
+        memcpy(record + 1, p->url, url_len);
+        end += p->length;
+    }
+    unsigned long long total = end - start;
+    g_index->data_end = end;
+    g_writing = 1;
+    cache_unlock();
+
+    for (int i = 0; i < n; i++) {
+        pending_write_t *item = batch[i];
+        if (item->blob_source == BLOB_NEW) {
+            cache_blob_t *header = (cache_blob_t *)(block + (item->blob_offset - start));
+            memcpy(header + 1, item->buffer->data, item->buffer->size);
+            header->checksum = body_checksum(2166136261u, item->buffer->data, item->buffer->size);
+        } else if (item->blob_source == BLOB_ON_DISK) {
+            item->conflict = !blob_equals(item->blob_offset, item->buffer, chunk);
+        } else {
+            item->conflict = item->blob_source == BLOB_CONFLICT || item->blob_owner->conflict;
+        }
+        if (item->conflict) {
+            LOG_WARN("Cache: another body has the content key of %s, not cached", item->url);
+            ((cache_record_t *)(block + (item->offset - start)))->magic = CACHE_DEAD_MAGIC;
+        }
+    }
+    int ok = total <= 0xFFFFFFFF && write_at(g_data_file, start, block, (DWORD)total);
+    free(chunk);
+    free(block);
+
+    cache_lock();
+    int indexed = 0;
+    for (int i = 0; ok && g_index && i < n; i++) {
+        pending_write_t *item = batch[i];
+        if (item->blob_source != BLOB_NEW || !reserve_slot()) continue;
+        cache_slot_t blob;
+        memset(&blob, 0, sizeof(blob));
+        blob.key = buffer_key(item->buffer);
+        blob.offset = item->blob_offset;
+        blob.length = item->blob_length;
+        blob.state = CACHE_SLOT_BLOB;
+        if (!find_blob(blob.key)) insert_slot(&blob);
+    }
+    for (int i = 0; ok && g_index && i < n; i++) {
+        pending_write_t *item = batch[i];
+        if (!item->cancelled && !item->conflict && index_record(item, buffer_key(item->buffer))) {
+            indexed++;
+            if (item->blob_source != BLOB_NEW) g_stats.dedup_hits++;
+            if (item->meta_changed) {
+                write_at(g_data_file, item->offset + offsetof(cache_record_t, meta), &item->meta, sizeof(item->meta));
+            }
+        }
+    }
+    // Unpin the shared blobs and drop new ones no entry ended up using
+    for (int i = 0; g_index && i < n; i++) {
+        pending_write_t *item = batch[i];
+        if (item->blob_source != BLOB_NEW && item->blob_source != BLOB_ON_DISK) continue;
+        cache_slot_t *blob = find_blob(buffer_key(item->buffer));
+        if (!blob || blob->offset != item->blob_offset) continue;
+        if (item->blob_source == BLOB_ON_DISK || blob->refs == 0) release_blob(blob);
+    }
+    for (int i = 0; i < n; i++) pending_unlink(batch[i]);
+    g_writing = 0;
+    g_stats.write_batches++;
+    int more = g_pending_head != NULL;
+    cache_unlock();
+    free(batch);
+
+    if (!ok) LOG_WARN("Cache write failed: %d records (%lu KB)", n, (unsigned long)(total / 1024));
+    else LOG_DEBUG("Cache: wrote %d records (%lu KB), %d indexed", n, (unsigned long)(total / 1024), indexed);
+    return more;
+}
+
+// Wait until at most max_queued bytes are queued, writing batches on this
+// thread whenever nobody else is
+static void wait_for_writes(size_t max_queued) {
+    for (;;) {
+        cache_lock();
+        int done = g_stats.write_queue_bytes <= max_queued && (max_queued > 0 || !g_pending_head);
+        int busy = g_writing;
+        cache_unlock();
+        if (done) return;
+        if (busy) Sleep(1);
+        else write_batch();
+    }
+}
+
+void cache_flush(void) {
+    wait_for_writes(0);
+}
+
+/*
+ * Maintenance
+ *
+ * A background thread keeps the disk within its budget. Once the live
+ * records pass the budget, the least recently used entries are evicted down
+ * to the low-water mark, along with blobs no other entry uses; that only
+ * marks slots deleted. Compaction then reclaims
+ * the space a bounded step at a time, so lookups are never held up for long.
+ * Moving records would change bytes under an open view, so compaction only
+ * runs while none are open.
+ */
+
+typedef struct {
+    unsigned int last_used;
+    unsigned int pos;
+} evict_candidate_t;
+
+static int compare_candidates(const void *a, const void *b) {
+    unsigned int x = ((const evict_candidate_t *)a)->last_used;
+    unsigned int y = ((const evict_candidate_t *)b)->last_used;
+    return x < y ? -1 : x > y;
+}
+
+static int compaction_due(void) {
+    unsigned long long garbage = g_index->data_end - g_index->live_bytes;
+    return garbage >= CACHE_COMPACT_MIN_GARBAGE && garbage * 4 >= g_index->data_end;
+}
+
+// Caller holds the lock
+static int needs_maintenance(void) {
+    return g_index && (g_index->live_bytes > g_stats.disk_budget || g_compacting || compaction_due());
+}
+
+static void evict_to_budget(void) {
+    if (g_index->live_bytes <= g_stats.disk_budget || g_index->live_count == 0) return;
+
+    evict_candidate_t *candidates = malloc((size_t)g_index->live_count * sizeof(evict_candidate_t));
+    if (!candidates) return;
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < g_index->slot_count && n < g_index->live_count; i++) {
+        if (g_slots[i].state != CACHE_SLOT_LIVE) continue;
+        candidates[n].last_used = g_slots[i].last_used;
+        candidates[n].pos = i;
+        n++;
+    }
+    qsort(candidates, n, sizeof(evict_candidate_t), compare_candidates);
+
+    unsigned long long target = g_stats.disk_budget / 100 * CACHE_EVICT_LOW_WATER_PERCENT;
+    unsigned int evicted = 0;
+    for (unsigned int i = 0; i < n && g_index->live_bytes > target; i++) {
+        drop_entry(&g_slots[candidates[i].pos]);
+        evicted++;
+    }
+    free(candidates);
+    g_stats.disk_evictions += evicted;
+    LOG_DEBUG("Cache: evicted %u entries, %lu KB live", evicted, (unsigned long)(g_index->live_bytes / 1024));
+}
+
+// The entry or blob slot pointing at the record at offset, if any
+static cache_slot_t* slot_at_offset(unsigned long long key, unsigned long long offset) {
+    unsigned int count = g_index->slot_count;
+    for (unsigned int i = 0, pos = (unsigned int)(key % count); i < count; i++, pos = (pos + 1) % count) {
+        cache_slot_t *slot = &g_slots[pos];
+        if (slot->state == CACHE_SLOT_EMPTY) break;
+        if ((slot->state == CACHE_SLOT_LIVE || slot->state == CACHE_SLOT_BLOB) && slot->key == key &&
+            slot->offset == offset) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Copy length bytes down the file (to < from), front to back, so the
+// source is always read before it can be overwritten
+static int move_bytes(unsigned long long from, unsigned long long to, unsigned int length, char *chunk) {
+    for (unsigned int done = 0; done < length; ) {
+        DWORD n = length - done < CACHE_COPY_CHUNK ? length - done : CACHE_COPY_CHUNK;
+        if (!read_at(g_data_file, from + done, chunk, n) || !write_at(g_data_file, to + done, chunk, n)) return 0;
+        done += n;
+    }
+    return 1;
+}
+
+// Cut cache.dat at end. The file cannot shrink while a section maps it, so
+// the data mapping is dropped and recreated by the next lookup.
+static void truncate_data(unsigned long long end) {
+    if (g_data_map) CloseHandle(g_data_map);
+    g_data_map = NULL;
+    g_data_mapped = 0;
+    g_index->data_end = end;
+
+    LARGE_INTEGER pos;
+    pos.QuadPart = (LONGLONG)end;
+    if (!SetFilePointerEx(g_data_file, pos, NULL, FILE_BEGIN) || !SetEndOfFile(g_data_file)) {
+        LOG_WARN("Cache: cannot truncate %s", g_data_path);
+    }
+}
+
+// One bounded step of compaction. Returns 1 while more work remains.
+static int compact_step(void) {
+    if (!g_compacting) {
+        if (!compaction_due()) return 0;
+        g_compacting = 1;
+        g_compact_read = 0;
+        g_compact_write = 0;
+        LOG_DEBUG("Cache: compacting %lu KB (%lu KB live)", (unsigned long)(g_index->data_end / 1024),
+                  (unsigned long)(g_index->live_bytes / 1024));
+    }
+    if (g_open_views > 0 || g_writing) return 0;
+
+    char *chunk = malloc(CACHE_COPY_CHUNK);
+    if (!chunk) return 0;
+    unsigned long long work = 0;
+    while (g_compact_read < g_index->data_end && work < CACHE_COMPACT_STEP) {
+        cache_header_t header;
+        unsigned long long record_length;
+        if (!read_header(g_compact_read, g_index->data_end, &header, &record_length)) {
+            LOG_WARN("Cache: bad record at %lu KB, compaction abandoned", (unsigned long)(g_compact_read / 1024));
+            g_compacting = 0;
+            free(chunk);
+            return 0;
+        }
+        unsigned int length = (unsigned int)record_length;
+        unsigned long long key = header.magic == CACHE_BLOB_MAGIC ? header.blob.key : header.entry.key;
+        cache_slot_t *slot = header.magic == CACHE_DEAD_MAGIC ? NULL : slot_at_offset(key, g_compact_read);
+        if (slot) {
+            if (g_compact_write != g_compact_read) {
+                if (!move_bytes(g_compact_read, g_compact_write, length, chunk)) {
+                    LOG_WARN("Cache: compaction I/O failed, abandoned");
+                    g_compacting = 0;
+                    free(chunk);
+                    return 0;
+                }
+                slot->offset = g_compact_write;
+                work += length;
+            }
+            g_compact_write += length;
+        }
+        g_compact_read += length;
+        work += sizeof(header);
+    }
+    free(chunk);
+    if (g_compact_read < g_index->data_end) return 1;
+
+    unsigned long long before = g_index->data_end;
+    truncate_data(g_compact_write);
+    g_compacting = 0;
+    g_stats.compactions++;
+    LOG_INFO("Cache compacted: %lu KB -> %lu KB", (unsigned long)(before / 1024), (unsigned long)(g_compact_write / 1024));
+    return 0;
+}
+
+int cache_maintain(void) {
+    cache_lock();
+    int more = 0;
+    if (ensure_open()) {
+        evict_to_budget();
+        more = compact_step();
+    }
+    cache_unlock();
+    return more;
+}
+
+static unsigned __stdcall worker_proc(void *param) {
+    (void)param;
+    DWORD wait = CACHE_MAINTENANCE_INTERVAL_MS;
+    while (WaitForSingleObject(g_worker_wake, wait) != WAIT_FAILED && !g_worker_stop) {
+        if (wait) Sleep(CACHE_WRITE_DELAY_MS);
+        // Steps back to back while there is work; the lock is free in between
+        int more = write_batch();
+        if (cache_maintain()) more = 1;
+        wait = more ? 0 : CACHE_MAINTENANCE_INTERVAL_MS;
+    }
+    return 0;
+}
+
 void cache_init(void) {
     // Create base cache directory
-    CreateDirectoryA(CACHE_DIR, NULL);
-    LOG_INFO("Cache initialized at %s", CACHE_DIR);
+    CreateDirectoryA(g_cache_dir, NULL);
+    cache_lock();
+    if (ensure_open()) {
+        LOG_INFO("Cache initialized at %s: %u entries, %lu KB of records", g_cache_dir,
+                 g_index->live_count, (unsigned long)(g_index->data_end / 1024));
+    }
+    if (!g_worker_thread) {
+        g_worker_stop = 0;
+        g_worker_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+        if (g_worker_wake) g_worker_thread = (HANDLE)_beginthreadex(NULL, 0, worker_proc, NULL, 0, NULL);
+        if (!g_worker_thread) LOG_WARN("Cache: no background thread; stores are written when the queue fills");
+    }
+    cache_unlock();
+}
+
+void cache_set_directory(const char *dir) {
+    if (!dir || !*dir || strlen(dir) + 1 + sizeof(CACHE_INDEX_FILE) > MAX_PATH) return;
+    // Everything queued belongs in the old directory
+    for (;;) {
+        cache_flush();
+        cache_lock();
+        if (!g_writing && !g_pending_head) break;
+        cache_unlock();
+        Sleep(1);
+    }
+    if (strcmp(dir, g_cache_dir) != 0) {
+        mem_clear();
+        close_files();
+        snprintf(g_cache_dir, sizeof(g_cache_dir), "%s", dir);
+        snprintf(g_index_path, sizeof(g_index_path), "%s\\%s", dir, CACHE_INDEX_FILE);
+        snprintf(g_data_path, sizeof(g_data_path), "%s\\%s", dir, CACHE_DATA_FILE);
+        LOG_INFO("Cache directory is now %s", dir);
+    }
+    cache_unlock();
 }
 
 void cache_cleanup(void) {
     LOG_INFO("Cache cleanup");
+    if (g_worker_thread) {
+        g_worker_stop = 1;
+        SetEvent(g_worker_wake);
+        WaitForSingleObject(g_worker_thread, INFINITE);
+        CloseHandle(g_worker_thread);
+        g_worker_thread = NULL;
+    }
+    if (g_worker_wake) CloseHandle(g_worker_wake);
+    g_worker_wake = NULL;
+
+    cache_flush();
+    cache_lock();
+    mem_clear();
+    close_files();
+    cache_unlock();
 }
 
-void* cache_get_image(const char *url, size_t *out_size) {
-    if (!url || !out_size) return NULL;
+// Map the body of blob; caller holds the lock
+static int map_blob(const cache_slot_t *blob, cache_view_t *view) {
+    unsigned long long end = blob->offset + blob->length;
+    if (end > g_data_mapped) {
+        // The file grew since the mapping was made. Views already handed
+        // out keep the old section alive.
+        if (g_data_map) CloseHandle(g_data_map);
+        g_data_mapped = file_size(g_data_file);
+        g_data_map = g_data_mapped ? CreateFileMappingA(g_data_file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        if (!g_data_map) g_data_mapped = 0;
+        if (end > g_data_mapped) return 0;
+    }
 
-    char filename[MAX_PATH] = {0};
-    url_to_filename(url, filename, sizeof(filename));
+    unsigned long long start = blob->offset - blob->offset % g_granularity;
+    size_t delta = (size_t)(blob->offset - start);
+    char *base = MapViewOfFile(g_data_map, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, delta + blob->length);
+    if (!base) {
+        LOG_WARN("Cache: MapViewOfFile failed for %lu bytes", (unsigned long)blob->length);
+        return 0;
+    }
 
-    // Try to open and read the cached file
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        LOG_DEBUG("Cache miss: %s", url);
-        return NULL;
+    const cache_blob_t *record = (const cache_blob_t *)(base + delta);
+    if (record->magic != CACHE_BLOB_MAGIC || record->key != blob->key || BLOB_LENGTH(record->body_size) != blob->length) {
+        UnmapViewOfFile(base);
+        return 0;
     }
 
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    view->base = base;
+    view->data = record + 1;
+    view->size = (size_t)record->body_size;
+    InterlockedIncrement(&g_open_views);
+    return 1;
+}
 
-    if (size <= 0) {
-        fclose(f);
-        LOG_WARN("Cache file has invalid size: %s", filename);
-        return NULL;
+// Caller holds the lock
+static int disk_open_view(const char *url, size_t url_len, unsigned long long key, cache_view_t *view) {
+    if (!ensure_open()) return 0;
+    unsigned int count = g_index->slot_count;
+    for (unsigned int i = 0, pos = (unsigned int)(key % count); i < count; i++, pos = (pos + 1) % count) {
+        cache_slot_t *slot = &g_slots[pos];
+        if (slot->state == CACHE_SLOT_EMPTY) break;
+        cache_record_t entry;
+        if (slot->state != CACHE_SLOT_LIVE || slot->key != key || !read_entry(slot, url, url_len, &entry)) continue;
+        cache_slot_t *blob = find_blob(slot->blob);
+        if (!blob || !map_blob(blob, view)) return 0;
+        view->meta = entry.meta;
+        slot->last_used = ++g_index->clock;
+        return 1;
     }
+    return 0;
+}
 
-    // Read file
-    void *data = malloc(size);
-    if (!data) {
-        fclose(f);
-        LOG_ERROR("Failed to allocate memory for cached image: %s", url);
-        return NULL;
+// Keep the disk entry of a memory hit recent too. Matching the key alone is
+// enough here: a collision only makes another entry look recently used.
+static void touch_key(unsigned long long key) {
+    if (!g_index) return;
+    unsigned int count = g_index->slot_count;
+    for (unsigned int i = 0, pos = (unsigned int)(key % count); i < count; i++, pos = (pos + 1) % count) {
+        cache_slot_t *slot = &g_slots[pos];
+        if (slot->state == CACHE_SLOT_EMPTY) return;
+        if (slot->state == CACHE_SLOT_LIVE && slot->key == key) {
+            slot->last_used = ++g_index->clock;
+            return;
+        }
     }
+}
 
-    size_t read = fread(data, 1, size, f);
-    fclose(f);
+int cache_open_view(const char *url, cache_view_t *view) {
+    if (!view) return 0;
+    memset(view, 0, sizeof(*view));
+    if (!url) return 0;
 
-    if (read != (size_t)size) {
-        free(data);
-        LOG_WARN("Cache read mismatch: expected %ld, got %lu", size, (unsigned long)read);
-        return NULL;
+    size_t url_len = strlen(url);
+    unsigned long long key = hash_key(url, url_len);
+    cache_lock();
+    int queued = pending_find(url, key) != NULL;
+    cache_unlock();
+    if (queued) cache_flush();
+
+    cache_lock();
+    int found = disk_open_view(url, url_len, key, view);
+    cache_unlock();
+
+    if (!found) LOG_DEBUG("Cache miss: %s", url);
+    else LOG_DEBUG("Cache hit: %s (%lu bytes)", url, (unsigned long)view->size);
+    return found;
+}
+
+void cache_close_view(cache_view_t *view) {
+    if (!view || !view->base) return;
+    UnmapViewOfFile(view->base);
+    InterlockedDecrement(&g_open_views);
+    memset(view, 0, sizeof(*view));
+}
+
+// Memory tier first, then (if allowed) the disk
+static cache_buffer_t* acquire(const char *url, int use_disk, cache_meta_t *out_meta) {
+    size_t url_len = strlen(url);
+    unsigned long long key = hash_key(url, url_len);
+    cache_buffer_t *buffer = NULL;
+    pending_write_t *queued = NULL;
+
+    cache_lock();
+    mem_entry_t *e = mem_find(url, key);
+    if (e) {
+        lru_unlink(e);
+        lru_push_front(e);
+        touch_key(key);
+        g_stats.hits++;
+        if (out_meta) *out_meta = e->meta;
+        buffer = cache_buffer_retain(e->buffer);
+    } else if ((queued = pending_find(url, key)) != NULL) {
+        // Too large for the memory tier and not written yet
+        g_stats.hits++;
+        if (out_meta) *out_meta = queued->meta;
+        buffer = cache_buffer_retain(queued->buffer);
+    } else {
+        cache_view_t view;
+        if (use_disk && disk_open_view(url, url_len, key, &view)) {
+            buffer = buffer_create(view.data, view.size);
+            if (buffer) {
+                g_stats.disk_hits++;
+                if (out_meta) *out_meta = view.meta;
+                mem_insert(url, key, buffer, &view.meta);
+            }
+            cache_close_view(&view);
+        }
+        if (!buffer) g_stats.misses++;
     }
+    cache_unlock();
+
+    if (!buffer) LOG_DEBUG("Cache miss: %s", url);
+    else LOG_DEBUG("Cache hit: %s (%lu bytes, %s)", url, (unsigned long)buffer->size, e || queued ? "memory" : "disk");
+    return buffer;
+}
+
+cache_buffer_t* cache_acquire(const char *url, cache_meta_t *out_meta) {
+    if (!url) return NULL;
+    return acquire(url, 1, out_meta);
+}
+
+void* cache_lookup(const char *url, size_t *out_size, cache_meta_t *out_meta) {
+    if (!url || !out_size) return NULL;
 
-    *out_size = size;
-    LOG_DEBUG("Cache hit: %s (%lu bytes)", url, (unsigned long)size);
+    cache_buffer_t *buffer = cache_acquire(url, out_meta);
+    if (!buffer) return NULL;
+
+    char *data = malloc(buffer->size + 1);
+    if (!data) {
+        LOG_ERROR("Failed to allocate memory for cached entry: %s", url);
+        cache_buffer_release(buffer);
+        return NULL;
+    }
+    memcpy(data, buffer->data, buffer->size + 1);
+    *out_size = buffer->size;
+    cache_buffer_release(buffer);
     return data;
 }
 
-int cache_put_image(const char *url, const void *data, size_t size) {
-    if (!url || !data || size == 0) return 0;
+int cache_store(const char *url, const void *data, size_t size, const cache_meta_t *meta) {
+    if (!url || !data || size == 0 || !meta) return 0;
 
-    char filename[MAX_PATH] = {0};
-    url_to_filename(url, filename, sizeof(filename));
+    size_t url_len = strlen(url);
+    if (url_len == 0 || url_len > CACHE_MAX_URL || size > 0x7FFFFFFF - sizeof(cache_record_t) - url_len) return 0;
 
-    // Ensure directory exists
-    ensure_directory_exists(filename);
+    unsigned long long key = hash_key(url, url_len);
+    cache_buffer_t *buffer = buffer_create(data, size);
+    if (!buffer) return 0;
 
-    // Write to cache file
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        LOG_WARN("Failed to open cache file for writing: %s", filename);
+    // The memory tier serves it at once; the disk write happens later
+    cache_lock();
+    mem_insert(url, key, buffer, meta);
+    int ok = pending_add(url, key, buffer, meta);
+    int over = g_stats.write_queue_bytes > CACHE_WRITE_QUEUE_LIMIT;
+    if (!ok) {
+        mem_entry_t *e = mem_find(url, key);
+        if (e) mem_remove(e);
+    }
+    cache_unlock();
+    cache_buffer_release(buffer);
+
+    if (!ok) {
+        LOG_WARN("Cache: cannot queue %s (%lu bytes)", url, (unsigned long)size);
         return 0;
     }
+    if (g_worker_wake) SetEvent(g_worker_wake);
+    if (over) wait_for_writes(CACHE_WRITE_QUEUE_LIMIT);
+    LOG_DEBUG("Cached: %s (%lu bytes)", url, (unsigned long)size);
+    return 1;
+}
 
-    size_t written = fwrite(data, 1, size, f);
-    fclose(f);
+int cache_update_meta(const char *url, const cache_meta_t *meta) {
+    if (!url || !meta) return 0;
 
-    if (written != size) {
-        LOG_WARN("Cache write mismatch: expected %lu, wrote %lu", (unsigned long)size, (unsigned long)written);
-        return 0;
+    size_t url_len = strlen(url);
+    unsigned long long key = hash_key(url, url_len);
+    int ok = 0;
+    cache_lock();
+    if (ensure_open()) {
+        // The metadata has a fixed size, so it is rewritten in place
+        cache_slot_t *slot = find_slot(url, url_len, key, NULL);
+        ok = slot && write_at(g_data_file, slot->offset + offsetof(cache_record_t, meta), meta, sizeof(*meta));
+    }
+    mem_entry_t *e = mem_find(url, key);
+    if (e) e->meta = *meta;
+    pending_write_t *queued = pending_find(url, key);
+    if (queued) {
+        queued->meta = *meta;
+        if (queued->in_flight) queued->meta_changed = 1;
     }
+    cache_unlock();
+    return ok || e || queued;
+}
 
-    LOG_DEBUG("Cached image: %s (%lu bytes)", url, (unsigned long)size);
-    return 1;
+static const char *g_type_names[CACHE_TYPE_COUNT] = {"document", "stylesheet", "image", "favicon"};
+
+static cache_policy_t g_policies[CACHE_TYPE_COUNT] = {
+    {CACHE_STORAGE_DISK, CACHE_DOCUMENT_MAX_TTL},
+    {CACHE_STORAGE_DISK, 0},
+    {CACHE_STORAGE_DISK, 0},
+    {CACHE_STORAGE_DISK, 0}
+};
+
+static int valid_type(cache_type_t type) {
+    return (int)type >= 0 && type < CACHE_TYPE_COUNT;
+}
+
+const char* cache_type_name(cache_type_t type) {
+    return valid_type(type) ? g_type_names[type] : "unknown";
+}
+
+void cache_set_policy(cache_type_t type, const cache_policy_t *policy) {
+    if (!valid_type(type) || !policy) return;
+    cache_lock();
+    g_policies[type] = *policy;
+    cache_unlock();
+}
+
+void cache_get_policy(cache_type_t type, cache_policy_t *out) {
+    if (!out) return;
+    cache_lock();
+    if (valid_type(type)) {
+        *out = g_policies[type];
+    } else {
+        out->storage = CACHE_STORAGE_NONE;
+        out->max_ttl = 0;
+    }
+    cache_unlock();
+}
+
+// "type:url", the key typed entries are stored under. Uses stack when it
+// fits; free the result if it is not stack.
+static char* typed_key(cache_type_t type, const char *url, char *stack, size_t stack_size) {
+    size_t len = strlen(g_type_names[type]) + 1 + strlen(url) + 1;
+    char *key = len <= stack_size ? stack : malloc(len);
+    if (key) snprintf(key, len, "%s:%s", g_type_names[type], url);
+    return key;
+}
+
+// The policy of type with meta capped by its max_ttl. Returns 0 if the type
+// is not cached.
+static int apply_policy(cache_type_t type, const cache_meta_t *meta, cache_policy_t *policy, cache_meta_t *out) {
+    if (!valid_type(type)) return 0;
+    cache_get_policy(type, policy);
+    if (meta) {
+        *out = *meta;
+        if (policy->max_ttl > 0 && out->expires_at > out->stored_at + policy->max_ttl) {
+            out->expires_at = out->stored_at + policy->max_ttl;
+        }
+    }
+    return policy->storage != CACHE_STORAGE_NONE;
+}
+
+// Memory-only store; any disk entry left from a different policy goes
+static int memory_store(const char *key, const void *data, size_t size, const cache_meta_t *meta) {
+    size_t key_len = strlen(key);
+    unsigned long long hash = hash_key(key, key_len);
+    cache_buffer_t *buffer = buffer_create(data, size);
+    if (!buffer) return 0;
+
+    cache_lock();
+    pending_cancel(key, hash);
+    cache_slot_t *slot = g_index ? find_slot(key, key_len, hash, NULL) : NULL;
+    if (slot) drop_entry(slot);
+    mem_insert(key, hash, buffer, meta);
+    int ok = mem_find(key, hash) != NULL;
+    cache_unlock();
+    cache_buffer_release(buffer);
+    return ok;
+}
+
+cache_buffer_t* cache_get(cache_type_t type, const char *url, cache_meta_t *out_meta) {
+    cache_policy_t policy;
+    if (!url || !apply_policy(type, NULL, &policy, NULL)) return NULL;
+
+    char stack[1024];
+    char *key = typed_key(type, url, stack, sizeof(stack));
+    if (!key) return NULL;
+    cache_buffer_t *buffer = acquire(key, policy.storage == CACHE_STORAGE_DISK, out_meta);
+    if (key != stack) free(key);
+    return buffer;
+}
+
+int cache_put(cache_type_t type, const char *url, const void *data, size_t size, const cache_meta_t *meta) {
+    cache_policy_t policy;
+    cache_meta_t capped;
+    if (!url || !data || size == 0 || !meta || !apply_policy(type, meta, &policy, &capped)) return 0;
+
+    char stack[1024];
+    char *key = typed_key(type, url, stack, sizeof(stack));
+    if (!key) return 0;
+    int ok = policy.storage == CACHE_STORAGE_DISK ? cache_store(key, data, size, &capped)
+                                                  : memory_store(key, data, size, &capped);
+    if (key != stack) free(key);
+    return ok;
+}
+
+int cache_put_meta(cache_type_t type, const char *url, const cache_meta_t *meta) {
+    cache_policy_t policy;
+    cache_meta_t capped;
+    if (!url || !meta || !apply_policy(type, meta, &policy, &capped)) return 0;
+
+    char stack[1024];
+    char *key = typed_key(type, url, stack, sizeof(stack));
+    if (!key) return 0;
+    int ok = cache_update_meta(key, &capped);
+    if (key != stack) free(key);
+    return ok;
+}
+
+void cache_remove(cache_type_t type, const char *url) {
+    if (!url || !valid_type(type)) return;
+
+    char stack[1024];
+    char *key = typed_key(type, url, stack, sizeof(stack));
+    if (!key) return;
+    size_t key_len = strlen(key);
+    unsigned long long hash = hash_key(key, key_len);
+    cache_lock();
+    pending_cancel(key, hash);
+    mem_entry_t *e = mem_find(key, hash);
+    if (e) mem_remove(e);
+    cache_slot_t *slot = ensure_open() ? find_slot(key, key_len, hash, NULL) : NULL;
+    if (slot) drop_entry(slot);
+    cache_unlock();
+    LOG_DEBUG("Cache: removed %s", key);
+    if (key != stack) free(key);
+}
+
+void cache_set_memory_budget(size_t bytes) {
+    cache_lock();
+    g_stats.budget = bytes;
+    mem_enforce_budget();
+    cache_unlock();
+}
+
+void cache_set_disk_budget(unsigned long long bytes) {
+    cache_lock();
+    g_stats.disk_budget = bytes;
+    if (g_worker_wake && needs_maintenance()) SetEvent(g_worker_wake);
+    cache_unlock();
+}
+
+void cache_get_stats(cache_stats_t *out) {
+    if (!out) return;
+    cache_lock();
+    *out = g_stats;
+    if (g_index) {
+        out->disk_bytes = g_index->data_end;
+        out->disk_live_bytes = g_index->live_bytes;
+        out->disk_entries = g_index->live_count;
+        out->disk_blobs = g_index->blob_count;
+    }
+    cache_unlock();
+}
+
+void cache_log_stats(void) {
+    cache_stats_t s;
+    cache_get_stats(&s);
+    unsigned long lookups = s.hits + s.disk_hits + s.misses;
+    LOG_INFO("Cache memory tier: hit ratio %lu%% (%lu/%lu), %lu from disk, %d entries, %lu/%lu KB resident, %lu evictions",
+             lookups ? (s.hits * 100) / lookups : 0, s.hits, lookups, s.disk_hits, s.entries,
+             (unsigned long)(s.resident_bytes / 1024), (unsigned long)(s.budget / 1024), s.evictions);
+    LOG_INFO("Cache disk: %u entries sharing %u bodies, %lu/%lu KB live in %lu KB, %lu evictions, %lu compactions",
+             s.disk_entries, s.disk_blobs, (unsigned long)(s.disk_live_bytes / 1024), (unsigned long)(s.disk_budget / 1024),
+             (unsigned long)(s.disk_bytes / 1024), s.disk_evictions, s.compactions);
+    LOG_INFO("Cache writes: %lu queued, %lu coalesced, %lu batches, %lu KB still queued",
+             s.writes_queued, s.writes_coalesced, s.write_batches, (unsigned long)(s.write_queue_bytes / 1024));
+    LOG_INFO("Cache sharing: %lu stores reused a body on disk, %lu buffers reused one in memory",
+             s.dedup_hits, s.buffers_shared);
+}
+
+// Per-domain folders of *.cache files from before the packed data file
+static void remove_legacy_dirs(void) {
+    WIN32_FIND_DATAA dir;
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s\\*", g_cache_dir);
+    HANDLE find = FindFirstFileA(path, &dir);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!(dir.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || dir.cFileName[0] == '.') continue;
+
+        snprintf(path, sizeof(path), "%s\\%s\\*.cache", g_cache_dir, dir.cFileName);
+        WIN32_FIND_DATAA file;
+        HANDLE files = FindFirstFileA(path, &file);
+        if (files != INVALID_HANDLE_VALUE) {
+            do {
+                snprintf(path, sizeof(path), "%s\\%s\\%s", g_cache_dir, dir.cFileName, file.cFileName);
+                DeleteFileA(path);
+            } while (FindNextFileA(files, &file));
+            FindClose(files);
+        }
+        snprintf(path, sizeof(path), "%s\\%s", g_cache_dir, dir.cFileName);
+        RemoveDirectoryA(path);
+    } while (FindNextFileA(find, &dir));
+    FindClose(find);
 }
 
 void cache_clear_all(void) {
-    LOG_INFO("Clearing all cached images");
-    // Simple approach: just log the intent
-    // Full recursive deletion would require more code
-    // User can manually delete the cache/ folder
+    cache_lock();
+    mem_clear();
+    pending_cancel(NULL, 0);
+    if (ensure_open()) {
+        unsigned int clock = g_index->clock;
+        reset_index(g_index->slot_count, g_index->data_end);
+        g_index->clock = clock;
+        g_compacting = 0;
+        // Open views pin the old records, and a batch being written has its
+        // space reserved; compaction reclaims both later
+        if (g_open_views == 0 && !g_writing) truncate_data(0);
+    }
+    remove_legacy_dirs();
+    cache_unlock();
+    LOG_INFO("Cache cleared");
 }
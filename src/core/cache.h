@@ -3,22 +3,205 @@
 
 #include <stddef.h>
 
-// Initialize cache system (creates cache directories if needed)
+/*
+ * Disk cache
+ *
+ * All entries live in one append-only data file (cache\cache.dat) found
+ * through a memory-mapped hash index of 64-bit URL keys (cache\cache.idx).
+ * Each record keeps the full URL, which is checked on every hit, so a key
+ * collision is a miss rather than somebody else's body. Hits can be read in
+ * place through a mapped view without copying.
+ *
+ * Bodies are stored by content: the same bytes under several URLs (CDN
+ * mirrors, cache-busting query strings, one favicon on several hosts) take
+ * disk space once, and in memory every buffer with the same bytes is the
+ * same buffer.
+ *
+ * Next to the body, an entry holds what the HTTP cache needs to decide
+ * whether it may be reused: the response status and content type, its
+ * validators (ETag, Last-Modified) and when it stops being fresh. The HTTP
+ * semantics themselves live in network/http_cache; this layer only stores
+ * entries.
+ *
+ * In front of the disk sits a memory tier: recently used bodies are kept as
+ * refcounted buffers in LRU order under a byte budget, so repeat lookups in
+ * a session do no I/O and share one copy. All functions are thread-safe.
+ *
+ * Disk writes happen behind the caller's back: a store goes to the memory
+ * tier at once and is queued for a background thread started by
+ * cache_init, which appends queued records in batches (repeat stores of a
+ * URL still queued collapse into one) and is flushed by cache_cleanup.
+ *
+ * The disk is bounded too: the same thread evicts the least recently used
+ * entries once the live records pass the disk budget, and compacts the data
+ * file in small steps when replaced and evicted records make up a quarter
+ * of it.
+ *
+ * Callers go through the typed API (cache_get/cache_put): every resource
+ * type has its own namespace, so the same URL fetched as a page and as an
+ * image are separate entries, and its own policy deciding where entries
+ * live and how long they may stay fresh. The untyped functions below key
+ * entries by URL alone.
+ */
+
+#define CACHE_MEMORY_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define CACHE_DISK_DEFAULT_BUDGET (64ULL * 1024 * 1024)
+#define CACHE_DOCUMENT_MAX_TTL (5 * 60)
+
+typedef enum {
+    CACHE_TYPE_DOCUMENT,     // Pages, form results and iframe documents
+    CACHE_TYPE_STYLESHEET,
+    CACHE_TYPE_IMAGE,        // <img> and CSS backgrounds
+    CACHE_TYPE_FAVICON,
+    CACHE_TYPE_COUNT
+} cache_type_t;
+
+typedef enum {
+    CACHE_STORAGE_NONE,      // Never cached
+    CACHE_STORAGE_MEMORY,    // Memory tier only, gone at exit
+    CACHE_STORAGE_DISK       // Memory tier backed by the data file
+} cache_storage_t;
+
+typedef struct {
+    cache_storage_t storage;
+    long long max_ttl;       // Cap on the freshness lifetime in seconds; 0 leaves it to the server
+} cache_policy_t;
+
+typedef struct {
+    int status_code;
+    char content_type[128];
+    char etag[256];
+    char last_modified[64];
+    long long stored_at;     // Seconds since 1970 (UTC) when fetched or last revalidated
+    long long expires_at;    // Fresh until then; 0 means revalidate before every use
+    int must_revalidate;     // Never use the body once stale without revalidating
+} cache_meta_t;
+
+// A read-only view of a cached body, mapped straight from the data file. It
+// stays valid until closed, whatever is stored meanwhile; compaction waits
+// while any view is open, so close them promptly.
+typedef struct {
+    const void *data;
+    size_t size;
+    cache_meta_t meta;
+    void *base;              // Start of the mapping, for cache_close_view
+} cache_view_t;
+
+// An immutable, refcounted body, shared by everything holding the same
+// bytes. data is NUL-terminated past the end.
+typedef struct {
+    volatile long refs;
+    size_t size;
+    const char *data;
+} cache_buffer_t;
+
+typedef struct {
+    unsigned long hits;        // Served from memory
+    unsigned long disk_hits;   // Read from disk into memory
+    unsigned long misses;
+    unsigned long evictions;
+    size_t resident_bytes;
+    size_t budget;
+    int entries;
+    unsigned long disk_evictions;
+    unsigned long compactions;
+    unsigned long long disk_bytes;       // Used part of the data file
+    unsigned long long disk_live_bytes;  // Records still reachable
+    unsigned long long disk_budget;
+    unsigned int disk_entries;
+    unsigned long writes_queued;
+    unsigned long writes_coalesced;      // Replaced a store still queued
+    unsigned long write_batches;
+    size_t write_queue_bytes;            // Body bytes waiting to be written
+    unsigned int disk_blobs;             // Distinct bodies behind the disk entries
+    unsigned long dedup_hits;            // Stores whose body was already on disk
+    unsigned long buffers_shared;        // New buffers that turned out to be an existing one
+} cache_stats_t;
+
+// Relative to the working directory unless cache_set_directory says otherwise
+#define CACHE_DEFAULT_DIR "cache"
+
+// Initialize cache system (creates cache directories if needed) and start
+// the background thread
 void cache_init(void);
 
-// Cleanup cache system
+// Keep the files in dir from now on (tests use a scratch directory). Queued
+// stores are written out to the old one first and the memory tier is
+// emptied; the new files are opened on next use.
+void cache_set_directory(const char *dir);
+
+// Stop the background thread, write out queued stores and close the files
 void cache_cleanup(void);
 
-// Get cached image data
-// Returns pointer to cached data (caller must free), or NULL if not cached
-// Sets *out_size to the size of the cached data
-void* cache_get_image(const char *url, size_t *out_size);
+// Write out every queued store before returning
+void cache_flush(void);
+
+// Get a cached body of the given type and its metadata (out_meta may be
+// NULL), from memory if possible. Returns a buffer the caller must release,
+// or NULL if not cached.
+cache_buffer_t* cache_get(cache_type_t type, const char *url, cache_meta_t *out_meta);
+
+// Store a body of the given type where its policy says, replacing any
+// previous entry. expires_at is capped by the policy's max_ttl.
+// Returns 1 on success, 0 on failure or if the type is not cached
+int cache_put(cache_type_t type, const char *url, const void *data, size_t size, const cache_meta_t *meta);
+
+// Replace the metadata of an existing typed entry, keeping its body (after a 304)
+int cache_put_meta(cache_type_t type, const char *url, const cache_meta_t *meta);
+
+// Drop the typed entry for url from memory, the write queue and the disk
+void cache_remove(cache_type_t type, const char *url);
+
+// Per-type policy; defaults keep everything on disk and pages fresh for at
+// most CACHE_DOCUMENT_MAX_TTL
+void cache_set_policy(cache_type_t type, const cache_policy_t *policy);
+void cache_get_policy(cache_type_t type, cache_policy_t *out);
+const char* cache_type_name(cache_type_t type);
+
+// Untyped counterpart of cache_get
+cache_buffer_t* cache_acquire(const char *url, cache_meta_t *out_meta);
+
+// A buffer holding a copy of data, or a live one already holding the same
+// bytes (for instance the cached body it came from). Release when done.
+cache_buffer_t* cache_buffer_create(const void *data, size_t size);
+cache_buffer_t* cache_buffer_retain(cache_buffer_t *buffer);
+void cache_buffer_release(cache_buffer_t *buffer);
+
+// Get a private copy of a cached body and its metadata (out_meta may be NULL)
+// Returns pointer to cached data (caller must free; NUL-terminated past the
+// end), or NULL if not cached. Sets *out_size to the size of the cached data
+void* cache_lookup(const char *url, size_t *out_size, cache_meta_t *out_meta);
+
+// Map the entry for url (writing it out first if still queued). Returns 1
+// on a hit; close the view when done.
+int cache_open_view(const char *url, cache_view_t *view);
+void cache_close_view(cache_view_t *view);
+
+// Store a body with its metadata, replacing any previous entry. The entry is
+// visible at once; the record is appended to the data file later (the old
+// one is garbage until the next compaction). Waits only when the write
+// queue is full. Returns 1 on success, 0 on failure
+int cache_store(const char *url, const void *data, size_t size, const cache_meta_t *meta);
+
+// Replace the metadata of an existing entry, keeping its body (after a 304)
+// Returns 1 on success, 0 if there is no such entry or it cannot be written
+int cache_update_meta(const char *url, const cache_meta_t *meta);
+
+// Bytes the memory tier may hold; lowering it evicts at once
+void cache_set_memory_budget(size_t bytes);
+
+// Bytes of live records the disk may hold; enforced by the maintenance thread
+void cache_set_disk_budget(unsigned long long bytes);
+
+// Run one step of eviction and compaction now, as the maintenance thread
+// does. Returns 1 while more work remains.
+int cache_maintain(void);
 
-// Store image data in cache
-// Returns 1 on success, 0 on failure
-int cache_put_image(const char *url, const void *data, size_t size);
+void cache_get_stats(cache_stats_t *out);
+void cache_log_stats(void);
 
-// Clear all cached images
+// Drop every entry from memory and disk, including the per-domain folders of
+// older versions
 void cache_clear_all(void);
 
 #endif // CACHE_H
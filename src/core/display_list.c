@@ -0,0 +1,279 @@
+#include "display_list.h"
+#include "spatial_index.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // For strcasecmp
+
+static rect_t rect_intersect(rect_t a, rect_t b) {
+    int x1 = a.x > b.x ? a.x : b.x;
+    int y1 = a.y > b.y ? a.y : b.y;
+    int x2 = (a.x + a.width) < (b.x + b.width) ? (a.x + a.width) : (b.x + b.width);
+    int y2 = (a.y + a.height) < (b.y + b.height) ? (a.y + a.height) : (b.y + b.height);
+    rect_t r = {x1, y1, x2 - x1, y2 - y1};
+    if (r.width < 0) r.width = 0;
+    if (r.height < 0) r.height = 0;
+    return r;
+}
+
+static int rect_is_empty(rect_t r) {
+    return r.width <= 0 || r.height <= 0;
+}
+
+int display_list_op_intersects(const dl_op_t *op, rect_t area) {
+    if (!op) return 0;
+    return op->bounds.x < area.x + area.width && area.x < op->bounds.x + op->bounds.width &&
+           op->bounds.y < area.y + area.height && area.y < op->bounds.y + op->bounds.height;
+}
+
+// Appends an op; returns NULL if it is fully clipped away or allocation fails
+static dl_op_t* push_op(display_list_t *list, dl_op_type_t type, rect_t rect, rect_t clip, node_t *node) {
+    rect_t bounds = rect_intersect(rect, clip);
+    if (rect_is_empty(bounds)) return NULL;
+
+    if (list->count == list->capacity) {
+        int new_cap = list->capacity == 0 ? 64 : list->capacity * 2;
+        dl_op_t *new_ops = realloc(list->ops, sizeof(dl_op_t) * new_cap);
+        if (!new_ops) {
+            LOG_ERROR("Display list allocation failed (%d ops)", new_cap);
+            return NULL;
+        }
+        list->ops = new_ops;
+        list->capacity = new_cap;
+    }
+
+    dl_op_t *op = &list->ops[list->count++];
+    memset(op, 0, sizeof(dl_op_t));
+    op->type = type;
+    op->rect = rect;
+    op->bounds = bounds;
+    op->node = node;
+    return op;
+}
+
+static int is_tag(node_t *node, const char *tag) {
+    return node->tag_name && strcasecmp(node->tag_name, tag) == 0;
+}
+
+// Mirrors the painting order of the original immediate-mode renderer:
+// background, background image, border, iframe content, input value, children.
+static void record_box(display_list_t *list, layout_box_t *box, int offset_x, int offset_y, rect_t clip) {
+    if (!box || !box->node || !box->node->style) return;
+    node_t *node = box->node;
+    style_t *style = node->style;
+    if (style->display == DISPLAY_NONE) return;
+
+    int x = box->fragment.border_box.x + offset_x;
+    int y = box->fragment.border_box.y + offset_y;
+    int w = box->fragment.border_box.width;
+    int h = box->fragment.border_box.height;
+    rect_t r = {x, y, w, h};
+
+    int is_replaced = 0;
+
+    if (node->type == DOM_NODE_ELEMENT) {
+        if (is_tag(node, "img")) {
+            is_replaced = 1;
+            if (node->image_data && node->image_size > 0) {
+                dl_op_t *op = push_op(list, DL_OP_IMAGE, r, clip, node);
+                if (op) {
+                    op->image_data = node->image_data;
+                    op->image_size = node->image_size;
+                }
+            }
+        } else {
+            if (style->bg_color != 0xFFFFFF) {
+                dl_op_t *op = push_op(list, DL_OP_RECT_FILL, r, clip, node);
+                if (op) op->color = style->bg_color;
+            }
+
+            if (node->bg_image_data) {
+                dl_op_t *op = push_op(list, DL_OP_IMAGE, r, clip, node);
+                if (op) {
+                    op->image_data = node->bg_image_data;
+                    op->image_size = node->bg_image_size;
+                }
+            }
+
+            if (style->border_width > 0) {
+                dl_op_t *op = push_op(list, DL_OP_BORDER, r, clip, node);
+                if (op) {
+                    op->color = 0x000000;
+                    op->border_width = style->border_width;
+                }
+            }
+
+            if (is_tag(node, "iframe")) is_replaced = 1;
+
+            if (box->iframe_root) {
+                int bw = style->border_width;
+                int cx = x + bw + style->padding_left;
+                int cy = y + bw + style->padding_top;
+                int cw = box->fragment.content_box.width;
+                // Use content box height if calculated, otherwise calculate from border box
+                int ch = box->fragment.content_box.height;
+                if (ch <= 0) ch = h - (bw * 2) - style->padding_top - style->padding_bottom;
+
+                rect_t content = {cx, cy, cw, ch};
+                rect_t inner_clip = rect_intersect(content, clip);
+                if (!rect_is_empty(inner_clip)) {
+                    dl_op_t *push = push_op(list, DL_OP_CLIP_PUSH, content, clip, node);
+                    if (push) {
+                        record_box(list, box->iframe_root, cx, cy, inner_clip);
+                        push_op(list, DL_OP_CLIP_POP, content, clip, node);
+                    }
+                }
+            }
+
+            if (is_tag(node, "input")) {
+                int bw = style->border_width;
+                rect_t text_rect = {
+                    x + style->padding_left + bw,
+                    y + style->padding_top + bw,
+                    w - style->padding_left - style->padding_right - (bw * 2),
+                    h - style->padding_top - style->padding_bottom - (bw * 2)
+                };
+                dl_op_t *op = push_op(list, DL_OP_TEXT, text_rect, clip, node);
+                if (op) op->text_flags = DL_TEXT_INPUT_VALUE;
+            }
+        }
+    } else if (node->type == DOM_NODE_TEXT && node->content) {
+        dl_op_t *op = push_op(list, DL_OP_TEXT, r, clip, node);
+        if (op) {
+            op->text = node->content;
+            op->text_flags = DL_TEXT_WRAP;
+        }
+    }
+
+    // Children are positioned relative to this box's border box.
+    // Replaced elements (img, iframe) do not paint their DOM children.
+    if (!is_replaced) {
+        layout_box_t *child = box->first_child;
+        while (child) {
+            record_box(list, child, x, y, clip);
+            child = child->next_sibling;
+        }
+    }
+}
+
+display_list_t* display_list_build(layout_box_t *root) {
+    display_list_t *list = calloc(1, sizeof(display_list_t));
+    if (!list) return NULL;
+
+    // The document itself is unclipped; the backend clips to the window
+    rect_t unclipped = {-(1 << 29), -(1 << 29), 1 << 30, 1 << 30};
+    record_box(list, root, 0, 0, unclipped);
+
+    // Clip pushes and pops share their bounds, so a query returns both or neither
+    rect_t *bounds = malloc(sizeof(rect_t) * (list->count > 0 ? list->count : 1));
+    if (bounds) {
+        for (int i = 0; i < list->count; i++) bounds[i] = list->ops[i].bounds;
+        list->index = spatial_index_create(bounds, list->count);
+        free(bounds);
+    }
+
+    LOG_DEBUG("Display list recorded: %d ops", list->count);
+    return list;
+}
+
+int display_list_query(display_list_t *list, rect_t area, int **out_ops) {
+    if (out_ops) *out_ops = NULL;
+    if (!list || !out_ops) return 0;
+
+    if (list->index) return spatial_index_query(list->index, area, out_ops);
+
+    // No index (allocation failure): fall back to a linear scan
+    int *ops = malloc(sizeof(int) * (list->count > 0 ? list->count : 1));
+    if (!ops) return 0;
+    int count = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (display_list_op_intersects(&list->ops[i], area)) ops[count++] = i;
+    }
+    *out_ops = ops;
+    return count;
+}
+
+static void replay_op(dl_backend_t *backend, const dl_op_t *op, int offset_x, int offset_y, int *clip_depth) {
+    int x = op->rect.x + offset_x;
+    int y = op->rect.y + offset_y;
+    int w = op->rect.width;
+    int h = op->rect.height;
+
+    switch (op->type) {
+        case DL_OP_RECT_FILL:
+            backend->fill_rect(backend, x, y, w, h, op->color);
+            break;
+
+        case DL_OP_BORDER: {
+            uint32_t color = op->color;
+            if (op->node && op->node == backend->focused_node) color = DL_FOCUS_COLOR;
+            int bw = op->border_width;
+            if (bw * 2 > w || bw * 2 > h) {
+                backend->fill_rect(backend, x, y, w, h, color);
+                break;
+            }
+            backend->fill_rect(backend, x, y, w, bw, color);
+            backend->fill_rect(backend, x, y + h - bw, w, bw, color);
+            backend->fill_rect(backend, x, y + bw, bw, h - (bw * 2), color);
+            backend->fill_rect(backend, x + w - bw, y + bw, bw, h - (bw * 2), color);
+            break;
+        }
+
+        case DL_OP_TEXT: {
+            const char *text = op->text;
+            if (op->text_flags & DL_TEXT_INPUT_VALUE) {
+                text = op->node->current_value ? op->node->current_value : node_get_attr(op->node, "value");
+            }
+            if (text && *text) backend->draw_text(backend, op, text, x, y, w, h);
+            break;
+        }
+
+        case DL_OP_IMAGE:
+            backend->draw_image(backend, op, x, y, w, h);
+            break;
+
+        case DL_OP_CLIP_PUSH:
+            backend->push_clip(backend, x, y, w, h);
+            (*clip_depth)++;
+            break;
+
+        case DL_OP_CLIP_POP:
+            if (*clip_depth > 0) {
+                backend->pop_clip(backend);
+                (*clip_depth)--;
+            }
+            break;
+    }
+}
+
+void display_list_replay(display_list_t *list, dl_backend_t *backend, int offset_x, int offset_y, const rect_t *dirty) {
+    if (!list || !backend) return;
+    int clip_depth = 0;
+
+    if (dirty) {
+        backend->push_clip(backend, dirty->x, dirty->y, dirty->width, dirty->height);
+        // Only visit the ops intersecting the dirty rect (in document coordinates)
+        rect_t area = {dirty->x - offset_x, dirty->y - offset_y, dirty->width, dirty->height};
+        int *ops = NULL;
+        int count = display_list_query(list, area, &ops);
+        for (int i = 0; i < count; i++) {
+            replay_op(backend, &list->ops[ops[i]], offset_x, offset_y, &clip_depth);
+        }
+        free(ops);
+    } else {
+        for (int i = 0; i < list->count; i++) {
+            replay_op(backend, &list->ops[i], offset_x, offset_y, &clip_depth);
+        }
+    }
+
+    // Unbalanced clip stack (e.g. recording ran out of memory mid-iframe)
+    while (clip_depth-- > 0) backend->pop_clip(backend);
+    if (dirty) backend->pop_clip(backend);
+}
+
+void display_list_free(display_list_t *list) {
+    if (!list) return;
+    spatial_index_free(list->index);
+    free(list->ops);
+    free(list);
+}
@@ -0,0 +1,96 @@
+#ifndef DISPLAY_LIST_H
+#define DISPLAY_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "layout.h"
+
+/*
+ * Display List
+ *
+ * A flat, paint-ordered list of draw operations recorded once per layout.
+ * Every operation carries absolute document coordinates, so painting is a
+ * linear replay that never has to walk the layout tree, inspect tag names
+ * or accumulate parent offsets.
+ *
+ * - rect:   the geometry the operation draws into
+ * - bounds: rect intersected with the enclosing clip; used for culling.
+ *           Clip push/pop pairs share the same bounds, so any culling
+ *           scheme that keeps a content op also keeps its clip pair.
+ *
+ * State that can change without a relayout (focus ring colour, the value
+ * typed into an <input>) is not baked into the list; operations keep a
+ * pointer to their source node and it is read at replay time.
+ *
+ * display_list_replay is the one paint path. A backend (GDI in
+ * src/ui/render.c, the software rasterizer in raster.c) only supplies the
+ * primitives below; culling against the dirty rect, borders, the focus
+ * colour, input values and clip balancing are shared, so both backends
+ * paint a list the same way.
+ */
+
+typedef enum {
+    DL_OP_RECT_FILL,   // Solid background fill
+    DL_OP_BORDER,      // Solid border drawn inside rect
+    DL_OP_TEXT,        // Text run using the node's computed style
+    DL_OP_IMAGE,       // Encoded image data scaled into rect
+    DL_OP_CLIP_PUSH,   // Intersect the clip with rect
+    DL_OP_CLIP_POP     // Restore the clip from the matching push
+} dl_op_type_t;
+
+// DL_OP_TEXT flags
+#define DL_TEXT_WRAP        0x01  // Word-wrapped text run (text nodes)
+#define DL_TEXT_INPUT_VALUE 0x02  // Single line, vertically centred; text read from the node
+
+typedef struct {
+    dl_op_type_t type;
+    rect_t rect;
+    rect_t bounds;
+    uint32_t color;            // 0xRRGGBB for fills and borders
+    int border_width;
+    int text_flags;
+    node_t *node;              // Source DOM node
+    const char *text;          // DL_OP_TEXT: borrowed from the DOM
+    const void *image_data;    // DL_OP_IMAGE: borrowed from the DOM
+    size_t image_size;
+} dl_op_t;
+
+typedef struct {
+    dl_op_t *ops;
+    int count;
+    int capacity;
+    struct spatial_index_s *index; // Over op bounds; ids are op positions
+} display_list_t;
+
+#define DL_FOCUS_COLOR 0x0078D7   // Border of the focused node
+
+// Paint primitives; embed as the first member of a backend's state.
+// Coordinates already include the replay offset.
+typedef struct dl_backend_s dl_backend_t;
+struct dl_backend_s {
+    void (*fill_rect)(dl_backend_t *backend, int x, int y, int w, int h, uint32_t color);
+    // text is the string to draw (an input's value already read from its node)
+    void (*draw_text)(dl_backend_t *backend, const dl_op_t *op, const char *text, int x, int y, int w, int h);
+    void (*draw_image)(dl_backend_t *backend, const dl_op_t *op, int x, int y, int w, int h);
+    void (*push_clip)(dl_backend_t *backend, int x, int y, int w, int h);
+    void (*pop_clip)(dl_backend_t *backend);
+    node_t *focused_node;
+};
+
+// Record the paint operations for a laid out tree and index their bounds
+display_list_t* display_list_build(layout_box_t *root);
+void display_list_free(display_list_t *list);
+
+// Returns 1 if the op's culling bounds intersect the given document-space rect
+int display_list_op_intersects(const dl_op_t *op, rect_t area);
+
+// Positions of the ops intersecting a document-space rect, in paint order.
+// Returns the count; *out_ops must be freed by the caller.
+int display_list_query(display_list_t *list, rect_t area, int **out_ops);
+
+// Paint the list through backend, shifted by the offset. dirty is in the
+// shifted coordinates; NULL paints every op, otherwise only the ops
+// intersecting it, clipped to it. Clips are balanced on return.
+void display_list_replay(display_list_t *list, dl_backend_t *backend, int offset_x, int offset_y, const rect_t *dirty);
+
+#endif // DISPLAY_LIST_H
@@ -30,8 +30,10 @@ void node_free(node_t *node) {
         if (node->style->bg_image) free(node->style->bg_image);
         free(node->style);
     }
-    if (node->image_data) free(node->image_data);
-    if (node->bg_image_data) free(node->bg_image_data);
+    if (node->image_buffer) cache_buffer_release(node->image_buffer);
+    else if (node->image_data) free(node->image_data);
+    if (node->bg_image_buffer) cache_buffer_release(node->bg_image_buffer);
+    else if (node->bg_image_data) free(node->bg_image_data);
     if (node->iframe_doc) node_free(node->iframe_doc);
 
     attr_t *attr = node->attributes;
@@ -46,6 +48,56 @@ void node_free(node_t *node) {
     free(node);
 }
 
+static char* dup_or_null(const char *s) {
+    return s ? strdup(s) : NULL;
+}
+
+static void* clone_image(const void *data, size_t size, cache_buffer_t *buffer, cache_buffer_t **out_buffer) {
+    *out_buffer = NULL;
+    if (!data) return NULL;
+    if (buffer) {
+        *out_buffer = cache_buffer_retain(buffer);
+        return (void *)data;
+    }
+    void *copy = malloc(size);
+    if (copy) memcpy(copy, data, size);
+    return copy;
+}
+
+node_t* node_clone(node_t *node) {
+    if (!node) return NULL;
+    node_t *copy = node_create(node->type);
+    if (!copy) return NULL;
+
+    copy->tag_name = dup_or_null(node->tag_name);
+    copy->content = dup_or_null(node->content);
+    copy->current_value = dup_or_null(node->current_value);
+
+    // Attributes keep their order
+    attr_t **tail = &copy->attributes;
+    for (attr_t *attr = node->attributes; attr; attr = attr->next) {
+        attr_t *a = calloc(1, sizeof(attr_t));
+        if (!a) break;
+        a->name = dup_or_null(attr->name);
+        a->value = dup_or_null(attr->value);
+        *tail = a;
+        tail = &a->next;
+    }
+
+    copy->image_data = clone_image(node->image_data, node->image_size, node->image_buffer, &copy->image_buffer);
+    if (copy->image_data) copy->image_size = node->image_size;
+    copy->image_width = node->image_width;
+    copy->image_height = node->image_height;
+    copy->bg_image_data = clone_image(node->bg_image_data, node->bg_image_size, node->bg_image_buffer, &copy->bg_image_buffer);
+    if (copy->bg_image_data) copy->bg_image_size = node->bg_image_size;
+
+    copy->iframe_doc = node_clone(node->iframe_doc);
+    for (node_t *child = node->first_child; child; child = child->next_sibling) {
+        node_add_child(copy, node_clone(child));
+    }
+    return copy;
+}
+
 void node_add_child(node_t *parent, node_t *child) {
     if (!parent || !child) return;
     child->parent = parent;
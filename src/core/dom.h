@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include "style.h"
+#include "cache.h"
 
 typedef enum {
     DOM_NODE_ELEMENT,
@@ -25,10 +26,12 @@ typedef struct node_s {
     style_t *style;
     void *image_data; // Pointer to decoded image or raw data
     size_t image_size;
+    cache_buffer_t *image_buffer; // Holds image_data when shared with identical images; else it is malloc'd
     int image_width; // Intrinsic image width in pixels
     int image_height; // Intrinsic image height in pixels
     void *bg_image_data;
     size_t bg_image_size;
+    cache_buffer_t *bg_image_buffer;
     struct node_s *iframe_doc; // Embedded DOM tree for iframes
     struct node_s *first_child;
     struct node_s *last_child;
@@ -38,6 +41,9 @@ typedef struct node_s {
 
 node_t* node_create(node_type_t type);
 void node_free(node_t *node);
+// Deep copy of the tree, images included (shared buffers are retained, not
+// copied). Styles are left at their defaults for style_compute to fill in.
+node_t* node_clone(node_t *node);
 void node_add_child(node_t *parent, node_t *child);
 void node_add_attr(node_t *node, const char *name, const char *value);
 const char* node_get_attr(node_t *node, const char *name);
@@ -21,26 +21,42 @@ static int is_raw_text_element(const char *tag) {
             strcasecmp(tag, "title") == 0);
 }
 
-node_t* html_parse(const char *html) {
-    if (!html) {
-        LOG_WARN("html_parse called with NULL input");
-        return NULL;
-    }
+struct html_parser_s {
+    node_t *root;
+    node_t *current;
+    char *buf;      // Unparsed input, NUL-terminated
+    size_t len;
+    size_t cap;
+    size_t total;   // Bytes fed so far
+    size_t scanned; // Bytes of the unparsed token at buf already searched for its end
+};
 
-    LOG_INFO("Parsing HTML content...");
-    node_t *root = node_create(DOM_NODE_ELEMENT);
-    root->tag_name = strdup("root");
-    node_t *current = root;
+// Build nodes from the buffered input. Unless final, a token running into
+// the end of the input is left unparsed until more arrives, so the tree
+// comes out exactly as if the whole document had been parsed at once.
+// The search for the end of a long text, raw-text or comment token resumes
+// where the previous call stopped, so a big script arriving in many chunks
+// is not rescanned from its start on every one.
+static void parse(html_parser_t *parser, int final) {
+    node_t *root = parser->root;
+    node_t *current = parser->current;
 
-    const char *p = html;
+    const char *p = parser->buf;
+    const char *token = p;
+    size_t skip = parser->scanned;
+    parser->scanned = 0;
     while (*p) {
+        token = p;
+        // Only the token left over from last time has been searched before
+        const char *resume = token + skip;
+        skip = 0;
         // Handle Raw Text Elements (script, style, etc.)
         if (current != root && current->type == DOM_NODE_ELEMENT && is_raw_text_element(current->tag_name)) {
             char closing_tag[128];
             snprintf(closing_tag, sizeof(closing_tag), "</%s>", current->tag_name);
             size_t close_len = strlen(closing_tag);
 
-            const char *end = p;
+            const char *end = resume;
             int found = 0;
             while (*end) {
                 if (strncasecmp(end, closing_tag, close_len) == 0) {
@@ -50,6 +66,13 @@ node_t* html_parse(const char *html) {
                 end++;
             }
 
+            if (!found && !final) {
+                // The closing tag may still come, possibly starting in the last few bytes
+                size_t searched = (size_t)(end - p);
+                parser->scanned = searched >= close_len ? searched - close_len + 1 : 0;
+                break;
+            }
+
             size_t len = end - p;
             if (len > 0) {
                 node_t *text = node_create(DOM_NODE_TEXT);
@@ -69,11 +92,22 @@ node_t* html_parse(const char *html) {
             if (*p == '!') { // Comment or DOCTYPE
                 if (strncmp(p, "!--", 3) == 0) {
                     p += 3;
-                    const char *end = strstr(p, "-->");
+                    const char *from = resume > p ? resume : p;
+                    const char *end = strstr(from, "-->");
                     if (end) p = end + 3;
-                    else while (*p) p++;
+                    else p = from + strlen(from);
+                    if (!end && !final) {
+                        // "-->" may still be completed by the last two bytes
+                        parser->scanned = (size_t)(p - token) - 2;
+                        p = token;
+                        break;
+                    }
                 } else {
                     while (*p && *p != '>') p++;
+                    if (!*p && !final) {
+                        p = token;
+                        break;
+                    }
                     if (*p) p++;
                 }
                 continue;
@@ -91,8 +125,12 @@ node_t* html_parse(const char *html) {
             tag_name[i] = '\0';
 
             if (is_closing) {
-                if (current->parent) current = current->parent;
                 while (*p && *p != '>') p++;
+                if (!*p && !final) {
+                    p = token;
+                    break;
+                }
+                if (current->parent) current = current->parent;
                 if (*p) p++;
             } else {
                 node_t *new_node = node_create(DOM_NODE_ELEMENT);
@@ -149,6 +187,11 @@ node_t* html_parse(const char *html) {
                 int self_closing = (*p == '/');
                 if (self_closing) p++;
                 while (*p && *p != '>') p++;
+                if (!*p && !final) {
+                    node_free(new_node);
+                    p = token;
+                    break;
+                }
                 if (*p) p++;
 
                 node_add_child(current, new_node);
@@ -158,7 +201,13 @@ node_t* html_parse(const char *html) {
             }
         } else {
             const char *start = p;
+            p = resume;
             while (*p && *p != '<') p++;
+            if (!*p && !final) {
+                parser->scanned = (size_t)(p - token);
+                p = token; // The text may go on in the next chunk
+                break;
+            }
             size_t len = p - start;
             if (len > 0) {
                 // Check if it's just whitespace
@@ -181,5 +230,81 @@ node_t* html_parse(const char *html) {
         }
     }
 
+    parser->current = current;
+    parser->len -= (size_t)(p - parser->buf);
+    memmove(parser->buf, p, parser->len + 1);
+}
+
+html_parser_t* html_parser_create(void) {
+    html_parser_t *parser = calloc(1, sizeof(html_parser_t));
+    if (!parser) return NULL;
+    parser->root = node_create(DOM_NODE_ELEMENT);
+    parser->buf = malloc(1);
+    if (!parser->root || !parser->buf) {
+        html_parser_free(parser);
+        return NULL;
+    }
+    parser->root->tag_name = strdup("root");
+    parser->current = parser->root;
+    parser->buf[0] = '\0';
+    parser->cap = 1;
+    return parser;
+}
+
+int html_parser_feed(html_parser_t *parser, const char *data, size_t len) {
+    if (!parser || !data || len == 0) return 1;
+    if (parser->len + len + 1 > parser->cap) {
+        size_t cap = parser->cap * 2;
+        while (cap < parser->len + len + 1) cap *= 2;
+        char *buf = realloc(parser->buf, cap);
+        if (!buf) {
+            LOG_ERROR("HTML parser: failed to grow input buffer to %lu bytes", (unsigned long)cap);
+            return 0;
+        }
+        parser->buf = buf;
+        parser->cap = cap;
+    }
+    memcpy(parser->buf + parser->len, data, len);
+    parser->len += len;
+    parser->buf[parser->len] = '\0';
+    parser->total += len;
+    parse(parser, 0);
+    return 1;
+}
+
+node_t* html_parser_root(html_parser_t *parser) {
+    return parser ? parser->root : NULL;
+}
+
+size_t html_parser_bytes(html_parser_t *parser) {
+    return parser ? parser->total : 0;
+}
+
+node_t* html_parser_finish(html_parser_t *parser) {
+    if (!parser) return NULL;
+    parse(parser, 1);
+    node_t *root = parser->root;
+    parser->root = NULL;
+    html_parser_free(parser);
     return root;
 }
+
+void html_parser_free(html_parser_t *parser) {
+    if (!parser) return;
+    if (parser->root) node_free(parser->root);
+    free(parser->buf);
+    free(parser);
+}
+
+node_t* html_parse(const char *html) {
+    if (!html) {
+        LOG_WARN("html_parse called with NULL input");
+        return NULL;
+    }
+
+    LOG_INFO("Parsing HTML content...");
+    html_parser_t *parser = html_parser_create();
+    if (!parser) return NULL;
+    html_parser_feed(parser, html, strlen(html));
+    return html_parser_finish(parser);
+}
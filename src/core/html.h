@@ -5,4 +5,20 @@
 
 node_t* html_parse(const char *html);
 
+// Incremental parsing of a document that arrives in pieces. Each feed
+// parses every token that is complete; the tree always matches what
+// html_parse would build from the whole input.
+typedef struct html_parser_s html_parser_t;
+
+html_parser_t* html_parser_create(void);
+// Returns 0 if the input could not be buffered
+int html_parser_feed(html_parser_t *parser, const char *data, size_t len);
+// The tree so far; still owned by the parser and grown by later feeds
+node_t* html_parser_root(html_parser_t *parser);
+size_t html_parser_bytes(html_parser_t *parser);
+// Parse what is left as the end of the document; returns the tree and frees the parser
+node_t* html_parser_finish(html_parser_t *parser);
+// Frees the parser along with its tree
+void html_parser_free(html_parser_t *parser);
+
 #endif // HTML_H
@@ -0,0 +1,189 @@
+#include "image_sniff.h"
+#include <string.h>
+
+typedef image_sniff_result_t (*sniff_fn_t)(const unsigned char *b, size_t size, image_info_t *out);
+
+static unsigned int be16(const unsigned char *p) { return ((unsigned int)p[0] << 8) | p[1]; }
+static unsigned int le16(const unsigned char *p) { return p[0] | ((unsigned int)p[1] << 8); }
+static unsigned int le24(const unsigned char *p) { return le16(p) | ((unsigned int)p[2] << 16); }
+static unsigned long be32(const unsigned char *p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+static unsigned long le32(const unsigned char *p) {
+    return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static image_sniff_result_t set_size(image_info_t *out, unsigned long width, unsigned long height) {
+    if (width == 0 || height == 0 || width > IMAGE_SNIFF_MAX_DIMENSION || height > IMAGE_SNIFF_MAX_DIMENSION) {
+        return IMAGE_SNIFF_FAILED;
+    }
+    out->width = (int)width;
+    out->height = (int)height;
+    return IMAGE_SNIFF_OK;
+}
+
+// Signature (8 bytes), then the IHDR chunk: length, type, width, height
+static image_sniff_result_t sniff_png(const unsigned char *b, size_t size, image_info_t *out) {
+    if (size < 24) return IMAGE_SNIFF_NEED_MORE;
+    if (memcmp(b + 12, "IHDR", 4) != 0) return IMAGE_SNIFF_FAILED;
+    return set_size(out, be32(b + 16), be32(b + 20));
+}
+
+// Signature (6 bytes), then the logical screen size
+static image_sniff_result_t sniff_gif(const unsigned char *b, size_t size, image_info_t *out) {
+    if (size < 10) return IMAGE_SNIFF_NEED_MORE;
+    return set_size(out, le16(b + 6), le16(b + 8));
+}
+
+// 14-byte file header, then the DIB header, whose size tells its version.
+// OS/2 1.x headers (12 bytes) hold 16-bit sizes; the rest signed 32-bit
+// ones, with a negative height for top-down bitmaps.
+static image_sniff_result_t sniff_bmp(const unsigned char *b, size_t size, image_info_t *out) {
+    if (size < 18) return IMAGE_SNIFF_NEED_MORE;
+    unsigned long header = le32(b + 14);
+    if (header == 12) {
+        if (size < 22) return IMAGE_SNIFF_NEED_MORE;
+        return set_size(out, le16(b + 18), le16(b + 20));
+    }
+    if (header < 16 || header > 124) return IMAGE_SNIFF_FAILED;
+    if (size < 26) return IMAGE_SNIFF_NEED_MORE;
+    unsigned long width = le32(b + 18);
+    unsigned long height = le32(b + 22);
+    if (width & 0x80000000UL) return IMAGE_SNIFF_FAILED;
+    if (height & 0x80000000UL) height = (0xFFFFFFFFUL - height + 1) & 0xFFFFFFFFUL; // Top-down
+    return set_size(out, width, height);
+}
+
+// 6-byte header with the image count, then a 16-byte directory entry per
+// image whose first two bytes are its size (0 meaning 256). An icon file
+// holds several sizes of one picture; the largest stands for it.
+static image_sniff_result_t sniff_ico(const unsigned char *b, size_t size, image_info_t *out) {
+    if (size < 6) return IMAGE_SNIFF_NEED_MORE;
+    unsigned int count = le16(b + 4);
+    if (count == 0 || 6 + (size_t)count * 16 > IMAGE_SNIFF_MAX_BYTES) return IMAGE_SNIFF_FAILED;
+    if (size < 6 + (size_t)count * 16) return IMAGE_SNIFF_NEED_MORE;
+
+    unsigned long best_width = 0, best_height = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        const unsigned char *entry = b + 6 + i * 16;
+        unsigned long width = entry[0] ? entry[0] : 256;
+        unsigned long height = entry[1] ? entry[1] : 256;
+        if (width * height > best_width * best_height) {
+            best_width = width;
+            best_height = height;
+        }
+    }
+    return set_size(out, best_width, best_height);
+}
+
+// RIFF container: "RIFF", size, "WEBP", then the first chunk. Lossy (VP8 )
+// images carry their size in the key frame header, lossless (VP8L) ones
+// packed into 14-bit fields, and extended (VP8X) ones as a 24-bit canvas
+// size ahead of any animation or metadata chunks.
+static image_sniff_result_t sniff_webp(const unsigned char *b, size_t size, image_info_t *out) {
+    if (size < 16) return size < 12 || memcmp(b + 8, "WEBP", 4) == 0 ? IMAGE_SNIFF_NEED_MORE : IMAGE_SNIFF_FAILED;
+    if (memcmp(b + 8, "WEBP", 4) != 0) return IMAGE_SNIFF_FAILED;
+
+    if (memcmp(b + 12, "VP8 ", 4) == 0) {
+        if (size < 30) return IMAGE_SNIFF_NEED_MORE;
+        if (b[23] != 0x9D || b[24] != 0x01 || b[25] != 0x2A) return IMAGE_SNIFF_FAILED;
+        return set_size(out, le16(b + 26) & 0x3FFF, le16(b + 28) & 0x3FFF);
+    }
+    if (memcmp(b + 12, "VP8L", 4) == 0) {
+        if (size < 25) return IMAGE_SNIFF_NEED_MORE;
+        if (b[20] != 0x2F) return IMAGE_SNIFF_FAILED;
+        unsigned long bits = le32(b + 21);
+        return set_size(out, (bits & 0x3FFF) + 1, ((bits >> 14) & 0x3FFF) + 1);
+    }
+    if (memcmp(b + 12, "VP8X", 4) == 0) {
+        if (size < 30) return IMAGE_SNIFF_NEED_MORE;
+        return set_size(out, le24(b + 24) + 1UL, le24(b + 27) + 1UL);
+    }
+    return IMAGE_SNIFF_FAILED;
+}
+
+// Walk the marker segments after SOI up to the first start-of-frame, which
+// holds the height and width. Scan data only follows SOS, so reaching that
+// (or EOI) first means the file is broken.
+static image_sniff_result_t sniff_jpeg(const unsigned char *b, size_t size, image_info_t *out) {
+    size_t pos = 2;
+    for (;;) {
+        if (pos + 2 > size) return IMAGE_SNIFF_NEED_MORE;
+        if (b[pos] != 0xFF) return IMAGE_SNIFF_FAILED;
+        unsigned char marker = b[pos + 1];
+        if (marker == 0xFF) {
+            pos++; // Fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2; // Stand-alone marker, no length
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) return IMAGE_SNIFF_FAILED;
+
+        if (pos + 4 > size) return IMAGE_SNIFF_NEED_MORE;
+        unsigned int length = be16(b + pos + 2);
+        if (length < 2) return IMAGE_SNIFF_FAILED;
+
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC) which share the range
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (length < 7) return IMAGE_SNIFF_FAILED;
+            if (pos + 9 > size) return IMAGE_SNIFF_NEED_MORE;
+            return set_size(out, be16(b + pos + 7), be16(b + pos + 5));
+        }
+        pos += 2 + length;
+        if (pos >= IMAGE_SNIFF_MAX_BYTES) return IMAGE_SNIFF_FAILED;
+    }
+}
+
+typedef struct {
+    image_format_t format;
+    const char *signature;
+    size_t length;
+    sniff_fn_t sniff;
+} image_signature_t;
+
+static const image_signature_t g_signatures[] = {
+    { IMAGE_FORMAT_PNG,  "\x89PNG\r\n\x1A\n", 8, sniff_png },
+    { IMAGE_FORMAT_JPEG, "\xFF\xD8\xFF",      3, sniff_jpeg },
+    { IMAGE_FORMAT_GIF,  "GIF87a",            6, sniff_gif },
+    { IMAGE_FORMAT_GIF,  "GIF89a",            6, sniff_gif },
+    { IMAGE_FORMAT_WEBP, "RIFF",              4, sniff_webp },
+    { IMAGE_FORMAT_BMP,  "BM",                2, sniff_bmp },
+    { IMAGE_FORMAT_ICO,  "\0\0\1\0",          4, sniff_ico },
+    { IMAGE_FORMAT_ICO,  "\0\0\2\0",          4, sniff_ico }  // Cursor; same layout
+};
+
+image_sniff_result_t image_sniff(const void *data, size_t size, image_info_t *out) {
+    const unsigned char *b = (const unsigned char *)data;
+    memset(out, 0, sizeof(*out));
+    if (!b) return IMAGE_SNIFF_NEED_MORE;
+
+    int prefix = 0; // Too short to tell, but consistent with some signature
+    for (size_t i = 0; i < sizeof(g_signatures) / sizeof(g_signatures[0]); i++) {
+        const image_signature_t *sig = &g_signatures[i];
+        if (size < sig->length) {
+            if (memcmp(b, sig->signature, size) == 0) prefix = 1;
+            continue;
+        }
+        if (memcmp(b, sig->signature, sig->length) != 0) continue;
+
+        out->format = sig->format;
+        image_sniff_result_t result = sig->sniff(b, size, out);
+        if (result == IMAGE_SNIFF_NEED_MORE && size >= IMAGE_SNIFF_MAX_BYTES) result = IMAGE_SNIFF_FAILED;
+        return result;
+    }
+    return prefix ? IMAGE_SNIFF_NEED_MORE : IMAGE_SNIFF_FAILED;
+}
+
+const char* image_format_name(image_format_t format) {
+    switch (format) {
+        case IMAGE_FORMAT_PNG:  return "PNG";
+        case IMAGE_FORMAT_JPEG: return "JPEG";
+        case IMAGE_FORMAT_GIF:  return "GIF";
+        case IMAGE_FORMAT_BMP:  return "BMP";
+        case IMAGE_FORMAT_ICO:  return "ICO";
+        case IMAGE_FORMAT_WEBP: return "WebP";
+        default:                return "unknown";
+    }
+}
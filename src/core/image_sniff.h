@@ -0,0 +1,50 @@
+#ifndef IMAGE_SNIFF_H
+#define IMAGE_SNIFF_H
+
+#include <stddef.h>
+
+/*
+ * Image header sniffing
+ *
+ * Reads the intrinsic size of an image from the start of its body, without
+ * decoding it, so layout can reserve the right box while the rest is still
+ * downloading. PNG, GIF, BMP, ICO/CUR and WebP keep their size within the
+ * first few dozen bytes; JPEG keeps it in the frame header, after whatever
+ * metadata segments (EXIF, ICC profiles, thumbnails) come first.
+ *
+ * image_sniff can be called again each time more of the body arrives. It
+ * gives up on data that is not one of the formats above, on headers that
+ * make no sense, and on JPEGs whose frame header is not within the first
+ * IMAGE_SNIFF_MAX_BYTES.
+ */
+
+#define IMAGE_SNIFF_MAX_BYTES (64 * 1024)
+#define IMAGE_SNIFF_MAX_DIMENSION 65535
+
+typedef enum {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_JPEG,
+    IMAGE_FORMAT_GIF,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_ICO,
+    IMAGE_FORMAT_WEBP
+} image_format_t;
+
+typedef enum {
+    IMAGE_SNIFF_FAILED = -1,    // Not a known format, or a broken header
+    IMAGE_SNIFF_NEED_MORE = 0,  // Nothing wrong so far; call again with more data
+    IMAGE_SNIFF_OK = 1
+} image_sniff_result_t;
+
+typedef struct {
+    image_format_t format;      // Set as soon as the signature is recognised
+    int width;
+    int height;
+} image_info_t;
+
+image_sniff_result_t image_sniff(const void *data, size_t size, image_info_t *out);
+
+const char* image_format_name(image_format_t format);
+
+#endif // IMAGE_SNIFF_H
@@ -38,6 +38,7 @@
  */
 
 #include "layout.h"
+#include "spatial_index.h"
 #include "platform.h"
 #include "log.h"
 #include <stdlib.h>
@@ -568,9 +569,22 @@ void layout_compute(layout_box_t *box, constraint_space_t space) {
     }
 
     // Handle iFrames
+    // The embedded layout only depends on the iframe document and its content width,
+    // so keep the previous result across ancestor relayouts unless one of them changed.
     if (box->node->iframe_doc) {
-        if (box->iframe_root) layout_free(box->iframe_root);
-        box->iframe_root = layout_create_tree(box->node->iframe_doc, box->fragment.content_box.width);
+        int iframe_width = box->fragment.content_box.width;
+        if (!box->iframe_root ||
+            box->iframe_doc_laid_out != box->node->iframe_doc ||
+            box->iframe_layout_width != iframe_width) {
+            if (box->iframe_root) layout_free(box->iframe_root);
+            box->iframe_root = layout_create_tree(box->node->iframe_doc, iframe_width);
+            box->iframe_doc_laid_out = box->node->iframe_doc;
+            box->iframe_layout_width = iframe_width;
+        }
+    } else if (box->iframe_root) {
+        layout_free(box->iframe_root);
+        box->iframe_root = NULL;
+        box->iframe_doc_laid_out = NULL;
     }
 }
 
@@ -634,3 +648,124 @@ layout_box_t* layout_hit_test(layout_box_t *root, int x, int y) {
     if (is_container) return NULL; // Container itself has no size/hit
     return root;
 }
+
+typedef struct {
+    layout_box_t **boxes;
+    rect_t *rects;
+    int *parents;
+    int count;
+    int capacity;
+} box_collector_t;
+
+// Flatten the tree in pre-order with absolute border boxes, each with the
+// position of its nearest collected ancestor (-1 for none). Inline
+// containers are skipped because layout_hit_test never returns them.
+static void collect_boxes(box_collector_t *c, layout_box_t *box, int offset_x, int offset_y, int parent) {
+    if (!box || !box->node || !box->node->style) return;
+
+    int x = box->fragment.border_box.x + offset_x;
+    int y = box->fragment.border_box.y + offset_y;
+
+    int is_container = (box->node->style->display == DISPLAY_INLINE && is_inline_container(box->node->tag_name));
+    if (!is_container) {
+        if (c->count == c->capacity) {
+            int new_cap = c->capacity == 0 ? 256 : c->capacity * 2;
+            layout_box_t **new_boxes = realloc(c->boxes, sizeof(layout_box_t*) * new_cap);
+            rect_t *new_rects = realloc(c->rects, sizeof(rect_t) * new_cap);
+            int *new_parents = realloc(c->parents, sizeof(int) * new_cap);
+            if (new_boxes) c->boxes = new_boxes;
+            if (new_rects) c->rects = new_rects;
+            if (new_parents) c->parents = new_parents;
+            if (!new_boxes || !new_rects || !new_parents) return;
+            c->capacity = new_cap;
+        }
+        c->boxes[c->count] = box;
+        c->parents[c->count] = parent;
+        c->rects[c->count].x = x;
+        c->rects[c->count].y = y;
+        c->rects[c->count].width = box->fragment.border_box.width;
+        c->rects[c->count].height = box->fragment.border_box.height;
+        parent = c->count++;
+    }
+
+    layout_box_t *child = box->first_child;
+    while (child) {
+        collect_boxes(c, child, x, y, parent);
+        child = child->next_sibling;
+    }
+}
+
+layout_index_t* layout_index_create(layout_box_t *root) {
+    if (!root) return NULL;
+    layout_index_t *index = calloc(1, sizeof(layout_index_t));
+    if (!index) return NULL;
+
+    box_collector_t c = {0};
+    collect_boxes(&c, root, 0, 0, -1);
+
+    index->boxes = c.boxes;
+    index->parents = c.parents;
+    index->count = c.count;
+    index->index = spatial_index_create(c.rects, c.count);
+    free(c.rects);
+
+    if (!index->index) {
+        layout_index_free(index);
+        return NULL;
+    }
+    LOG_DEBUG("Layout index built over %d boxes", index->count);
+    return index;
+}
+
+void layout_index_free(layout_index_t *index) {
+    if (!index) return;
+    spatial_index_free(index->index);
+    free(index->boxes);
+    free(index->parents);
+    free(index);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Like layout_hit_test, a box only counts if every ancestor contains the
+// point too: children overflowing their parent are not hit outside it. The
+// boxes containing the point come back in pre-order, so the last one whose
+// ancestors are all among them is the one the tree walk would return.
+layout_box_t* layout_index_hit_test(layout_index_t *index, int x, int y) {
+    if (!index) return NULL;
+    rect_t point = {x, y, 1, 1};
+    int *ids = NULL;
+    int count = spatial_index_query(index->index, point, &ids);
+
+    layout_box_t *hit = NULL;
+    for (int i = count - 1; i >= 0 && !hit; i--) {
+        int ancestor = index->parents[ids[i]];
+        while (ancestor >= 0 && bsearch(&ancestor, ids, i, sizeof(int), compare_ids)) {
+            ancestor = index->parents[ancestor];
+        }
+        if (ancestor < 0) hit = index->boxes[ids[i]];
+    }
+    free(ids);
+    return hit;
+}
+
+int layout_index_query(layout_index_t *index, rect_t area, layout_box_t ***out_boxes) {
+    if (out_boxes) *out_boxes = NULL;
+    if (!index || !out_boxes) return 0;
+
+    int *ids = NULL;
+    int count = spatial_index_query(index->index, area, &ids);
+    if (count == 0) return 0;
+
+    layout_box_t **boxes = malloc(sizeof(layout_box_t*) * count);
+    if (!boxes) {
+        free(ids);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) boxes[i] = index->boxes[ids[i]];
+    free(ids);
+    *out_boxes = boxes;
+    return count;
+}
@@ -94,6 +94,8 @@ typedef struct layout_box_s {
     struct layout_box_s *next_sibling;
 
     struct layout_box_s *iframe_root; // For iframes
+    node_t *iframe_doc_laid_out;      // iframe_doc that iframe_root was built from
+    int iframe_layout_width;          // Content width iframe_root was laid out at
 } layout_box_t;
 
 layout_box_t* layout_create_tree(node_t *root, int container_width);
@@ -104,4 +106,23 @@ void layout_compute(layout_box_t *box, constraint_space_t space);
 
 layout_box_t* layout_hit_test(layout_box_t *root, int x, int y);
 
+// Spatial index over the absolute border boxes of a laid out tree.
+// Built once after layout; answers hit tests and visible-rect queries in
+// logarithmic time instead of walking the whole tree.
+struct spatial_index_s;
+
+typedef struct {
+    layout_box_t **boxes;           // Indexed boxes in paint (pre-)order
+    int *parents;                   // Position of each box's nearest indexed ancestor, -1 for none
+    int count;
+    struct spatial_index_s *index;  // Ids are positions in boxes[]
+} layout_index_t;
+
+layout_index_t* layout_index_create(layout_box_t *root);
+void layout_index_free(layout_index_t *index);
+// Topmost box at absolute document coordinates, matching layout_hit_test
+layout_box_t* layout_index_hit_test(layout_index_t *index, int x, int y);
+// Boxes intersecting an absolute rect, in paint order; *out_boxes must be freed
+int layout_index_query(layout_index_t *index, rect_t area, layout_box_t ***out_boxes);
+
 #endif // LAYOUT_H
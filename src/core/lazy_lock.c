@@ -0,0 +1,42 @@
+#include "lazy_lock.h"
+
+#ifdef _WIN32
+
+void lazy_lock_enter(lazy_lock_t *lock) {
+    if (lock->state != 2) {
+        if (InterlockedCompareExchange(&lock->state, 1, 0) == 0) {
+            InitializeCriticalSection(&lock->section);
+            lock->state = 2;
+        } else {
+            while (lock->state != 2) Sleep(0);
+        }
+    }
+    EnterCriticalSection(&lock->section);
+}
+
+void lazy_lock_leave(lazy_lock_t *lock) {
+    LeaveCriticalSection(&lock->section);
+}
+
+#else
+
+#include <sched.h>
+
+void lazy_lock_enter(lazy_lock_t *lock) {
+    if (lock->state != 2) {
+        if (__sync_bool_compare_and_swap(&lock->state, 0, 1)) {
+            pthread_mutex_init(&lock->mutex, NULL);
+            __sync_synchronize();
+            lock->state = 2;
+        } else {
+            while (lock->state != 2) sched_yield();
+        }
+    }
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void lazy_lock_leave(lazy_lock_t *lock) {
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+#endif
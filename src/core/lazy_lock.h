@@ -0,0 +1,35 @@
+#ifndef LAZY_LOCK_H
+#define LAZY_LOCK_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * Lazily initialized lock
+ *
+ * A CRITICAL_SECTION that needs no init call. A zeroed lazy_lock_t (any
+ * static one) is initialized by whichever thread enters it first; threads
+ * racing that one wait until it is ready. Windows XP has no one-time init
+ * (InitOnceExecuteOnce is Vista+), so module state shared between threads
+ * is guarded with these.
+ *
+ * Elsewhere (the headless build) it is a pthread mutex set up the same way.
+ */
+
+typedef struct {
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+    volatile LONG state;       // 0 = uninitialized, 1 = initializing, 2 = ready
+#else
+    pthread_mutex_t mutex;
+    volatile int state;
+#endif
+} lazy_lock_t;
+
+void lazy_lock_enter(lazy_lock_t *lock);
+void lazy_lock_leave(lazy_lock_t *lock);
+
+#endif // LAZY_LOCK_H
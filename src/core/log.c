@@ -1,6 +1,10 @@
 #include "log.h"
+#include "lazy_lock.h"
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 
 void log_init(void) {
@@ -9,22 +13,37 @@ void log_init(void) {
     setvbuf(stderr, NULL, _IONBF, 0);
 }
 
+// Workers (e.g. the resource loader) log concurrently with the UI thread
+static lazy_lock_t g_log_lock;
+
+static void log_lock(void) {
+    lazy_lock_enter(&g_log_lock);
+}
+
+static void log_unlock(void) {
+    lazy_lock_leave(&g_log_lock);
+}
+
 static char* g_capture_buf = NULL;
 static size_t g_capture_size = 0;
 static size_t g_capture_cap = 0;
 static int g_is_capturing = 0;
 
 void log_capture_start(void) {
+    log_lock();
     if (g_capture_buf) free(g_capture_buf);
     g_capture_buf = malloc(4096);
     g_capture_buf[0] = '\0';
     g_capture_size = 0;
     g_capture_cap = 4096;
     g_is_capturing = 1;
+    log_unlock();
 }
 
 char* log_capture_stop(void) {
+    log_lock();
     g_is_capturing = 0;
+    log_unlock();
     return g_capture_buf; // Caller must NOT free, next start will free it
 }
 
@@ -46,6 +65,7 @@ void log_msg(log_level_t level, const char* format, ...) {
     va_end(args);
 
     if (len > 0) {
+        log_lock();
         // Print to the actual standard streams
         fprintf(out, "[%s] %s\n", level_str, buffer);
         
@@ -59,10 +79,13 @@ void log_msg(log_level_t level, const char* format, ...) {
                 g_capture_size += snprintf(g_capture_buf + g_capture_size, g_capture_cap - g_capture_size, "[%s] %s\n", level_str, buffer);
             }
         }
+        log_unlock();
 
+#ifdef _WIN32
         // Also always output to debug stream (for DebugView/IDE)
         char debug_buffer[1100];
         _snprintf(debug_buffer, sizeof(debug_buffer), "[%s] %s\n", level_str, buffer);
         OutputDebugString(debug_buffer);
+#endif
     }
 }
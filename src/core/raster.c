@@ -0,0 +1,407 @@
+#include "raster.h"
+#include "dom.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <emmintrin.h>
+#define RASTER_HAVE_SSE2 1
+#endif
+
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+#define GLYPH_ADVANCE 6      // Glyph plus one column of spacing
+#define GLYPH_LINE_HEIGHT 9  // Glyph plus descender row and leading
+#define GLYPH_FIRST 0x20
+#define GLYPH_LAST 0x7E
+
+#define IMAGE_PLACEHOLDER_FILL 0xEEEEEE
+#define IMAGE_PLACEHOLDER_FRAME 0x999999
+
+// Classic 5x7 font for printable ASCII: five columns per glyph, bit 0 is the top row
+static const uint8_t g_font5x7[GLYPH_LAST - GLYPH_FIRST + 1][GLYPH_WIDTH] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, // space ! "
+    {0x14,0x7F,0x14,0x7F,0x14}, {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, // # $ %
+    {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00}, {0x00,0x1C,0x22,0x41,0x00}, // & ' (
+    {0x00,0x41,0x22,0x1C,0x00}, {0x08,0x2A,0x1C,0x2A,0x08}, {0x08,0x08,0x3E,0x08,0x08}, // ) * +
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, // , - .
+    {0x20,0x10,0x08,0x04,0x02}, {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, // / 0 1
+    {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4B,0x31}, {0x18,0x14,0x12,0x7F,0x10}, // 2 3 4
+    {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03}, // 5 6 7
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1E}, {0x00,0x36,0x36,0x00,0x00}, // 8 9 :
+    {0x00,0x56,0x36,0x00,0x00}, {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, // ; < =
+    {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06}, {0x32,0x49,0x79,0x41,0x3E}, // > ? @
+    {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22}, // A B C
+    {0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x01,0x01}, // D E F
+    {0x3E,0x41,0x41,0x51,0x32}, {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, // G H I
+    {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41}, {0x7F,0x40,0x40,0x40,0x40}, // J K L
+    {0x7F,0x02,0x04,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E}, // M N O
+    {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, // P Q R
+    {0x46,0x49,0x49,0x49,0x31}, {0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, // S T U
+    {0x1F,0x20,0x40,0x20,0x1F}, {0x7F,0x20,0x18,0x20,0x7F}, {0x63,0x14,0x08,0x14,0x63}, // V W X
+    {0x03,0x04,0x78,0x04,0x03}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7F,0x41,0x41,0x00}, // Y Z [
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7F,0x00}, {0x04,0x02,0x01,0x02,0x04}, // \ ] ^
+    {0x40,0x40,0x40,0x40,0x40}, {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78}, // _ ` a
+    {0x7F,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20}, {0x38,0x44,0x44,0x48,0x7F}, // b c d
+    {0x38,0x54,0x54,0x54,0x18}, {0x08,0x7E,0x09,0x01,0x02}, {0x08,0x14,0x54,0x54,0x3C}, // e f g
+    {0x7F,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7D,0x40,0x00}, {0x20,0x40,0x44,0x3D,0x00}, // h i j
+    {0x00,0x7F,0x10,0x28,0x44}, {0x00,0x41,0x7F,0x40,0x00}, {0x7C,0x04,0x18,0x04,0x78}, // k l m
+    {0x7C,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38}, {0x7C,0x14,0x14,0x14,0x08}, // n o p
+    {0x08,0x14,0x14,0x18,0x7C}, {0x7C,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20}, // q r s
+    {0x04,0x3F,0x44,0x40,0x20}, {0x3C,0x40,0x40,0x20,0x7C}, {0x1C,0x20,0x40,0x20,0x1C}, // t u v
+    {0x3C,0x40,0x30,0x40,0x3C}, {0x44,0x28,0x10,0x28,0x44}, {0x0C,0x50,0x50,0x50,0x3C}, // w x y
+    {0x44,0x64,0x54,0x4C,0x44}, {0x00,0x08,0x36,0x41,0x00}, {0x00,0x00,0x7F,0x00,0x00}, // z { |
+    {0x00,0x41,0x36,0x08,0x00}, {0x02,0x01,0x02,0x04,0x02}                              // } ~
+};
+
+static rect_t intersect_rect(rect_t a, rect_t b) {
+    int x1 = a.x > b.x ? a.x : b.x;
+    int y1 = a.y > b.y ? a.y : b.y;
+    int x2 = (a.x + a.width) < (b.x + b.width) ? (a.x + a.width) : (b.x + b.width);
+    int y2 = (a.y + a.height) < (b.y + b.height) ? (a.y + a.height) : (b.y + b.height);
+    rect_t r = {x1, y1, x2 > x1 ? x2 - x1 : 0, y2 > y1 ? y2 - y1 : 0};
+    return r;
+}
+
+static void fill_span_scalar(uint32_t *dst, int count, uint32_t pixel) {
+    while (count-- > 0) *dst++ = pixel;
+}
+
+#ifdef RASTER_HAVE_SSE2
+// Compiled for SSE2 whatever the build targets (plain i686, so XP machines
+// without it still run) and only called once the CPU is known to have it
+__attribute__((target("sse2"))) static void fill_span_sse2(uint32_t *dst, int count, uint32_t pixel) {
+    // Align to 16 bytes, then write four pixels per store
+    while (count > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = pixel;
+        count--;
+    }
+    __m128i v = _mm_set1_epi32((int)pixel);
+    for (; count >= 4; count -= 4, dst += 4) {
+        _mm_store_si128((__m128i *)dst, v);
+    }
+    while (count-- > 0) *dst++ = pixel;
+}
+#endif
+
+static void (*g_fill_span)(uint32_t *dst, int count, uint32_t pixel) = NULL;
+
+// Picked on first use; threads racing here all pick the same one
+static void fill_span(uint32_t *dst, int count, uint32_t pixel) {
+    if (!g_fill_span) {
+        g_fill_span = fill_span_scalar;
+#ifdef RASTER_HAVE_SSE2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) g_fill_span = fill_span_sse2;
+#endif
+        LOG_DEBUG("Raster: %s span fills", g_fill_span == fill_span_scalar ? "scalar" : "SSE2");
+    }
+    g_fill_span(dst, count, pixel);
+}
+
+raster_surface_t* raster_surface_create(int width, int height) {
+    if (width <= 0 || height <= 0) return NULL;
+    raster_surface_t *surface = calloc(1, sizeof(raster_surface_t));
+    if (!surface) return NULL;
+
+    surface->pixels = malloc(sizeof(uint32_t) * (size_t)width * height);
+    if (!surface->pixels) {
+        LOG_ERROR("Raster surface allocation failed (%dx%d)", width, height);
+        free(surface);
+        return NULL;
+    }
+    surface->width = width;
+    surface->height = height;
+    surface->stride = width;
+    surface->clip.width = width;
+    surface->clip.height = height;
+    return surface;
+}
+
+void raster_surface_free(raster_surface_t *surface) {
+    if (!surface) return;
+    free(surface->pixels);
+    free(surface);
+}
+
+void raster_clear(raster_surface_t *surface, uint32_t color) {
+    if (!surface) return;
+    uint32_t pixel = 0xFF000000u | (color & 0xFFFFFF);
+    for (int y = 0; y < surface->height; y++) {
+        fill_span(surface->pixels + (size_t)y * surface->stride, surface->width, pixel);
+    }
+}
+
+void raster_fill_rect(raster_surface_t *surface, int x, int y, int w, int h, uint32_t color) {
+    if (!surface || w <= 0 || h <= 0) return;
+    rect_t r = {x, y, w, h};
+    r = intersect_rect(r, surface->clip);
+    if (r.width <= 0 || r.height <= 0) return;
+
+    uint32_t pixel = 0xFF000000u | (color & 0xFFFFFF);
+    uint32_t *row = surface->pixels + (size_t)r.y * surface->stride + r.x;
+    for (int i = 0; i < r.height; i++, row += surface->stride) {
+        fill_span(row, r.width, pixel);
+    }
+}
+
+void raster_push_clip(raster_surface_t *surface, rect_t rect) {
+    if (!surface) return;
+    if (surface->clip_depth == RASTER_MAX_CLIP_DEPTH) {
+        surface->overflow_depth++;
+        return;
+    }
+    surface->clip_stack[surface->clip_depth++] = surface->clip;
+    surface->clip = intersect_rect(surface->clip, rect);
+}
+
+void raster_pop_clip(raster_surface_t *surface) {
+    if (!surface) return;
+    if (surface->overflow_depth > 0) {
+        surface->overflow_depth--;
+    } else if (surface->clip_depth > 0) {
+        surface->clip = surface->clip_stack[--surface->clip_depth];
+    }
+}
+
+// --- Text ---
+
+static int font_scale(const style_t *style) {
+    int size = style ? style->font_size : 16;
+    int scale = (size + 4) / 8;
+    return scale < 1 ? 1 : scale;
+}
+
+// Bytes in the UTF-8 sequence starting at p; every sequence is drawn as one glyph
+static int glyph_bytes(const char *p) {
+    unsigned char c = (unsigned char)*p;
+    int n = 1;
+    if (c >= 0xC0) {
+        while (n < 4 && ((unsigned char)p[n] & 0xC0) == 0x80) n++;
+    }
+    return n;
+}
+
+typedef struct {
+    const char *start;
+    int bytes;
+    int glyphs;
+} text_line_t;
+
+// Take the next line from *pos, wrapping at spaces after max_glyphs (0 = only at
+// newlines). Words longer than a line overflow it rather than being split,
+// matching DrawText's DT_WORDBREAK.
+static int next_line(const char **pos, int max_glyphs, text_line_t *line) {
+    const char *p = *pos;
+    if (!*p) return 0;
+
+    line->start = p;
+    line->glyphs = 0;
+    const char *brk = NULL;
+    int brk_glyphs = 0;
+
+    while (*p && *p != '\n') {
+        if (*p == ' ') {
+            brk = p;
+            brk_glyphs = line->glyphs;
+        } else if (max_glyphs > 0 && line->glyphs >= max_glyphs && brk) {
+            line->bytes = (int)(brk - line->start);
+            line->glyphs = brk_glyphs;
+            while (line->bytes > 0 && line->start[line->bytes - 1] == ' ') {
+                line->bytes--;
+                line->glyphs--;
+            }
+            p = brk;
+            while (*p == ' ') p++;
+            *pos = p;
+            return 1;
+        }
+        p += glyph_bytes(p);
+        line->glyphs++;
+    }
+
+    line->bytes = (int)(p - line->start);
+    if (*p == '\n') p++;
+    *pos = p;
+    return 1;
+}
+
+void raster_measure_text(const char *text, style_t *style, int width_constraint, int *out_width, int *out_height, int *out_baseline) {
+    if (!text || !out_width || !out_height) return;
+
+    int scale = font_scale(style);
+    int advance = GLYPH_ADVANCE * scale;
+    int max_glyphs = width_constraint > 0 ? width_constraint / advance : 0;
+    if (width_constraint > 0 && max_glyphs < 1) max_glyphs = 1;
+
+    int lines = 0;
+    int widest = 0;
+    text_line_t line;
+    const char *pos = text;
+    while (next_line(&pos, max_glyphs, &line)) {
+        if (line.glyphs > widest) widest = line.glyphs;
+        lines++;
+    }
+    if (lines == 0) lines = 1;
+
+    *out_width = widest * advance;
+    *out_height = lines * GLYPH_LINE_HEIGHT * scale;
+    if (out_baseline) *out_baseline = GLYPH_HEIGHT * scale;
+}
+
+static void draw_glyph(raster_surface_t *surface, int x, int y, int scale, const char *p, uint32_t color) {
+    unsigned char c = (unsigned char)*p;
+    if (c < GLYPH_FIRST) c = ' ';
+    if (c > GLYPH_LAST) c = '?'; // Outside the built-in font
+    const uint8_t *cols = g_font5x7[c - GLYPH_FIRST];
+
+    // Emit each run of set pixels in a glyph row as one span fill
+    for (int row = 0; row < GLYPH_HEIGHT; row++) {
+        int col = 0;
+        while (col < GLYPH_WIDTH) {
+            if (!((cols[col] >> row) & 1)) {
+                col++;
+                continue;
+            }
+            int run = col;
+            while (run < GLYPH_WIDTH && ((cols[run] >> row) & 1)) run++;
+            raster_fill_rect(surface, x + col * scale, y + row * scale, (run - col) * scale, scale, color);
+            col = run;
+        }
+    }
+}
+
+static void draw_text_line(raster_surface_t *surface, const text_line_t *line, int x, int y, const style_t *style) {
+    int scale = font_scale(style);
+    int advance = GLYPH_ADVANCE * scale;
+    uint32_t color = style ? style->color : 0;
+    int bold = style && style->font_weight >= 700;
+
+    const char *p = line->start;
+    const char *end = line->start + line->bytes;
+    int pen = x;
+    while (p < end) {
+        draw_glyph(surface, pen, y, scale, p, color);
+        if (bold) draw_glyph(surface, pen + 1, y, scale, p, color);
+        p += glyph_bytes(p);
+        pen += advance;
+    }
+
+    if (style && style->text_decoration == TEXT_DECORATION_UNDERLINE) {
+        raster_fill_rect(surface, x, y + GLYPH_HEIGHT * scale, pen - x, scale, color);
+    } else if (style && style->text_decoration == TEXT_DECORATION_LINE_THROUGH) {
+        raster_fill_rect(surface, x, y + (GLYPH_HEIGHT / 2) * scale, pen - x, scale, color);
+    }
+}
+
+static void draw_text_op(raster_surface_t *surface, const dl_op_t *op, const char *text, int x, int y, int w, int h) {
+    style_t *style = op->node ? op->node->style : NULL;
+    int single_line = (op->text_flags & DL_TEXT_INPUT_VALUE) != 0;
+
+    int scale = font_scale(style);
+    int advance = GLYPH_ADVANCE * scale;
+    int line_height = GLYPH_LINE_HEIGHT * scale;
+
+    // DrawText clips to its rect
+    rect_t r = {x, y, w, h};
+    raster_push_clip(surface, r);
+
+    text_line_t line;
+    const char *pos = text;
+    if (single_line) {
+        if (next_line(&pos, 0, &line)) {
+            int line_x = x;
+            int line_width = line.glyphs * advance;
+            if (style && style->text_align == TEXT_ALIGN_CENTER) line_x = x + (w - line_width) / 2;
+            else if (style && style->text_align == TEXT_ALIGN_RIGHT) line_x = x + w - line_width;
+            draw_text_line(surface, &line, line_x, y + (h - line_height) / 2, style);
+        }
+    } else {
+        int max_glyphs = w / advance;
+        if (max_glyphs < 1) max_glyphs = 1;
+        int line_y = y;
+        while (line_y < y + h && next_line(&pos, max_glyphs, &line)) {
+            draw_text_line(surface, &line, x, line_y, style);
+            line_y += line_height;
+        }
+    }
+
+    raster_pop_clip(surface);
+}
+
+// --- Display list backend ---
+
+typedef struct {
+    dl_backend_t base;
+    raster_surface_t *surface;
+} raster_backend_t;
+
+static void backend_fill_rect(dl_backend_t *backend, int x, int y, int w, int h, uint32_t color) {
+    raster_fill_rect(((raster_backend_t *)backend)->surface, x, y, w, h, color);
+}
+
+static void backend_draw_text(dl_backend_t *backend, const dl_op_t *op, const char *text, int x, int y, int w, int h) {
+    draw_text_op(((raster_backend_t *)backend)->surface, op, text, x, y, w, h);
+}
+
+static void backend_draw_image(dl_backend_t *backend, const dl_op_t *op, int x, int y, int w, int h) {
+    raster_surface_t *surface = ((raster_backend_t *)backend)->surface;
+    (void)op;
+    raster_fill_rect(surface, x, y, w, h, IMAGE_PLACEHOLDER_FILL);
+    raster_fill_rect(surface, x, y, w, 1, IMAGE_PLACEHOLDER_FRAME);
+    raster_fill_rect(surface, x, y + h - 1, w, 1, IMAGE_PLACEHOLDER_FRAME);
+    raster_fill_rect(surface, x, y, 1, h, IMAGE_PLACEHOLDER_FRAME);
+    raster_fill_rect(surface, x + w - 1, y, 1, h, IMAGE_PLACEHOLDER_FRAME);
+}
+
+static void backend_push_clip(dl_backend_t *backend, int x, int y, int w, int h) {
+    rect_t r = {x, y, w, h};
+    raster_push_clip(((raster_backend_t *)backend)->surface, r);
+}
+
+static void backend_pop_clip(dl_backend_t *backend) {
+    raster_pop_clip(((raster_backend_t *)backend)->surface);
+}
+
+void raster_render_display_list(raster_surface_t *surface, display_list_t *list, int offset_x, int offset_y, const rect_t *dirty) {
+    if (!surface || !list) return;
+    raster_backend_t backend = {
+        {backend_fill_rect, backend_draw_text, backend_draw_image, backend_push_clip, backend_pop_clip, surface->focused_node},
+        surface
+    };
+    display_list_replay(list, &backend.base, offset_x, offset_y, dirty);
+}
+
+void raster_render_tree(raster_surface_t *surface, layout_box_t *box, int offset_x, int offset_y) {
+    display_list_t *list = display_list_build(box);
+    if (!list) return;
+    raster_render_display_list(surface, list, offset_x, offset_y, NULL);
+    display_list_free(list);
+}
+
+int raster_write_ppm(raster_surface_t *surface, const char *path) {
+    if (!surface || !path) return 0;
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERROR("Failed to open %s for writing", path);
+        return 0;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", surface->width, surface->height);
+    unsigned char *row = malloc((size_t)surface->width * 3);
+    int ok = row != NULL;
+    for (int y = 0; ok && y < surface->height; y++) {
+        const uint32_t *src = surface->pixels + (size_t)y * surface->stride;
+        for (int x = 0; x < surface->width; x++) {
+            row[x * 3] = (src[x] >> 16) & 0xFF;
+            row[x * 3 + 1] = (src[x] >> 8) & 0xFF;
+            row[x * 3 + 2] = src[x] & 0xFF;
+        }
+        if (fwrite(row, 3, surface->width, f) != (size_t)surface->width) ok = 0;
+    }
+    free(row);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) LOG_ERROR("Failed to write %s", path);
+    return ok;
+}
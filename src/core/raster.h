@@ -0,0 +1,66 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include "layout.h"
+#include "display_list.h"
+
+/*
+ * Software Rasterizer
+ *
+ * The software backend of display_list_replay (GDI, behind
+ * render_display_list, is the other). It draws into a 32-bit framebuffer
+ * held in memory and makes no GDI calls, so pages can be painted without a
+ * window for paint benchmarks and for tests that check pixels.
+ *
+ * - Pixels are 0xAARRGGBB words, i.e. B, G, R, A bytes on little-endian
+ *   machines, the same layout as a 32bpp DIB section.
+ * - Fills are opaque span writes, with SSE2 stores when the CPU has them.
+ * - Clip push/pop is a stack of rectangles intersected with the surface.
+ * - Text uses a built-in 5x7 bitmap font scaled by integer factors from the
+ *   computed font size; raster_measure_text reports the same metrics so a
+ *   headless build can use it for layout.
+ * - Images are not decoded; their rect is drawn as a placeholder frame.
+ */
+
+#define RASTER_MAX_CLIP_DEPTH 32
+
+typedef struct {
+    uint32_t *pixels;
+    int width;
+    int height;
+    int stride;                           // In pixels
+    rect_t clip;                          // Current effective clip
+    rect_t clip_stack[RASTER_MAX_CLIP_DEPTH];
+    int clip_depth;
+    int overflow_depth;                   // Pushes past RASTER_MAX_CLIP_DEPTH, ignored
+    node_t *focused_node;                 // Border drawn in the focus colour, like g_focused_node
+} raster_surface_t;
+
+raster_surface_t* raster_surface_create(int width, int height);
+void raster_surface_free(raster_surface_t *surface);
+
+// Fill the whole surface (ignores the clip) with 0xRRGGBB
+void raster_clear(raster_surface_t *surface, uint32_t color);
+
+// Opaque fill of a rect in surface coordinates, clipped
+void raster_fill_rect(raster_surface_t *surface, int x, int y, int w, int h, uint32_t color);
+
+// Clip stack, rects in surface coordinates
+void raster_push_clip(raster_surface_t *surface, rect_t rect);
+void raster_pop_clip(raster_surface_t *surface);
+
+// Same semantics as platform_measure_text, for the built-in font
+void raster_measure_text(const char *text, style_t *style, int width_constraint, int *out_width, int *out_height, int *out_baseline);
+
+// The software backend of display_list_replay, and the counterparts of
+// render_display_list / render_tree. dirty is in surface coordinates; NULL
+// repaints everything.
+void raster_render_display_list(raster_surface_t *surface, display_list_t *list, int offset_x, int offset_y, const rect_t *dirty);
+void raster_render_tree(raster_surface_t *surface, layout_box_t *box, int offset_x, int offset_y);
+
+// Write the surface as a binary PPM (P6), e.g. to look at a failed pixel
+// comparison. Returns 1 on success, 0 on failure.
+int raster_write_ppm(raster_surface_t *surface, const char *path);
+
+#endif // RASTER_H
@@ -0,0 +1,137 @@
+#include "spatial_index.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_entries(const void *a, const void *b) {
+    const spatial_entry_t *ea = (const spatial_entry_t *)a;
+    const spatial_entry_t *eb = (const spatial_entry_t *)b;
+    if (ea->rect.y != eb->rect.y) return ea->rect.y < eb->rect.y ? -1 : 1;
+    return ea->id - eb->id;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Fill max_bottom for the implicit subtree covering entries[lo, hi)
+static int build_max_bottom(spatial_index_t *index, int lo, int hi) {
+    if (lo >= hi) return -(1 << 30);
+    int mid = lo + (hi - lo) / 2;
+    int bottom = index->entries[mid].rect.y + index->entries[mid].rect.height;
+    int left = build_max_bottom(index, lo, mid);
+    int right = build_max_bottom(index, mid + 1, hi);
+    if (left > bottom) bottom = left;
+    if (right > bottom) bottom = right;
+    index->max_bottom[mid] = bottom;
+    return bottom;
+}
+
+spatial_index_t* spatial_index_create(const rect_t *rects, int count) {
+    spatial_index_t *index = calloc(1, sizeof(spatial_index_t));
+    if (!index) return NULL;
+    if (!rects || count <= 0) return index;
+
+    index->entries = malloc(sizeof(spatial_entry_t) * count);
+    index->max_bottom = malloc(sizeof(int) * count);
+    if (!index->entries || !index->max_bottom) {
+        LOG_ERROR("Spatial index allocation failed (%d entries)", count);
+        spatial_index_free(index);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (rects[i].width <= 0 || rects[i].height <= 0) continue;
+        index->entries[index->count].rect = rects[i];
+        index->entries[index->count].id = i;
+        index->count++;
+    }
+
+    qsort(index->entries, index->count, sizeof(spatial_entry_t), compare_entries);
+    build_max_bottom(index, 0, index->count);
+    return index;
+}
+
+void spatial_index_free(spatial_index_t *index) {
+    if (!index) return;
+    free(index->entries);
+    free(index->max_bottom);
+    free(index);
+}
+
+static int intersects(rect_t a, rect_t b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+typedef struct {
+    int *ids;
+    int count;
+    int capacity;
+} id_list_t;
+
+static void id_list_add(id_list_t *list, int id) {
+    if (list->count == list->capacity) {
+        int new_cap = list->capacity == 0 ? 32 : list->capacity * 2;
+        int *new_ids = realloc(list->ids, sizeof(int) * new_cap);
+        if (!new_ids) return;
+        list->ids = new_ids;
+        list->capacity = new_cap;
+    }
+    list->ids[list->count++] = id;
+}
+
+static void query_range(const spatial_index_t *index, int lo, int hi, rect_t area, id_list_t *out) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        // Nothing in this subtree reaches down into the area
+        if (index->max_bottom[mid] <= area.y) return;
+
+        query_range(index, lo, mid, area, out);
+
+        // Entries from mid onwards start at or below the area's bottom edge
+        const spatial_entry_t *e = &index->entries[mid];
+        if (e->rect.y >= area.y + area.height) return;
+        if (intersects(e->rect, area)) id_list_add(out, e->id);
+
+        // Continue with the right subtree iteratively
+        lo = mid + 1;
+    }
+}
+
+int spatial_index_query(const spatial_index_t *index, rect_t area, int **out_ids) {
+    if (out_ids) *out_ids = NULL;
+    if (!index || !out_ids || area.width <= 0 || area.height <= 0) return 0;
+
+    id_list_t result = {0};
+    query_range(index, 0, index->count, area, &result);
+    if (result.count > 1) qsort(result.ids, result.count, sizeof(int), compare_ids);
+    *out_ids = result.ids;
+    return result.count;
+}
+
+static void hit_range(const spatial_index_t *index, int lo, int hi, int x, int y, int *best) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->max_bottom[mid] <= y) return;
+
+        hit_range(index, lo, mid, x, y, best);
+
+        const spatial_entry_t *e = &index->entries[mid];
+        if (e->rect.y > y) return;
+        if (e->id > *best &&
+            x >= e->rect.x && x < e->rect.x + e->rect.width &&
+            y >= e->rect.y && y < e->rect.y + e->rect.height) {
+            *best = e->id;
+        }
+
+        lo = mid + 1;
+    }
+}
+
+int spatial_index_hit_test(const spatial_index_t *index, int x, int y) {
+    if (!index) return -1;
+    int best = -1;
+    hit_range(index, 0, index->count, x, y, &best);
+    return best;
+}
@@ -0,0 +1,42 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "layout.h"
+
+/*
+ * Spatial Index
+ *
+ * A static index over axis-aligned rectangles, built once after layout.
+ * Entries are sorted by their top edge and stored as an implicit balanced
+ * binary tree (the middle element of every range is that range's root).
+ * Each tree node also records the largest bottom edge in its subtree, so a
+ * query can skip any subtree that ends above the area of interest or starts
+ * below it. Queries cost O(log n + k) for k results.
+ *
+ * Ids are the caller's array indices; callers use them as paint order, so
+ * the highest id under a point is the topmost box.
+ */
+
+typedef struct {
+    rect_t rect;
+    int id;
+} spatial_entry_t;
+
+typedef struct spatial_index_s {
+    spatial_entry_t *entries; // Sorted by rect.y
+    int *max_bottom;          // Per implicit tree node: max(y + height) in its subtree
+    int count;
+} spatial_index_t;
+
+// Build an index over rects[0..count); empty rectangles are not indexed
+spatial_index_t* spatial_index_create(const rect_t *rects, int count);
+void spatial_index_free(spatial_index_t *index);
+
+// Collect ids of rectangles intersecting area, in ascending id order.
+// Returns the number of ids; *out_ids must be freed by the caller (NULL if none).
+int spatial_index_query(const spatial_index_t *index, rect_t area, int **out_ids);
+
+// Highest id whose rectangle contains (x, y), or -1
+int spatial_index_hit_test(const spatial_index_t *index, int x, int y);
+
+#endif // SPATIAL_INDEX_H
@@ -0,0 +1,107 @@
+#include "core/html.h"
+#include "core/style.h"
+#include "core/layout.h"
+#include "core/display_list.h"
+#include "core/raster.h"
+#include "core/platform.h"
+#include "core/cache.h"
+#include "core/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Headless renderer (make headless)
+ *
+ * Paints an HTML file through the software rasterizer and writes it as a
+ * PPM, with no window, GDI or network. Built with the host compiler from
+ * the portable part of src/core, so paint changes can be checked and
+ * benchmarked on any machine:
+ *
+ *   gem32-raster page.html out.ppm [width]
+ *
+ * Text is laid out and drawn with the rasterizer's built-in font, and
+ * images are placeholder frames (nothing is fetched).
+ */
+
+#define HEADLESS_DEFAULT_WIDTH 800
+#define HEADLESS_MAX_HEIGHT 16384
+
+// Layout measures text with the font the rasterizer draws
+void platform_measure_text(const char *text, style_t *style, int width_constraint, int *out_width, int *out_height, int *out_baseline) {
+    raster_measure_text(text, style, width_constraint, out_width, out_height, out_baseline);
+}
+
+// Shared cache buffers only come from the disk cache, which is not linked
+// in, so DOM nodes never hold one here
+cache_buffer_t* cache_buffer_retain(cache_buffer_t *buffer) {
+    return buffer;
+}
+
+void cache_buffer_release(cache_buffer_t *buffer) {
+    (void)buffer;
+}
+
+static char* read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    size_t cap = 65536, len = 0;
+    char *data = malloc(cap);
+    while (data) {
+        len += fread(data + len, 1, cap - len - 1, f);
+        if (len < cap - 1) break;
+        char *grown = realloc(data, cap * 2);
+        if (!grown) { free(data); data = NULL; break; }
+        data = grown;
+        cap *= 2;
+    }
+    if (data) data[len] = '\0';
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s page.html out.ppm [width]\n", argv[0]);
+        return 2;
+    }
+    int width = argc > 3 ? atoi(argv[3]) : HEADLESS_DEFAULT_WIDTH;
+    if (width <= 0) width = HEADLESS_DEFAULT_WIDTH;
+
+    log_init();
+    char *html = read_file(argv[1]);
+    if (!html) {
+        LOG_ERROR("Failed to read %s", argv[1]);
+        return 1;
+    }
+
+    node_t *dom = html_parse(html);
+    free(html);
+    if (!dom) {
+        LOG_ERROR("Failed to parse %s", argv[1]);
+        return 1;
+    }
+    style_compute(dom);
+    layout_box_t *layout = layout_create_tree(dom, width);
+    display_list_t *list = layout ? display_list_build(layout) : NULL;
+
+    int height = layout ? layout->fragment.border_box.height : 0;
+    if (height < 1) height = 1;
+    if (height > HEADLESS_MAX_HEIGHT) height = HEADLESS_MAX_HEIGHT;
+    raster_surface_t *surface = list ? raster_surface_create(width, height) : NULL;
+
+    int ok = 0;
+    if (surface) {
+        raster_clear(surface, 0xFFFFFF);
+        raster_render_display_list(surface, list, 0, 0, NULL);
+        ok = raster_write_ppm(surface, argv[2]);
+        if (ok) LOG_INFO("Wrote %dx%d (%d ops) to %s", width, height, list->count, argv[2]);
+    } else {
+        LOG_ERROR("Failed to lay out %s", argv[1]);
+    }
+
+    raster_surface_free(surface);
+    display_list_free(list);
+    layout_free(layout);
+    node_free(dom);
+    return ok ? 0 : 1;
+}
@@ -1,7 +1,11 @@
 #include "ui/window.h"
 #include "ui/render.h"
+#include "ui/navigator.h"
 #include "core/log.h"
 #include "core/cache.h"
+#include "network/conn_pool.h"
+#include "network/dns_cache.h"
+#include "network/http_cache.h"
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     (void)hPrevInstance;
@@ -26,8 +30,20 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         DispatchMessage(&msg);
     }
 
-    render_cleanup();
+    // The caches are locked throughout, so queued stores are flushed and the
+    // index closed clean even if the worker is stuck; its connections, TLS
+    // state and fonts are left to process exit in that case
+    int worker_stopped = nav_shutdown();
+    http_cache_log_stats();
+    cache_log_stats();
     cache_cleanup();
+    if (!worker_stopped) return msg.wParam;
+    render_cleanup();
+    conn_pool_log_stats();
+    conn_pool_clear();
+    tls_log_stats();
+    tls_cleanup();
+    dns_cache_log_stats();
 
     return msg.wParam;
 }
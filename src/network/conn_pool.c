@@ -0,0 +1,183 @@
+#include "conn_pool.h"
+#include "core/log.h"
+#include "core/lazy_lock.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct idle_conn_s {
+    char host[256];
+    int port;
+    tls_connection_t *conn;
+    DWORD idle_since;
+    struct idle_conn_s *next;
+} idle_conn_t;
+
+static idle_conn_t *g_idle = NULL; // Most recently released first
+static conn_pool_stats_t g_stats = {0, 0, 0, 0};
+static DWORD g_idle_timeout = CONN_POOL_IDLE_TIMEOUT_MS;
+
+static lazy_lock_t g_pool_lock;
+
+static void pool_lock(void) {
+    lazy_lock_enter(&g_pool_lock);
+}
+
+static void pool_unlock(void) {
+    lazy_lock_leave(&g_pool_lock);
+}
+
+// An idle HTTP connection must have nothing to read: readable means the
+// server closed it (or sent something we never asked for)
+static int connection_is_idle(tls_connection_t *conn) {
+    if (SSL_pending(conn->ssl) > 0) return 0;
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(conn->socket, &readable);
+    struct timeval timeout = {0, 0};
+    return select((int)conn->socket + 1, &readable, NULL, NULL, &timeout) == 0;
+}
+
+// Unlink idle connections past the timeout; the caller closes them outside the lock
+static idle_conn_t* take_expired(DWORD now) {
+    idle_conn_t *expired = NULL;
+    idle_conn_t **link = &g_idle;
+    while (*link) {
+        idle_conn_t *entry = *link;
+        if (now - entry->idle_since > g_idle_timeout) {
+            *link = entry->next;
+            entry->next = expired;
+            expired = entry;
+            g_stats.expired++;
+        } else {
+            link = &entry->next;
+        }
+    }
+    return expired;
+}
+
+static void close_entries(idle_conn_t *entry) {
+    while (entry) {
+        idle_conn_t *next = entry->next;
+        tls_close(entry->conn);
+        free(entry);
+        entry = next;
+    }
+}
+
+tls_connection_t* conn_pool_acquire(const char *host, int port, int *out_reused) {
+    if (out_reused) *out_reused = 0;
+
+    for (;;) {
+        pool_lock();
+        idle_conn_t *expired = take_expired(GetTickCount());
+        idle_conn_t *found = NULL;
+        idle_conn_t **link = &g_idle;
+        while (*link) {
+            if ((*link)->port == port && strcasecmp((*link)->host, host) == 0) {
+                found = *link;
+                *link = found->next;
+                break;
+            }
+            link = &(*link)->next;
+        }
+        pool_unlock();
+        close_entries(expired);
+
+        if (!found) break;
+
+        tls_connection_t *conn = found->conn;
+        free(found);
+        if (connection_is_idle(conn)) {
+            pool_lock();
+            g_stats.reused++;
+            pool_unlock();
+            if (out_reused) *out_reused = 1;
+            LOG_DEBUG("Reusing pooled connection to %s:%d", host, port);
+            return conn;
+        }
+
+        LOG_DEBUG("Pooled connection to %s:%d was closed by the server", host, port);
+        pool_lock();
+        g_stats.expired++;
+        pool_unlock();
+        tls_close(conn);
+    }
+
+    tls_connection_t *conn = tls_connect(host, port);
+    if (conn) {
+        pool_lock();
+        g_stats.opened++;
+        pool_unlock();
+    }
+    return conn;
+}
+
+void conn_pool_release(tls_connection_t *conn, const char *host, int port, int reusable) {
+    if (!conn) return;
+    if (!reusable) {
+        tls_close(conn);
+        return;
+    }
+
+    idle_conn_t *entry = calloc(1, sizeof(idle_conn_t));
+    if (!entry) {
+        tls_close(conn);
+        return;
+    }
+    strncpy(entry->host, host, sizeof(entry->host) - 1);
+    entry->port = port;
+    entry->conn = conn;
+    entry->idle_since = GetTickCount();
+
+    pool_lock();
+    int count = 0;
+    for (idle_conn_t *e = g_idle; e; e = e->next) {
+        if (e->port == port && strcasecmp(e->host, host) == 0) count++;
+    }
+    if (count < CONN_POOL_MAX_IDLE_PER_HOST) {
+        entry->next = g_idle;
+        g_idle = entry;
+        entry = NULL;
+    } else {
+        g_stats.expired++;
+    }
+    pool_unlock();
+
+    // Over the per-host limit
+    if (entry) close_entries(entry);
+}
+
+void conn_pool_note_retry(void) {
+    pool_lock();
+    g_stats.retried++;
+    pool_unlock();
+}
+
+void conn_pool_set_idle_timeout(unsigned long ms) {
+    pool_lock();
+    g_idle_timeout = (DWORD)ms;
+    pool_unlock();
+}
+
+void conn_pool_clear(void) {
+    pool_lock();
+    idle_conn_t *all = g_idle;
+    g_idle = NULL;
+    pool_unlock();
+    close_entries(all);
+}
+
+void conn_pool_get_stats(conn_pool_stats_t *out) {
+    if (!out) return;
+    pool_lock();
+    *out = g_stats;
+    pool_unlock();
+}
+
+void conn_pool_log_stats(void) {
+    conn_pool_stats_t stats;
+    conn_pool_get_stats(&stats);
+    LOG_INFO("Connection pool: %lu opened, %lu reused, %lu stale retries, %lu closed idle",
+             stats.opened, stats.reused, stats.retried, stats.expired);
+}
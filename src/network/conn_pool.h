@@ -0,0 +1,50 @@
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+
+#include "tls.h"
+
+/*
+ * Keep-alive Connection Pool
+ *
+ * Idle TLS connections left open by HTTP/1.1 persistent responses, keyed by
+ * host and port. Fetches take a pooled connection when one is available and
+ * hand it back once the response has been fully delimited, so later requests
+ * to the same origin skip the TCP and TLS handshakes.
+ *
+ * Idle connections are closed after CONN_POOL_IDLE_TIMEOUT_MS (adjustable
+ * with conn_pool_set_idle_timeout) and at most
+ * CONN_POOL_MAX_IDLE_PER_HOST are kept per origin. A pooled connection the
+ * server has already closed is detected on acquire when possible; callers
+ * still retry once on a fresh connection if a reused one fails before any
+ * response bytes arrive. All functions are thread-safe.
+ */
+
+#define CONN_POOL_MAX_IDLE_PER_HOST 6
+#define CONN_POOL_IDLE_TIMEOUT_MS 30000
+
+typedef struct {
+    unsigned long opened;     // New connections (full TCP + TLS setup)
+    unsigned long reused;     // Requests served on a pooled connection
+    unsigned long retried;    // Reused connections that turned out stale mid-request
+    unsigned long expired;    // Idle connections closed by timeout, limit or staleness
+} conn_pool_stats_t;
+
+// Returns a pooled connection (*out_reused = 1) or a newly connected one
+tls_connection_t* conn_pool_acquire(const char *host, int port, int *out_reused);
+
+// Return a connection after a fully read response; closes it unless reusable
+void conn_pool_release(tls_connection_t *conn, const char *host, int port, int reusable);
+
+// Record a stale reused connection (the caller closes it and retries)
+void conn_pool_note_retry(void);
+
+// How long a connection may sit idle before it is closed instead of reused
+void conn_pool_set_idle_timeout(unsigned long ms);
+
+// Close every idle connection
+void conn_pool_clear(void);
+
+void conn_pool_get_stats(conn_pool_stats_t *out);
+void conn_pool_log_stats(void);
+
+#endif // CONN_POOL_H
@@ -0,0 +1,121 @@
+#include "content_decoder.h"
+#include "core/log.h"
+#include <string.h>
+
+#define DECODE_CHUNK 16384
+
+content_coding_t content_coding_from_header(const char *value) {
+    if (!value) return CONTENT_CODING_NONE;
+    while (*value == ' ' || *value == '\t') value++;
+    if (strncasecmp(value, "gzip", 4) == 0 || strncasecmp(value, "x-gzip", 6) == 0) return CONTENT_CODING_GZIP;
+    if (strncasecmp(value, "deflate", 7) == 0) return CONTENT_CODING_DEFLATE;
+    return CONTENT_CODING_NONE;
+}
+
+// RFC 1950 header: CM = 8, window <= 32K, and the check bits make it a multiple of 31
+static int looks_like_zlib(const unsigned char *data, size_t len) {
+    if (len < 1 || (data[0] & 0x0f) != 8 || (data[0] >> 4) > 7) return 0;
+    return len < 2 || ((data[0] << 8) | data[1]) % 31 == 0;
+}
+
+static int decoder_on_headers(network_sink_t *sink, int status_code, const char *content_type, long long content_length) {
+    content_decoder_t *d = (content_decoder_t *)sink;
+    (void)content_length; // Compressed size; the decoded size is unknown
+    return d->target->on_headers(d->target, status_code, content_type, -1);
+}
+
+static int decoder_fail(content_decoder_t *d, const char *reason) {
+    LOG_WARN("Content decoding failed after %lu -> %lu bytes: %s",
+             (unsigned long)d->in_total, (unsigned long)d->out_total, reason);
+    d->failed = 1;
+    return 0;
+}
+
+static int decoder_on_data(network_sink_t *sink, const char *data, size_t len) {
+    content_decoder_t *d = (content_decoder_t *)sink;
+    if (d->failed) return 0;
+    if (d->trailing || len == 0) return 1;
+    if (d->finished) {
+        // Only gzip allows more after the end: the next member
+        if (d->coding != CONTENT_CODING_GZIP) return 1;
+        inflateReset(&d->zs);
+        d->finished = 0;
+    }
+
+    if (!d->started) {
+        int window_bits = MAX_WBITS + 16; // gzip wrapper
+        if (d->coding == CONTENT_CODING_DEFLATE) {
+            window_bits = looks_like_zlib((const unsigned char *)data, len) ? MAX_WBITS : -MAX_WBITS;
+        }
+        if (inflateInit2(&d->zs, window_bits) != Z_OK) return decoder_fail(d, "inflateInit2");
+        d->started = 1;
+    }
+
+    d->in_total += len;
+    d->zs.next_in = (Bytef *)data;
+    d->zs.avail_in = (uInt)len;
+
+    unsigned char out[DECODE_CHUNK];
+    for (;;) {
+        d->zs.next_out = out;
+        d->zs.avail_out = sizeof(out);
+        int ret = inflate(&d->zs, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR) {
+            // Padding after a complete gzip member is common; don't reject the page for it
+            if (ret == Z_DATA_ERROR && d->coding == CONTENT_CODING_GZIP && d->members_done > 0 && d->zs.total_out == 0) {
+                d->finished = 1;
+                d->trailing = 1;
+                return 1;
+            }
+            return decoder_fail(d, d->zs.msg ? d->zs.msg : "corrupt stream");
+        }
+
+        size_t produced = sizeof(out) - d->zs.avail_out;
+        if (produced > 0) {
+            d->out_total += produced;
+            if (d->out_total > d->max_output) return decoder_fail(d, "decoded size limit exceeded");
+            if (d->out_total > CONTENT_DECODER_RATIO_ALLOWANCE && d->out_total / d->max_ratio > d->in_total) {
+                return decoder_fail(d, "compression ratio limit exceeded");
+            }
+            if (!d->target->on_data(d->target, (const char *)out, produced)) {
+                d->failed = 1;
+                return 0;
+            }
+        }
+
+        if (ret == Z_STREAM_END) {
+            d->members_done++;
+            if (d->coding == CONTENT_CODING_GZIP && d->zs.avail_in > 0) {
+                inflateReset(&d->zs); // Next gzip member
+                continue;
+            }
+            d->finished = 1;
+            return 1;
+        }
+        // Input used up and no output pending
+        if (d->zs.avail_in == 0 && d->zs.avail_out != 0) return 1;
+        if (ret == Z_BUF_ERROR) return 1;
+    }
+}
+
+int content_decoder_init(content_decoder_t *decoder, content_coding_t coding, network_sink_t *target) {
+    memset(decoder, 0, sizeof(*decoder));
+    if (coding == CONTENT_CODING_NONE || !target) return 0;
+    decoder->base.on_headers = decoder_on_headers;
+    decoder->base.on_data = decoder_on_data;
+    decoder->target = target;
+    decoder->coding = coding;
+    decoder->max_output = CONTENT_DECODER_MAX_OUTPUT;
+    decoder->max_ratio = CONTENT_DECODER_MAX_RATIO;
+    return 1;
+}
+
+int content_decoder_complete(content_decoder_t *decoder) {
+    // No body at all (204, HEAD) has nothing to be cut short
+    return !decoder->failed && (decoder->finished || decoder->in_total == 0);
+}
+
+void content_decoder_end(content_decoder_t *decoder) {
+    if (decoder->started) inflateEnd(&decoder->zs);
+    decoder->started = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef CONTENT_DECODER_H
+#define CONTENT_DECODER_H
+
+#include <zlib.h>
+#include "protocol.h"
+
+/*
+ * Content-Encoding Decoder
+ *
+ * A network_sink_t that inflates a gzip or deflate coded body on the fly and
+ * forwards the decoded bytes to another sink. It sits after transfer
+ * decoding, so chunked responses are inflated chunk by chunk as they arrive.
+ *
+ * "deflate" is accepted both zlib-wrapped (as the RFC says) and raw (as some
+ * servers send it); concatenated gzip members are decoded back to back.
+ *
+ * Decompression bombs are stopped once the decoded size passes max_output or
+ * grows past max_ratio times the compressed input (after a small allowance),
+ * at which point the transfer is aborted.
+ */
+
+#define CONTENT_DECODER_ACCEPT "gzip, deflate"
+#define CONTENT_DECODER_MAX_OUTPUT (128 * 1024 * 1024)
+#define CONTENT_DECODER_MAX_RATIO 1000
+#define CONTENT_DECODER_RATIO_ALLOWANCE (1024 * 1024)
+
+typedef enum {
+    CONTENT_CODING_NONE,
+    CONTENT_CODING_GZIP,
+    CONTENT_CODING_DEFLATE
+} content_coding_t;
+
+typedef struct {
+    network_sink_t base;
+    network_sink_t *target;
+    content_coding_t coding;
+    z_stream zs;
+    int started;                 // inflateInit2 done (deflate waits for the first bytes)
+    int finished;                // End of the compressed stream (or of a gzip member) seen
+    int trailing;                // Padding after the last gzip member; the rest is ignored
+    int members_done;            // Complete gzip members (or the one deflate stream)
+    int failed;                  // Corrupt data or bomb guard tripped
+    size_t max_output;
+    unsigned long max_ratio;
+    unsigned long long in_total;
+    unsigned long long out_total;
+} content_decoder_t;
+
+// Map a Content-Encoding header value; unknown and identity codings are NONE
+content_coding_t content_coding_from_header(const char *value);
+
+// Returns 1 and sets up the decoder for coding, 0 if coding is NONE
+int content_decoder_init(content_decoder_t *decoder, content_coding_t coding, network_sink_t *target);
+
+// Whether the whole compressed stream was decoded
+int content_decoder_complete(content_decoder_t *decoder);
+
+void content_decoder_end(content_decoder_t *decoder);
+
+#endif // CONTENT_DECODER_H
@@ -0,0 +1,251 @@
+#include "dns_cache.h"
+#include "core/log.h"
+#include "core/lazy_lock.h"
+#include <stdlib.h>
+#include <string.h>
+
+// How long a lookup waits for another thread already resolving the same host
+#define DNS_WAIT_PENDING_MS 15000
+
+typedef enum {
+    DNS_ENTRY_EMPTY,
+    DNS_ENTRY_PENDING,
+    DNS_ENTRY_RESOLVED,
+    DNS_ENTRY_FAILED
+} dns_entry_state_t;
+
+typedef struct {
+    char host[256];
+    dns_entry_state_t state;
+    DWORD resolved_at;
+    unsigned long last_used;
+    dns_result_t result;
+} dns_entry_t;
+
+static dns_entry_t g_entries[DNS_CACHE_MAX_ENTRIES];
+static unsigned long g_clock = 0;
+static DWORD g_ttl_ms = DNS_CACHE_DEFAULT_TTL_MS;
+static DWORD g_negative_ttl_ms = DNS_CACHE_NEGATIVE_TTL_MS;
+static dns_cache_stats_t g_stats = {0, 0, 0, 0, 0};
+static int g_winsock_started = 0;
+
+static lazy_lock_t g_dns_lock;
+
+static void dns_lock(void) {
+    lazy_lock_enter(&g_dns_lock);
+}
+
+static void dns_unlock(void) {
+    lazy_lock_leave(&g_dns_lock);
+}
+
+// Winsock is started here, once for the process: every connection resolves
+// its host through this cache before making a socket
+static int ensure_winsock(void) {
+    dns_lock();
+    if (!g_winsock_started) {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0) g_winsock_started = 1;
+        else LOG_ERROR("DNS: WSAStartup failed");
+    }
+    int ok = g_winsock_started;
+    dns_unlock();
+    return ok;
+}
+
+static dns_entry_t* find_entry(const char *host) {
+    for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++) {
+        if (g_entries[i].state != DNS_ENTRY_EMPTY && strcmp(g_entries[i].host, host) == 0) return &g_entries[i];
+    }
+    return NULL;
+}
+
+// A slot for host: its own, a free one, or the least recently used settled
+// one. NULL if every slot is mid-lookup.
+static dns_entry_t* claim_entry(const char *host) {
+    dns_entry_t *e = find_entry(host);
+    if (e) return e;
+    for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++) {
+        dns_entry_t *c = &g_entries[i];
+        if (c->state == DNS_ENTRY_EMPTY) {
+            e = c;
+            break;
+        }
+        if (c->state != DNS_ENTRY_PENDING && (!e || c->last_used < e->last_used)) e = c;
+    }
+    if (e) {
+        strcpy(e->host, host);
+        e->state = DNS_ENTRY_EMPTY;
+    }
+    return e;
+}
+
+static int entry_fresh(const dns_entry_t *e, DWORD now) {
+    if (e->state == DNS_ENTRY_RESOLVED) return now - e->resolved_at < g_ttl_ms;
+    if (e->state == DNS_ENTRY_FAILED) return now - e->resolved_at < g_negative_ttl_ms;
+    return 0;
+}
+
+static int lookup(const char *host, dns_result_t *out) {
+    struct addrinfo hints = {0}, *result = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    memset(out, 0, sizeof(*out));
+    if (!ensure_winsock()) return 0;
+
+    DWORD start = GetTickCount();
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) {
+        LOG_ERROR("getaddrinfo failed for %s", host);
+        return 0;
+    }
+    for (struct addrinfo *ai = result; ai && out->count < DNS_CACHE_MAX_ADDRS; ai = ai->ai_next) {
+        if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) || ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+        dns_address_t *a = &out->addrs[out->count++];
+        a->family = ai->ai_family;
+        a->addr_len = (int)ai->ai_addrlen;
+        memcpy(&a->addr, ai->ai_addr, ai->ai_addrlen);
+    }
+    freeaddrinfo(result);
+    LOG_DEBUG("DNS: %s resolved to %d address(es) in %lu ms", host, out->count, (unsigned long)(GetTickCount() - start));
+    return out->count > 0;
+}
+
+// Record a finished lookup, unless the entry was reused for another host meanwhile
+static void store_result(const char *host, int ok, const dns_result_t *result) {
+    dns_lock();
+    dns_entry_t *e = find_entry(host);
+    if (!e) e = claim_entry(host);
+    if (e) {
+        e->state = ok ? DNS_ENTRY_RESOLVED : DNS_ENTRY_FAILED;
+        e->resolved_at = GetTickCount();
+        e->last_used = ++g_clock;
+        e->result = *result;
+    }
+    dns_unlock();
+}
+
+static void set_port(dns_result_t *result, int port) {
+    for (int i = 0; i < result->count; i++) {
+        if (result->addrs[i].family == AF_INET) {
+            ((struct sockaddr_in *)&result->addrs[i].addr)->sin_port = htons((u_short)port);
+        } else {
+            ((struct sockaddr_in6 *)&result->addrs[i].addr)->sin6_port = htons((u_short)port);
+        }
+    }
+}
+
+int dns_resolve(const char *host, int port, dns_result_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (!host || !*host || strlen(host) >= sizeof(g_entries[0].host)) return 0;
+
+    DWORD wait_start = GetTickCount();
+    dns_lock();
+    for (;;) {
+        dns_entry_t *e = find_entry(host);
+        if (e && e->state == DNS_ENTRY_PENDING && GetTickCount() - wait_start < DNS_WAIT_PENDING_MS) {
+            // Another thread (usually a prefetch) is resolving it right now
+            dns_unlock();
+            Sleep(5);
+            dns_lock();
+            continue;
+        }
+        if (e && entry_fresh(e, GetTickCount())) {
+            e->last_used = ++g_clock;
+            int ok = e->state == DNS_ENTRY_RESOLVED;
+            if (ok) {
+                *out = e->result;
+                g_stats.hits++;
+            } else {
+                g_stats.negative_hits++;
+            }
+            dns_unlock();
+            if (ok) set_port(out, port);
+            return ok;
+        }
+        if (e && e->state != DNS_ENTRY_PENDING) g_stats.expired++;
+        break;
+    }
+    g_stats.misses++;
+    dns_entry_t *e = claim_entry(host);
+    if (e) e->state = DNS_ENTRY_PENDING;
+    dns_unlock();
+
+    dns_result_t result;
+    int ok = lookup(host, &result);
+    store_result(host, ok, &result);
+    if (!ok) return 0;
+    *out = result;
+    set_port(out, port);
+    return 1;
+}
+
+static DWORD WINAPI prefetch_proc(LPVOID param) {
+    char *host = param;
+    dns_result_t result;
+    int ok = lookup(host, &result);
+    store_result(host, ok, &result);
+    free(host);
+    return 0;
+}
+
+void dns_prefetch(const char *host) {
+    if (!host || !*host || strlen(host) >= sizeof(g_entries[0].host)) return;
+
+    dns_lock();
+    dns_entry_t *e = find_entry(host);
+    if (e && (e->state == DNS_ENTRY_PENDING || entry_fresh(e, GetTickCount()))) {
+        dns_unlock();
+        return;
+    }
+    e = claim_entry(host);
+    if (!e) {
+        dns_unlock();
+        return;
+    }
+    e->state = DNS_ENTRY_PENDING;
+    g_stats.prefetches++;
+    dns_unlock();
+
+    char *copy = strdup(host);
+    if (!copy || !QueueUserWorkItem(prefetch_proc, copy, WT_EXECUTEDEFAULT)) {
+        free(copy);
+        dns_lock();
+        e = find_entry(host);
+        if (e && e->state == DNS_ENTRY_PENDING) e->state = DNS_ENTRY_EMPTY;
+        dns_unlock();
+    }
+}
+
+void dns_cache_set_ttl(DWORD positive_ms, DWORD negative_ms) {
+    dns_lock();
+    g_ttl_ms = positive_ms;
+    g_negative_ttl_ms = negative_ms;
+    dns_unlock();
+}
+
+void dns_cache_clear(void) {
+    dns_lock();
+    for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++) {
+        // Lookups in flight find their slot gone and simply record a new entry
+        g_entries[i].state = DNS_ENTRY_EMPTY;
+    }
+    dns_unlock();
+}
+
+void dns_cache_get_stats(dns_cache_stats_t *out) {
+    if (!out) return;
+    dns_lock();
+    *out = g_stats;
+    dns_unlock();
+}
+
+void dns_cache_log_stats(void) {
+    dns_cache_stats_t s;
+    dns_cache_get_stats(&s);
+    unsigned long lookups = s.hits + s.negative_hits + s.misses;
+    LOG_INFO("DNS cache: hit rate %lu%% (%lu/%lu), %lu negative hits, %lu prefetches, %lu expired",
+             lookups ? ((s.hits + s.negative_hits) * 100) / lookups : 0, s.hits + s.negative_hits, lookups,
+             s.negative_hits, s.prefetches, s.expired);
+}
@@ -0,0 +1,57 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+/*
+ * DNS Cache
+ *
+ * Resolved addresses are kept per host name for a TTL, so the many
+ * connections a page makes to one host do one getaddrinfo between them.
+ * Failed lookups are cached too, for a shorter time, so a dead host does not
+ * stall every resource that points at it.
+ *
+ * dns_prefetch starts a lookup on a thread pool thread as soon as a host is
+ * known (e.g. discovered in the DOM), so the address is usually in the cache
+ * by the time the connection is made. All functions are thread-safe.
+ */
+
+#define DNS_CACHE_DEFAULT_TTL_MS 60000
+#define DNS_CACHE_NEGATIVE_TTL_MS 10000
+#define DNS_CACHE_MAX_ENTRIES 128
+#define DNS_CACHE_MAX_ADDRS 8
+
+typedef struct {
+    int family;                     // AF_INET or AF_INET6
+    int addr_len;
+    struct sockaddr_storage addr;   // Port filled in by dns_resolve
+} dns_address_t;
+
+typedef struct {
+    int count;
+    dns_address_t addrs[DNS_CACHE_MAX_ADDRS];   // In getaddrinfo order
+} dns_result_t;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;           // Lookups that went to getaddrinfo
+    unsigned long negative_hits;    // Hits on a cached failure
+    unsigned long prefetches;       // Lookups started by dns_prefetch
+    unsigned long expired;
+} dns_cache_stats_t;
+
+// Resolve host, from the cache when fresh. Returns 1 and fills out (with port
+// set on every address) on success, 0 if the host does not resolve.
+int dns_resolve(const char *host, int port, dns_result_t *out);
+
+// Resolve host in the background unless it is cached or already in flight
+void dns_prefetch(const char *host);
+
+void dns_cache_set_ttl(DWORD positive_ms, DWORD negative_ms);
+void dns_cache_clear(void);
+void dns_cache_get_stats(dns_cache_stats_t *out);
+void dns_cache_log_stats(void);
+
+#endif // DNS_CACHE_H
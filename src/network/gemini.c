@@ -5,7 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-network_response_t* gemini_fetch(const char *url) {
+network_response_t* gemini_fetch_stream(const char *url, network_sink_t *sink) {
     if (strncmp(url, "gemini://", 9) != 0) return NULL;
 
     LOG_INFO("Gemini fetching: %s", url);
@@ -60,56 +60,56 @@ network_response_t* gemini_fetch(const char *url) {
     }
 
     network_response_t *res = calloc(1, sizeof(network_response_t));
+    if (!res) {
+        tls_close(conn);
+        return NULL;
+    }
+
+    // Response header: "<status> <meta>\r\n", meta at most 1024 bytes
     char buffer[16384];
     int received;
-    int total_received = 0;
+    size_t buffered = 0;
+    char *line_end = NULL;
+    while (!line_end && buffered < sizeof(buffer) - 1 &&
+           (received = tls_recv(conn, buffer + buffered, (int)(sizeof(buffer) - 1 - buffered))) > 0) {
+        buffered += received;
+        buffer[buffered] = '\0';
+        line_end = strstr(buffer, "\r\n");
+    }
 
-    while ((received = tls_recv(conn, buffer, sizeof(buffer)-1)) > 0) {
-        char *new_data = realloc(res->data, total_received + received + 1);
-        if (!new_data) break;
-        res->data = new_data;
-        memcpy(res->data + total_received, buffer, received);
-        total_received += received;
-        res->data[total_received] = '\0';
+    // Without a header line everything received is passed on as the body
+    size_t body_offset = 0;
+    if (line_end) {
+        *line_end = '\0';
+        char *space = strchr(buffer, ' ');
+        if (space) {
+            *space = '\0';
+            res->content_type = strdup(space + 1);
+        }
+        res->status_code = atoi(buffer);
+        body_offset = (line_end - buffer) + 2;
     }
-    res->size = total_received;
 
-    // Robust parsing after full receive
-    if (res->data && res->size >= 2) {
-        char *line_end = strstr(res->data, "\r\n");
-        if (line_end) {
-            *line_end = '\0';
-            char *space = strchr(res->data, ' ');
-            if (space) {
-                *space = '\0';
-                res->status_code = atoi(res->data);
-                res->content_type = strdup(space + 1);
-                *space = ' '; // Restore
-            } else {
-                res->status_code = atoi(res->data);
-            }
-            *line_end = '\r'; // Restore
-            
-            // Body starts after CRLF
-            char *body_start = line_end + 2;
-            size_t body_len = res->size - (body_start - res->data);
-            if (body_len > 0) {
-                char *body_data = malloc(body_len + 1);
-                if (body_data) {
-                    memcpy(body_data, body_start, body_len);
-                    body_data[body_len] = '\0';
-                    free(res->data);
-                    res->data = body_data;
-                    res->size = body_len;
-                }
-            } else {
-                free(res->data);
-                res->data = NULL;
-                res->size = 0;
-            }
+    // Redirects (3x) are followed by the caller and have no body
+    size_t total_received = buffered - body_offset;
+    if (sink && res->status_code != 30 && res->status_code != 31 &&
+        sink->on_headers(sink, res->status_code, res->content_type, -1)) {
+        int ok = total_received == 0 || sink->on_data(sink, buffer + body_offset, total_received);
+        while (ok && (received = tls_recv(conn, buffer, sizeof(buffer))) > 0) {
+            total_received += received;
+            ok = sink->on_data(sink, buffer, received);
         }
     }
+    LOG_DEBUG("Gemini response %d, %lu body bytes", res->status_code, (unsigned long)total_received);
 
     tls_close(conn);
     return res;
-}
\ No newline at end of file
+}
+
+network_response_t* gemini_fetch(const char *url) {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+    network_response_t *res = gemini_fetch_stream(url, &sink.base);
+    network_buffer_sink_attach(&sink, res);
+    return res;
+}
@@ -4,5 +4,6 @@
 #include "protocol.h"
 
 network_response_t* gemini_fetch(const char *url);
+network_response_t* gemini_fetch_stream(const char *url, network_sink_t *sink);
 
 #endif // GEMINI_H
@@ -1,11 +1,65 @@
 #include "http.h"
 #include "tls.h"
+#include "conn_pool.h"
+#include "content_decoder.h"
+#include "http_parser.h"
 #include "core/log.h"
+#include "core/lazy_lock.h"
 #include <wininet.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+// WinInet requests in progress, so http_abort_all can close them under a
+// blocked read. A slot cleared by an abort means the handle is already closed.
+#define HTTP_MAX_ACTIVE_REQUESTS 32
+static HINTERNET g_active[HTTP_MAX_ACTIVE_REQUESTS];
+static lazy_lock_t g_active_lock;
+
+// Returns the slot, or -1 if all are taken (the request then cannot be aborted)
+static int track_request(HINTERNET request) {
+    int slot = -1;
+    lazy_lock_enter(&g_active_lock);
+    for (int i = 0; i < HTTP_MAX_ACTIVE_REQUESTS && slot < 0; i++) {
+        if (!g_active[i]) {
+            g_active[i] = request;
+            slot = i;
+        }
+    }
+    lazy_lock_leave(&g_active_lock);
+    return slot;
+}
+
+// Close everything a request opened, except a request handle the abort got to first
+static void close_request(int slot, HINTERNET request, HINTERNET connect, HINTERNET internet) {
+    int ours = 1;
+    if (slot >= 0) {
+        lazy_lock_enter(&g_active_lock);
+        ours = g_active[slot] == request;
+        if (ours) g_active[slot] = NULL;
+        lazy_lock_leave(&g_active_lock);
+    }
+    if (ours) InternetCloseHandle(request);
+    InternetCloseHandle(connect);
+    InternetCloseHandle(internet);
+}
+
+void http_abort_all(void) {
+    int count = 0;
+    lazy_lock_enter(&g_active_lock);
+    for (int i = 0; i < HTTP_MAX_ACTIVE_REQUESTS; i++) {
+        if (g_active[i]) {
+            // Closing a request handle cancels a blocking call on it
+            InternetCloseHandle(g_active[i]);
+            g_active[i] = NULL;
+            count++;
+        }
+    }
+    lazy_lock_leave(&g_active_lock);
+    tls_abort_all();
+    if (count) LOG_INFO("HTTP: aborted %d request(s)", count);
+}
+
 static void log_last_error(const char *context) {
     DWORD err = GetLastError();
     char buffer[1024];
@@ -28,74 +82,165 @@ static void log_last_error(const char *context) {
     }
 }
 
-static int is_chunked(const char *headers) {
-    if (!headers) return 0;
-    const char *te = strstr(headers, "Transfer-Encoding:");
-    if (te) {
-        const char *end = strstr(te, "\r\n");
-        if (end) {
-            char val[64];
-            int len = (int)(end - (te + 18));
-            if (len > 63) len = 63;
-            memcpy(val, te + 18, len);
-            val[len] = '\0';
-            if (strstr(val, "chunked")) return 1;
-        }
-    }
-    return 0;
+// --- Raw HTTPS over tls_connection_t (HTTP/1.1 keep-alive) ---
+
+#define HTTP_RECV_CHUNK 16384
+
+// Swallows bodies nobody will see (redirects), keeping the connection framed
+static int discard_on_headers(network_sink_t *sink, int status_code, const char *content_type, long long content_length) {
+    (void)sink; (void)status_code; (void)content_type; (void)content_length;
+    return 1;
 }
 
-static void unchunk_response(network_response_t *res) {
-    if (!res || !res->data || res->size == 0) return;
+static int discard_on_data(network_sink_t *sink, const char *data, size_t len) {
+    (void)sink; (void)data; (void)len;
+    return 1;
+}
 
-    char *new_data = malloc(res->size + 1); // Max size roughly same
-    if (!new_data) return;
+static network_sink_t g_discard_sink = {discard_on_headers, discard_on_data};
+
+typedef enum {
+    HTTPS_OK,
+    HTTPS_FAILED,
+    HTTPS_STALE      // Reused connection died before any response byte arrived
+} https_result_t;
+
+typedef struct {
+    network_response_t *res;
+    network_sink_t *sink;          // Where the (decoded) body goes
+    content_decoder_t decoder;
+    int decoding;
+    int headers_seen;
+    char content_encoding[64];
+} https_exchange_t;
+
+static int exchange_on_headers(http_parser_t *parser, void *user) {
+    https_exchange_t *ex = user;
+    network_response_t *res = ex->res;
+
+    ex->headers_seen = 1;
+    res->status_code = parser->status_code;
+    LOG_INFO("HTTPS Response Status: %d", res->status_code);
+    const char *value = http_parser_header(parser, "Content-Type");
+    if (value) res->content_type = strdup(value);
+    network_response_set_validators(res, http_parser_header(parser, "ETag"), http_parser_header(parser, "Last-Modified"),
+                                    http_parser_header(parser, "Cache-Control"), http_parser_header(parser, "Expires"));
+
+    // Redirects are followed by the caller; only the Location is kept
+    value = http_parser_header(parser, "Location");
+    if (res->status_code >= 300 && res->status_code <= 308 && value) {
+        res->data = strdup(value);
+        res->size = res->data ? strlen(res->data) : 0;
+        LOG_INFO("HTTPS Redirect Location: %s", res->data);
+        ex->sink = &g_discard_sink;
+    }
 
-    size_t write_pos = 0;
-    char *p = res->data;
-    char *end = res->data + res->size;
+    // Content coding applies to what the transfer framing yields
+    value = http_parser_header(parser, "Content-Encoding");
+    if (value && ex->sink != &g_discard_sink &&
+        content_decoder_init(&ex->decoder, content_coding_from_header(value), ex->sink)) {
+        ex->decoding = 1;
+        strncpy(ex->content_encoding, value, sizeof(ex->content_encoding) - 1);
+        ex->sink = &ex->decoder.base;
+    }
 
-    while (p < end) {
-        char *term = strstr(p, "\r\n");
-        if (!term) break;
+    return ex->sink->on_headers(ex->sink, res->status_code, res->content_type, parser->content_length);
+}
 
-        *term = '\0';
-        long chunk_len = strtol(p, NULL, 16);
-        *term = '\r'; // Restore (optional)
-        p = term + 2; // Skip \r\n
+static int exchange_on_body(http_parser_t *parser, const char *data, size_t len, void *user) {
+    https_exchange_t *ex = user;
+    (void)parser;
+    return ex->sink->on_data(ex->sink, data, len);
+}
 
-        if (chunk_len == 0) break; // End chunk
+static const http_parser_callbacks_t g_exchange_callbacks = {exchange_on_headers, exchange_on_body};
 
-        if (p + chunk_len > end) break; // Malformed
+// One request/response exchange. *out_reusable says whether the connection
+// is positioned at the start of the next response.
+static https_result_t https_exchange(tls_connection_t *conn, int reused, const char *request, int req_len,
+                                     const char *body, const char *method, network_sink_t *sink,
+                                     network_response_t **out_res, int *out_reusable) {
+    *out_res = NULL;
+    *out_reusable = 0;
 
-        // Resize if needed (unlikely unless initial alloc was conservative)
-        // memcpy
-        if (write_pos + chunk_len > res->size) {
-             // Should not happen for valid chunks as chunked overhead makes src larger
+    if (tls_send(conn, request, req_len) < 0 || (body && tls_send(conn, body, (int)strlen(body)) < 0)) {
+        if (reused) return HTTPS_STALE;
+        LOG_ERROR("HTTPS Tunneling: Failed to send request");
+        return HTTPS_FAILED;
+    }
+
+    char *buf = malloc(HTTP_RECV_CHUNK);
+    https_exchange_t ex;
+    memset(&ex, 0, sizeof(ex));
+    ex.res = calloc(1, sizeof(network_response_t));
+    ex.sink = sink ? sink : &g_discard_sink;
+    if (!buf || !ex.res) {
+        free(buf);
+        free(ex.res);
+        return HTTPS_FAILED;
+    }
+
+    http_parser_t parser;
+    http_parser_init(&parser, strcmp(method, "HEAD") == 0);
+
+    // The parser stops at the end of the message, so anything it leaves
+    // unconsumed was sent past this response
+    unsigned long total = 0;
+    int leftover = 0;
+    while (parser.state != HTTP_PARSE_DONE && parser.state != HTTP_PARSE_ERROR && !parser.aborted) {
+        int n = tls_recv(conn, buf, HTTP_RECV_CHUNK);
+        if (n <= 0) {
+            http_parser_finish(&parser);
+            break;
         }
+        total += n;
+        size_t used = http_parser_execute(&parser, &g_exchange_callbacks, &ex, buf, (size_t)n);
+        if (used < (size_t)n) leftover = 1;
+    }
+    LOG_INFO("HTTPS Data received: %lu bytes total", total);
 
-        memcpy(new_data + write_pos, p, chunk_len);
-        write_pos += chunk_len;
-        p += chunk_len;
+    https_result_t result = HTTPS_OK;
+    if (!ex.headers_seen) {
+        if (total == 0 && reused) {
+            result = HTTPS_STALE;
+        } else {
+            LOG_WARN("HTTPS Response: %s", parser.error ? parser.error : "Could not find end of headers");
+            result = HTTPS_FAILED;
+        }
+    } else if (parser.state != HTTP_PARSE_DONE) {
+        // Cut off, badly framed or stopped by the sink: what arrived is passed
+        // on, flagged, so it can be shown but is never taken for the resource
+        LOG_WARN("HTTPS Response: %s after %lu body bytes",
+                 parser.error ? parser.error : "transfer stopped", (unsigned long)parser.body_bytes);
+        ex.res->incomplete = 1;
+    }
 
-        // Skip trailing \r\n
-        if (p + 2 <= end && p[0] == '\r' && p[1] == '\n') p += 2;
+    if (ex.decoding) {
+        if (parser.state == HTTP_PARSE_DONE && !content_decoder_complete(&ex.decoder)) {
+            LOG_WARN("HTTPS Response: compressed body is truncated");
+            ex.res->incomplete = 1;
+        }
+        LOG_INFO("HTTPS Content-Encoding %s: %lu -> %lu bytes", ex.content_encoding,
+                 (unsigned long)ex.decoder.in_total, (unsigned long)ex.decoder.out_total);
+        content_decoder_end(&ex.decoder);
     }
 
-    new_data[write_pos] = '\0';
-    free(res->data);
-    res->data = new_data;
-    res->size = write_pos;
-    LOG_INFO("Unchunked response to %lu bytes", (unsigned long) res->size);
+    *out_reusable = http_parser_reusable(&parser) && !leftover;
+    http_parser_free(&parser);
+    free(buf);
+
+    if (result != HTTPS_OK) {
+        network_response_free(ex.res);
+        return result;
+    }
+    *out_res = ex.res;
+    return HTTPS_OK;
 }
 
-static network_response_t* https_fetch_raw(const char *host, int port, const char *path, const char *method, const char *body, const char *content_type) {
+static network_response_t* https_fetch_raw(const char *host, int port, const char *path, const char *method,
+                                           const char *body, const char *content_type, const char *extra_headers,
+                                           network_sink_t *sink) {
     LOG_INFO("HTTPS Tunneling: %s:%d%s", host, port, path);
-    tls_connection_t *conn = tls_connect(host, port);
-    if (!conn) {
-        LOG_ERROR("HTTPS Tunneling: TLS connection failed to %s", host);
-        return NULL;
-    }
 
     char request[4096];
     int req_len = snprintf(request, sizeof(request),
@@ -103,7 +248,7 @@ static network_response_t* https_fetch_raw(const char *host, int port, const cha
         "Host: %s\r\n"
         "User-Agent: Gem32Browser/1.0\r\n"
         "Accept: */*\r\n"
-        "Connection: close\r\n",
+        "Accept-Encoding: " CONTENT_DECODER_ACCEPT "\r\n",
         method, path, host);
 
     if (body && content_type) {
@@ -112,112 +257,47 @@ static network_response_t* https_fetch_raw(const char *host, int port, const cha
             "Content-Length: %lu\r\n",
             content_type, (unsigned long)strlen(body));
     }
+    if (extra_headers && req_len + strlen(extra_headers) + 2 < sizeof(request)) {
+        strcpy(request + req_len, extra_headers);
+        req_len += (int)strlen(extra_headers);
+    }
     strcat(request, "\r\n");
     req_len += 2;
 
     LOG_DEBUG("HTTPS Request:\n%s", request);
 
-    if (tls_send(conn, request, req_len) < 0) {
-        LOG_ERROR("HTTPS Tunneling: Failed to send request");
-        tls_close(conn);
-        return NULL;
-    }
-
-    if (body) {
-        tls_send(conn, body, (int)strlen(body));
-    }
-
-    network_response_t *res = calloc(1, sizeof(network_response_t));
-    char *buffer = malloc(65536);
-    int received;
-    int total_received = 0;
-    char *data = NULL;
-
-    while ((received = tls_recv(conn, buffer, 65535)) > 0) {
-        LOG_DEBUG("HTTPS Received %d bytes", received);
-        char *new_data = realloc(data, total_received + received + 1);
-        if (!new_data) break;
-        data = new_data;
-        memcpy(data + total_received, buffer, received);
-        total_received += received;
-        data[total_received] = '\0';
-    }
-    free(buffer);
-    tls_close(conn);
-
-    if (data) {
-        LOG_INFO("HTTPS Data received: %d bytes total", total_received);
-        // Simple HTTP parser
-        char *header_end = strstr(data, "\r\n\r\n");
-        if (header_end) {
-            *header_end = '\0';
-            char *body_start = header_end + 4;
-
-            char *first_line_end = strstr(data, "\r\n");
-            if (first_line_end) {
-                *first_line_end = '\0';
-                char *status_code_ptr = strchr(data, ' ');
-                if (status_code_ptr) {
-                    res->status_code = atoi(status_code_ptr + 1);
-                    LOG_INFO("HTTPS Response Status: %d", res->status_code);
-                }
-            }
-
-            // Headers scan for Content-Type and Transfer-Encoding
-            if (1) {
-                char *ct = strstr(data, "Content-Type: ");
-                if (ct) {
-                    ct += 14;
-                    char *ct_end = strstr(ct, "\r\n");
-                    if (ct_end) {
-                        int ct_len = (int)(ct_end - ct);
-                        res->content_type = malloc(ct_len + 1);
-                        memcpy(res->content_type, ct, ct_len);
-                        res->content_type[ct_len] = '\0';
-                    }
-                }
-            }
-
-            char *loc = strstr(data, "Location: ");
-            if (loc) {
-                loc += 10;
-                char *loc_end = strstr(loc, "\r\n");
-                if (loc_end) {
-                    int loc_len = (int)(loc_end - loc);
-                    if (res->status_code >= 300 && res->status_code <= 308) {
-                        res->data = malloc(loc_len + 1);
-                        memcpy(res->data, loc, loc_len);
-                        res->data[loc_len] = '\0';
-                        res->size = loc_len;
-                        LOG_INFO("HTTPS Redirect Location: %s", res->data);
-                    }
-                }
-            }
+    // Requests with a body always get a fresh connection, so a stale-connection
+    // retry can never replay them. The retry of any other request gets a fresh
+    // one too: the pool may hold more connections the server has dropped.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = 0;
+        tls_connection_t *conn = body || attempt > 0 ? tls_connect(host, port) : conn_pool_acquire(host, port, &reused);
+        if (!conn) {
+            LOG_ERROR("HTTPS Tunneling: TLS connection failed to %s", host);
+            return NULL;
+        }
 
-            if (!res->data) {
-                size_t body_len = total_received - (body_start - data);
-                res->data = malloc(body_len + 1);
-                memcpy(res->data, body_start, body_len);
-                res->data[body_len] = '\0';
-                res->size = body_len;
-
-                // Handle Chunked
-                if (is_chunked(data)) {
-                    unchunk_response(res);
-                }
-            }
-        } else {
-            LOG_WARN("HTTPS Response: Could not find end of headers");
+        network_response_t *res = NULL;
+        int reusable = 0;
+        https_result_t result = https_exchange(conn, reused, request, req_len, body, method, sink, &res, &reusable);
+        if (result == HTTPS_STALE) {
+            LOG_DEBUG("HTTPS Tunneling: pooled connection to %s went stale, retrying", host);
+            conn_pool_note_retry();
+            tls_close(conn);
+            continue;
         }
-        free(data);
-    } else {
-        LOG_ERROR("HTTPS Tunneling: No data received");
-    }
 
-    return res;
+        if (body) tls_close(conn);
+        else conn_pool_release(conn, host, port, result == HTTPS_OK && reusable);
+        if (result != HTTPS_OK) LOG_ERROR("HTTPS Tunneling: No data received");
+        return res;
+    }
+    return NULL;
 }
 
-static network_response_t* perform_http_request(const char *url, const char *method, const char *body, const char *content_type) {
+static network_response_t* perform_http_request(const char *url, const char *method, const char *body,
+                                                const char *content_type, const char *extra_headers,
+                                                network_sink_t *sink) {
     LOG_INFO("HTTP %s %s", method, url);
 
     URL_COMPONENTS urlComp = {0};
@@ -250,7 +330,7 @@ static network_response_t* perform_http_request(const char *url, const char *met
     if (strlen(full_path) == 0) strcpy(full_path, "/");
 
     if (urlComp.nScheme == INTERNET_SCHEME_HTTPS) {
-        return https_fetch_raw(host, urlComp.nPort, full_path, method, body, content_type);
+        return https_fetch_raw(host, urlComp.nPort, full_path, method, body, content_type, extra_headers, sink);
     }
 
     HINTERNET hInternet = InternetOpen("Gem32Browser/1.0", INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0);
@@ -263,36 +343,30 @@ static network_response_t* perform_http_request(const char *url, const char *met
     const char *accept[] = {"*/*", NULL};
     HINTERNET hRequest = HttpOpenRequest(hConnect, method, full_path, NULL, NULL, accept, flags, 0);
     if (!hRequest) { log_last_error("HttpOpenRequest"); InternetCloseHandle(hConnect); InternetCloseHandle(hInternet); return NULL; }
+    int slot = track_request(hRequest);
 
-    const char *headers = NULL;
-    DWORD headersLen = 0;
-    char headerBuf[256];
+    // WinInet passes compressed bodies through untouched; they are decoded below
+    char headers[1024];
+    int headersLen = snprintf(headers, sizeof(headers), "Accept-Encoding: %s\r\n", CONTENT_DECODER_ACCEPT);
     if (body && content_type) {
-        snprintf(headerBuf, sizeof(headerBuf), "Content-Type: %s\r\n", content_type);
-        headers = headerBuf;
-        headersLen = (DWORD)strlen(headers);
+        headersLen += snprintf(headers + headersLen, sizeof(headers) - headersLen, "Content-Type: %s\r\n", content_type);
+    }
+    if (extra_headers && headersLen + strlen(extra_headers) < sizeof(headers)) {
+        strcpy(headers + headersLen, extra_headers);
+        headersLen += (int)strlen(extra_headers);
     }
 
-    if (!HttpSendRequest(hRequest, headers, headersLen, (LPVOID)body, body ? (DWORD)strlen(body) : 0)) {
+    if (!HttpSendRequest(hRequest, headers, (DWORD)headersLen, (LPVOID)body, body ? (DWORD)strlen(body) : 0)) {
         log_last_error("HttpSendRequest");
-        InternetCloseHandle(hRequest); InternetCloseHandle(hConnect); InternetCloseHandle(hInternet);
+        close_request(slot, hRequest, hConnect, hInternet);
         return NULL;
     }
 
     network_response_t *res = calloc(1, sizeof(network_response_t));
-    char buf[4096];
-    DWORD bytesRead;
-    size_t totalSize = 0;
-
-    while (InternetReadFile(hRequest, buf, sizeof(buf), &bytesRead) && bytesRead > 0) {
-        char *newData = realloc(res->data, totalSize + bytesRead + 1);
-        if (!newData) break;
-        res->data = newData;
-        memcpy(res->data + totalSize, buf, bytesRead);
-        totalSize += bytesRead;
-        res->data[totalSize] = '\0';
+    if (!res) {
+        close_request(slot, hRequest, hConnect, hInternet);
+        return NULL;
     }
-    res->size = totalSize;
 
     char ctBuffer[256];
     DWORD ctSize = sizeof(ctBuffer);
@@ -304,9 +378,96 @@ static network_response_t* perform_http_request(const char *url, const char *met
     index = 0;
     if (HttpQueryInfo(hRequest, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &statusCode, &scSize, &index)) res->status_code = (int)statusCode;
 
-    InternetCloseHandle(hRequest); InternetCloseHandle(hConnect); InternetCloseHandle(hInternet);
+    // Freshness and validators, for the HTTP cache
+    char etag[256] = {0}, lastModified[64] = {0}, cacheControl[256] = {0}, expires[64] = {0};
+    DWORD valueSize = sizeof(etag);
+    index = 0;
+    HttpQueryInfo(hRequest, HTTP_QUERY_ETAG, etag, &valueSize, &index);
+    valueSize = sizeof(lastModified);
+    index = 0;
+    HttpQueryInfo(hRequest, HTTP_QUERY_LAST_MODIFIED, lastModified, &valueSize, &index);
+    valueSize = sizeof(cacheControl);
+    index = 0;
+    HttpQueryInfo(hRequest, HTTP_QUERY_CACHE_CONTROL, cacheControl, &valueSize, &index);
+    valueSize = sizeof(expires);
+    index = 0;
+    HttpQueryInfo(hRequest, HTTP_QUERY_EXPIRES, expires, &valueSize, &index);
+    network_response_set_validators(res, etag[0] ? etag : NULL, lastModified[0] ? lastModified : NULL,
+                                    cacheControl[0] ? cacheControl : NULL, expires[0] ? expires : NULL);
+
+    long long content_length = -1;
+    DWORD contentLength = 0;
+    DWORD clSize = sizeof(contentLength);
+    index = 0;
+    if (HttpQueryInfo(hRequest, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &contentLength, &clSize, &index)) content_length = contentLength;
+
+    if (!sink) sink = &g_discard_sink;
+    content_decoder_t decoder;
+    char ceBuffer[64];
+    DWORD ceSize = sizeof(ceBuffer);
+    index = 0;
+    int decoding = HttpQueryInfo(hRequest, HTTP_QUERY_CONTENT_ENCODING, ceBuffer, &ceSize, &index) &&
+                   content_decoder_init(&decoder, content_coding_from_header(ceBuffer), sink);
+    network_sink_t *body_sink = decoding ? &decoder.base : sink;
+
+    if (body_sink->on_headers(body_sink, res->status_code, res->content_type, content_length)) {
+        char buf[HTTP_RECV_CHUNK];
+        DWORD bytesRead;
+        unsigned long long received = 0;
+        for (;;) {
+            if (!InternetReadFile(hRequest, buf, sizeof(buf), &bytesRead)) {
+                log_last_error("InternetReadFile");
+                res->incomplete = 1;
+                break;
+            }
+            if (bytesRead == 0) break;
+            received += bytesRead;
+            if (!body_sink->on_data(body_sink, buf, bytesRead)) {
+                res->incomplete = 1;
+                break;
+            }
+        }
+        // Content-Length counts the bytes on the wire, before content decoding
+        if (!res->incomplete && content_length >= 0 && received != (unsigned long long)content_length) {
+            LOG_WARN("HTTP Response: %lu of %lu body bytes", (unsigned long)received, (unsigned long)content_length);
+            res->incomplete = 1;
+        }
+    } else {
+        res->incomplete = 1;
+    }
+
+    if (decoding) {
+        if (!res->incomplete && !content_decoder_complete(&decoder)) {
+            LOG_WARN("HTTP Response: compressed body is truncated");
+            res->incomplete = 1;
+        }
+        LOG_INFO("HTTP Content-Encoding %s: %lu -> %lu bytes", ceBuffer,
+                 (unsigned long)decoder.in_total, (unsigned long)decoder.out_total);
+        content_decoder_end(&decoder);
+    }
+
+    close_request(slot, hRequest, hConnect, hInternet);
+    return res;
+}
+
+static network_response_t* perform_buffered_request(const char *url, const char *method, const char *body, const char *content_type) {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+    network_response_t *res = perform_http_request(url, method, body, content_type, NULL, &sink.base);
+    network_buffer_sink_attach(&sink, res);
     return res;
 }
 
-network_response_t* http_fetch(const char *url) { return perform_http_request(url, "GET", NULL, NULL); }
-network_response_t* http_post(const char *url, const char *body, const char *content_type) { return perform_http_request(url, "POST", body, content_type); }
+network_response_t* http_fetch(const char *url) { return perform_buffered_request(url, "GET", NULL, NULL); }
+network_response_t* http_post(const char *url, const char *body, const char *content_type) { return perform_buffered_request(url, "POST", body, content_type); }
+network_response_t* http_fetch_stream(const char *url, const char *extra_headers, network_sink_t *sink) {
+    return perform_http_request(url, "GET", NULL, NULL, extra_headers, sink);
+}
+
+void http_set_max_connections_per_server(int max_connections) {
+    DWORD value = (DWORD)max_connections;
+    if (!InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &value, sizeof(value))) {
+        log_last_error("InternetSetOption(MAX_CONNS_PER_SERVER)");
+    }
+    InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER, &value, sizeof(value));
+}
@@ -5,5 +5,15 @@
 
 network_response_t* http_fetch(const char *url);
 network_response_t* http_post(const char *url, const char *body, const char *content_type);
+// extra_headers: NULL or complete "Name: value\r\n" lines added to the request
+network_response_t* http_fetch_stream(const char *url, const char *extra_headers, network_sink_t *sink);
+
+// Cancel every request in progress (WinInet and raw HTTPS alike, and Gemini
+// through the TLS layer): threads blocked reading a response return at once
+// with the response marked incomplete or failed. Meant for shutdown.
+void http_abort_all(void);
+
+// WinInet's own per-server limit (2 on XP) would otherwise cap concurrent loads
+void http_set_max_connections_per_server(int max_connections);
 
 #endif // HTTP_H
@@ -0,0 +1,264 @@
+#include "http_cache.h"
+#include "core/log.h"
+#include "core/lazy_lock.h"
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static http_cache_stats_t g_stats = {0, 0, 0, 0, 0, 0};
+
+static lazy_lock_t g_stats_lock;
+
+static void stats_lock(void) {
+    lazy_lock_enter(&g_stats_lock);
+}
+
+static void stats_unlock(void) {
+    lazy_lock_leave(&g_stats_lock);
+}
+
+static void copy_field(char *dst, size_t dst_size, const char *src) {
+    // Values that do not fit are dropped rather than truncated: a cut
+    // validator would never match
+    if (src && strlen(src) < dst_size) strcpy(dst, src);
+    else dst[0] = '\0';
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static long long days_from_civil(long long y, int m, int d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int month_from_name(const char *name) {
+    static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    for (int i = 0; i < 12; i++) {
+        if (strncasecmp(name, months[i], 3) == 0) return i + 1;
+    }
+    return 0;
+}
+
+long long http_cache_parse_date(const char *value) {
+    if (!value) return -1;
+
+    int day, year, hour, minute, second;
+    char month_name[4] = {0};
+    const char *comma = strchr(value, ',');
+    if (comma) {
+        // "Sun, 06 Nov 1994 08:49:37 GMT" or "Sunday, 06-Nov-94 08:49:37 GMT"
+        if (sscanf(comma + 1, " %d%*[ -]%3s%*[ -]%d %d:%d:%d", &day, month_name, &year, &hour, &minute, &second) != 6) return -1;
+        if (year < 100) year += year < 70 ? 2000 : 1900;
+    } else {
+        // "Sun Nov  6 08:49:37 1994"
+        if (sscanf(value, "%*s %3s %d %d:%d:%d %d", month_name, &day, &hour, &minute, &second, &year) != 6) return -1;
+    }
+
+    int month = month_from_name(month_name);
+    if (!month || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59 ||
+        second < 0 || second > 60 || year < 1970) {
+        return -1;
+    }
+    return days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+// Set expires_at and must_revalidate from the response's caching headers and
+// the validators already in meta. Returns 0 for no-store.
+static int apply_freshness(const network_response_t *res, long long now, cache_meta_t *meta) {
+    long long max_age = -1;
+    int no_cache = 0;
+    meta->must_revalidate = 0;
+
+    const char *p = res->cache_control;
+    while (p && *p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        size_t len = strcspn(p, ",");
+        if (strncasecmp(p, "no-store", 8) == 0) return 0;
+        if (strncasecmp(p, "no-cache", 8) == 0) no_cache = 1;
+        else if (strncasecmp(p, "must-revalidate", 15) == 0) meta->must_revalidate = 1;
+        else if (strncasecmp(p, "max-age=", 8) == 0) {
+            const char *v = p + 8;
+            if (*v == '"') v++;
+            max_age = atol(v);
+            if (max_age < 0) max_age = 0;
+        }
+        p += len;
+    }
+
+    long long lifetime = 0;
+    if (no_cache) {
+        lifetime = 0;
+    } else if (max_age >= 0) {
+        lifetime = max_age;
+    } else if (res->expires) {
+        // An invalid date (often "0" or "-1") means already expired
+        long long expires = http_cache_parse_date(res->expires);
+        lifetime = expires > now ? expires - now : 0;
+    } else if (meta->last_modified[0]) {
+        long long modified = http_cache_parse_date(meta->last_modified);
+        if (modified > 0 && modified < now) {
+            lifetime = (now - modified) * HTTP_CACHE_HEURISTIC_PERCENT / 100;
+            if (lifetime > HTTP_CACHE_HEURISTIC_MAX) lifetime = HTTP_CACHE_HEURISTIC_MAX;
+        }
+    }
+    meta->expires_at = lifetime > 0 ? now + lifetime : 0;
+    return 1;
+}
+
+int http_cache_meta_from_response(const char *url, const network_response_t *res, long long now, cache_meta_t *meta) {
+    memset(meta, 0, sizeof(*meta));
+    if (!res || !res->data || res->size == 0) return 0;
+
+    int gemini = strncmp(url, "gemini://", 9) == 0;
+    if (gemini ? res->status_code != 20 : (res->status_code != 200 && res->status_code != 203)) return 0;
+
+    meta->status_code = res->status_code;
+    copy_field(meta->content_type, sizeof(meta->content_type), res->content_type);
+    meta->stored_at = now;
+    if (gemini) {
+        meta->expires_at = now + HTTP_CACHE_GEMINI_TTL;
+        return 1;
+    }
+
+    copy_field(meta->etag, sizeof(meta->etag), res->etag);
+    copy_field(meta->last_modified, sizeof(meta->last_modified), res->last_modified);
+    if (!apply_freshness(res, now, meta)) return 0;
+
+    // Never fresh and nothing to revalidate with: storing it would only cost disk
+    if (meta->expires_at == 0 && !meta->etag[0] && !meta->last_modified[0]) return 0;
+    return 1;
+}
+
+int http_cache_begin(cache_type_t type, const char *url, http_cache_entry_t *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->type = type;
+    entry->buffer = cache_get(type, url, &entry->meta);
+    if (!entry->buffer) return 0;
+    entry->fresh = entry->meta.expires_at > (long long)time(NULL);
+    return entry->fresh;
+}
+
+network_response_t* http_cache_revalidate_stream(const char *url, const http_cache_entry_t *entry, network_sink_t *sink) {
+    if (entry && entry->buffer && (entry->meta.etag[0] || entry->meta.last_modified[0])) {
+        LOG_DEBUG("HTTP cache: revalidating %s", url);
+        return network_fetch_conditional_stream(url, entry->meta.etag[0] ? entry->meta.etag : NULL,
+                                                entry->meta.last_modified[0] ? entry->meta.last_modified : NULL, sink);
+    }
+    return network_fetch_stream(url, sink);
+}
+
+network_response_t* http_cache_revalidate(const char *url, const http_cache_entry_t *entry) {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+    network_response_t *res = http_cache_revalidate_stream(url, entry, &sink.base);
+    network_buffer_sink_attach(&sink, res);
+    return res;
+}
+
+// A response carrying a copy of the stored body (nodes own and free what they
+// are given), NUL-terminated like one from the network
+static network_response_t* response_from_entry(const char *url, const http_cache_entry_t *entry) {
+    network_response_t *res = calloc(1, sizeof(network_response_t));
+    char *data = malloc(entry->buffer->size + 1);
+    if (!res || !data) {
+        free(res);
+        free(data);
+        return NULL;
+    }
+    memcpy(data, entry->buffer->data, entry->buffer->size + 1);
+    res->status_code = entry->meta.status_code;
+    if (entry->meta.content_type[0]) res->content_type = strdup(entry->meta.content_type);
+    res->final_url = strdup(url);
+    res->data = data;
+    res->size = entry->buffer->size;
+    return res;
+}
+
+network_response_t* http_cache_finish(const char *url, http_cache_entry_t *entry, network_response_t *res) {
+    long long now = (long long)time(NULL);
+    network_response_t *out = res;
+
+    if (entry->buffer && entry->fresh && !res) {
+        LOG_DEBUG("HTTP cache: fresh hit %s", url);
+        stats_lock();
+        g_stats.fresh_hits++;
+        g_stats.bytes_saved += entry->buffer->size;
+        stats_unlock();
+        out = response_from_entry(url, entry);
+    } else if (entry->buffer && res && res->status_code == 304) {
+        // The 304 may carry new validators and freshness; anything it
+        // leaves out stays as stored
+        cache_meta_t meta = entry->meta;
+        if (res->etag) copy_field(meta.etag, sizeof(meta.etag), res->etag);
+        if (res->last_modified) copy_field(meta.last_modified, sizeof(meta.last_modified), res->last_modified);
+        int keep = 1;
+        if (res->cache_control || res->expires) {
+            keep = apply_freshness(res, now, &meta);
+        } else if (meta.expires_at) {
+            meta.expires_at = now + (entry->meta.expires_at - entry->meta.stored_at);
+        }
+        meta.stored_at = now;
+        // The body is still good for this use, but no-store now forbids keeping it
+        if (keep) cache_put_meta(entry->type, url, &meta);
+        else cache_remove(entry->type, url);
+        LOG_DEBUG("HTTP cache: %s not modified, reusing %lu bytes", url, (unsigned long)entry->buffer->size);
+        stats_lock();
+        g_stats.revalidated++;
+        g_stats.bytes_saved += entry->buffer->size;
+        stats_unlock();
+        entry->meta = meta;
+        network_response_free(res);
+        out = response_from_entry(url, entry);
+    } else if ((!res || res->incomplete) && entry->buffer && !entry->meta.must_revalidate) {
+        LOG_WARN("HTTP cache: %s, using stale copy of %s", res ? "body cut short" : "network failed", url);
+        stats_lock();
+        g_stats.stale_served++;
+        stats_unlock();
+        network_response_free(res);
+        out = response_from_entry(url, entry);
+    } else if (res) {
+        // A body cut short is passed on for what it is worth, but would be
+        // served as the resource for as long as it stayed fresh
+        const char *key = entry->type == CACHE_TYPE_DOCUMENT && res->final_url ? res->final_url : url;
+        cache_meta_t meta;
+        int stored = !res->incomplete && http_cache_meta_from_response(key, res, now, &meta) &&
+                     cache_put(entry->type, key, res->data, res->size, &meta);
+        if (res->incomplete) LOG_WARN("HTTP cache: not storing %s, its body was cut short", key);
+        stats_lock();
+        g_stats.misses++;
+        if (stored) g_stats.stored++;
+        stats_unlock();
+    }
+
+    cache_buffer_release(entry->buffer);
+    entry->buffer = NULL;
+    return out;
+}
+
+network_response_t* http_cache_fetch(cache_type_t type, const char *url) {
+    http_cache_entry_t entry;
+    network_response_t *res = NULL;
+    if (!http_cache_begin(type, url, &entry)) res = http_cache_revalidate(url, &entry);
+    return http_cache_finish(url, &entry, res);
+}
+
+void http_cache_get_stats(http_cache_stats_t *out) {
+    if (!out) return;
+    stats_lock();
+    *out = g_stats;
+    stats_unlock();
+}
+
+void http_cache_log_stats(void) {
+    http_cache_stats_t s;
+    http_cache_get_stats(&s);
+    unsigned long requests = s.fresh_hits + s.revalidated + s.stale_served + s.misses;
+    LOG_INFO("HTTP cache: %lu requests, %lu fresh, %lu revalidated (304), %lu stale, %lu fetched (%lu stored), %lu KB saved",
+             requests, s.fresh_hits, s.revalidated, s.stale_served, s.misses, s.stored,
+             (unsigned long)(s.bytes_saved / 1024));
+}
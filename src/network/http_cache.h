@@ -0,0 +1,85 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include "protocol.h"
+#include "core/cache.h"
+
+/*
+ * HTTP cache
+ *
+ * Fetches through the disk cache with HTTP semantics (RFC 9111, as a
+ * private cache):
+ * - A 200 is stored with its validators and a freshness deadline from
+ *   Cache-Control max-age, else Expires, else 10% of the time since
+ *   Last-Modified (capped at a day). no-store responses are not kept;
+ *   no-cache ones are kept but revalidated on every use.
+ * - Fresh entries are used without touching the network.
+ * - Stale entries with an ETag or Last-Modified are revalidated with a
+ *   conditional GET; a 304 refreshes the metadata and reuses the body.
+ * - If the network fails, a stale body is still better than nothing. A
+ *   body that was cut short is not stored; a stale copy is used instead.
+ * - A 304 that says no-store serves the stored body once and removes it.
+ * - Gemini has no caching headers; its responses stay fresh for an hour.
+ * - Entries are filed under their resource type, whose cache policy may keep
+ *   them in memory only, cap their freshness or not cache them at all. A
+ *   redirected document is filed under where it ended up, so relative links
+ *   resolve against the right base when it comes from the cache.
+ *
+ * A fetch is split in three so the loader can keep disk access on the UI
+ * thread and the network on its workers: http_cache_begin looks the URL up,
+ * http_cache_revalidate does the network part on any thread and
+ * http_cache_finish stores or refreshes the entry and picks the response to
+ * use. http_cache_fetch runs all three.
+ */
+
+#define HTTP_CACHE_HEURISTIC_PERCENT 10
+#define HTTP_CACHE_HEURISTIC_MAX (24 * 60 * 60)
+#define HTTP_CACHE_GEMINI_TTL (60 * 60)
+
+typedef struct {
+    cache_type_t type;
+    cache_buffer_t *buffer;  // Stored body, shared with the memory tier; NULL on a miss
+    cache_meta_t meta;
+    int fresh;               // Usable without the network
+} http_cache_entry_t;
+
+typedef struct {
+    unsigned long fresh_hits;      // Served without the network
+    unsigned long revalidated;     // 304: body reused
+    unsigned long stale_served;    // Network failed or body cut short, stale body used
+    unsigned long misses;          // Full responses fetched
+    unsigned long stored;
+    unsigned long long bytes_saved; // Body bytes not transferred thanks to the cache
+} http_cache_stats_t;
+
+// Look url up among entries of type. Returns 1 when the entry is fresh.
+int http_cache_begin(cache_type_t type, const char *url, http_cache_entry_t *entry);
+
+// Network part: a conditional GET when the entry has validators, otherwise
+// a plain one. Must not be called for fresh entries. Thread-safe.
+network_response_t* http_cache_revalidate(const char *url, const http_cache_entry_t *entry);
+
+// The same, handing the body to sink as it arrives. The response comes back
+// without data; attach the collected body before http_cache_finish.
+network_response_t* http_cache_revalidate_stream(const char *url, const http_cache_entry_t *entry, network_sink_t *sink);
+
+// Combine the entry with what the network returned (NULL on failure, or for
+// a fresh entry). Returns the response to use, a 304 becoming a 200 with the
+// stored body, or NULL. Consumes res and releases the entry.
+network_response_t* http_cache_finish(const char *url, http_cache_entry_t *entry, network_response_t *res);
+
+// All three steps on the calling thread
+network_response_t* http_cache_fetch(cache_type_t type, const char *url);
+
+// Work out the metadata to store for res received at now (seconds since
+// 1970, UTC). Returns 0 if the response must not be stored.
+int http_cache_meta_from_response(const char *url, const network_response_t *res, long long now, cache_meta_t *meta);
+
+// Parse an HTTP-date (IMF-fixdate, RFC 850 or asctime form) to seconds since
+// 1970, UTC. Returns -1 if it cannot be parsed.
+long long http_cache_parse_date(const char *value);
+
+void http_cache_get_stats(http_cache_stats_t *out);
+void http_cache_log_stats(void);
+
+#endif // HTTP_CACHE_H
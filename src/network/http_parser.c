@@ -0,0 +1,318 @@
+#include "http_parser.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define ARENA_INITIAL 1024
+
+void http_parser_init(http_parser_t *parser, int head_request) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSE_STATUS;
+    parser->head_request = head_request;
+    parser->content_length = -1;
+}
+
+void http_parser_free(http_parser_t *parser) {
+    free(parser->arena);
+    parser->arena = NULL;
+    parser->arena_cap = 0;
+}
+
+static int fail(http_parser_t *p, const char *reason) {
+    p->state = HTTP_PARSE_ERROR;
+    p->error = reason;
+    return 0;
+}
+
+static int arena_reserve(http_parser_t *p, size_t needed, size_t limit) {
+    if (needed > limit) {
+        return fail(p, p->state <= HTTP_PARSE_HEADERS ? "header section too large" : "line too long");
+    }
+    if (needed <= p->arena_cap) return 1;
+    size_t cap = p->arena_cap ? p->arena_cap : ARENA_INITIAL;
+    while (cap < needed) cap *= 2;
+    if (cap > limit) cap = limit;
+    char *arena = realloc(p->arena, cap);
+    if (!arena) return fail(p, "out of memory");
+    p->arena = arena;
+    p->arena_cap = cap;
+    return 1;
+}
+
+static size_t line_limit(const http_parser_t *p) {
+    if (p->state <= HTTP_PARSE_HEADERS) return HTTP_PARSER_MAX_HEADER_BYTES;
+    return p->arena_len + HTTP_PARSER_MAX_LINE;
+}
+
+static int is_ows(char c) {
+    return c == ' ' || c == '\t';
+}
+
+const char* http_parser_header(const http_parser_t *parser, const char *name) {
+    for (int i = 0; i < parser->header_count; i++) {
+        if (strcasecmp(parser->arena + parser->headers[i].name, name) == 0) {
+            return parser->arena + parser->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+// Whether a comma-separated field value lists token (case-insensitive)
+static int has_token(const char *value, const char *token) {
+    size_t token_len = strlen(token);
+    while (value && *value) {
+        while (*value == ',' || is_ows(*value)) value++;
+        const char *end = value;
+        while (*end && *end != ',') end++;
+        const char *trim = end;
+        while (trim > value && is_ows(trim[-1])) trim--;
+        if ((size_t)(trim - value) == token_len && strncasecmp(value, token, token_len) == 0) return 1;
+        value = end;
+    }
+    return 0;
+}
+
+// Content-Length, allowing the "n, n" a repeated identical field folds into
+static long long parse_content_length(const char *value) {
+    long long result = -1;
+    while (*value) {
+        while (is_ows(*value) || *value == ',') value++;
+        if (!*value) break;
+        if (*value < '0' || *value > '9') return -2;
+        long long n = 0;
+        while (*value >= '0' && *value <= '9') {
+            if (n > (1LL << 52)) return -2;
+            n = n * 10 + (*value++ - '0');
+        }
+        while (is_ows(*value)) value++;
+        if (*value && *value != ',') return -2;
+        if (result >= 0 && n != result) return -2;
+        result = n;
+    }
+    return result;
+}
+
+// Replace a header's value with "<old><sep><add>", add being add_len bytes at
+// arena offset add_off (inside the pending line)
+static int join_value(http_parser_t *p, http_header_t *h, const char *sep, size_t add_off, size_t add_len) {
+    size_t old_len = strlen(p->arena + h->value);
+    size_t sep_len = strlen(sep);
+    size_t total = old_len + sep_len + add_len;
+    if (!arena_reserve(p, p->arena_len + total + 1, HTTP_PARSER_MAX_HEADER_BYTES)) return 0;
+    memmove(p->arena + p->arena_len + old_len + sep_len, p->arena + add_off, add_len);
+    memcpy(p->arena + p->arena_len, p->arena + h->value, old_len);
+    memcpy(p->arena + p->arena_len + old_len, sep, sep_len);
+    p->arena[p->arena_len + total] = '\0';
+    h->value = p->arena_len;
+    p->arena_len += total + 1;
+    return 1;
+}
+
+static int parse_status_line(http_parser_t *p, const char *line, size_t len) {
+    if (len == 0) return 1; // Stray blank lines before a response are tolerated
+    if (len < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[7] < '0' || line[7] > '9' || line[8] != ' ') {
+        return fail(p, "malformed status line");
+    }
+    for (int i = 9; i < 12; i++) {
+        if (line[i] < '0' || line[i] > '9') return fail(p, "malformed status code");
+    }
+    if (len > 12 && line[12] != ' ') return fail(p, "malformed status code");
+    p->http_minor = line[7] - '0';
+    p->status_code = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    p->header_count = 0;
+    p->arena_len = 0;
+    p->state = HTTP_PARSE_HEADERS;
+    return 1;
+}
+
+// The pending line (at arena_len, len bytes, NUL-terminated) is a field
+static int parse_header_line(http_parser_t *p, size_t len) {
+    char *line = p->arena + p->arena_len;
+
+    if (is_ows(line[0])) {
+        // Obsolete line folding continues the previous field
+        if (p->header_count == 0) return fail(p, "continuation line without a header");
+        size_t start = 0;
+        while (start < len && is_ows(line[start])) start++;
+        size_t end = len;
+        while (end > start && is_ows(line[end - 1])) end--;
+        return join_value(p, &p->headers[p->header_count - 1], " ", p->arena_len + start, end - start);
+    }
+
+    char *colon = memchr(line, ':', len);
+    if (!colon || colon == line) return fail(p, "malformed header line");
+    size_t name_end = colon - line;
+    while (name_end > 0 && is_ows(line[name_end - 1])) name_end--;
+    size_t value_start = (colon - line) + 1;
+    while (value_start < len && is_ows(line[value_start])) value_start++;
+    size_t value_end = len;
+    while (value_end > value_start && is_ows(line[value_end - 1])) value_end--;
+    line[name_end] = '\0';
+    line[value_end] = '\0';
+
+    for (int i = 0; i < p->header_count; i++) {
+        if (strcasecmp(p->arena + p->headers[i].name, line) == 0) {
+            return join_value(p, &p->headers[i], ", ", p->arena_len + value_start, value_end - value_start);
+        }
+    }
+    if (p->header_count == HTTP_PARSER_MAX_HEADERS) return fail(p, "too many header fields");
+
+    http_header_t *h = &p->headers[p->header_count++];
+    h->name = p->arena_len;
+    h->value = p->arena_len + value_start;
+    p->arena_len += len + 1;
+    return 1;
+}
+
+static int headers_complete(http_parser_t *p, const http_parser_callbacks_t *cb, void *user) {
+    int status = p->status_code;
+    if (status >= 100 && status < 200 && status != 101) {
+        // Interim response; the real one follows
+        p->state = HTTP_PARSE_STATUS;
+        p->header_count = 0;
+        p->arena_len = 0;
+        return 1;
+    }
+
+    int no_body = p->head_request || status < 200 || status == 204 || status == 304;
+    const char *value = http_parser_header(p, "Transfer-Encoding");
+    p->chunked = !no_body && value && has_token(value, "chunked");
+    p->content_length = -1;
+    if (!no_body && !p->chunked && (value = http_parser_header(p, "Content-Length"))) {
+        p->content_length = parse_content_length(value);
+        if (p->content_length < -1) return fail(p, "invalid Content-Length");
+    }
+
+    p->keep_alive = p->http_minor >= 1;
+    if ((value = http_parser_header(p, "Connection"))) {
+        if (has_token(value, "close")) p->keep_alive = 0;
+        else if (has_token(value, "keep-alive")) p->keep_alive = 1;
+    }
+    if (status == 101 || (!no_body && !p->chunked && p->content_length < 0)) p->keep_alive = 0;
+
+    if (cb && cb->on_headers_complete && !cb->on_headers_complete(p, user)) {
+        p->aborted = 1;
+        return 0;
+    }
+
+    if (no_body) {
+        p->state = HTTP_PARSE_DONE;
+    } else if (p->chunked) {
+        p->state = HTTP_PARSE_CHUNK_SIZE;
+    } else if (p->content_length >= 0) {
+        p->remaining = (unsigned long long)p->content_length;
+        p->state = p->remaining ? HTTP_PARSE_BODY_LENGTH : HTTP_PARSE_DONE;
+    } else {
+        p->state = HTTP_PARSE_BODY_EOF;
+    }
+    return 1;
+}
+
+static int parse_chunk_size(http_parser_t *p, const char *line) {
+    unsigned long long size = 0;
+    int digits = 0;
+    for (; ; line++, digits++) {
+        int d;
+        if (*line >= '0' && *line <= '9') d = *line - '0';
+        else if (*line >= 'a' && *line <= 'f') d = *line - 'a' + 10;
+        else if (*line >= 'A' && *line <= 'F') d = *line - 'A' + 10;
+        else break;
+        if (digits == 15) return fail(p, "chunk size too large");
+        size = size * 16 + d;
+    }
+    if (digits == 0) return fail(p, "malformed chunk size");
+    while (is_ows(*line)) line++;
+    if (*line && *line != ';') return fail(p, "malformed chunk size");
+
+    p->remaining = size;
+    p->state = size ? HTTP_PARSE_CHUNK_DATA : HTTP_PARSE_TRAILERS;
+    return 1;
+}
+
+static int process_line(http_parser_t *p, size_t len, const http_parser_callbacks_t *cb, void *user) {
+    char *line = p->arena + p->arena_len;
+    switch (p->state) {
+        case HTTP_PARSE_STATUS:
+            return parse_status_line(p, line, len);
+        case HTTP_PARSE_HEADERS:
+            if (len == 0) return headers_complete(p, cb, user);
+            return parse_header_line(p, len);
+        case HTTP_PARSE_CHUNK_SIZE:
+            return parse_chunk_size(p, line);
+        case HTTP_PARSE_CHUNK_END:
+            if (len != 0) return fail(p, "missing CRLF after chunk data");
+            p->state = HTTP_PARSE_CHUNK_SIZE;
+            return 1;
+        case HTTP_PARSE_TRAILERS:
+            if (len == 0) p->state = HTTP_PARSE_DONE; // Trailer fields are not used
+            return 1;
+        default:
+            return fail(p, "unexpected line");
+    }
+}
+
+static int emit_body(http_parser_t *p, const http_parser_callbacks_t *cb, void *user, const char *data, size_t len) {
+    p->body_bytes += len;
+    if (cb && cb->on_body && !cb->on_body(p, data, len, user)) {
+        p->aborted = 1;
+        return 0;
+    }
+    return 1;
+}
+
+size_t http_parser_execute(http_parser_t *parser, const http_parser_callbacks_t *callbacks, void *user,
+                           const char *data, size_t len) {
+    http_parser_t *p = parser;
+    size_t pos = 0;
+
+    while (pos < len && !p->aborted && p->state != HTTP_PARSE_DONE && p->state != HTTP_PARSE_ERROR) {
+        switch (p->state) {
+            case HTTP_PARSE_BODY_LENGTH:
+            case HTTP_PARSE_CHUNK_DATA: {
+                size_t take = len - pos;
+                if (take > p->remaining) take = (size_t)p->remaining;
+                if (!emit_body(p, callbacks, user, data + pos, take)) return pos + take;
+                pos += take;
+                p->remaining -= take;
+                if (p->remaining == 0) {
+                    p->state = p->state == HTTP_PARSE_BODY_LENGTH ? HTTP_PARSE_DONE : HTTP_PARSE_CHUNK_END;
+                }
+                break;
+            }
+            case HTTP_PARSE_BODY_EOF:
+                emit_body(p, callbacks, user, data + pos, len - pos);
+                pos = len;
+                break;
+            default: {
+                // Line-oriented states: gather up to the next LF
+                const char *nl = memchr(data + pos, '\n', len - pos);
+                size_t n = nl ? (size_t)(nl - (data + pos)) : len - pos;
+                if (!arena_reserve(p, p->arena_len + p->line_len + n + 1, line_limit(p))) return pos;
+                memcpy(p->arena + p->arena_len + p->line_len, data + pos, n);
+                p->line_len += n;
+                pos += n;
+                if (!nl) break;
+                pos++;
+
+                size_t line_len = p->line_len;
+                if (line_len > 0 && p->arena[p->arena_len + line_len - 1] == '\r') line_len--;
+                p->arena[p->arena_len + line_len] = '\0';
+                p->line_len = 0;
+                if (!process_line(p, line_len, callbacks, user)) return pos;
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+int http_parser_finish(http_parser_t *parser) {
+    if (parser->state == HTTP_PARSE_BODY_EOF) parser->state = HTTP_PARSE_DONE;
+    if (parser->state == HTTP_PARSE_DONE) return 1;
+    if (parser->state != HTTP_PARSE_ERROR) fail(parser, "connection closed mid-message");
+    return 0;
+}
+
+int http_parser_reusable(const http_parser_t *parser) {
+    return parser->state == HTTP_PARSE_DONE && parser->keep_alive && !parser->aborted;
+}
@@ -0,0 +1,93 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+
+/*
+ * HTTP/1.1 Response Parser
+ *
+ * An incremental state machine fed with whatever the connection returned,
+ * in pieces of any size. One pass over the input: the status line, header
+ * and chunk-size lines are gathered into a small arena, and body bytes are
+ * handed to on_body as pointers into the caller's buffer, never copied.
+ *
+ * - Header names are matched case-insensitively; repeated fields are folded
+ *   into one comma-separated value, obsolete line folding into one line.
+ * - The body is delimited by Content-Length, chunked framing (extensions and
+ *   trailers skipped) or, failing both, the end of the connection.
+ * - HEAD responses, 1xx, 204 and 304 have no body; interim 1xx responses
+ *   (100 Continue, 103 Early Hints) are skipped to reach the final one.
+ * - http_parser_reusable says whether the connection may carry another
+ *   request once the message is done.
+ */
+
+#define HTTP_PARSER_MAX_HEADERS 64
+#define HTTP_PARSER_MAX_HEADER_BYTES 65536
+#define HTTP_PARSER_MAX_LINE 4096          // Chunk-size and trailer lines
+
+typedef enum {
+    HTTP_PARSE_STATUS,
+    HTTP_PARSE_HEADERS,
+    HTTP_PARSE_BODY_LENGTH,
+    HTTP_PARSE_BODY_EOF,
+    HTTP_PARSE_CHUNK_SIZE,
+    HTTP_PARSE_CHUNK_DATA,
+    HTTP_PARSE_CHUNK_END,
+    HTTP_PARSE_TRAILERS,
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_ERROR
+} http_parse_state_t;
+
+typedef struct {
+    size_t name;                  // Offsets of NUL-terminated strings in the arena
+    size_t value;
+} http_header_t;
+
+typedef struct http_parser_s http_parser_t;
+
+typedef struct {
+    // Status and headers of the final response are known. Return 0 to stop.
+    int (*on_headers_complete)(http_parser_t *parser, void *user);
+    // A run of body bytes (after chunk decoding). Return 0 to stop.
+    int (*on_body)(http_parser_t *parser, const char *data, size_t len, void *user);
+} http_parser_callbacks_t;
+
+struct http_parser_s {
+    http_parse_state_t state;
+    int head_request;             // Response to HEAD: headers only
+    int http_minor;               // HTTP/1.x
+    int status_code;
+    int chunked;
+    int keep_alive;               // Connection may be reused after this message
+    int aborted;                  // A callback returned 0
+    long long content_length;     // -1 if not given (or chunked)
+    unsigned long long remaining; // Bytes left in the Content-Length body or current chunk
+    unsigned long long body_bytes;
+    const char *error;
+
+    http_header_t headers[HTTP_PARSER_MAX_HEADERS];
+    int header_count;
+
+    char *arena;                  // Header strings, then the line being assembled
+    size_t arena_len;             // Committed header bytes
+    size_t arena_cap;
+    size_t line_len;              // Bytes of the pending line after arena_len
+};
+
+void http_parser_init(http_parser_t *parser, int head_request);
+void http_parser_free(http_parser_t *parser);
+
+// Parse up to len bytes; returns how many were consumed. Stops early once
+// the message is done, on a parse error, or when a callback returns 0.
+size_t http_parser_execute(http_parser_t *parser, const http_parser_callbacks_t *callbacks, void *user,
+                           const char *data, size_t len);
+
+// The connection reached EOF. Returns 1 if that completes the message.
+int http_parser_finish(http_parser_t *parser);
+
+// Case-insensitive field lookup; NULL if absent
+const char* http_parser_header(const http_parser_t *parser, const char *name);
+
+int http_parser_reusable(const http_parser_t *parser);
+
+#endif // HTTP_PARSER_H
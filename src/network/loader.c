@@ -1,9 +1,14 @@
 #include "loader.h"
 #include "http.h"
+#include "dns_cache.h"
+#include "http_cache.h"
 #include "core/html.h"
+#include "core/image_sniff.h"
 #include "core/log.h"
-#include "core/cache.h"
 #include "ui/render.h"
+#include <windows.h>
+#include <process.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -37,127 +42,552 @@ int loader_count_resources(node_t *node) {
     return count;
 }
 
-void loader_fetch_resources(node_t *node, const char *base_url, loader_progress_cb_t cb, void *ctx, int *current_count, int total_count) {
+// Pool configuration (see loader_set_concurrency)
+static int g_max_workers = LOADER_DEFAULT_WORKERS;
+static int g_max_per_host = LOADER_DEFAULT_PER_HOST;
+
+typedef enum {
+    RESOURCE_BACKGROUND,
+    RESOURCE_IMAGE,
+    RESOURCE_IFRAME
+} resource_kind_t;
+
+typedef struct loader_job_s {
+    node_t *node;
+    resource_kind_t kind;
+    char url[1024];
+    char host[256];
+    http_cache_entry_t cached; // Looked up on the main thread before dispatch
+    network_response_t *res;   // Filled in by the worker
+    image_info_t sniffed;      // Intrinsic size the worker read off the first bytes of an image
+    int size_known;            // Main thread: the node has its intrinsic size
+    struct loader_job_s *next;
+    struct loader_job_s *next_sized;
+} loader_job_t;
+
+typedef struct {
+    loader_job_t *head;
+    loader_job_t *tail;
+} job_queue_t;
+
+// State shared between the main thread and the workers. Only the ready,
+// done and sized queues cross threads; pending jobs and host accounting stay
+// on the main thread, which decides what may run next.
+typedef struct {
+    CRITICAL_SECTION lock;
+    HANDLE ready_sem;          // One count per job on the ready queue (or shutdown wakeup)
+    HANDLE done_sem;           // One count per job on the done or sized queue
+    job_queue_t ready;
+    job_queue_t done;
+    loader_job_t *sized_head;  // Images whose size is known while their bodies still stream,
+    loader_job_t *sized_tail;  // linked through next_sized
+    int shutdown;
+} fetch_pool_t;
+
+typedef struct {
+    char host[256];
+    int active;
+} host_slot_t;
+
+#define LOADER_MAX_HOSTS 64
+
+typedef struct {
+    fetch_pool_t pool;
+    HANDLE threads[LOADER_MAX_WORKERS];
+    int thread_count;
+    int workers_failed;        // A worker could not be started; make do with thread_count
+    job_queue_t pending;       // Discovered, not yet dispatched
+    int in_flight;
+    host_slot_t hosts[LOADER_MAX_HOSTS];
+    int host_count;
+    int found;                 // Resources seen by collect_jobs, cached or queued
+    int discovered;            // Resources found beyond the caller's total_count (iframe contents)
+    int images;                // <img> resources found
+    int images_sized;          // ... whose nodes have their intrinsic size
+    int images_early;          // ... found from the start of the download
+    int discovering;           // Walks and iframe jobs under way that may still find images
+    loader_sized_cb_t sized_cb;
+    int cancelled;             // The progress callback asked to stop
+} loader_state_t;
+
+static void queue_push(job_queue_t *q, loader_job_t *job) {
+    job->next = NULL;
+    if (q->tail) q->tail->next = job;
+    else q->head = job;
+    q->tail = job;
+}
+
+static loader_job_t* queue_pop(job_queue_t *q) {
+    loader_job_t *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+        job->next = NULL;
+    }
+    return job;
+}
+
+static void resolve_url(const char *base_url, const char *src, char *out, size_t out_size) {
+    if (strncmp(src, "http", 4) == 0) {
+        strncpy(out, src, out_size - 1);
+        out[out_size - 1] = '\0';
+    } else {
+        snprintf(out, out_size, "%s/%s", base_url, src);
+    }
+}
+
+// Connection limits apply per scheme://host:port
+static void extract_host(const char *url, char *host, size_t host_size) {
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    size_t len = strcspn(start, "/?#");
+    if (len >= host_size) len = host_size - 1;
+    memcpy(host, start, len);
+    host[len] = '\0';
+}
+
+// Hosts reached through tls_connect (https, gemini) resolve via the DNS cache;
+// start the lookup now so it overlaps the rest of the DOM walk and the queue
+static void prefetch_dns(const char *url, const char *host) {
+    if (strncmp(url, "https://", 8) != 0 && strncmp(url, "gemini://", 9) != 0) return;
+    if (host[0] == '[') return; // IPv6 literal
+    char name[256];
+    size_t len = strcspn(host, ":");
+    if (len >= sizeof(name)) return;
+    memcpy(name, host, len);
+    name[len] = '\0';
+    dns_prefetch(name);
+}
+
+static host_slot_t* get_host_slot(loader_state_t *state, const char *host) {
+    for (int i = 0; i < state->host_count; i++) {
+        if (strcmp(state->hosts[i].host, host) == 0) return &state->hosts[i];
+    }
+    if (state->host_count < LOADER_MAX_HOSTS) {
+        host_slot_t *slot = &state->hosts[state->host_count++];
+        strncpy(slot->host, host, sizeof(slot->host) - 1);
+        slot->host[sizeof(slot->host) - 1] = '\0';
+        slot->active = 0;
+        return slot;
+    }
+    return NULL; // Too many hosts to track: only the worker limit applies
+}
+
+static int g_connection_limit_applied = 0;
+
+static void report_progress(loader_state_t *state, loader_progress_cb_t cb, void *ctx, int *current_count, int total_count) {
+    if (cb) {
+        (*current_count)++;
+        if (cb(*current_count, total_count + state->discovered, ctx)) state->cancelled = 1;
+    }
+}
+
+// Tell sized_cb how many images still lack a size. Never 0 while iframes
+// that may hold more images are still loading.
+static void report_sized(loader_state_t *state, node_t *node, void *ctx) {
+    int unsized = state->images - state->images_sized;
+    if (unsized == 0 && state->discovering > 0) unsized = 1;
+    if (state->sized_cb && !state->cancelled && state->sized_cb(node, unsized, ctx)) state->cancelled = 1;
+}
+
+// Forget the jobs nobody has started on yet
+static int drop_pending(loader_state_t *state) {
+    int dropped = 0;
+    loader_job_t *job;
+    while ((job = queue_pop(&state->pending)) != NULL) {
+        if (job->kind == RESOURCE_IFRAME) state->discovering--;
+        cache_buffer_release(job->cached.buffer);
+        free(job);
+        dropped++;
+    }
+    return dropped;
+}
+
+static void complete_job(loader_state_t *state, loader_job_t *job,
+                         loader_progress_cb_t cb, void *ctx, int *current_count, int total_count);
+
+// Fresh cache entries complete at once; everything else is queued for the
+// network, stale entries carrying their validators along
+static void add_job(loader_state_t *state, node_t *node, resource_kind_t kind, const char *url,
+                    loader_progress_cb_t cb, void *ctx, int *current_count, int total_count) {
+    loader_job_t *job = calloc(1, sizeof(loader_job_t));
+    if (!job) {
+        LOG_ERROR("Failed to allocate fetch job for %s", url);
+        return;
+    }
+    job->node = node;
+    job->kind = kind;
+    strncpy(job->url, url, sizeof(job->url) - 1);
+    if (kind == RESOURCE_IMAGE) state->images++;
+    if (kind == RESOURCE_IFRAME) state->discovering++;
+    cache_type_t type = kind == RESOURCE_IFRAME ? CACHE_TYPE_DOCUMENT : CACHE_TYPE_IMAGE;
+    if (http_cache_begin(type, job->url, &job->cached)) {
+        complete_job(state, job, cb, ctx, current_count, total_count);
+        free(job);
+        return;
+    }
+    extract_host(job->url, job->host, sizeof(job->host));
+    prefetch_dns(job->url, job->host);
+    queue_push(&state->pending, job);
+}
+
+// Walk the DOM in document order, queueing everything that needs the network
+static void collect_jobs(loader_state_t *state, node_t *node, const char *base_url,
+                         loader_progress_cb_t cb, void *ctx, int *current_count, int total_count) {
     if (!node) return;
 
     if (node->type == DOM_NODE_ELEMENT) {
+        char full_url[1024];
+
         // Background Image
         if (node->style && node->style->bg_image) {
-            char full_url[1024];
-            if (strncmp(node->style->bg_image, "http", 4) == 0) {
-                strncpy(full_url, node->style->bg_image, 1023);
+            state->found++;
+            resolve_url(base_url, node->style->bg_image, full_url, sizeof(full_url));
+            add_job(state, node, RESOURCE_BACKGROUND, full_url, cb, ctx, current_count, total_count);
+        }
+
+        const char *src = get_attr(node, "src");
+        if (src && strcasecmp(node->tag_name, "img") == 0) {
+            state->found++;
+            resolve_url(base_url, src, full_url, sizeof(full_url));
+            add_job(state, node, RESOURCE_IMAGE, full_url, cb, ctx, current_count, total_count);
+        } else if (src && strcasecmp(node->tag_name, "iframe") == 0) {
+            state->found++;
+            resolve_url(base_url, src, full_url, sizeof(full_url));
+            add_job(state, node, RESOURCE_IFRAME, full_url, cb, ctx, current_count, total_count);
+        }
+    }
+
+    node_t *child = node->first_child;
+    while (child) {
+        collect_jobs(state, child, base_url, cb, ctx, current_count, total_count);
+        child = child->next_sibling;
+    }
+}
+
+// An image body for a node: a buffer shared with every identical image (and
+// the cached copy), or the response's own data if none can be made
+static void* share_image(network_response_t *res, cache_buffer_t **buffer) {
+    *buffer = cache_buffer_create(res->data, res->size);
+    if (*buffer) return (void *)(*buffer)->data;
+    void *data = res->data;
+    res->data = NULL; // Take ownership
+    return data;
+}
+
+// Runs on the main thread: settle the response with the cache and hand it
+// over to its node
+static void complete_job(loader_state_t *state, loader_job_t *job,
+                         loader_progress_cb_t cb, void *ctx, int *current_count, int total_count) {
+    network_response_t *res = http_cache_finish(job->url, &job->cached, job->res);
+    job->res = NULL;
+    node_t *node = job->node;
+
+    switch (job->kind) {
+        case RESOURCE_BACKGROUND:
+            if (res) {
+                LOG_DEBUG("Loaded background: %s (%lu bytes)", job->url, (unsigned long)res->size);
+                node->bg_image_data = share_image(res, &node->bg_image_buffer);
+                node->bg_image_size = res->size;
             } else {
-                snprintf(full_url, 1023, "%s/%s", base_url, node->style->bg_image);
+                LOG_WARN("Failed to load background: %s", job->url);
             }
+            break;
 
-            // Try cache first
-            size_t cached_size = 0;
-            void *cached_data = cache_get_image(full_url, &cached_size);
-            if (cached_data) {
-                LOG_DEBUG("Loaded background from cache: %s (%lu bytes)", full_url, (unsigned long) cached_size);
-                node->bg_image_data = cached_data;
-                node->bg_image_size = cached_size;
+        case RESOURCE_IMAGE:
+            if (res) {
+                LOG_DEBUG("Loaded image: %s (%lu bytes)", job->url, (unsigned long)res->size);
+                node->image_data = share_image(res, &node->image_buffer);
+                node->image_size = res->size;
+                render_extract_image_dimensions(node->image_data, res->size, &node->image_width, &node->image_height);
             } else {
-                // Fetch from network
-                network_response_t *res = network_fetch(full_url);
-                if (res) {
-                    LOG_DEBUG("Loaded background from network: %s (%lu bytes)", full_url, (unsigned long)res->size);
-                    node->bg_image_data = res->data;
-                    node->bg_image_size = res->size;
-                    // Cache for later
-                    cache_put_image(full_url, res->data, res->size);
-                    res->data = NULL; // Take ownership
-                    network_response_free(res);
-                } else {
-                    LOG_WARN("Failed to load background: %s", full_url);
-                }
+                LOG_WARN("Failed to load image: %s", job->url);
             }
-            if (cb) {
-                (*current_count)++;
-                cb(*current_count, total_count, ctx);
+            if (!job->size_known) {
+                state->images_sized++;
+                report_sized(state, node, ctx);
             }
-        }
+            break;
 
-        if (strcasecmp(node->tag_name, "img") == 0) {
-            const char *src = get_attr(node, "src");
-            if (src) {
-                char full_url[1024];
-                if (strncmp(src, "http", 4) == 0) {
-                    strncpy(full_url, src, 1023);
-                } else {
-                    snprintf(full_url, 1023, "%s/%s", base_url, src);
-                }
-
-                // Try cache first
-                size_t cached_size = 0;
-                void *cached_data = cache_get_image(full_url, &cached_size);
-                if (cached_data) {
-                    LOG_DEBUG("Loaded image from cache: %s (%lu bytes)", full_url, (unsigned long) cached_size);
-                    node->image_data = cached_data;
-                    node->image_size = cached_size;
-                    // Extract dimensions from cached image
-                    render_extract_image_dimensions(cached_data, cached_size, &node->image_width, &node->image_height);
-                } else {
-                    // Fetch from network
-                    network_response_t *res = network_fetch(full_url);
-                    if (res) {
-                        LOG_DEBUG("Loaded image from network: %s (%lu bytes)", full_url, (unsigned long)res->size);
-                        node->image_data = res->data;
-                        node->image_size = res->size;
-                        // Extract dimensions before caching
-                        render_extract_image_dimensions(res->data, res->size, &node->image_width, &node->image_height);
-                        // Cache for later
-                        cache_put_image(full_url, res->data, res->size);
-                        res->data = NULL; // Take ownership
-                        network_response_free(res);
-                    } else {
-                        LOG_WARN("Failed to load image: %s", full_url);
-                    }
-                }
-                if (cb) {
-                    (*current_count)++;
-                    cb(*current_count, total_count, ctx);
-                }
+        case RESOURCE_IFRAME:
+            if (res && res->data) {
+                node->iframe_doc = html_parse(res->data);
+                // The iframe's own resources join the same queue. They were not
+                // known when the caller counted, so they extend the progress total.
+                int before = state->found;
+                collect_jobs(state, node->iframe_doc, job->url, cb, ctx, current_count, total_count);
+                state->discovered += state->found - before;
             }
-        } else if (strcasecmp(node->tag_name, "iframe") == 0) {
-            const char *src = get_attr(node, "src");
-            if (src) {
-                char full_url[1024];
-                if (strncmp(src, "http", 4) == 0) {
-                    strncpy(full_url, src, 1023);
-                } else {
-                    snprintf(full_url, 1023, "%s/%s", base_url, src);
-                }
-
-                network_response_t *res = network_fetch(full_url);
-                if (res && res->data) {
-                    node->iframe_doc = html_parse(res->data);
-                    // Recursively fetch resources for the iframe
-                    loader_fetch_resources(node->iframe_doc, full_url, cb, ctx, current_count, total_count); // Pass pointers down? No, total_count is for *this* doc?
-                    // Actually, if we want global progress, we should count iframe resources too.
-                    // But loader_count_resources isn't recursive into iframes because they aren't loaded yet!
-                    // So progress bar will jump.
-                    // That's acceptable. Or we can just count the iframe fetch itself as 1 step.
-                    // I'll count the iframe fetch as 1 step.
-                    // The recursive fetch inside iframe won't update the MAIN progress bar total,
-                    // but it will increment current... potentially exceeding total if not careful.
-                    // Simplest: Don't pass cb to recursive iframe load? Or pass it but don't increment main count?
-                    // I'll pass it. The user will see progress go beyond 100% or just keep moving.
-                    // Or I can treat iframe content loading as separate.
-                    // Let's just update progress for the iframe *element* itself.
-                    network_response_free(res);
-                }
-                if (cb) {
-                    (*current_count)++;
-                    cb(*current_count, total_count, ctx);
-                }
+            // The last iframe in may be what the layout was waiting on
+            state->discovering--;
+            if (state->discovering == 0 && state->images > 0 && state->images == state->images_sized) {
+                report_sized(state, node, ctx);
             }
+            break;
+    }
+
+    if (res) network_response_free(res);
+    report_progress(state, cb, ctx, current_count, total_count);
+}
+
+// Collects an image body and, as soon as its first bytes give away the
+// intrinsic size, hands the job to the main thread through the sized queue
+// so layout can go ahead while the rest downloads
+typedef struct {
+    network_sink_t base;
+    network_buffer_sink_t body;
+    fetch_pool_t *pool;
+    loader_job_t *job;
+    int sniffing;              // Size not found yet, nor given up on
+    int published;
+} image_sink_t;
+
+static int image_on_headers(network_sink_t *sink, int status_code, const char *content_type, long long content_length) {
+    image_sink_t *img = (image_sink_t *)sink;
+    // Error pages are not images; a retried request starts the body over
+    img->sniffing = !img->published && status_code >= 200 && status_code < 300;
+    return img->body.base.on_headers(&img->body.base, status_code, content_type, content_length);
+}
+
+static int image_on_data(network_sink_t *sink, const char *data, size_t len) {
+    image_sink_t *img = (image_sink_t *)sink;
+    if (!img->body.base.on_data(&img->body.base, data, len)) return 0;
+    if (!img->sniffing) return 1;
+
+    image_info_t info;
+    image_sniff_result_t sniffed = image_sniff(img->body.data, img->body.size, &info);
+    if (sniffed == IMAGE_SNIFF_NEED_MORE) return 1;
+    img->sniffing = 0;
+    if (sniffed != IMAGE_SNIFF_OK) return 1;
+
+    fetch_pool_t *pool = img->pool;
+    loader_job_t *job = img->job;
+    job->sniffed = info;
+    job->next_sized = NULL;
+    EnterCriticalSection(&pool->lock);
+    if (pool->sized_tail) pool->sized_tail->next_sized = job;
+    else pool->sized_head = job;
+    pool->sized_tail = job;
+    LeaveCriticalSection(&pool->lock);
+    ReleaseSemaphore(pool->done_sem, 1, NULL);
+    img->published = 1;
+    return 1;
+}
+
+static network_response_t* fetch_image(fetch_pool_t *pool, loader_job_t *job) {
+    image_sink_t img;
+    memset(&img, 0, sizeof(img));
+    network_buffer_sink_init(&img.body);
+    img.base.on_headers = image_on_headers;
+    img.base.on_data = image_on_data;
+    img.pool = pool;
+    img.job = job;
+    network_response_t *res = http_cache_revalidate_stream(job->url, &job->cached, &img.base);
+    network_buffer_sink_attach(&img.body, res);
+    return res;
+}
+
+// Runs on the main thread: size the node from what the worker sniffed. The
+// job is still in flight; its worker no longer writes the fields used here.
+static void apply_size(loader_state_t *state, loader_job_t *job, void *ctx) {
+    node_t *node = job->node;
+    node->image_width = job->sniffed.width;
+    node->image_height = job->sniffed.height;
+    job->size_known = 1;
+    state->images_sized++;
+    state->images_early++;
+    LOG_DEBUG("Loader: %s is a %dx%d %s, sized ahead of its body", job->url,
+              job->sniffed.width, job->sniffed.height, image_format_name(job->sniffed.format));
+    report_sized(state, node, ctx);
+}
+
+static unsigned __stdcall fetch_worker(void *arg) {
+    fetch_pool_t *pool = (fetch_pool_t *)arg;
+    for (;;) {
+        WaitForSingleObject(pool->ready_sem, INFINITE);
+
+        EnterCriticalSection(&pool->lock);
+        loader_job_t *job = queue_pop(&pool->ready);
+        int shutdown = pool->shutdown;
+        LeaveCriticalSection(&pool->lock);
+
+        if (!job) {
+            if (shutdown) break;
+            continue;
         }
+
+        if (job->kind == RESOURCE_IMAGE) job->res = fetch_image(pool, job);
+        else job->res = http_cache_revalidate(job->url, &job->cached);
+
+        EnterCriticalSection(&pool->lock);
+        queue_push(&pool->done, job);
+        LeaveCriticalSection(&pool->lock);
+        ReleaseSemaphore(pool->done_sem, 1, NULL);
     }
+    return 0;
+}
 
-    node_t *child = node->first_child;
-    while (child) {
-        loader_fetch_resources(child, base_url, cb, ctx, current_count, total_count);
-        child = child->next_sibling;
+// Start workers until there is one per job (in flight or pending), up to
+// g_max_workers. Called again whenever iframes add jobs.
+static void add_workers(loader_state_t *state, int job_count) {
+    fetch_pool_t *pool = &state->pool;
+    if (!pool->ready_sem || !pool->done_sem || state->workers_failed) return;
+
+    int workers = g_max_workers < job_count ? g_max_workers : job_count;
+    while (state->thread_count < workers) {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, fetch_worker, pool, 0, NULL);
+        if (!thread) {
+            LOG_WARN("Loader: only %d of %d fetch workers started", state->thread_count, workers);
+            state->workers_failed = 1;
+            break;
+        }
+        state->threads[state->thread_count++] = thread;
+    }
+}
+
+static void start_workers(loader_state_t *state, int job_count) {
+    fetch_pool_t *pool = &state->pool;
+    InitializeCriticalSection(&pool->lock);
+    pool->ready_sem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    pool->done_sem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    if (!pool->ready_sem || !pool->done_sem) {
+        LOG_ERROR("Loader: failed to create semaphores, fetching sequentially");
+        return;
+    }
+    add_workers(state, job_count);
+}
+
+static void stop_workers(loader_state_t *state) {
+    fetch_pool_t *pool = &state->pool;
+    if (state->thread_count > 0) {
+        EnterCriticalSection(&pool->lock);
+        pool->shutdown = 1;
+        LeaveCriticalSection(&pool->lock);
+        ReleaseSemaphore(pool->ready_sem, state->thread_count, NULL);
+        WaitForMultipleObjects(state->thread_count, state->threads, TRUE, INFINITE);
+        for (int i = 0; i < state->thread_count; i++) CloseHandle(state->threads[i]);
     }
+    if (pool->ready_sem) CloseHandle(pool->ready_sem);
+    if (pool->done_sem) CloseHandle(pool->done_sem);
+    DeleteCriticalSection(&pool->lock);
+}
+
+// Move pending jobs whose host has a free connection onto the ready queue
+static void dispatch_jobs(loader_state_t *state) {
+    loader_job_t **link = &state->pending.head;
+    loader_job_t *prev = NULL;
+    while (*link && state->in_flight < state->thread_count) {
+        loader_job_t *job = *link;
+        host_slot_t *slot = get_host_slot(state, job->host);
+        if (slot && slot->active >= g_max_per_host) {
+            prev = job;
+            link = &job->next;
+            continue;
+        }
+
+        *link = job->next;
+        if (state->pending.tail == job) state->pending.tail = prev;
+        if (slot) slot->active++;
+        state->in_flight++;
+
+        EnterCriticalSection(&state->pool.lock);
+        queue_push(&state->pool.ready, job);
+        LeaveCriticalSection(&state->pool.lock);
+        ReleaseSemaphore(state->pool.ready_sem, 1, NULL);
+    }
+}
+
+void loader_set_concurrency(int max_workers, int max_per_host) {
+    if (max_workers < 1) max_workers = 1;
+    if (max_workers > LOADER_MAX_WORKERS) max_workers = LOADER_MAX_WORKERS;
+    if (max_per_host < 1) max_per_host = 1;
+    g_max_workers = max_workers;
+    g_max_per_host = max_per_host;
+    http_set_max_connections_per_server(max_per_host);
+    g_connection_limit_applied = 1;
+}
+
+void loader_fetch_resources(node_t *root, const char *base_url, loader_progress_cb_t cb, loader_sized_cb_t sized_cb,
+                            void *ctx, int *current_count, int total_count) {
+    if (!root) return;
+
+    loader_state_t *state = calloc(1, sizeof(loader_state_t));
+    if (!state) return;
+
+    if (!g_connection_limit_applied) {
+        http_set_max_connections_per_server(g_max_per_host);
+        g_connection_limit_applied = 1;
+    }
+
+    DWORD start_time = GetTickCount();
+    state->sized_cb = sized_cb;
+    state->discovering = 1;
+    collect_jobs(state, root, base_url, cb, ctx, current_count, total_count);
+    state->discovering--;
+
+    int job_count = 0;
+    for (loader_job_t *j = state->pending.head; j; j = j->next) job_count++;
+    if (job_count == 0) {
+        free(state);
+        return;
+    }
+
+    start_workers(state, job_count);
+
+    int fetched = 0;
+    int dropped = 0;
+    while (state->pending.head || state->in_flight > 0) {
+        if (state->cancelled) {
+            dropped += drop_pending(state);
+            if (state->in_flight == 0) break;
+        }
+        if (state->thread_count == 0) {
+            // No workers could be started: fetch on this thread, one at a time
+            loader_job_t *job = queue_pop(&state->pending);
+            job->res = http_cache_revalidate(job->url, &job->cached);
+            complete_job(state, job, cb, ctx, current_count, total_count);
+            free(job);
+            fetched++;
+            continue;
+        }
+
+        // Iframes may have added more jobs than the pool was started for
+        if (state->pending.head && state->thread_count < g_max_workers) {
+            int job_count = state->in_flight;
+            for (loader_job_t *j = state->pending.head; j; j = j->next) job_count++;
+            add_workers(state, job_count);
+        }
+        dispatch_jobs(state);
+        WaitForSingleObject(state->pool.done_sem, INFINITE);
+
+        EnterCriticalSection(&state->pool.lock);
+        // A job's size is always queued before the job itself is done
+        loader_job_t *sized = state->pool.sized_head;
+        if (sized) {
+            state->pool.sized_head = sized->next_sized;
+            if (!state->pool.sized_head) state->pool.sized_tail = NULL;
+        }
+        loader_job_t *job = sized ? NULL : queue_pop(&state->pool.done);
+        LeaveCriticalSection(&state->pool.lock);
+        if (sized) {
+            if (!state->cancelled) apply_size(state, sized, ctx);
+            continue;
+        }
+        if (!job) continue;
+
+        state->in_flight--;
+        host_slot_t *slot = get_host_slot(state, job->host);
+        if (slot) slot->active--;
+        complete_job(state, job, cb, ctx, current_count, total_count);
+        free(job);
+        fetched++;
+    }
+
+    int workers = state->thread_count;
+    stop_workers(state);
+    if (state->cancelled) LOG_INFO("Loader: cancelled, %d resources not fetched", dropped);
+    LOG_INFO("Loader: fetched %d resources in %lu ms (%d workers, %d per host), %d of %d images sized ahead of their bodies",
+             fetched, (unsigned long)(GetTickCount() - start_time), workers, g_max_per_host,
+             state->images_early, state->images);
+    free(state);
 }
@@ -3,9 +3,31 @@
 
 #include "core/dom.h"
 
-typedef void (*loader_progress_cb_t)(int current, int total, void *ctx);
+// Return nonzero to cancel: resources not yet requested are dropped and
+// loader_fetch_resources returns once the fetches in flight have finished
+typedef int (*loader_progress_cb_t)(int current, int total, void *ctx);
+
+// Image sizes are read off the first bytes of each download (see
+// core/image_sniff) and set on the node while the body keeps streaming.
+// It is also called when an image whose size was not sniffed finishes (or
+// fails). unsized counts the images found so far whose size is still
+// unknown, and only reaches 0 once every iframe has been fetched and
+// searched for more; from then on the remaining bodies will not change the
+// layout. Return nonzero to cancel, as above.
+typedef int (*loader_sized_cb_t)(node_t *node, int unsized, void *ctx);
+
+// Resources are fetched by a pool of worker threads. Results are attached to
+// their nodes, cached and reported through the progress callback on the
+// calling thread, in completion order.
+#define LOADER_DEFAULT_WORKERS 6
+#define LOADER_DEFAULT_PER_HOST 6
+#define LOADER_MAX_WORKERS 16
+
+// Limit the worker count and the concurrent connections to any one host
+void loader_set_concurrency(int max_workers, int max_per_host);
 
 int loader_count_resources(node_t *root);
-void loader_fetch_resources(node_t *root, const char *base_url, loader_progress_cb_t cb, void *ctx, int *current_count, int total_count);
+void loader_fetch_resources(node_t *root, const char *base_url, loader_progress_cb_t cb, loader_sized_cb_t sized_cb,
+                            void *ctx, int *current_count, int total_count);
 
 #endif // LOADER_H
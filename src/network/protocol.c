@@ -11,10 +11,92 @@ void network_response_free(network_response_t *res) {
         if (res->data) free(res->data);
         if (res->content_type) free(res->content_type);
         if (res->final_url) free(res->final_url);
+        free(res->etag);
+        free(res->last_modified);
+        free(res->cache_control);
+        free(res->expires);
         free(res);
     }
 }
 
+void network_response_set_validators(network_response_t *res, const char *etag, const char *last_modified,
+                                     const char *cache_control, const char *expires) {
+    if (!res) return;
+    if (etag) res->etag = strdup(etag);
+    if (last_modified) res->last_modified = strdup(last_modified);
+    if (cache_control) res->cache_control = strdup(cache_control);
+    if (expires) res->expires = strdup(expires);
+}
+
+static int buffer_reserve(network_buffer_sink_t *b, size_t needed) {
+    if (needed <= b->cap) return 1;
+    size_t new_cap = b->cap ? b->cap : NETWORK_BUFFER_INITIAL;
+    while (new_cap < needed) new_cap *= 2;
+    char *new_data = realloc(b->data, new_cap);
+    if (!new_data) {
+        LOG_ERROR("Response buffer: failed to grow to %lu bytes", (unsigned long)new_cap);
+        b->failed = 1;
+        return 0;
+    }
+    b->data = new_data;
+    b->cap = new_cap;
+    return 1;
+}
+
+static int buffer_on_headers(network_sink_t *sink, int status_code, const char *content_type, long long content_length) {
+    network_buffer_sink_t *b = (network_buffer_sink_t *)sink;
+    (void)content_type;
+    b->size = 0;
+    // 204 and 304 may announce the length of a body they do not carry
+    b->expected = status_code == 204 || status_code == 304 ? -1 : content_length;
+    if (content_length > 0 && content_length <= NETWORK_BUFFER_MAX_PREALLOC && (size_t)content_length + 1 > b->cap) {
+        // Exact size up front; a short body just leaves the tail unused
+        char *new_data = realloc(b->data, (size_t)content_length + 1);
+        if (new_data) {
+            b->data = new_data;
+            b->cap = (size_t)content_length + 1;
+        }
+    }
+    return 1;
+}
+
+static int buffer_on_data(network_sink_t *sink, const char *data, size_t len) {
+    network_buffer_sink_t *b = (network_buffer_sink_t *)sink;
+    if (!buffer_reserve(b, b->size + len + 1)) return 0;
+    memcpy(b->data + b->size, data, len);
+    b->size += len;
+    b->data[b->size] = '\0';
+    return 1;
+}
+
+void network_buffer_sink_init(network_buffer_sink_t *sink) {
+    memset(sink, 0, sizeof(*sink));
+    sink->base.on_headers = buffer_on_headers;
+    sink->base.on_data = buffer_on_data;
+    sink->expected = -1;
+}
+
+void network_buffer_sink_attach(network_buffer_sink_t *sink, network_response_t *res) {
+    if (res && !res->data) {
+        if (sink->failed || (sink->expected >= 0 && (long long)sink->size != sink->expected)) {
+            LOG_WARN("Response buffer: %lu body bytes, %s", (unsigned long)sink->size,
+                     sink->failed ? "out of memory" : "not what Content-Length announced");
+            res->incomplete = 1;
+        }
+        if (sink->size > 0) {
+            res->data = sink->data;
+            res->size = sink->size;
+            sink->data = NULL;
+        }
+    }
+    free(sink->data);
+    sink->data = NULL;
+    sink->size = 0;
+    sink->cap = 0;
+    sink->expected = -1;
+    sink->failed = 0;
+}
+
 // Mock for now, in a real implementation this would show a dialog
 static char* platform_input_prompt(const char *prompt) {
     (void)prompt;
@@ -22,7 +104,9 @@ static char* platform_input_prompt(const char *prompt) {
     return NULL; 
 }
 
-network_response_t* network_fetch(const char *url) {
+// extra_headers only go out with the first request; they describe what the
+// caller holds for url, not for wherever it redirects
+static network_response_t* fetch_stream(const char *url, const char *extra_headers, network_sink_t *sink) {
     int redirect_count = 0;
     const int max_redirects = 5;
     char current_url[2048];
@@ -37,9 +121,9 @@ network_response_t* network_fetch(const char *url) {
         }
         network_response_t *res = NULL;
         if (strncmp(current_url, "gemini://", 9) == 0) {
-            res = gemini_fetch(current_url);
+            res = gemini_fetch_stream(current_url, sink);
         } else {
-            res = http_fetch(current_url);
+            res = http_fetch_stream(current_url, redirect_count == 0 ? extra_headers : NULL, sink);
         }
 
         if (!res) return NULL;
@@ -62,7 +146,7 @@ network_response_t* network_fetch(const char *url) {
         // HTTP: 301, 302, 303, 307, 308
         // Gemini: 30, 31
         int is_redirect = 0;
-        if (res->status_code >= 300 && res->status_code <= 308) is_redirect = 1;
+        if (res->status_code >= 300 && res->status_code <= 308 && res->status_code != 304) is_redirect = 1;
         if (res->status_code == 30 || res->status_code == 31) is_redirect = 2; // Gemini type
 
         if (is_redirect) {
@@ -86,6 +170,40 @@ network_response_t* network_fetch(const char *url) {
     return NULL;
 }
 
+network_response_t* network_fetch_stream(const char *url, network_sink_t *sink) {
+    return fetch_stream(url, NULL, sink);
+}
+
+network_response_t* network_fetch(const char *url) {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+    network_response_t *res = network_fetch_stream(url, &sink.base);
+    network_buffer_sink_attach(&sink, res);
+    return res;
+}
+
+network_response_t* network_fetch_conditional_stream(const char *url, const char *etag, const char *last_modified,
+                                                    network_sink_t *sink) {
+    char headers[768] = {0};
+    size_t len = 0;
+    if (etag && strlen(etag) < 256) {
+        len += snprintf(headers + len, sizeof(headers) - len, "If-None-Match: %s\r\n", etag);
+    }
+    if (last_modified && strlen(last_modified) < 128) {
+        len += snprintf(headers + len, sizeof(headers) - len, "If-Modified-Since: %s\r\n", last_modified);
+    }
+
+    return fetch_stream(url, len ? headers : NULL, sink);
+}
+
+network_response_t* network_fetch_conditional(const char *url, const char *etag, const char *last_modified) {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+    network_response_t *res = network_fetch_conditional_stream(url, etag, last_modified, &sink.base);
+    network_buffer_sink_attach(&sink, res);
+    return res;
+}
+
 network_response_t* network_post(const char *url, const char *body, const char *content_type) {
     if (strncmp(url, "gemini://", 9) == 0) {
         return NULL; // Gemini doesn't have POST
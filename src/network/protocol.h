@@ -16,11 +16,72 @@ typedef struct {
     char *content_type;
     int status_code;
     char *final_url; // The URL after all redirects
+    int incomplete;  // The body was cut short (connection lost, bad framing or coding); never cached
+    // Caching headers as sent by the server, NULL when absent
+    char *etag;
+    char *last_modified;
+    char *cache_control;
+    char *expires;
 } network_response_t;
 
 void network_response_free(network_response_t *res);
 
+// Copy the caching headers into res (any may be NULL)
+void network_response_set_validators(network_response_t *res, const char *etag, const char *last_modified,
+                                     const char *cache_control, const char *expires);
+
 network_response_t* network_fetch(const char *url);
 network_response_t* network_post(const char *url, const char *body, const char *content_type);
 
+/*
+ * Streaming fetch
+ *
+ * Body bytes are handed to a sink as they come off the connection instead of
+ * being collected into network_response_t::data. on_headers runs once the
+ * status and headers of the final response are known and before any data;
+ * redirect responses that are followed never reach the sink. Either callback
+ * may return 0 to stop the transfer early.
+ *
+ * The response returned by a streaming fetch carries the status, content
+ * type and final URL; its data is NULL unless it is an unfollowed redirect,
+ * where it holds the Location as usual.
+ */
+
+typedef struct network_sink_s network_sink_t;
+struct network_sink_s {
+    // content_length is -1 when the server did not announce one
+    int (*on_headers)(network_sink_t *sink, int status_code, const char *content_type, long long content_length);
+    int (*on_data)(network_sink_t *sink, const char *data, size_t len);
+};
+
+// Collects the body into one buffer, grown geometrically or preallocated
+// from Content-Length, so a download of n bytes costs O(n) copying
+#define NETWORK_BUFFER_INITIAL 16384
+#define NETWORK_BUFFER_MAX_PREALLOC (64 * 1024 * 1024)
+
+typedef struct {
+    network_sink_t base;
+    char *data;      // NUL-terminated once anything arrived
+    size_t size;
+    size_t cap;
+    long long expected; // Content-Length, -1 if not announced
+    int failed;      // Out of memory; the transfer was stopped
+} network_buffer_sink_t;
+
+void network_buffer_sink_init(network_buffer_sink_t *sink);
+
+// Move the collected body into res->data (unless it already holds a redirect
+// Location) and reset the sink; frees the buffer if res is NULL. A body cut
+// short by running out of memory, or not matching its Content-Length, marks
+// res incomplete.
+void network_buffer_sink_attach(network_buffer_sink_t *sink, network_response_t *res);
+
+network_response_t* network_fetch_stream(const char *url, network_sink_t *sink);
+
+// GET with If-None-Match / If-Modified-Since on the first request (either
+// validator may be NULL). A 304 comes back as is, with no data.
+network_response_t* network_fetch_conditional(const char *url, const char *etag, const char *last_modified);
+network_response_t* network_fetch_conditional_stream(const char *url, const char *etag, const char *last_modified,
+                                                    network_sink_t *sink);
+
 #endif // PROTOCOL_H
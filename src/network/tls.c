@@ -1,11 +1,35 @@
 #include "tls.h"
+#include "dns_cache.h"
 #include "core/log.h"
+#include "core/lazy_lock.h"
 #include <ws2tcpip.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+typedef struct {
+    char host[256];
+    int port;
+    SSL_SESSION *session;        // NULL for a free slot
+    unsigned long last_used;
+} session_entry_t;
+
+static SSL_CTX *g_ctx = NULL;
 static int openssl_initialized = 0;
+static session_entry_t g_sessions[TLS_SESSION_CACHE_SIZE];
+static unsigned long g_session_clock = 0;
+static tls_stats_t g_stats = {0, 0, 0, 0};
+static tls_connection_t *g_live = NULL;  // Connections with a socket, newest first
+
+static lazy_lock_t g_tls_lock;
+
+static void tls_lock(void) {
+    lazy_lock_enter(&g_tls_lock);
+}
+
+static void tls_unlock(void) {
+    lazy_lock_leave(&g_tls_lock);
+}
 
 static void init_openssl(void) {
     if (!openssl_initialized) {
@@ -26,29 +50,12 @@ static void log_openssl_errors(const char *context) {
     }
 }
 
-tls_connection_t* tls_connect(const char *host, int port) {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        LOG_ERROR("WSAStartup failed");
-        return NULL;
-    }
-
-    init_openssl();
-
-    tls_connection_t *conn = calloc(1, sizeof(tls_connection_t));
-    if (!conn) {
-        LOG_ERROR("Failed to allocate connection structure");
-        WSACleanup();
-        return NULL;
-    }
-
+static SSL_CTX* create_context(void) {
     // Create SSL context for TLS 1.2 only (OpenSSL 1.1.1 compatible)
     const SSL_METHOD *method = TLSv1_2_client_method();
-    conn->ctx = SSL_CTX_new(method);
-    if (!conn->ctx) {
+    SSL_CTX *ctx = SSL_CTX_new(method);
+    if (!ctx) {
         log_openssl_errors("SSL_CTX_new failed");
-        free(conn);
-        WSACleanup();
         return NULL;
     }
 
@@ -68,7 +75,7 @@ tls_connection_t* tls_connect(const char *host, int port) {
                               "AES128-GCM-SHA256:"
                               "AES256-GCM-SHA384";
 
-    if (!SSL_CTX_set_cipher_list(conn->ctx, cipher_list)) {
+    if (!SSL_CTX_set_cipher_list(ctx, cipher_list)) {
         log_openssl_errors("Failed to set cipher list");
         LOG_INFO("Using default cipher list");
     }
@@ -76,60 +83,273 @@ tls_connection_t* tls_connect(const char *host, int port) {
     // Set elliptic curve for ECDHE - P-256 is widely supported (OpenSSL 1.1.1 compatible)
     EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
     if (ecdh) {
-        SSL_CTX_set_tmp_ecdh(conn->ctx, ecdh);
+        SSL_CTX_set_tmp_ecdh(ctx, ecdh);
         EC_KEY_free(ecdh);
     }
 
-    // Resolve hostname
-    char port_str[16];
-    sprintf(port_str, "%d", port);
+    // Sessions are cached per host below; OpenSSL's own client cache is not
+    // keyed by server, so keep it off
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
 
-    struct addrinfo hints = {0}, *result = NULL;
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+    return ctx;
+}
 
-    if (getaddrinfo(host, port_str, &hints, &result) != 0) {
-        LOG_ERROR("getaddrinfo failed for %s", host);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
-        return NULL;
+// Build the shared context once. Returns it with a reference held for the
+// caller, or NULL on failure (retried next call).
+static SSL_CTX* acquire_context(void) {
+    tls_lock();
+    if (!g_ctx) {
+        init_openssl();
+        g_ctx = create_context();
     }
+    SSL_CTX *ctx = g_ctx;
+    if (ctx) SSL_CTX_up_ref(ctx);
+    tls_unlock();
+    return ctx;
+}
 
-    // Create socket
-    conn->socket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (conn->socket == INVALID_SOCKET) {
-        LOG_ERROR("socket creation failed");
-        freeaddrinfo(result);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
-        return NULL;
+static session_entry_t* find_session(const char *host, int port) {
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        session_entry_t *e = &g_sessions[i];
+        if (e->session && e->port == port && strcmp(e->host, host) == 0) return e;
     }
+    return NULL;
+}
 
-    // Connect
-    if (connect(conn->socket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR) {
-        LOG_ERROR("connect failed to %s:%d (error: %lu)", host, port, GetLastError());
-        closesocket(conn->socket);
-        freeaddrinfo(result);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
+// Returns a new reference to the cached session for host:port, or NULL
+static SSL_SESSION* lookup_session(const char *host, int port) {
+    SSL_SESSION *session = NULL;
+    tls_lock();
+    session_entry_t *e = find_session(host, port);
+    if (e) {
+        e->last_used = ++g_session_clock;
+        session = e->session;
+        SSL_SESSION_up_ref(session);
+    }
+    tls_unlock();
+    return session;
+}
+
+// Takes ownership of session (NULL just forgets host:port)
+static void store_session(const char *host, int port, SSL_SESSION *session) {
+    if (strlen(host) >= sizeof(g_sessions[0].host)) {
+        if (session) SSL_SESSION_free(session);
+        return;
+    }
+
+    tls_lock();
+    session_entry_t *e = find_session(host, port);
+    if (!e && session) {
+        // Free slot, else the least recently used one
+        e = &g_sessions[0];
+        for (int i = 0; i < TLS_SESSION_CACHE_SIZE && e->session; i++) {
+            if (!g_sessions[i].session || g_sessions[i].last_used < e->last_used) e = &g_sessions[i];
+        }
+    }
+    SSL_SESSION *old = NULL;
+    if (e) {
+        old = e->session;
+        e->session = session;
+        if (session) {
+            strcpy(e->host, host);
+            e->port = port;
+            e->last_used = ++g_session_clock;
+        }
+    }
+    tls_unlock();
+
+    if (old) SSL_SESSION_free(old);
+}
+
+static void count_handshake(unsigned long *counter) {
+    tls_lock();
+    (*counter)++;
+    tls_unlock();
+}
+
+// Order addresses alternating between families, starting with the family of
+// the resolver's first choice (RFC 8305 section 4)
+static int interleave_families(const dns_result_t *resolved, int *order) {
+    int first_family = resolved->addrs[0].family;
+    int used[DNS_CACHE_MAX_ADDRS] = {0};
+    int count = 0;
+    int want_first = 1;
+    while (count < resolved->count) {
+        int picked = -1;
+        for (int pass = 0; pass < 2 && picked < 0; pass++) {
+            // Preferred family this turn, or whatever is left once it runs out
+            int want = pass == 0 ? want_first : !want_first;
+            for (int i = 0; i < resolved->count; i++) {
+                if (!used[i] && (resolved->addrs[i].family == first_family) == want) {
+                    picked = i;
+                    break;
+                }
+            }
+        }
+        used[picked] = 1;
+        order[count++] = picked;
+        want_first = !want_first;
+    }
+    return count;
+}
+
+// Start a non-blocking connect. Returns 1 if already connected, 0 if in
+// progress, -1 on immediate failure.
+static int start_attempt(const dns_address_t *addr, SOCKET *out, int *last_error) {
+    *out = socket(addr->family, SOCK_STREAM, IPPROTO_TCP);
+    if (*out == INVALID_SOCKET) {
+        *last_error = WSAGetLastError();
+        return -1;
+    }
+    u_long non_blocking = 1;
+    ioctlsocket(*out, FIONBIO, &non_blocking);
+    if (connect(*out, (const struct sockaddr *)&addr->addr, addr->addr_len) == 0) return 1;
+    int err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK || err == WSAEINPROGRESS) return 0;
+    *last_error = err;
+    closesocket(*out);
+    *out = INVALID_SOCKET;
+    return -1;
+}
+
+SOCKET tls_connect_addresses(const char *host, int port, const dns_result_t *resolved, DWORD timeout_ms) {
+    int order[DNS_CACHE_MAX_ADDRS];
+    int count = interleave_families(resolved, order);
+    SOCKET pending[DNS_CACHE_MAX_ADDRS];
+    int pending_addr[DNS_CACHE_MAX_ADDRS];
+    int pending_count = 0;
+    int next = 0;
+    int last_error = 0;
+    int winner_addr = -1;
+    int attempt_failed = 0;      // A failure starts the next attempt without waiting
+    SOCKET winner = INVALID_SOCKET;
+    DWORD start = GetTickCount();
+    DWORD last_attempt = start;
+
+    while (winner == INVALID_SOCKET) {
+        DWORD now = GetTickCount();
+        DWORD elapsed = now - start;
+        if (elapsed >= timeout_ms) {
+            last_error = WSAETIMEDOUT;
+            break;
+        }
+
+        if (next < count && (pending_count == 0 || attempt_failed || now - last_attempt >= TLS_CONNECT_ATTEMPT_DELAY_MS)) {
+            SOCKET s;
+            int addr_index = order[next++];
+            int started = start_attempt(&resolved->addrs[addr_index], &s, &last_error);
+            last_attempt = now;
+            attempt_failed = started < 0;
+            if (started == 1) {
+                winner = s;
+                winner_addr = addr_index;
+            } else if (started == 0) {
+                pending[pending_count] = s;
+                pending_addr[pending_count++] = addr_index;
+            }
+            continue;
+        }
+        if (pending_count == 0) break; // Every address failed
+
+        // Sleep until an attempt settles, the next one is due or time is up
+        DWORD wait = timeout_ms - elapsed;
+        if (next < count) {
+            DWORD due = TLS_CONNECT_ATTEMPT_DELAY_MS - (now - last_attempt);
+            if (due < wait) wait = due;
+        }
+        fd_set writable, failed;
+        FD_ZERO(&writable);
+        FD_ZERO(&failed);
+        SOCKET max_socket = 0;
+        for (int i = 0; i < pending_count; i++) {
+            FD_SET(pending[i], &writable);
+            FD_SET(pending[i], &failed);
+            if (pending[i] > max_socket) max_socket = pending[i];
+        }
+        struct timeval timeout = {(long)(wait / 1000), (long)(wait % 1000) * 1000};
+        if (select((int)max_socket + 1, NULL, &writable, &failed, &timeout) == SOCKET_ERROR) {
+            last_error = WSAGetLastError();
+            break;
+        }
+
+        for (int i = pending_count - 1; i >= 0 && winner == INVALID_SOCKET; i--) {
+            SOCKET s = pending[i];
+            int is_failed = FD_ISSET(s, &failed);
+            if (!is_failed && !FD_ISSET(s, &writable)) continue;
+
+            // Windows reports a refused connect as an exception, POSIX as writable
+            int err = 0;
+            int err_len = sizeof(err);
+            getsockopt(s, SOL_SOCKET, SO_ERROR, (char *)&err, &err_len);
+            if (!is_failed && err == 0) {
+                winner = s;
+                winner_addr = pending_addr[i];
+            } else {
+                last_error = err ? err : WSAECONNREFUSED;
+                attempt_failed = 1;
+                closesocket(s);
+            }
+            pending[i] = pending[--pending_count];
+            pending_addr[i] = pending_addr[pending_count];
+        }
+    }
+
+    for (int i = 0; i < pending_count; i++) closesocket(pending[i]);
+
+    if (winner == INVALID_SOCKET) {
+        LOG_ERROR("connect failed to %s:%d after %lu ms (%d address(es), error: %d)",
+                  host, port, (unsigned long)(GetTickCount() - start), count, last_error);
+        return INVALID_SOCKET;
+    }
+
+    // Back to blocking for OpenSSL, but never forever: a server that accepts
+    // and then goes quiet fails the handshake or read instead of hanging it
+    u_long blocking = 0;
+    ioctlsocket(winner, FIONBIO, &blocking);
+    DWORD io_timeout = TLS_IO_TIMEOUT_MS;
+    setsockopt(winner, SOL_SOCKET, SO_RCVTIMEO, (const char *)&io_timeout, sizeof(io_timeout));
+    setsockopt(winner, SOL_SOCKET, SO_SNDTIMEO, (const char *)&io_timeout, sizeof(io_timeout));
+    if (winner_addr != order[0]) {
+        LOG_INFO("Connected to %s:%d via fallback address %d of %d", host, port, winner_addr + 1, count);
+    }
+    return winner;
+}
+
+tls_connection_t* tls_connect(const char *host, int port) {
+    SSL_CTX *ctx = acquire_context();
+    if (!ctx) return NULL;
+
+    tls_connection_t *conn = calloc(1, sizeof(tls_connection_t));
+    if (!conn) {
+        LOG_ERROR("Failed to allocate connection structure");
+        SSL_CTX_free(ctx);
         return NULL;
     }
-    freeaddrinfo(result);
+    conn->socket = INVALID_SOCKET;
+
+    // Resolve hostname (cached across connections)
+    dns_result_t resolved;
+    if (!dns_resolve(host, port, &resolved)) {
+        LOG_ERROR("Could not resolve %s", host);
+        goto fail;
+    }
+
+    conn->socket = tls_connect_addresses(host, port, &resolved, TLS_CONNECT_TIMEOUT_MS);
+    if (conn->socket == INVALID_SOCKET) goto fail;
+    tls_lock();
+    conn->live_next = g_live;
+    if (g_live) g_live->live_prev = conn;
+    g_live = conn;
+    tls_unlock();
     LOG_DEBUG("TCP connection established to %s:%d", host, port);
 
-    // Create SSL structure
-    conn->ssl = SSL_new(conn->ctx);
+    // Create SSL structure; it holds its own reference to the shared context
+    conn->ssl = SSL_new(ctx);
+    SSL_CTX_free(ctx);
+    ctx = NULL;
     if (!conn->ssl) {
         log_openssl_errors("SSL_new failed");
-        closesocket(conn->socket);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
-        return NULL;
+        goto fail;
     }
 
     // Set SNI (Server Name Indication)
@@ -141,12 +361,18 @@ tls_connection_t* tls_connect(const char *host, int port) {
     // Associate socket with SSL
     if (!SSL_set_fd(conn->ssl, conn->socket)) {
         log_openssl_errors("SSL_set_fd failed");
-        SSL_free(conn->ssl);
-        closesocket(conn->socket);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
-        return NULL;
+        goto fail;
+    }
+
+    // Offer the last session negotiated with this server for resumption
+    SSL_SESSION *cached = lookup_session(host, port);
+    if (cached) {
+        if (SSL_set_session(conn->ssl, cached)) {
+            count_handshake(&g_stats.sessions_offered);
+        } else {
+            log_openssl_errors("SSL_set_session failed");
+        }
+        SSL_SESSION_free(cached);
     }
 
     // Perform TLS handshake
@@ -173,20 +399,37 @@ tls_connection_t* tls_connect(const char *host, int port) {
                 break;
         }
 
-        SSL_free(conn->ssl);
-        closesocket(conn->socket);
-        SSL_CTX_free(conn->ctx);
-        free(conn);
-        WSACleanup();
-        return NULL;
+        // Don't offer a session the server may have choked on again
+        if (cached) store_session(host, port, NULL);
+        count_handshake(&g_stats.failed_handshakes);
+        goto fail;
     }
 
     // Log connection info
     const char *version = SSL_get_version(conn->ssl);
     const char *cipher = SSL_get_cipher(conn->ssl);
-    LOG_INFO("TLS handshake successful: %s using %s", version, cipher);
+    if (SSL_session_reused(conn->ssl)) {
+        count_handshake(&g_stats.resumed_handshakes);
+        LOG_INFO("TLS session resumed: %s using %s", version, cipher);
+    } else {
+        count_handshake(&g_stats.full_handshakes);
+        LOG_INFO("TLS handshake successful: %s using %s", version, cipher);
+
+        // TLS 1.2 sessions are final once the handshake completes
+        SSL_SESSION *session = SSL_get1_session(conn->ssl);
+        if (session && !SSL_SESSION_is_resumable(session)) {
+            SSL_SESSION_free(session);
+            session = NULL;
+        }
+        store_session(host, port, session);
+    }
 
     return conn;
+
+fail:
+    if (ctx) SSL_CTX_free(ctx);
+    tls_close(conn);
+    return NULL;
 }
 
 int tls_send(tls_connection_t *conn, const char *buf, int len) {
@@ -224,18 +467,59 @@ void tls_close(tls_connection_t *conn) {
     if (!conn) return;
 
     if (conn->ssl) {
-        SSL_shutdown(conn->ssl);
+        // close_notify only makes sense on an established session
+        if (SSL_is_init_finished(conn->ssl)) SSL_shutdown(conn->ssl);
         SSL_free(conn->ssl);
     }
 
     if (conn->socket != INVALID_SOCKET) {
+        tls_lock();
+        if (conn->live_prev) conn->live_prev->live_next = conn->live_next;
+        else if (g_live == conn) g_live = conn->live_next;
+        if (conn->live_next) conn->live_next->live_prev = conn->live_prev;
+        tls_unlock();
         closesocket(conn->socket);
     }
 
-    if (conn->ctx) {
-        SSL_CTX_free(conn->ctx);
+    free(conn);
+}
+
+void tls_get_stats(tls_stats_t *out) {
+    if (!out) return;
+    tls_lock();
+    *out = g_stats;
+    tls_unlock();
+}
+
+void tls_log_stats(void) {
+    tls_stats_t s;
+    tls_get_stats(&s);
+    unsigned long total = s.full_handshakes + s.resumed_handshakes;
+    LOG_INFO("TLS: %lu handshakes, %lu full, %lu resumed (%lu%% of %lu offered sessions), %lu failed",
+             total, s.full_handshakes, s.resumed_handshakes,
+             s.sessions_offered ? (s.resumed_handshakes * 100) / s.sessions_offered : 0,
+             s.sessions_offered, s.failed_handshakes);
+}
+
+void tls_abort_all(void) {
+    int count = 0;
+    tls_lock();
+    for (tls_connection_t *c = g_live; c; c = c->live_next) {
+        shutdown(c->socket, SD_BOTH);
+        count++;
     }
+    tls_unlock();
+    if (count) LOG_INFO("TLS: aborted %d open connection(s)", count);
+}
 
-    free(conn);
-    WSACleanup();
+void tls_cleanup(void) {
+    tls_lock();
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (g_sessions[i].session) SSL_SESSION_free(g_sessions[i].session);
+        g_sessions[i].session = NULL;
+    }
+    // Connections still open keep the context alive through their SSL objects
+    if (g_ctx) SSL_CTX_free(g_ctx);
+    g_ctx = NULL;
+    tls_unlock();
 }
@@ -5,16 +5,66 @@
 #include <windows.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include "dns_cache.h"
 
-typedef struct {
+/*
+ * TLS Client
+ *
+ * Every connection is created from one process-wide SSL_CTX, set up on first
+ * use. Winsock is started by the DNS cache, which resolves every host first.
+ * Sessions negotiated with a host are kept per host and port and offered
+ * again on the next connection, so repeat visits (Gemini and HTTPS alike)
+ * get an abbreviated handshake when the server still knows the session. All
+ * functions are thread-safe.
+ */
+
+#define TLS_SESSION_CACHE_SIZE 64
+
+// TCP connects race the resolved addresses (RFC 8305 "happy eyeballs"): the
+// next address is tried whenever the current ones have not connected within
+// the attempt delay, and the whole connect gives up after the timeout
+#define TLS_CONNECT_ATTEMPT_DELAY_MS 250
+#define TLS_CONNECT_TIMEOUT_MS 10000
+
+// Sends and receives on a connected socket (the handshake included) fail
+// after this long without progress
+#define TLS_IO_TIMEOUT_MS 30000
+
+typedef struct tls_connection_s {
     SOCKET socket;
-    SSL_CTX *ctx;
     SSL *ssl;
+    struct tls_connection_s *live_prev;  // Open connections, for tls_abort_all
+    struct tls_connection_s *live_next;
 } tls_connection_t;
 
+typedef struct {
+    unsigned long full_handshakes;
+    unsigned long resumed_handshakes;
+    unsigned long failed_handshakes;
+    unsigned long sessions_offered;   // Connections that offered a cached session
+} tls_stats_t;
+
 tls_connection_t* tls_connect(const char *host, int port);
 int tls_send(tls_connection_t *conn, const char *buf, int len);
 int tls_recv(tls_connection_t *conn, char *buf, int max_len);
 void tls_close(tls_connection_t *conn);
 
+// The TCP connect behind tls_connect: race the resolved addresses, starting
+// the next one whenever the previous has not finished within
+// TLS_CONNECT_ATTEMPT_DELAY_MS, and keep the first that succeeds. Gives up
+// after timeout_ms in total. Returns a blocking socket with send and receive
+// timeouts set, or INVALID_SOCKET. Winsock must already be started.
+SOCKET tls_connect_addresses(const char *host, int port, const dns_result_t *resolved, DWORD timeout_ms);
+
+void tls_get_stats(tls_stats_t *out);
+void tls_log_stats(void);
+
+// Shut down the socket of every open connection, so threads blocked in a
+// handshake, tls_recv or tls_send on one return at once with an error. The
+// connections stay allocated; their owners still tls_close them.
+void tls_abort_all(void);
+
+// Free the shared context and cached sessions; tls_connect starts over after this
+void tls_cleanup(void);
+
 #endif // TLS_H
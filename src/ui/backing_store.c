@@ -0,0 +1,230 @@
+#include "backing_store.h"
+#include "render.h"
+#include "core/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Floor division, so coordinates left of or above the page map to negative tiles
+static int tile_index(int coord, int size) {
+    return coord >= 0 ? coord / size : -((-coord + size - 1) / size);
+}
+
+static int compute_max_tiles(int viewport_height) {
+    // One viewport on screen plus one above and one below, for up to two
+    // columns when scrolled horizontally part way across a tile
+    int rows = viewport_height / BACKING_TILE_HEIGHT + 2;
+    return rows * 3 * 2;
+}
+
+static void fill_background(HDC hdc, const RECT *rc, COLORREF color) {
+    HBRUSH brush = CreateSolidBrush(color);
+    FillRect(hdc, rc, brush);
+    DeleteObject(brush);
+}
+
+backing_store_t* backing_store_create(int viewport_width, int viewport_height, COLORREF background) {
+    backing_store_t *store = calloc(1, sizeof(backing_store_t));
+    if (!store) return NULL;
+    store->background = background;
+    backing_store_resize(store, viewport_width, viewport_height);
+    return store;
+}
+
+void backing_store_invalidate(backing_store_t *store) {
+    if (!store) return;
+    for (int i = 0; i < store->tile_count; i++) {
+        if (store->tiles[i].bitmap) DeleteObject(store->tiles[i].bitmap);
+    }
+    store->tile_count = 0;
+}
+
+void backing_store_free(backing_store_t *store) {
+    if (!store) return;
+    backing_store_invalidate(store);
+    free(store->tiles);
+    free(store);
+}
+
+void backing_store_resize(backing_store_t *store, int viewport_width, int viewport_height) {
+    if (!store) return;
+    if (viewport_width < 1) viewport_width = 1;
+    if (viewport_height < 1) viewport_height = 1;
+
+    int max_tiles = compute_max_tiles(viewport_height);
+    if (viewport_width != store->tile_width || max_tiles != store->max_tiles) {
+        backing_store_invalidate(store);
+        backing_tile_t *tiles = realloc(store->tiles, sizeof(backing_tile_t) * max_tiles);
+        if (!tiles) {
+            LOG_ERROR("Backing store: failed to allocate %d tile slots", max_tiles);
+            free(store->tiles);
+            store->tiles = NULL;
+            store->max_tiles = 0;
+        } else {
+            store->tiles = tiles;
+            store->max_tiles = max_tiles;
+        }
+        store->tile_width = viewport_width;
+    }
+    store->viewport_height = viewport_height;
+}
+
+static backing_tile_t* find_tile(backing_store_t *store, int col, int row) {
+    for (int i = 0; i < store->tile_count; i++) {
+        if (store->tiles[i].col == col && store->tiles[i].row == row) return &store->tiles[i];
+    }
+    return NULL;
+}
+
+// Render a tile, reusing the least recently used slot once the store is full
+static backing_tile_t* render_tile(backing_store_t *store, HDC reference, display_list_t *list, int col, int row) {
+    if (store->max_tiles == 0) return NULL;
+
+    HDC memDC = CreateCompatibleDC(reference);
+    if (!memDC) return NULL;
+
+    backing_tile_t *tile;
+    if (store->tile_count < store->max_tiles) {
+        tile = &store->tiles[store->tile_count];
+        tile->bitmap = CreateCompatibleBitmap(reference, store->tile_width, BACKING_TILE_HEIGHT);
+        if (!tile->bitmap) {
+            LOG_WARN("Backing store: CreateCompatibleBitmap failed for %dx%d tile", store->tile_width, BACKING_TILE_HEIGHT);
+            DeleteDC(memDC);
+            return NULL;
+        }
+        store->tile_count++;
+    } else {
+        tile = &store->tiles[0];
+        for (int i = 1; i < store->tile_count; i++) {
+            if (store->tiles[i].last_used < tile->last_used) tile = &store->tiles[i];
+        }
+    }
+    tile->col = col;
+    tile->row = row;
+    tile->last_used = ++store->clock;
+
+    HBITMAP oldBitmap = SelectObject(memDC, tile->bitmap);
+
+    RECT rc = {0, 0, store->tile_width, BACKING_TILE_HEIGHT};
+    fill_background(memDC, &rc, store->background);
+    if (list) {
+        render_display_list(memDC, list, -col * store->tile_width, -row * BACKING_TILE_HEIGHT, &rc);
+    }
+
+    SelectObject(memDC, oldBitmap);
+    DeleteDC(memDC);
+    return tile;
+}
+
+void backing_store_paint(backing_store_t *store, HDC hdc, display_list_t *list,
+                         int scroll_x, int scroll_y, const RECT *dirty) {
+    if (!store || !dirty || dirty->right <= dirty->left || dirty->bottom <= dirty->top) return;
+
+    int tw = store->tile_width;
+    int th = BACKING_TILE_HEIGHT;
+    int first_col = tile_index(dirty->left + scroll_x, tw);
+    int last_col = tile_index(dirty->right - 1 + scroll_x, tw);
+    int first_row = tile_index(dirty->top + scroll_y, th);
+    int last_row = tile_index(dirty->bottom - 1 + scroll_y, th);
+
+    HDC memDC = CreateCompatibleDC(hdc);
+
+    for (int row = first_row; row <= last_row; row++) {
+        for (int col = first_col; col <= last_col; col++) {
+            // Tile in client coordinates, clipped to the dirty rect
+            RECT tile_rc = {
+                col * tw - scroll_x, row * th - scroll_y,
+                col * tw - scroll_x + tw, row * th - scroll_y + th
+            };
+            RECT part;
+            if (!IntersectRect(&part, &tile_rc, dirty)) continue;
+
+            backing_tile_t *tile = find_tile(store, col, row);
+            if (tile) {
+                tile->last_used = ++store->clock;
+                store->hits++;
+            } else {
+                tile = render_tile(store, hdc, list, col, row);
+                store->misses++;
+            }
+
+            if (tile && memDC) {
+                HBITMAP oldBitmap = SelectObject(memDC, tile->bitmap);
+                BitBlt(hdc, part.left, part.top, part.right - part.left, part.bottom - part.top,
+                       memDC, part.left - tile_rc.left, part.top - tile_rc.top, SRCCOPY);
+                SelectObject(memDC, oldBitmap);
+            } else {
+                // Out of GDI memory: draw this part directly
+                SaveDC(hdc);
+                IntersectClipRect(hdc, part.left, part.top, part.right, part.bottom);
+                fill_background(hdc, &part, store->background);
+                if (list) render_display_list(hdc, list, -scroll_x, -scroll_y, &part);
+                RestoreDC(hdc, -1);
+            }
+        }
+    }
+
+    if (memDC) DeleteDC(memDC);
+}
+
+typedef struct {
+    int found;
+    int col;
+    int row;
+} prefetch_scan_t;
+
+// Note the first missing tile of a row and keep the cached ones ahead of
+// everything else in LRU order, so rendering never evicts a wanted tile
+static void scan_row(backing_store_t *store, prefetch_scan_t *scan, int row,
+                     int first_col, int last_col, int first_row, int last_row) {
+    if (row < first_row || row > last_row) return;
+    for (int col = first_col; col <= last_col; col++) {
+        backing_tile_t *tile = find_tile(store, col, row);
+        if (tile) {
+            tile->last_used = ++store->clock;
+        } else if (!scan->found) {
+            scan->found = 1;
+            scan->col = col;
+            scan->row = row;
+        }
+    }
+}
+
+int backing_store_prefetch(backing_store_t *store, HDC reference, display_list_t *list,
+                           int scroll_x, int scroll_y, int content_height) {
+    if (!store || !list || store->max_tiles == 0) return 0;
+
+    int tw = store->tile_width;
+    int th = BACKING_TILE_HEIGHT;
+    int vh = store->viewport_height;
+    int first_col = tile_index(scroll_x, tw);
+    int last_col = tile_index(scroll_x + tw - 1, tw);
+    int view_first = tile_index(scroll_y, th);
+    int view_last = tile_index(scroll_y + vh - 1, th);
+    int first_row = tile_index(scroll_y - vh, th);
+    int last_row = tile_index(scroll_y + 2 * vh - 1, th);
+    int page_last = content_height > 0 ? (content_height - 1) / th : 0;
+    if (first_row < 0) first_row = 0;
+    if (last_row > page_last) last_row = page_last;
+
+    // Visible rows first, then moving outwards alternating below and above,
+    // favouring below since that is the usual reading direction
+    prefetch_scan_t scan = {0};
+    for (int row = view_first; row <= view_last; row++) {
+        scan_row(store, &scan, row, first_col, last_col, first_row, last_row);
+    }
+    for (int d = 1; view_last + d <= last_row || view_first - d >= first_row; d++) {
+        scan_row(store, &scan, view_last + d, first_col, last_col, first_row, last_row);
+        scan_row(store, &scan, view_first - d, first_col, last_col, first_row, last_row);
+    }
+
+    if (!scan.found) return 0;
+    return render_tile(store, reference, list, scan.col, scan.row) != NULL;
+}
+
+void backing_store_log_stats(backing_store_t *store) {
+    if (!store) return;
+    unsigned long lookups = store->hits + store->misses;
+    LOG_INFO("Backing store: %d/%d tiles of %dx%d, hit rate %lu%% (%lu/%lu)",
+             store->tile_count, store->max_tiles, store->tile_width, BACKING_TILE_HEIGHT,
+             lookups ? (store->hits * 100) / lookups : 0, store->hits, lookups);
+}
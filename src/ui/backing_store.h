@@ -0,0 +1,65 @@
+#ifndef BACKING_STORE_H
+#define BACKING_STORE_H
+
+#include <windows.h>
+#include "../core/display_list.h"
+
+/*
+ * Backing Store
+ *
+ * Caches painted content in offscreen tiles laid out on a grid in document
+ * coordinates. A paint copies the dirty area out of the tiles, so scrolling
+ * back over content already seen is a BitBlt instead of a display list
+ * replay, and nothing is ever drawn straight onto the screen (no flicker).
+ *
+ * Tiles are kept least-recently-used up to roughly three viewports: the one
+ * on screen and one above and below it, which idle prefetch fills in ahead
+ * of the user scrolling there.
+ *
+ * The store does not track what changed; callers invalidate it whenever the
+ * display list is rebuilt or node state read at replay time (focus, input
+ * values) changes.
+ */
+
+#define BACKING_TILE_HEIGHT 256
+
+typedef struct {
+    HBITMAP bitmap;
+    int col;                   // Grid position; the tile covers
+    int row;                   // [col * width, row * BACKING_TILE_HEIGHT) onwards
+    unsigned long last_used;
+} backing_tile_t;
+
+typedef struct {
+    backing_tile_t *tiles;
+    int tile_count;
+    int max_tiles;
+    int tile_width;            // Viewport width, so unscrolled pages are one column
+    int viewport_height;
+    COLORREF background;
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+} backing_store_t;
+
+backing_store_t* backing_store_create(int viewport_width, int viewport_height, COLORREF background);
+void backing_store_free(backing_store_t *store);
+
+// Adopt a new viewport size; drops all tiles if the tile width changes
+void backing_store_resize(backing_store_t *store, int viewport_width, int viewport_height);
+
+// Drop every tile (content changed)
+void backing_store_invalidate(backing_store_t *store);
+
+// Paint the dirty rect (client coordinates) from tiles, rendering missing ones
+void backing_store_paint(backing_store_t *store, HDC hdc, display_list_t *list,
+                         int scroll_x, int scroll_y, const RECT *dirty);
+
+// Render one missing tile near the viewport. Returns 1 if there may be more
+// to prefetch, 0 once the viewport and its neighbours are all cached.
+int backing_store_prefetch(backing_store_t *store, HDC reference, display_list_t *list,
+                           int scroll_x, int scroll_y, int content_height);
+
+void backing_store_log_stats(backing_store_t *store);
+
+#endif // BACKING_STORE_H
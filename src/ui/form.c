@@ -1,5 +1,4 @@
 #include "form.h"
-#include "network/protocol.h"
 #include "core/log.h"
 #include <stdlib.h>
 #include <string.h>
@@ -83,11 +82,14 @@ static void collect_inputs(node_t *root, char **buffer, size_t *size) {
     }
 }
 
-network_response_t* form_submit(node_t *submit_node, const char *base_url, char *out_url, size_t out_url_size) {
+int form_build_request(node_t *submit_node, const char *base_url, form_request_t *out) {
+    out->url[0] = '\0';
+    out->post_body = NULL;
+
     node_t *form = find_enclosing_form(submit_node);
     if (!form) {
-        LOG_WARN("form_submit called on node not inside a form");
-        return NULL;
+        LOG_WARN("Form submission from a node that is not inside a form");
+        return 0;
     }
 
     const char *action = node_get_attr(form, "action");
@@ -135,22 +137,18 @@ network_response_t* form_submit(node_t *submit_node, const char *base_url, char
     size_t body_size = 0;
     collect_inputs(form, &body, &body_size);
 
-    network_response_t *res = NULL;
     if (strcasecmp(method, "POST") == 0) {
-        if (out_url) strncpy(out_url, target_url, out_url_size);
-        res = network_post(target_url, body, "application/x-www-form-urlencoded");
+        strncpy(out->url, target_url, sizeof(out->url) - 1);
+        out->post_body = body;
     } else {
-        char full_url[4096];
         if (strlen(body) > 0) {
             char sep = strchr(target_url, '?') ? '&' : '?';
-            snprintf(full_url, sizeof(full_url), "%s%c%s", target_url, sep, body);
+            snprintf(out->url, sizeof(out->url), "%s%c%s", target_url, sep, body);
         } else {
-            strncpy(full_url, target_url, sizeof(full_url));
+            strncpy(out->url, target_url, sizeof(out->url) - 1);
         }
-        if (out_url) strncpy(out_url, full_url, out_url_size);
-        res = network_fetch(full_url);
+        free(body);
     }
-
-    free(body);
-    return res;
+    out->url[sizeof(out->url) - 1] = '\0';
+    return 1;
 }
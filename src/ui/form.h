@@ -2,12 +2,14 @@
 #define FORM_H
 
 #include "core/dom.h"
-#include "network/protocol.h"
 
-// Submits the form enclosing the given node (e.g., a submit button).
-// base_url is needed to resolve relative action URLs.
-// out_url will be filled with the final URL used (useful for GET params).
-// Returns the network response of the submission.
-network_response_t* form_submit(node_t *submit_node, const char *base_url, char *out_url, size_t out_url_size);
+typedef struct {
+    char url[4096];   // Target URL; carries the query string for GET
+    char *post_body;  // URL-encoded fields for POST, NULL for GET; free() it
+} form_request_t;
+
+// Reads the form enclosing submit_node into the request it would send,
+// without sending it. Returns 0 if the node is not inside a form.
+int form_build_request(node_t *submit_node, const char *base_url, form_request_t *out);
 
 #endif // FORM_H
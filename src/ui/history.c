@@ -1,4 +1,5 @@
 #include "history.h"
+#include "core/log.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -63,8 +64,30 @@ void history_node_free(history_node_t *node) {
     free(node);
 }
 
+static void* detach_page(history_tree_t *tree, history_node_t *node) {
+    void *page = node->page;
+    if (page) {
+        tree->page_stats.bytes -= node->page_bytes;
+        tree->page_stats.pages--;
+        node->page = NULL;
+        node->page_bytes = 0;
+    }
+    return page;
+}
+
+// Free every cached page in the subtree; the nodes themselves stay
+static void drop_pages(history_tree_t *tree, history_node_t *node) {
+    if (!node) return;
+    for (int i = 0; i < node->children_count; i++) {
+        drop_pages(tree, node->children[i]);
+    }
+    void *page = detach_page(tree, node);
+    if (page) tree->page_free(page);
+}
+
 void history_free(history_tree_t *tree) {
     if (!tree) return;
+    drop_pages(tree, tree->root);
     history_node_free(tree->root);
     free(tree);
 }
@@ -90,3 +113,72 @@ void history_reset(history_tree_t *tree, const char *url, const char *title) {
     tree->root = new_root;
     tree->current = new_root;
 }
+
+void history_set_page_cache(history_tree_t *tree, int max_pages, size_t budget, history_page_free_fn free_fn) {
+    if (!tree) return;
+    if (tree->page_free) drop_pages(tree, tree->root);
+    tree->page_free = free_fn;
+    tree->page_stats.max_pages = free_fn ? max_pages : 0;
+    tree->page_stats.budget = budget;
+}
+
+static history_node_t* oldest_page(history_node_t *node, history_node_t *oldest) {
+    if (!node) return oldest;
+    if (node->page && (!oldest || node->page_used < oldest->page_used)) oldest = node;
+    for (int i = 0; i < node->children_count; i++) {
+        oldest = oldest_page(node->children[i], oldest);
+    }
+    return oldest;
+}
+
+void history_store_page(history_tree_t *tree, history_node_t *node, void *page, size_t bytes) {
+    if (!tree || !node || !page) return;
+    history_page_stats_t *st = &tree->page_stats;
+
+    void *old = detach_page(tree, node);
+    if (old) tree->page_free(old);
+    if (st->max_pages <= 0 || bytes > st->budget) {
+        if (tree->page_free) tree->page_free(page);
+        return;
+    }
+
+    // The history is a handful of nodes per session; a walk is cheaper than keeping a list
+    while (st->pages >= st->max_pages || st->bytes + bytes > st->budget) {
+        history_node_t *victim = oldest_page(tree->root, NULL);
+        if (!victim) break;
+        LOG_DEBUG("History: evicting cached page %s (%lu bytes)", victim->url, (unsigned long)victim->page_bytes);
+        tree->page_free(detach_page(tree, victim));
+        st->evictions++;
+    }
+
+    node->page = page;
+    node->page_bytes = bytes;
+    node->page_used = ++tree->page_clock;
+    st->bytes += bytes;
+    st->pages++;
+}
+
+void* history_take_page(history_tree_t *tree, history_node_t *node) {
+    if (!tree || !node) return NULL;
+    if (node->page) tree->page_stats.hits++;
+    else tree->page_stats.misses++;
+    return detach_page(tree, node);
+}
+
+void history_get_page_stats(history_tree_t *tree, history_page_stats_t *out) {
+    if (!out) return;
+    if (!tree) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    *out = tree->page_stats;
+}
+
+void history_log_page_stats(history_tree_t *tree) {
+    history_page_stats_t s;
+    history_get_page_stats(tree, &s);
+    unsigned long lookups = s.hits + s.misses;
+    LOG_INFO("Page cache: hit rate %lu%% (%lu/%lu), %d/%d pages, %lu/%lu KB, %lu evictions",
+             lookups ? (s.hits * 100) / lookups : 0, s.hits, lookups, s.pages, s.max_pages,
+             (unsigned long)(s.bytes / 1024), (unsigned long)(s.budget / 1024), s.evictions);
+}
@@ -12,13 +12,38 @@ typedef struct history_node_s {
     struct history_node_s **children;
     int children_count;
     int children_capacity;
+
+    // Back/forward cache: the fully built page last shown for this node
+    void *page;
+    size_t page_bytes;
+    unsigned long page_used;
 } history_node_t;
 
+typedef void (*history_page_free_fn)(void *page);
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t bytes;        // Estimated memory held by cached pages
+    size_t budget;
+    int pages;
+    int max_pages;
+} history_page_stats_t;
+
 typedef struct {
     history_node_t *root;
     history_node_t *current;
+
+    // Back/forward cache state, see history_set_page_cache
+    history_page_free_fn page_free;
+    unsigned long page_clock;
+    history_page_stats_t page_stats;
 } history_tree_t;
 
+#define HISTORY_PAGE_CACHE_MAX_PAGES 8
+#define HISTORY_PAGE_CACHE_BUDGET (48 * 1024 * 1024)
+
 history_tree_t* history_create();
 void history_add(history_tree_t *tree, const char *url, const char *title);
 void history_node_set_favicon(history_node_t *node, void *data, size_t size);
@@ -27,4 +52,25 @@ void history_free(history_tree_t *tree);
 // Create a new root node (for manual navigation via address bar)
 void history_reset(history_tree_t *tree, const char *url, const char *title);
 
+/*
+ * Back/forward cache
+ *
+ * Keeps the pages of the last few visited nodes alive so that going back
+ * to one restores it as it was left instead of fetching and rebuilding it.
+ * Pages are opaque to the history; the owner supplies their size estimate
+ * and a function to free them. The least recently stored pages are dropped
+ * once more than max_pages are held or their bytes exceed the budget.
+ */
+void history_set_page_cache(history_tree_t *tree, int max_pages, size_t budget, history_page_free_fn free_fn);
+
+// Attach page to node, replacing (and freeing) any page it already had.
+// A page larger than the whole budget is freed straight away.
+void history_store_page(history_tree_t *tree, history_node_t *node, void *page, size_t bytes);
+
+// Detach and return node's page, or NULL if it has none
+void* history_take_page(history_tree_t *tree, history_node_t *node);
+
+void history_get_page_stats(history_tree_t *tree, history_page_stats_t *out);
+void history_log_page_stats(history_tree_t *tree);
+
 #endif // HISTORY_H
@@ -3,8 +3,7 @@
 #include <string.h>
 #include <wininet.h>
 #include "core/log.h"
-#include "core/cache.h"
-#include "network/protocol.h"
+#include "network/http_cache.h"
 #include "render.h"
 
 // Layout orientation: currently using VERTICAL_LEFT
@@ -48,9 +47,10 @@ static void get_root_domain(const char *host, char *root_domain, size_t max_len)
     }
 }
 
-// Fetch favicon for a history node
-void history_ui_fetch_favicon(history_node_t *node) {
-    if (!node || !node->url) return;
+// Fetch the favicon of the site serving page_url
+void* history_ui_load_favicon(const char *page_url, size_t *out_size) {
+    *out_size = 0;
+    if (!page_url) return NULL;
 
     URL_COMPONENTS urlComp = {0};
     urlComp.dwStructSize = sizeof(urlComp);
@@ -59,9 +59,9 @@ void history_ui_fetch_favicon(history_node_t *node) {
     urlComp.dwHostNameLength = sizeof(host);
     urlComp.dwSchemeLength = 1;
 
-    if (!InternetCrackUrl(node->url, 0, 0, &urlComp)) return;
+    if (!InternetCrackUrl(page_url, 0, 0, &urlComp)) return NULL;
 
-    if (strncmp(node->url, "gemini://", 9) == 0) return;
+    if (strncmp(page_url, "gemini://", 9) == 0) return NULL;
 
     const char *scheme = (urlComp.nScheme == INTERNET_SCHEME_HTTPS) ? "https" : "http";
 
@@ -91,27 +91,19 @@ void history_ui_fetch_favicon(history_node_t *node) {
             char favicon_url[2048];
             snprintf(favicon_url, sizeof(favicon_url), "%s://%s%s", scheme, hosts_to_try[h], favicon_paths[i]);
 
-            // Try cache first
-            size_t cached_size = 0;
-            void *cached_data = cache_get_image(favicon_url, &cached_size);
-            if (cached_data && cached_size > 0) {
-                history_node_set_favicon(node, cached_data, cached_size);
-                return;  // Success - stop trying other hosts/formats
-            }
-
-            // Fetch from network
-            network_response_t *res = network_fetch(favicon_url);
+            // Served from the cache while fresh, revalidated once stale
+            network_response_t *res = http_cache_fetch(CACHE_TYPE_FAVICON, favicon_url);
             if (res && res->data && res->size > 0 && res->status_code == 200) {
-                // Cache for later
-                cache_put_image(favicon_url, res->data, res->size);
-                history_node_set_favicon(node, res->data, res->size);
+                void *data = res->data;
+                *out_size = res->size;
                 res->data = NULL;
-                if (res) network_response_free(res);
-                return;  // Success - stop trying other hosts/formats
+                network_response_free(res);
+                return data;  // Success - stop trying other hosts/formats
             }
             if (res) network_response_free(res);
         }
     }
+    return NULL;
 }
 
 // Calculate the width needed for a node and all its descendants
@@ -7,7 +7,8 @@
 // Rendering and interaction functions for the history pane UI
 void history_ui_draw(HDC hdc, history_tree_t *tree);
 history_node_t* history_ui_hit_test(history_tree_t *tree, int hitX, int hitY);
-void history_ui_fetch_favicon(history_node_t *node);
+// Network only, no UI state: safe to call off the UI thread. Returns malloc'd data or NULL.
+void* history_ui_load_favicon(const char *page_url, size_t *out_size);
 
 // Set panel height for vertical layout rendering
 void history_ui_set_panel_height(int height);
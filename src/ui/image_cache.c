@@ -0,0 +1,146 @@
+#include "image_cache.h"
+#include "core/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_CACHE_BUCKETS 256
+
+typedef struct image_entry_s {
+    unsigned long long hash;  // Of the encoded bytes
+    size_t size;
+    int width;
+    int height;
+    decoded_image_t image;
+    size_t bytes;
+    struct image_entry_s *hash_next;
+    struct image_entry_s *lru_prev;  // Towards most recently used
+    struct image_entry_s *lru_next;  // Towards least recently used
+} image_entry_t;
+
+static image_entry_t *g_buckets[IMAGE_CACHE_BUCKETS];
+static image_entry_t *g_lru_head = NULL; // Most recently used
+static image_entry_t *g_lru_tail = NULL; // Least recently used
+static image_cache_stats_t g_stats = {0, 0, 0, 0, IMAGE_CACHE_DEFAULT_BUDGET, 0};
+
+// 64-bit FNV-1a over all of the encoded data
+static unsigned long long content_hash(const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static unsigned int bucket_for(unsigned long long hash, int width, int height) {
+    unsigned long long key = hash ^ ((unsigned long long)width << 16) ^ (unsigned long long)height;
+    return (unsigned int)((key >> 32) ^ key) % IMAGE_CACHE_BUCKETS;
+}
+
+static void lru_unlink(image_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else g_lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else g_lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(image_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = g_lru_head;
+    if (g_lru_head) g_lru_head->lru_prev = e;
+    g_lru_head = e;
+    if (!g_lru_tail) g_lru_tail = e;
+}
+
+static void remove_entry(image_entry_t *e) {
+    unsigned int b = bucket_for(e->hash, e->width, e->height);
+    image_entry_t **pp = &g_buckets[b];
+    while (*pp && *pp != e) pp = &(*pp)->hash_next;
+    if (*pp) *pp = e->hash_next;
+
+    lru_unlink(e);
+    g_stats.bytes -= e->bytes;
+    g_stats.entries--;
+    if (e->image.bitmap) DeleteObject(e->image.bitmap);
+    free(e);
+}
+
+static void evict_to_budget(size_t incoming) {
+    while (g_lru_tail && g_stats.bytes + incoming > g_stats.budget) {
+        remove_entry(g_lru_tail);
+        g_stats.evictions++;
+    }
+}
+
+void image_cache_set_budget(size_t bytes) {
+    g_stats.budget = bytes;
+    evict_to_budget(0);
+}
+
+decoded_image_t* image_cache_lookup(const void *data, size_t size, int width, int height) {
+    if (!data || size == 0) return NULL;
+
+    unsigned long long hash = content_hash(data, size);
+    for (image_entry_t *e = g_buckets[bucket_for(hash, width, height)]; e; e = e->hash_next) {
+        if (e->hash != hash || e->size != size || e->width != width || e->height != height) continue;
+        lru_unlink(e);
+        lru_push_front(e);
+        g_stats.hits++;
+        return &e->image;
+    }
+
+    g_stats.misses++;
+    return NULL;
+}
+
+decoded_image_t* image_cache_insert(const void *data, size_t size, int width, int height, const decoded_image_t *image) {
+    if (!data || size == 0 || !image) return NULL;
+
+    size_t bytes = image->bitmap ? (size_t)image->width * image->height * 4 : 0;
+    bytes += sizeof(image_entry_t);
+    if (bytes > g_stats.budget) {
+        if (image->bitmap) DeleteObject(image->bitmap);
+        return NULL;
+    }
+    evict_to_budget(bytes);
+
+    image_entry_t *e = calloc(1, sizeof(image_entry_t));
+    if (!e) {
+        if (image->bitmap) DeleteObject(image->bitmap);
+        return NULL;
+    }
+    e->hash = content_hash(data, size);
+    e->size = size;
+    e->width = width;
+    e->height = height;
+    e->image = *image;
+    e->bytes = bytes;
+
+    unsigned int b = bucket_for(e->hash, width, height);
+    e->hash_next = g_buckets[b];
+    g_buckets[b] = e;
+    lru_push_front(e);
+
+    g_stats.bytes += bytes;
+    g_stats.entries++;
+    return &e->image;
+}
+
+void image_cache_clear(void) {
+    while (g_lru_head) remove_entry(g_lru_head);
+}
+
+void image_cache_get_stats(image_cache_stats_t *out) {
+    if (out) *out = g_stats;
+}
+
+void image_cache_log_stats(void) {
+    unsigned long lookups = g_stats.hits + g_stats.misses;
+    LOG_INFO("Image cache: %d entries, %lu KB of %lu KB, hit rate %lu%% (%lu/%lu), %lu evictions",
+             g_stats.entries,
+             (unsigned long)(g_stats.bytes / 1024), (unsigned long)(g_stats.budget / 1024),
+             lookups ? (g_stats.hits * 100) / lookups : 0, g_stats.hits, lookups,
+             g_stats.evictions);
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <windows.h>
+#include <stddef.h>
+
+/*
+ * Decoded Image Cache
+ *
+ * Holds images already decoded and scaled into 32bpp DIB sections so that
+ * painting is a BitBlt/AlphaBlend instead of a full GDI+/OLE decode.
+ *
+ * Entries are keyed by a hash of the whole encoded data plus the target
+ * size, never by its address: a freed buffer reused for another image must
+ * not bring back the old picture. The hash is a single pass over bytes that
+ * are already in memory, far cheaper than the decode it saves, and the same
+ * image at two addresses shares one surface. Entries are evicted
+ * least-recently-used under a byte budget.
+ * Failed decodes are cached as well so broken images are not retried on
+ * every paint.
+ */
+
+typedef struct {
+    HBITMAP bitmap;  // NULL if decoding failed
+    void *bits;      // Top-down premultiplied BGRA pixels owned by bitmap
+    int width;
+    int height;
+    int has_alpha;   // 0 if every pixel is opaque (plain BitBlt is enough)
+} decoded_image_t;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t bytes;        // Pixel memory currently held
+    size_t budget;
+    int entries;
+} image_cache_stats_t;
+
+#define IMAGE_CACHE_DEFAULT_BUDGET (32 * 1024 * 1024)
+
+void image_cache_set_budget(size_t bytes);
+
+// Returns the cached surface or NULL on a miss
+decoded_image_t* image_cache_lookup(const void *data, size_t size, int width, int height);
+
+// Takes ownership of image->bitmap; returns the cached copy (NULL if it cannot be stored)
+decoded_image_t* image_cache_insert(const void *data, size_t size, int width, int height, const decoded_image_t *image);
+
+void image_cache_clear(void);
+void image_cache_get_stats(image_cache_stats_t *out);
+void image_cache_log_stats(void);
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,386 @@
+#include "navigator.h"
+#include "history_ui.h"
+#include "core/html.h"
+#include "core/style.h"
+#include "core/log.h"
+#include "core/lazy_lock.h"
+#include "network/protocol.h"
+#include "network/http.h"
+#include "network/http_cache.h"
+#include "network/loader.h"
+#include <process.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    unsigned long id;
+    HWND target;
+    char *url;
+    char *post_body;
+    int layout_width;
+    int fetch_favicon;
+
+    DWORD start;
+    node_t *dom;             // Tree the next partial page is copied from
+    DWORD partial_at;        // When the last partial page was posted (or the load started)
+    DWORD partial_cost;      // How long building it took
+    size_t partial_bytes;    // Document bytes it covered
+    int partial_count;
+} nav_job_t;
+
+// Streams the document into the parser while collecting it for the cache
+typedef struct {
+    network_sink_t base;
+    network_buffer_sink_t body;
+    html_parser_t *parser;   // NULL once feeding failed; the body is parsed whole instead
+    nav_job_t *job;
+} doc_sink_t;
+
+static nav_job_t *g_pending = NULL;    // Started but not yet picked up by the worker
+static unsigned long g_current = 0;
+static unsigned long g_next_id = 0;
+static HANDLE g_thread = NULL;
+static HANDLE g_wake = NULL;
+static volatile LONG g_stop = 0;
+
+static lazy_lock_t g_nav_lock;
+
+static void nav_lock(void) {
+    lazy_lock_enter(&g_nav_lock);
+}
+
+static void nav_unlock(void) {
+    lazy_lock_leave(&g_nav_lock);
+}
+
+static void job_free(nav_job_t *job) {
+    if (!job) return;
+    free(job->url);
+    free(job->post_body);
+    free(job);
+}
+
+unsigned long nav_current(void) {
+    nav_lock();
+    unsigned long id = g_current;
+    nav_unlock();
+    return id;
+}
+
+static int cancelled(const nav_job_t *job) {
+    return nav_current() != job->id;
+}
+
+static void post(const nav_job_t *job, UINT msg, LPARAM lParam) {
+    if (!cancelled(job)) PostMessage(job->target, msg, (WPARAM)job->id, lParam);
+}
+
+static void build_layout(nav_result_t *result) {
+    result->layout = layout_create_tree(result->dom, result->layout_width);
+    if (result->layout) {
+        result->display_list = display_list_build(result->layout);
+        result->layout_index = layout_index_create(result->layout);
+    }
+}
+
+static int partial_due(const nav_job_t *job, size_t new_bytes) {
+    DWORD since = GetTickCount() - job->partial_at;
+    if (since < 2 * job->partial_cost) return 0;
+    return since >= NAV_PARTIAL_INTERVAL_MS || new_bytes >= NAV_PARTIAL_BYTES;
+}
+
+// Copy job->dom as it stands, lay the copy out and hand it to the window.
+// Pages with nothing to show yet (only a <head> so far) are not posted.
+static void post_partial(nav_job_t *job) {
+    DWORD start = GetTickCount();
+    nav_result_t *result = calloc(1, sizeof(nav_result_t));
+    if (!result) return;
+    result->id = job->id;
+    result->ok = 1;
+    result->url = strdup(job->url);
+    result->layout_width = job->layout_width;
+    result->dom = node_clone(job->dom);
+    if (result->dom) {
+        style_compute(result->dom);
+        build_layout(result);
+    }
+
+    DWORD now = GetTickCount();
+    job->partial_at = now;
+    job->partial_cost = now - start;
+    result->elapsed_ms = now - job->start;
+    if (!result->layout || result->layout->fragment.border_box.height <= 0 || cancelled(job) ||
+        !PostMessage(job->target, WM_NAV_PARTIAL, (WPARAM)job->id, (LPARAM)result)) {
+        nav_result_free(result);
+        return;
+    }
+    job->partial_count++;
+    LOG_DEBUG("Navigation: partial page %d of %s after %lu ms (built in %lu ms)", job->partial_count,
+              job->url, (unsigned long)result->elapsed_ms, (unsigned long)job->partial_cost);
+}
+
+static int doc_on_headers(network_sink_t *sink, int status_code, const char *content_type, long long content_length) {
+    doc_sink_t *doc = (doc_sink_t *)sink;
+    if (html_parser_bytes(doc->parser) > 0) {
+        // The request is being retried: start the tree over
+        html_parser_free(doc->parser);
+        doc->parser = html_parser_create();
+        doc->job->dom = html_parser_root(doc->parser);
+        doc->job->partial_bytes = 0;
+    }
+    if (!doc->body.base.on_headers(&doc->body.base, status_code, content_type, content_length)) return 0;
+    return !cancelled(doc->job);
+}
+
+static int doc_on_data(network_sink_t *sink, const char *data, size_t len) {
+    doc_sink_t *doc = (doc_sink_t *)sink;
+    nav_job_t *job = doc->job;
+    if (!doc->body.base.on_data(&doc->body.base, data, len)) return 0;
+    if (doc->parser && !html_parser_feed(doc->parser, data, len)) {
+        html_parser_free(doc->parser);
+        doc->parser = NULL;
+        job->dom = NULL;
+    }
+    if (doc->parser) {
+        size_t bytes = html_parser_bytes(doc->parser);
+        if (partial_due(job, bytes - job->partial_bytes)) {
+            job->partial_bytes = bytes;
+            post_partial(job);
+        }
+    }
+    return !cancelled(job);
+}
+
+// The document through the HTTP cache, parsed as it streams in when it
+// comes from the network. *out_parser is set if it holds the whole body.
+static network_response_t* fetch_document(nav_job_t *job, html_parser_t **out_parser) {
+    *out_parser = NULL;
+    http_cache_entry_t entry;
+    if (http_cache_begin(CACHE_TYPE_DOCUMENT, job->url, &entry)) {
+        return http_cache_finish(job->url, &entry, NULL);
+    }
+
+    doc_sink_t doc;
+    memset(&doc, 0, sizeof(doc));
+    network_buffer_sink_init(&doc.body);
+    doc.base.on_headers = doc_on_headers;
+    doc.base.on_data = doc_on_data;
+    doc.parser = html_parser_create();
+    doc.job = job;
+    job->dom = html_parser_root(doc.parser);
+
+    network_response_t *res = http_cache_revalidate_stream(job->url, &entry, &doc.base);
+    network_buffer_sink_attach(&doc.body, res);
+    job->dom = NULL;
+    if (cancelled(job)) {
+        // Most likely cut short; keep it out of the cache
+        network_response_free(res);
+        cache_buffer_release(entry.buffer);
+        html_parser_free(doc.parser);
+        return NULL;
+    }
+
+    // Only a full response is returned as is; a 304 or a failure turns into the stored copy
+    int streamed = res && res->status_code != 304;
+    res = http_cache_finish(job->url, &entry, res);
+    if (streamed && res && doc.parser && html_parser_bytes(doc.parser) == res->size) {
+        *out_parser = doc.parser;
+    } else {
+        html_parser_free(doc.parser);
+    }
+    return res;
+}
+
+// Runs on the worker, once per finished resource
+static int resource_progress(int current, int total, void *ctx) {
+    nav_job_t *job = ctx;
+    if (cancelled(job)) return 1;
+    PostMessage(job->target, WM_NAV_PROGRESS, (WPARAM)job->id, MAKELPARAM(current, total));
+    // Let images fill in
+    if (partial_due(job, 0)) post_partial(job);
+    return 0;
+}
+
+// Runs on the worker as image sizes become known ahead of their bodies
+static int resource_sized(node_t *node, int unsized, void *ctx) {
+    nav_job_t *job = ctx;
+    (void)node;
+    if (cancelled(job)) return 1;
+    if (unsized == 0) {
+        // Nothing left to move the layout: show it now, not when the last body lands
+        LOG_DEBUG("Navigation: layout of %s settled after %lu ms, image bodies still loading",
+                  job->url, (unsigned long)(GetTickCount() - job->start));
+        post_partial(job);
+    } else if (partial_due(job, 0)) {
+        post_partial(job);
+    }
+    return 0;
+}
+
+void nav_result_free(nav_result_t *result) {
+    if (!result) return;
+    if (result->display_list) display_list_free(result->display_list);
+    if (result->layout_index) layout_index_free(result->layout_index);
+    if (result->layout) layout_free(result->layout);
+    if (result->dom) node_free(result->dom);
+    free(result->favicon_data);
+    free(result->url);
+    free(result);
+}
+
+static void run_job(nav_job_t *job) {
+    job->start = job->partial_at = GetTickCount();
+    nav_result_t *result = calloc(1, sizeof(nav_result_t));
+    if (!result) {
+        LOG_ERROR("Navigation: out of memory loading %s", job->url);
+        post(job, WM_NAV_DONE, 0);
+        return;
+    }
+    result->id = job->id;
+    result->layout_width = job->layout_width;
+
+    post(job, WM_NAV_STAGE, NAV_STAGE_FETCH);
+    html_parser_t *parser = NULL;
+    network_response_t *res = job->post_body
+        ? network_post(job->url, job->post_body, "application/x-www-form-urlencoded")
+        : fetch_document(job, &parser);
+    result->url = strdup(res && res->final_url ? res->final_url : job->url);
+
+    if (res && res->data && !cancelled(job)) {
+        if (job->fetch_favicon && result->url) {
+            result->favicon_data = history_ui_load_favicon(result->url, &result->favicon_size);
+        }
+        post(job, WM_NAV_STAGE, NAV_STAGE_PARSE);
+        if (parser) {
+            result->dom = html_parser_finish(parser);
+            parser = NULL;
+        } else {
+            result->dom = html_parse((char*)res->data);
+        }
+    }
+    html_parser_free(parser);
+    if (res) network_response_free(res);
+
+    if (result->dom && !cancelled(job)) {
+        style_compute(result->dom);
+
+        int resource_count = loader_count_resources(result->dom);
+        post(job, WM_NAV_STAGE, NAV_STAGE_RESOURCES);
+        post(job, WM_NAV_PROGRESS, MAKELPARAM(0, resource_count));
+        if (resource_count > 0) {
+            // Text first; the images fill in as they arrive
+            job->dom = result->dom;
+            post_partial(job);
+            int current = 0;
+            loader_fetch_resources(result->dom, result->url, resource_progress, resource_sized, job, &current, resource_count);
+            job->dom = NULL;
+        }
+    }
+
+    if (result->dom && !cancelled(job)) {
+        post(job, WM_NAV_STAGE, NAV_STAGE_LAYOUT);
+        build_layout(result);
+        result->ok = 1;
+    }
+
+    result->elapsed_ms = GetTickCount() - job->start;
+    if (cancelled(job)) {
+        LOG_INFO("Navigation to %s cancelled after %lu ms", job->url, (unsigned long)result->elapsed_ms);
+        nav_result_free(result);
+    } else if (!PostMessage(job->target, WM_NAV_DONE, (WPARAM)job->id, (LPARAM)result)) {
+        nav_result_free(result);
+    }
+}
+
+static unsigned __stdcall nav_worker(void *param) {
+    (void)param;
+    while (WaitForSingleObject(g_wake, INFINITE) != WAIT_FAILED && !g_stop) {
+        nav_lock();
+        nav_job_t *job = g_pending;
+        g_pending = NULL;
+        nav_unlock();
+        if (job) {
+            run_job(job);
+            job_free(job);
+        }
+    }
+    return 0;
+}
+
+unsigned long nav_start(HWND target, const nav_request_t *request) {
+    nav_job_t *job = calloc(1, sizeof(nav_job_t));
+    if (job) {
+        job->target = target;
+        job->url = strdup(request->url);
+        job->post_body = request->post_body ? strdup(request->post_body) : NULL;
+        job->layout_width = request->layout_width;
+        job->fetch_favicon = request->fetch_favicon;
+        if (!job->url || (request->post_body && !job->post_body)) {
+            job_free(job);
+            job = NULL;
+        }
+    }
+
+    nav_lock();
+    if (++g_next_id == 0) g_next_id = 1;
+    unsigned long id = g_next_id;
+    g_current = id;
+    nav_job_t *replaced = g_pending;
+    g_pending = NULL;
+    if (job) {
+        job->id = id;
+        if (!g_thread) {
+            g_stop = 0;
+            if (!g_wake) g_wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+            if (g_wake) g_thread = (HANDLE)_beginthreadex(NULL, 0, nav_worker, NULL, 0, NULL);
+            if (!g_thread) LOG_WARN("Navigation: no worker thread; loading on the UI thread");
+        }
+        if (g_thread) {
+            g_pending = job;
+            SetEvent(g_wake);
+        }
+    }
+    nav_unlock();
+    job_free(replaced);
+
+    if (!job) {
+        LOG_ERROR("Navigation: out of memory starting %s", request->url);
+        PostMessage(target, WM_NAV_DONE, (WPARAM)id, 0);
+    } else if (!g_thread) {
+        // Results still arrive as messages, just once this returns
+        run_job(job);
+        job_free(job);
+    }
+    return id;
+}
+
+void nav_cancel(void) {
+    nav_lock();
+    g_current = 0;
+    nav_job_t *replaced = g_pending;
+    g_pending = NULL;
+    nav_unlock();
+    job_free(replaced);
+}
+
+int nav_shutdown(void) {
+    nav_cancel();
+    if (g_thread) {
+        g_stop = 1;
+        SetEvent(g_wake);
+        if (WaitForSingleObject(g_thread, NAV_SHUTDOWN_GRACE_MS) != WAIT_OBJECT_0) {
+            // Blocked in a read: close the connections under it
+            LOG_INFO("Navigation: worker busy at shutdown, aborting its fetches");
+            http_abort_all();
+            if (WaitForSingleObject(g_thread, NAV_SHUTDOWN_TIMEOUT_MS) != WAIT_OBJECT_0) {
+                LOG_WARN("Navigation: worker still busy after aborting; leaving it to process exit");
+                return 0;
+            }
+        }
+        CloseHandle(g_thread);
+        g_thread = NULL;
+    }
+    if (g_wake) CloseHandle(g_wake);
+    g_wake = NULL;
+    return 1;
+}
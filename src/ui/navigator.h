@@ -0,0 +1,98 @@
+#ifndef NAVIGATOR_H
+#define NAVIGATOR_H
+
+#include <windows.h>
+#include <stddef.h>
+#include "core/dom.h"
+#include "core/layout.h"
+#include "core/display_list.h"
+
+/*
+ * Navigation Worker
+ *
+ * Runs the page pipeline - fetch, parse, style, resource loading and
+ * layout - on a background thread so that the window only ever waits on
+ * its own message queue. Progress and the finished page are posted back
+ * to the window as messages carrying the id nav_start returned.
+ *
+ * While the document streams in and while its images arrive, the worker
+ * also posts partial pages: independent copies of the tree so far, styled
+ * and laid out, for the window to show until the finished page replaces
+ * them. They come at most every NAV_PARTIAL_INTERVAL_MS, or sooner once
+ * NAV_PARTIAL_BYTES more of the document has arrived, and never more often
+ * than twice the time the previous one took to build, so slow machines
+ * spend their time loading rather than re-laying out. Image sizes are known
+ * from the first bytes of each download; the moment the last one is, a
+ * partial page goes out whose layout the finished page will not change.
+ *
+ * One navigation is current at a time; starting another cancels it. The
+ * worker notices between stages, after each resource and with each chunk
+ * of the document, stops, and throws its work away. A form POST already
+ * on the wire is allowed to finish, but its result is discarded.
+ */
+
+// wParam = navigation id, lParam = nav_stage_t just entered
+#define WM_NAV_STAGE    (WM_APP + 1)
+// wParam = navigation id, lParam = MAKELPARAM(resources done, resources total)
+#define WM_NAV_PROGRESS (WM_APP + 2)
+// wParam = navigation id, lParam = nav_result_t*; the window owns it from then on
+#define WM_NAV_DONE     (WM_APP + 3)
+// Same as WM_NAV_DONE for a partial page; more will follow
+#define WM_NAV_PARTIAL  (WM_APP + 4)
+
+#define NAV_PARTIAL_INTERVAL_MS 100
+#define NAV_PARTIAL_BYTES (32 * 1024)
+
+// How long nav_shutdown lets a cancelled worker wind down on its own, and
+// then how long it waits once the fetches it is blocked in are aborted
+#define NAV_SHUTDOWN_GRACE_MS 500
+#define NAV_SHUTDOWN_TIMEOUT_MS 3000
+
+typedef enum {
+    NAV_STAGE_FETCH,
+    NAV_STAGE_PARSE,
+    NAV_STAGE_RESOURCES,
+    NAV_STAGE_LAYOUT
+} nav_stage_t;
+
+typedef struct {
+    const char *url;
+    const char *post_body;  // URL-encoded form fields to POST; NULL for a GET
+    int layout_width;       // Available width to lay the page out at
+    int fetch_favicon;      // Also load the site's favicon
+} nav_request_t;
+
+typedef struct {
+    unsigned long id;
+    int ok;                        // 0 if the document could not be fetched or parsed
+    char *url;                     // Final URL, after redirects
+    node_t *dom;                   // Styled, with its resources attached
+    layout_box_t *layout;
+    display_list_t *display_list;
+    layout_index_t *layout_index;
+    int layout_width;
+    void *favicon_data;            // malloc'd, NULL if none was found
+    size_t favicon_size;
+    DWORD elapsed_ms;
+} nav_result_t;
+
+// Start loading a page for target, cancelling the current navigation.
+// Returns the id its messages carry (never 0).
+unsigned long nav_start(HWND target, const nav_request_t *request);
+
+// Cancel the current navigation; nothing more is posted for it
+void nav_cancel(void);
+
+// Id of the navigation whose messages are still wanted, 0 if none
+unsigned long nav_current(void);
+
+void nav_result_free(nav_result_t *result);
+
+// Cancel and wait for the worker thread to exit. A worker still busy after
+// NAV_SHUTDOWN_GRACE_MS has its fetches aborted (http_abort_all). Returns 0
+// if it is still running NAV_SHUTDOWN_TIMEOUT_MS after that; the connection
+// and TLS state it uses must then be left alone (the caches are locked and
+// can still be flushed), and exiting the process ends it.
+int nav_shutdown(void);
+
+#endif // NAVIGATOR_H
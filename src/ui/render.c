@@ -1,8 +1,10 @@
 #include "render.h"
+#include "image_cache.h"
 #include <stdio.h>
 #include <olectl.h>
 #include "core/platform.h"
 #include "core/log.h"
+#include "core/image_sniff.h"
 
 #ifndef WINGDIPAPI
 #define WINGDIPAPI __stdcall
@@ -33,6 +35,11 @@ typedef GpStatus (WINGDIPAPI *PFN_GdipCreateFromHDC)(HDC, GpGraphics**);
 typedef GpStatus (WINGDIPAPI *PFN_GdipDeleteGraphics)(GpGraphics*);
 typedef GpStatus (WINGDIPAPI *PFN_GdipDisposeImage)(GpImage*);
 typedef GpStatus (WINGDIPAPI *PFN_GdipDrawImageRectI)(GpGraphics*, GpImage*, INT, INT, INT, INT);
+typedef GpStatus (WINGDIPAPI *PFN_GdipCreateBitmapFromScan0)(INT, INT, INT, INT, BYTE*, GpBitmap**);
+typedef GpStatus (WINGDIPAPI *PFN_GdipGetImageGraphicsContext)(GpImage*, GpGraphics**);
+
+// PixelFormat32bppPARGB from gdipluspixelformats.h
+#define GDIP_PIXEL_FORMAT_32BPP_PARGB 0x000E200B
 
 static HMODULE g_hGdiPlus = NULL;
 static ULONG_PTR g_gdiplusToken = 0;
@@ -43,6 +50,10 @@ static PFN_GdipCreateFromHDC fn_GdipCreateFromHDC = NULL;
 static PFN_GdipDeleteGraphics fn_GdipDeleteGraphics = NULL;
 static PFN_GdipDisposeImage fn_GdipDisposeImage = NULL;
 static PFN_GdipDrawImageRectI fn_GdipDrawImageRectI = NULL;
+static PFN_GdipCreateBitmapFromScan0 fn_GdipCreateBitmapFromScan0 = NULL;
+static PFN_GdipGetImageGraphicsContext fn_GdipGetImageGraphicsContext = NULL;
+
+static void free_font_cache(void);
 
 void render_init(void) {
     g_hGdiPlus = LoadLibrary("gdiplus.dll");
@@ -54,6 +65,8 @@ void render_init(void) {
         fn_GdipDeleteGraphics = (PFN_GdipDeleteGraphics)GetProcAddress(g_hGdiPlus, "GdipDeleteGraphics");
         fn_GdipDisposeImage = (PFN_GdipDisposeImage)GetProcAddress(g_hGdiPlus, "GdipDisposeImage");
         fn_GdipDrawImageRectI = (PFN_GdipDrawImageRectI)GetProcAddress(g_hGdiPlus, "GdipDrawImageRectI");
+        fn_GdipCreateBitmapFromScan0 = (PFN_GdipCreateBitmapFromScan0)GetProcAddress(g_hGdiPlus, "GdipCreateBitmapFromScan0");
+        fn_GdipGetImageGraphicsContext = (PFN_GdipGetImageGraphicsContext)GetProcAddress(g_hGdiPlus, "GdipGetImageGraphicsContext");
 
         if (fn_GdiplusStartup && fn_GdipCreateBitmapFromStream) {
             GdiplusStartupInput input = {1, NULL, FALSE, FALSE};
@@ -75,6 +88,10 @@ void render_init(void) {
 }
 
 void render_cleanup(void) {
+    free_font_cache();
+    image_cache_log_stats();
+    // Decoded surfaces must go before GDI+ is shut down
+    image_cache_clear();
     if (g_hGdiPlus && fn_GdiplusShutdown) {
         fn_GdiplusShutdown(g_gdiplusToken);
         FreeLibrary(g_hGdiPlus);
@@ -90,112 +107,20 @@ static int is_png(const void *data, size_t size) {
            bytes[4] == 0x0D && bytes[5] == 0x0A && bytes[6] == 0x1A && bytes[7] == 0x0A;
 }
 
-// Extract PNG dimensions from the IHDR chunk
-// PNG format: 8 byte signature, then IHDR chunk with width/height at bytes 16-24
-static int get_png_dimensions(const void *data, size_t size, int *out_width, int *out_height) {
-    if (!data || size < 24 || !out_width || !out_height) return 0;
-    if (!is_png(data, size)) return 0;
-
-    const unsigned char *bytes = (const unsigned char *)data;
-    // PNG structure:
-    // Offset 0-7: PNG signature
-    // Offset 8-11: IHDR chunk length (always 13)
-    // Offset 12-15: IHDR chunk type
-    // Offset 16-19: Width (big-endian uint32)
-    // Offset 20-23: Height (big-endian uint32)
-    unsigned int width = (bytes[16] << 24) | (bytes[17] << 16) | (bytes[18] << 8) | bytes[19];
-    unsigned int height = (bytes[20] << 24) | (bytes[21] << 16) | (bytes[22] << 8) | bytes[23];
-
-    // Sanity check - PNG dimensions should be non-zero and reasonable
-    // PNG can be up to 2^31-1 in each dimension theoretically, but we limit to reasonable values
-    if (width == 0 || width > 16384 || height == 0 || height > 16384) return 0;
-
-    *out_width = (int)width;
-    *out_height = (int)height;
-    return 1;
-}
-
-// Detect JPEG signature (FF D8)
-static int is_jpeg(const void *data, size_t size) {
-    if (!data || size < 2) return 0;
-    const unsigned char *bytes = (const unsigned char *)data;
-    return bytes[0] == 0xFF && bytes[1] == 0xD8;
-}
-
-// Extract JPEG dimensions from SOF (Start of Frame) marker
-// JPEG markers: FF D8 (SOI), FF xx (other markers), FF C0/C1/C2/C9/CA/CB (SOF)
-// SOF format: FF C0/C1/C2/C9/CA/CB, length (2 bytes), precision (1), height (2), width (2)
-static int get_jpeg_dimensions(const void *data, size_t size, int *out_width, int *out_height) {
-    if (!data || size < 20 || !out_width || !out_height) return 0;
-    if (!is_jpeg(data, size)) return 0;
-
-    const unsigned char *bytes = (const unsigned char *)data;
-    size_t pos = 2;  // Skip SOI marker (FF D8)
-
-    while (pos + 8 < size) {
-        // Look for marker
-        if (bytes[pos] != 0xFF) {
-            pos++;
-            continue;
-        }
-
-        unsigned char marker = bytes[pos + 1];
-
-        // SOF markers: C0, C1, C2, C9, CA, CB (we care about dimensions)
-        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2 ||
-            marker == 0xC9 || marker == 0xCA || marker == 0xCB) {
-            // Length is at pos+2, height at pos+5, width at pos+7
-            if (pos + 9 < size) {
-                unsigned int height = (bytes[pos + 5] << 8) | bytes[pos + 6];
-                unsigned int width = (bytes[pos + 7] << 8) | bytes[pos + 8];
-
-                if (width > 0 && width <= 65535 && height > 0 && height <= 65535) {
-                    *out_width = (int)width;
-                    *out_height = (int)height;
-                    return 1;
-                }
-            }
-            return 0;  // Found SOF but couldn't read valid dimensions
-        }
-
-        // Skip this marker: marker is 2 bytes, then 2-byte length (big-endian)
-        if (pos + 3 < size) {
-            unsigned int marker_len = (bytes[pos + 2] << 8) | bytes[pos + 3];
-            // Sanity check: length should include itself (2 bytes)
-            if (marker_len < 2) {
-                return 0;  // Invalid marker length
-            }
-            pos += marker_len + 2;
-        } else {
-            return 0;
-        }
-    }
-
-    return 0;  // No SOF marker found
-}
-
-// Public function for extracting image dimensions (supports PNG, JPEG, others)
+// Intrinsic size of a complete image body, from its header. The loader
+// usually knows it already from the start of the download (see
+// core/image_sniff); formats the sniffer does not know get 100x100.
 void render_extract_image_dimensions(const void *data, size_t size, int *out_width, int *out_height) {
-    // Initialize output to safe defaults
     if (out_width) *out_width = 0;
     if (out_height) *out_height = 0;
+    if (!data || size == 0 || !out_width || !out_height) return;
 
-    if (!data || size == 0 || !out_width || !out_height) {
+    image_info_t info;
+    if (image_sniff(data, size, &info) == IMAGE_SNIFF_OK) {
+        *out_width = info.width;
+        *out_height = info.height;
         return;
     }
-
-    // Try PNG first
-    if (get_png_dimensions(data, size, out_width, out_height)) {
-        return;
-    }
-
-    // Try JPEG second
-    if (get_jpeg_dimensions(data, size, out_width, out_height)) {
-        return;
-    }
-
-    // For other formats (BMP, GIF, etc.), we'd need format-specific parsers
-    // For now, default to reasonable dimensions if format unknown
     *out_width = 100;
     *out_height = 100;
 }
@@ -284,231 +209,384 @@ static void set_color_from_style(HDC hdc, style_t *style) {
     SetTextColor(hdc, RGB(r, g, b));
 }
 
-void render_image_data(HDC hdc, void *data, size_t size, int x, int y, int w, int h) {
-    if (!data || size == 0) return;
-
-    // Validate image size is reasonable (some sanity check)
-    if (size > 10 * 1024 * 1024) {
-        LOG_WARN("Image data too large: %lu bytes (max 10MB)", (unsigned long)size);
-        return;
-    }
-
-    // Use reasonable defaults for zero dimensions
-    if (w <= 0) w = 100;
-    if (h <= 0) h = 100;
-
-    int is_png_file = is_png(data, size);
-
+// Wrap encoded image bytes in an IStream for GDI+/OLE (the stream owns its copy)
+static IStream* create_image_stream(const void *data, size_t size) {
     HGLOBAL hGlobal = GlobalAlloc(GMEM_MOVEABLE, size);
     if (!hGlobal) {
         LOG_WARN("GlobalAlloc failed for image data size %lu", (unsigned long)size);
-        return;
+        return NULL;
     }
 
     void *ptr = GlobalLock(hGlobal);
     if (!ptr) {
         GlobalFree(hGlobal);
         LOG_WARN("GlobalLock failed for image data");
-        return;
+        return NULL;
     }
 
     memcpy(ptr, data, size);
     GlobalUnlock(hGlobal);
 
     IStream *pStream = NULL;
-    if (CreateStreamOnHGlobal(hGlobal, TRUE, &pStream) == S_OK) {
-        int drawn = 0;
-
-        // Try GDI+ first (supports PNG, JPEG, GIF, BMP, TIFF, ICO)
-        if (g_hGdiPlus && fn_GdipCreateBitmapFromStream && fn_GdipCreateFromHDC) {
-            GpBitmap *bitmap = NULL;
-            GpStatus status = fn_GdipCreateBitmapFromStream(pStream, &bitmap);
-            if (status == 0 && bitmap) {
+    if (CreateStreamOnHGlobal(hGlobal, TRUE, &pStream) != S_OK) {
+        LOG_ERROR("CreateStreamOnHGlobal failed for image data (size %lu)", (unsigned long)size);
+        GlobalFree(hGlobal);
+        return NULL;
+    }
+    return pStream;
+}
+
+static void log_png_unsupported(size_t size) {
+    LOG_ERROR("PNG image could not be rendered (size %lu bytes)", (unsigned long)size);
+    LOG_ERROR("PNG support requires GDI+ to be properly installed on Windows XP SP3");
+    LOG_ERROR("Solutions: 1) Install Windows GDI+ update KB976519");
+    LOG_ERROR("          2) Download and run gdiplus_redistributable from Microsoft");
+    LOG_ERROR("          3) Convert PNG images to JPG or BMP format");
+}
+
+// Decode and scale an image into a 32bpp premultiplied top-down DIB section.
+// On failure out->bitmap is NULL.
+static void decode_image(const void *data, size_t size, int w, int h, decoded_image_t *out) {
+    memset(out, 0, sizeof(decoded_image_t));
+    out->width = w;
+    out->height = h;
+
+    int is_png_file = is_png(data, size);
+
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h; // Top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void *bits = NULL;
+    HBITMAP hBitmap = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!hBitmap || !bits) {
+        LOG_WARN("CreateDIBSection failed for %dx%d image", w, h);
+        return;
+    }
+    memset(bits, 0, (size_t)w * h * 4); // Fully transparent
+
+    IStream *pStream = create_image_stream(data, size);
+    if (!pStream) {
+        DeleteObject(hBitmap);
+        return;
+    }
+
+    int decoded = 0;
+
+    // Try GDI+ first (supports PNG, JPEG, GIF, BMP, TIFF, ICO); draw straight into the
+    // DIB's pixels as premultiplied ARGB so alpha is preserved for AlphaBlend
+    if (g_hGdiPlus && fn_GdipCreateBitmapFromStream && fn_GdipCreateBitmapFromScan0 && fn_GdipGetImageGraphicsContext) {
+        GpBitmap *source = NULL;
+        GpStatus status = fn_GdipCreateBitmapFromStream(pStream, &source);
+        if (status == 0 && source) {
+            GpBitmap *target = NULL;
+            if (fn_GdipCreateBitmapFromScan0(w, h, w * 4, GDIP_PIXEL_FORMAT_32BPP_PARGB, (BYTE*)bits, &target) == 0 && target) {
                 GpGraphics *graphics = NULL;
-                GpStatus graphics_status = fn_GdipCreateFromHDC(hdc, &graphics);
-                if (graphics_status == 0 && graphics) {
-                    // Draw at the requested position and size (w, h already include padding/border from layout)
-                    GpStatus draw_status = fn_GdipDrawImageRectI(graphics, (GpImage*)bitmap, x, y, w, h);
+                if (fn_GdipGetImageGraphicsContext((GpImage*)target, &graphics) == 0 && graphics) {
+                    GpStatus draw_status = fn_GdipDrawImageRectI(graphics, (GpImage*)source, 0, 0, w, h);
                     if (draw_status == 0) {
-                        drawn = 1;
+                        decoded = 1;
+                        out->has_alpha = 1;
                     } else {
                         LOG_WARN("GdipDrawImageRectI failed with status %d", (int)draw_status);
                     }
                     fn_GdipDeleteGraphics(graphics);
-                } else {
-                    LOG_WARN("GdipCreateFromHDC failed with status %d", (int)graphics_status);
-                }
-                fn_GdipDisposeImage((GpImage*)bitmap);
-            } else if (status != 0) {
-                if (is_png_file) {
-                    // PNG codec issue - likely GDI+ version or installation problem
-                    LOG_WARN("GDI+ PNG codec failed (status %d). GDI+ may not be installed or updated.", (int)status);
-                } else {
-                    LOG_DEBUG("GDI+ failed to load image (status %d), trying OleLoadPicture", (int)status);
                 }
+                fn_GdipDisposeImage((GpImage*)target);
+            }
+            fn_GdipDisposeImage((GpImage*)source);
+        } else if (status != 0) {
+            if (is_png_file) {
+                // PNG codec issue - likely GDI+ version or installation problem
+                LOG_WARN("GDI+ PNG codec failed (status %d). GDI+ may not be installed or updated.", (int)status);
+            } else {
+                LOG_DEBUG("GDI+ failed to load image (status %d), trying OleLoadPicture", (int)status);
             }
-            // If GDI+ failed, reset stream position for fallback
-            LARGE_INTEGER li = {0};
-            pStream->lpVtbl->Seek(pStream, li, STREAM_SEEK_SET, NULL);
         }
+        // If GDI+ failed, reset stream position for fallback
+        LARGE_INTEGER li = {0};
+        pStream->lpVtbl->Seek(pStream, li, STREAM_SEEK_SET, NULL);
+    }
 
-        if (!drawn && !is_png_file) {
-            // Fallback to OLE (BMP, JPG, GIF, ICO) - NOTE: OLE does NOT support PNG
-            IPicture *pPicture = NULL;
-            HRESULT hr = OleLoadPicture(pStream, size, FALSE, &IID_IPicture, (void**)&pPicture);
-            if (hr == S_OK && pPicture) {
-                long hmWidth, hmHeight;
-                pPicture->lpVtbl->get_Width(pPicture, &hmWidth);
-                pPicture->lpVtbl->get_Height(pPicture, &hmHeight);
-
-                HRESULT render_hr = pPicture->lpVtbl->Render(pPicture, hdc, x, y, w, h, 0, hmHeight, hmWidth, -hmHeight, NULL);
-                if (render_hr == S_OK) {
-                    drawn = 1;
-                } else {
-                    LOG_WARN("OleLoadPicture Render failed (hr=0x%lx)", (unsigned long)render_hr);
-                }
-                pPicture->lpVtbl->Release(pPicture);
+    if (!decoded && !is_png_file) {
+        // Fallback to OLE (BMP, JPG, GIF, ICO) - NOTE: OLE does NOT support PNG
+        IPicture *pPicture = NULL;
+        HRESULT hr = OleLoadPicture(pStream, size, FALSE, &IID_IPicture, (void**)&pPicture);
+        if (hr == S_OK && pPicture) {
+            long hmWidth, hmHeight;
+            pPicture->lpVtbl->get_Width(pPicture, &hmWidth);
+            pPicture->lpVtbl->get_Height(pPicture, &hmHeight);
+
+            HDC memDC = CreateCompatibleDC(NULL);
+            HBITMAP oldBitmap = SelectObject(memDC, hBitmap);
+            HRESULT render_hr = pPicture->lpVtbl->Render(pPicture, memDC, 0, 0, w, h, 0, hmHeight, hmWidth, -hmHeight, NULL);
+            SelectObject(memDC, oldBitmap);
+            DeleteDC(memDC);
+
+            if (render_hr == S_OK) {
+                decoded = 1;
             } else {
-                LOG_WARN("Image load failed (OleLoadPicture) for size %lu (hr=0x%lx)", (unsigned long)size, (unsigned long)hr);
+                LOG_WARN("OleLoadPicture Render failed (hr=0x%lx)", (unsigned long)render_hr);
             }
+            pPicture->lpVtbl->Release(pPicture);
+        } else {
+            LOG_WARN("Image load failed (OleLoadPicture) for size %lu (hr=0x%lx)", (unsigned long)size, (unsigned long)hr);
         }
+    }
 
-        if (!drawn && is_png_file) {
-            LOG_ERROR("PNG image could not be rendered (size %lu bytes)", (unsigned long)size);
-            LOG_ERROR("PNG support requires GDI+ to be properly installed on Windows XP SP3");
-            LOG_ERROR("Solutions: 1) Install Windows GDI+ update KB976519");
-            LOG_ERROR("          2) Download and run gdiplus_redistributable from Microsoft");
-            LOG_ERROR("          3) Convert PNG images to JPG or BMP format");
-        }
+    pStream->lpVtbl->Release(pStream);
 
-        pStream->lpVtbl->Release(pStream);
+    if (!decoded) {
+        if (is_png_file) log_png_unsupported(size);
+        DeleteObject(hBitmap);
+        return;
+    }
+
+    GdiFlush();
+    if (out->has_alpha) {
+        // Opaque images can skip per-pixel blending at paint time
+        const BYTE *px = (const BYTE *)bits;
+        size_t count = (size_t)w * h;
+        out->has_alpha = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (px[i * 4 + 3] != 0xFF) {
+                out->has_alpha = 1;
+                break;
+            }
+        }
     } else {
-        LOG_ERROR("CreateStreamOnHGlobal failed for image data (size %lu)", (unsigned long)size);
-        GlobalFree(hGlobal);
+        // GDI leaves the alpha channel at zero; mark every pixel opaque
+        BYTE *px = (BYTE *)bits;
+        size_t count = (size_t)w * h;
+        for (size_t i = 0; i < count; i++) px[i * 4 + 3] = 0xFF;
     }
-}
 
-void render_tree(HDC hdc, layout_box_t *box, int offset_x, int offset_y) {
-    if (!box || !box->node || !box->node->style) return;
-    if (box->node->style->display == DISPLAY_NONE) return;
+    out->bitmap = hBitmap;
+    out->bits = bits;
+}
 
-    int x = box->fragment.border_box.x + offset_x;
-    int y = box->fragment.border_box.y + offset_y;
-    int w = box->fragment.border_box.width;
-    int h = box->fragment.border_box.height;
+static void blit_decoded(HDC hdc, decoded_image_t *image, int x, int y) {
+    HDC memDC = CreateCompatibleDC(hdc);
+    if (!memDC) return;
+    HBITMAP oldBitmap = SelectObject(memDC, image->bitmap);
 
-    if (box->node->type == DOM_NODE_ELEMENT) {
-        if (box->node->tag_name && strcasecmp(box->node->tag_name, "img") == 0) {
-            render_image_data(hdc, box->node->image_data, box->node->image_size, x, y, w, h);
-        } else {
-            // Background color if set
-            if (box->node->style->bg_color != 0xFFFFFF) {
-                HBRUSH hBrush = CreateSolidBrush(RGB((box->node->style->bg_color >> 16) & 0xFF, (box->node->style->bg_color >> 8) & 0xFF, box->node->style->bg_color & 0xFF));
-                RECT r = {x, y, x + w, y + h};
-                FillRect(hdc, &r, hBrush);
-                DeleteObject(hBrush);
-            }
+    if (image->has_alpha) {
+        BLENDFUNCTION blend = {AC_SRC_OVER, 0, 255, AC_SRC_ALPHA};
+        AlphaBlend(hdc, x, y, image->width, image->height, memDC, 0, 0, image->width, image->height, blend);
+    } else {
+        BitBlt(hdc, x, y, image->width, image->height, memDC, 0, 0, SRCCOPY);
+    }
 
-            // Background Image
-            if (box->node->bg_image_data) {
-                render_image_data(hdc, box->node->bg_image_data, box->node->bg_image_size, x, y, w, h);
-            }
-            
-            // Border if set
-            if (box->node->style->border_width > 0) {
-                COLORREF borderColor = RGB(0, 0, 0);
-                if (box->node == g_focused_node) borderColor = RGB(0, 120, 215); // Focused blue
-                
-                HPEN hPen = CreatePen(PS_SOLID, box->node->style->border_width, borderColor);
-                HPEN oldPen = SelectObject(hdc, hPen);
-                HBRUSH oldBrush = SelectObject(hdc, GetStockObject(NULL_BRUSH));
-                
-                Rectangle(hdc, x, y, x + w, y + h);
-                
-                SelectObject(hdc, oldBrush);
-                SelectObject(hdc, oldPen);
-                DeleteObject(hPen);
-            }
+    SelectObject(memDC, oldBitmap);
+    DeleteDC(memDC);
+}
 
-            // Render iframe content
-            if (box->iframe_root) {
-                int bw = box->node->style->border_width;
-                int pl = box->node->style->padding_left;
-                int pt = box->node->style->padding_top;
-                int cx = x + bw + pl;
-                int cy = y + bw + pt;
-                int cw = box->fragment.content_box.width;
-                // Use content box height if calculated, otherwise calculate from border box
-                int ch = box->fragment.content_box.height;
-                if (ch <= 0) ch = h - (bw * 2) - pt - box->node->style->padding_bottom;
-                
-                HRGN hRgn = CreateRectRgn(cx, cy, cx + cw, cy + ch);
-                SelectClipRgn(hdc, hRgn);
-                
-                render_tree(hdc, box->iframe_root, cx, cy);
-                
-                SelectClipRgn(hdc, NULL);
-                DeleteObject(hRgn);
+// Uncached path for images too large to keep decoded: decode straight onto the target DC
+static void draw_image_direct(HDC hdc, void *data, size_t size, int x, int y, int w, int h) {
+    int is_png_file = is_png(data, size);
+    IStream *pStream = create_image_stream(data, size);
+    if (!pStream) return;
+
+    int drawn = 0;
+    if (g_hGdiPlus && fn_GdipCreateBitmapFromStream && fn_GdipCreateFromHDC) {
+        GpBitmap *bitmap = NULL;
+        if (fn_GdipCreateBitmapFromStream(pStream, &bitmap) == 0 && bitmap) {
+            GpGraphics *graphics = NULL;
+            if (fn_GdipCreateFromHDC(hdc, &graphics) == 0 && graphics) {
+                if (fn_GdipDrawImageRectI(graphics, (GpImage*)bitmap, x, y, w, h) == 0) drawn = 1;
+                fn_GdipDeleteGraphics(graphics);
             }
+            fn_GdipDisposeImage((GpImage*)bitmap);
+        }
+        LARGE_INTEGER li = {0};
+        pStream->lpVtbl->Seek(pStream, li, STREAM_SEEK_SET, NULL);
+    }
 
-            // Render input value
-            if (box->node->tag_name && strcasecmp(box->node->tag_name, "input") == 0) {
-                const char *val = box->node->current_value ? box->node->current_value : node_get_attr(box->node, "value");
-                if (val && strlen(val) > 0) {
-                    set_color_from_style(hdc, box->node->style);
-                    SetBkMode(hdc, TRANSPARENT);
-                    HFONT hFont = get_font(box->node->style);
-                    HFONT oldFont = SelectObject(hdc, hFont);
-                    
-                    int bw = box->node->style->border_width;
-                    RECT r = {
-                        x + box->node->style->padding_left + bw, 
-                        y + box->node->style->padding_top + bw, 
-                        x + w - box->node->style->padding_right - bw, 
-                        y + h - box->node->style->padding_bottom - bw
-                    };
-                    
-                    UINT format = DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
-                    if (box->node->style->text_align == TEXT_ALIGN_CENTER) format = DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
-                    else if (box->node->style->text_align == TEXT_ALIGN_RIGHT) format = DT_RIGHT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
-                    
-                    DrawText(hdc, val, -1, &r, format);
-                    
-                    SelectObject(hdc, oldFont);
-                    DeleteObject(hFont);
-                }
-            }
+    if (!drawn && !is_png_file) {
+        IPicture *pPicture = NULL;
+        if (OleLoadPicture(pStream, size, FALSE, &IID_IPicture, (void**)&pPicture) == S_OK && pPicture) {
+            long hmWidth, hmHeight;
+            pPicture->lpVtbl->get_Width(pPicture, &hmWidth);
+            pPicture->lpVtbl->get_Height(pPicture, &hmHeight);
+            if (pPicture->lpVtbl->Render(pPicture, hdc, x, y, w, h, 0, hmHeight, hmWidth, -hmHeight, NULL) == S_OK) drawn = 1;
+            pPicture->lpVtbl->Release(pPicture);
         }
-    } else if (box->node->type == DOM_NODE_TEXT && box->node->content) {
-        set_color_from_style(hdc, box->node->style);
-        SetBkMode(hdc, TRANSPARENT);
-        
-        HFONT hFont = get_font(box->node->style);
-        HFONT oldFont = SelectObject(hdc, hFont);
+    }
+
+    if (!drawn) LOG_WARN("Image could not be drawn (size %lu bytes)", (unsigned long)size);
+    pStream->lpVtbl->Release(pStream);
+}
 
-        RECT r = {x, y, x + w, y + h};
-        DrawText(hdc, box->node->content, -1, &r, DT_LEFT | DT_WORDBREAK | DT_NOPREFIX);
+void render_image_data(HDC hdc, void *data, size_t size, int x, int y, int w, int h) {
+    if (!data || size == 0) return;
 
-        SelectObject(hdc, oldFont);
-        DeleteObject(hFont);
+    // Validate image size is reasonable (some sanity check)
+    if (size > 10 * 1024 * 1024) {
+        LOG_WARN("Image data too large: %lu bytes (max 10MB)", (unsigned long)size);
+        return;
     }
 
-    // Pass the current box's absolute position as the offset for children
-    // This assumes children's coordinates are relative to this box.
-    // Do not render children of replaced elements (img, iframe)
-    int is_replaced = 0;
-    if (box->node->type == DOM_NODE_ELEMENT && box->node->tag_name) {
-        if (strcasecmp(box->node->tag_name, "img") == 0 || 
-            strcasecmp(box->node->tag_name, "iframe") == 0) {
-            is_replaced = 1;
+    // Use reasonable defaults for zero dimensions
+    if (w <= 0) w = 100;
+    if (h <= 0) h = 100;
+
+    decoded_image_t *image = image_cache_lookup(data, size, w, h);
+    if (!image) {
+        image_cache_stats_t stats;
+        image_cache_get_stats(&stats);
+        if ((size_t)w * h * 4 > stats.budget / 2) {
+            // Too large to keep decoded without thrashing the cache
+            draw_image_direct(hdc, data, size, x, y, w, h);
+            return;
         }
+
+        decoded_image_t fresh;
+        decode_image(data, size, w, h, &fresh);
+        // Failures are cached too, so a broken image is not re-decoded on every paint
+        image = image_cache_insert(data, size, w, h, &fresh);
     }
 
-    if (!is_replaced) {
-        layout_box_t *child = box->first_child;
-        while (child) {
-            render_tree(hdc, child, x, y);
-            child = child->next_sibling;
+    if (image && image->bitmap) {
+        blit_decoded(hdc, image, x, y);
+    }
+}
+
+// Fonts are requested for every text op on every paint, so keep the
+// handful of distinct style combinations alive instead of recreating them.
+#define FONT_CACHE_SIZE 32
+
+typedef struct {
+    int size;
+    int weight;
+    int italic;
+    int decoration;
+    int family;
+    HFONT font;
+} font_cache_entry_t;
+
+static font_cache_entry_t g_font_cache[FONT_CACHE_SIZE];
+static int g_font_cache_count = 0;
+static int g_font_cache_next = 0;
+
+static HFONT get_cached_font(style_t *style) {
+    int size = style ? style->font_size : 0;
+    int weight = style ? style->font_weight : 0;
+    int italic = style ? (int)style->font_style : 0;
+    int decoration = style ? (int)style->text_decoration : 0;
+    int family = style ? (int)style->font_family : 0;
+
+    for (int i = 0; i < g_font_cache_count; i++) {
+        font_cache_entry_t *e = &g_font_cache[i];
+        if (e->size == size && e->weight == weight && e->italic == italic &&
+            e->decoration == decoration && e->family == family) {
+            return e->font;
         }
     }
-}
\ No newline at end of file
+
+    HFONT font = get_font(style);
+    font_cache_entry_t *slot;
+    if (g_font_cache_count < FONT_CACHE_SIZE) {
+        slot = &g_font_cache[g_font_cache_count++];
+    } else {
+        // Round-robin replacement; the evicted font is never selected outside a paint
+        slot = &g_font_cache[g_font_cache_next];
+        g_font_cache_next = (g_font_cache_next + 1) % FONT_CACHE_SIZE;
+        DeleteObject(slot->font);
+    }
+    slot->size = size;
+    slot->weight = weight;
+    slot->italic = italic;
+    slot->decoration = decoration;
+    slot->family = family;
+    slot->font = font;
+    return font;
+}
+
+static void free_font_cache(void) {
+    for (int i = 0; i < g_font_cache_count; i++) {
+        DeleteObject(g_font_cache[i].font);
+    }
+    g_font_cache_count = 0;
+    g_font_cache_next = 0;
+}
+
+static COLORREF to_colorref(uint32_t color) {
+    return RGB((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+}
+
+static void fill_rect_color(HDC hdc, int x, int y, int w, int h, COLORREF color) {
+    if (w <= 0 || h <= 0) return;
+    RECT r = {x, y, x + w, y + h};
+    SetDCBrushColor(hdc, color);
+    FillRect(hdc, &r, (HBRUSH)GetStockObject(DC_BRUSH));
+}
+
+// --- Display list backend ---
+
+typedef struct {
+    dl_backend_t base;
+    HDC hdc;
+} gdi_backend_t;
+
+static void gdi_fill_rect(dl_backend_t *backend, int x, int y, int w, int h, uint32_t color) {
+    fill_rect_color(((gdi_backend_t *)backend)->hdc, x, y, w, h, to_colorref(color));
+}
+
+static void gdi_draw_text(dl_backend_t *backend, const dl_op_t *op, const char *text, int x, int y, int w, int h) {
+    HDC hdc = ((gdi_backend_t *)backend)->hdc;
+    node_t *node = op->node;
+    UINT format = DT_LEFT | DT_WORDBREAK | DT_NOPREFIX;
+    if (op->text_flags & DL_TEXT_INPUT_VALUE) {
+        format = DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
+        if (node->style->text_align == TEXT_ALIGN_CENTER) format = DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
+        else if (node->style->text_align == TEXT_ALIGN_RIGHT) format = DT_RIGHT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX;
+    }
+
+    set_color_from_style(hdc, node->style);
+    HFONT oldFont = SelectObject(hdc, get_cached_font(node->style));
+    RECT r = {x, y, x + w, y + h};
+    DrawText(hdc, text, -1, &r, format);
+    SelectObject(hdc, oldFont);
+}
+
+static void gdi_draw_image(dl_backend_t *backend, const dl_op_t *op, int x, int y, int w, int h) {
+    render_image_data(((gdi_backend_t *)backend)->hdc, (void*)op->image_data, op->image_size, x, y, w, h);
+}
+
+static void gdi_push_clip(dl_backend_t *backend, int x, int y, int w, int h) {
+    HDC hdc = ((gdi_backend_t *)backend)->hdc;
+    SaveDC(hdc);
+    IntersectClipRect(hdc, x, y, x + w, y + h);
+}
+
+static void gdi_pop_clip(dl_backend_t *backend) {
+    RestoreDC(((gdi_backend_t *)backend)->hdc, -1);
+}
+
+void render_display_list(HDC hdc, display_list_t *list, int offset_x, int offset_y, const RECT *dirty) {
+    if (!list) return;
+
+    SetBkMode(hdc, TRANSPARENT);
+    gdi_backend_t backend = {
+        {gdi_fill_rect, gdi_draw_text, gdi_draw_image, gdi_push_clip, gdi_pop_clip, g_focused_node},
+        hdc
+    };
+    if (dirty) {
+        rect_t area = {dirty->left, dirty->top, dirty->right - dirty->left, dirty->bottom - dirty->top};
+        display_list_replay(list, &backend.base, offset_x, offset_y, &area);
+    } else {
+        display_list_replay(list, &backend.base, offset_x, offset_y, NULL);
+    }
+}
+
+void render_tree(HDC hdc, layout_box_t *box, int offset_x, int offset_y) {
+    display_list_t *list = display_list_build(box);
+    if (!list) return;
+    render_display_list(hdc, list, offset_x, offset_y, NULL);
+    display_list_free(list);
+}
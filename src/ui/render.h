@@ -3,12 +3,15 @@
 
 #include <windows.h>
 #include "../core/layout.h"
+#include "../core/display_list.h"
 
 extern node_t *g_focused_node;
 
 void render_init(void);
 void render_cleanup(void);
 void render_tree(HDC hdc, layout_box_t *box, int offset_x, int offset_y);
+// Replay a recorded display list; ops outside the dirty rect (client coordinates) are skipped
+void render_display_list(HDC hdc, display_list_t *list, int offset_x, int offset_y, const RECT *dirty);
 void render_image_data(HDC hdc, void *data, size_t size, int x, int y, int w, int h);
 void render_extract_image_dimensions(const void *data, size_t size, int *out_width, int *out_height);
 
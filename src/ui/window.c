@@ -5,14 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include "render.h"
+#include "backing_store.h"
 #include "history.h"
 #include "history_ui.h"
 #include "bookmarks.h"
 #include "core/log.h"
 #include "network/protocol.h"
+#include "network/http_cache.h"
 #include "core/html.h"
 #include "core/layout.h"
 #include "ui/form.h"
+#include "navigator.h"
 
 // Constants
 #define TOP_BAR_HEIGHT 30
@@ -29,20 +32,48 @@
 #define ID_STATUS_TEXT 1008
 #define ID_PROG_CTRL 1009
 
+// Timer IDs
+#define ID_TIMER_PREFETCH 1
+
 // Standard Shell32 Animation IDs
 #define IDR_AVI_FILECOPY 160
 
+// Everything needed to put a page back on screen without refetching it,
+// kept on its history node by the back/forward cache
+typedef struct {
+    node_t *dom;
+    layout_box_t *layout;
+    display_list_t *display_list;
+    layout_index_t *layout_index;
+    int layout_width;
+    int content_width;
+    int content_height;
+    int scroll_x;
+    int scroll_y;
+} cached_page_t;
+
 // Global state
+static node_t *g_current_dom = NULL; // Owns everything below
 static layout_box_t *g_current_layout = NULL;
+static display_list_t *g_display_list = NULL; // Recorded from g_current_layout
+static layout_index_t *g_layout_index = NULL;  // Hit testing over g_current_layout
+static backing_store_t *g_backing_store = NULL; // Painted tiles of g_display_list
 static history_tree_t *g_history = NULL;
 static int g_scroll_y = 0;
 static int g_scroll_x = 0;
 static int g_content_height = 0;
 static int g_content_width = 0;
+static int g_layout_width = 0; // Available width g_current_layout was built for
 node_t *g_focused_node = NULL; // Removed static, matches render.h
 static HINSTANCE g_hInst;
 static int g_manual_navigation = 0;
-static int g_skip_history = 0;
+static int g_nav_from_history = 0; // The current navigation revisits g_history->current
+static int g_nav_shown = 0;        // A page of the current navigation is on screen
+static int g_nav_partials = 0;     // Partial pages shown for it so far
+static DWORD g_nav_start = 0;
+static int g_first_paint_pending = 0;
+static int g_page_partial = 0;     // The page on screen is still loading
+static char *g_page_url = NULL;    // Address of the page on screen, which forms resolve against
 static HMODULE g_hShell32 = NULL;
 static HWND g_hLoading = NULL;
 
@@ -53,11 +84,14 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
 static LRESULT CALLBACK HistoryWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 static void ResizeChildWindows(HWND hwnd, int width, int height);
 void Navigate(HWND hwnd, const char *url); // Forward declaration
-static void ProcessResponse(HWND hwnd, network_response_t *res, const char *url);
+static void StartNavigation(HWND hwnd, const char *url, const char *post_body, int from_history);
+static void OnNavigationDone(HWND hwnd, nav_result_t *result);
+static void FreePage(void *page);
 
 BOOL CreateMainWindow(HINSTANCE hInstance, int nCmdShow) {
     g_hInst = hInstance;
     g_history = history_create(); // Fixed: history_create, not history_tree_create
+    history_set_page_cache(g_history, HISTORY_PAGE_CACHE_MAX_PAGES, HISTORY_PAGE_CACHE_BUDGET, FreePage);
     
     // Initialize Common Controls
     INITCOMMONCONTROLSEX icex;
@@ -151,6 +185,30 @@ static void UpdateScrollBars(HWND hwnd) {
     SetScrollInfo(hwnd, SB_HORZ, &si, TRUE);
 }
 
+// Repaint everything after the content itself changed (new page, focus, typing)
+static void InvalidateContent(HWND hwnd) {
+    backing_store_invalidate(g_backing_store);
+    InvalidateRect(hwnd, NULL, FALSE);
+    // Refill the tiles around the viewport once the message queue is idle
+    SetTimer(hwnd, ID_TIMER_PREFETCH, USER_TIMER_MINIMUM, NULL);
+}
+
+// Shift what is already on screen and paint only the newly exposed strip
+static void ScrollContent(HWND hwnd, int new_x, int new_y) {
+    int dx = g_scroll_x - new_x;
+    int dy = g_scroll_y - new_y;
+    if (dx == 0 && dy == 0) return;
+
+    g_scroll_x = new_x;
+    g_scroll_y = new_y;
+    SetScrollPos(hwnd, SB_HORZ, g_scroll_x, TRUE);
+    SetScrollPos(hwnd, SB_VERT, g_scroll_y, TRUE);
+
+    ScrollWindowEx(hwnd, dx, dy, NULL, NULL, NULL, NULL, SW_INVALIDATE);
+    UpdateWindow(hwnd);
+    SetTimer(hwnd, ID_TIMER_PREFETCH, USER_TIMER_MINIMUM, NULL);
+}
+
 static void ShowLoading(HWND hParent) {
     if (!g_hLoading) return;
 
@@ -171,14 +229,10 @@ static void ShowLoading(HWND hParent) {
             SendMessage(hAnim, ACM_PLAY, (WPARAM)-1, MAKELPARAM(0, -1));
         }
     }
-    UpdateWindow(g_hLoading);
-    UpdateWindow(hParent);
-    
-    // Pump messages
-    MSG msg;
-    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+    HWND hProg = GetDlgItem(g_hLoading, ID_PROG_CTRL);
+    if (hProg) {
+        SendMessage(hProg, PBM_SETRANGE, 0, MAKELPARAM(0, 1));
+        SendMessage(hProg, PBM_SETPOS, 0, 0);
     }
 }
 
@@ -195,8 +249,9 @@ static void HandleClick(HWND hwnd, int x, int y) {
 
     if (!g_current_layout) return;
 
-    // Fixed: layout_hit_test, not layout_find_at
-    layout_box_t *clicked = layout_hit_test(g_current_layout, absoluteX, absoluteY);
+    layout_box_t *clicked = g_layout_index
+        ? layout_index_hit_test(g_layout_index, absoluteX, absoluteY)
+        : layout_hit_test(g_current_layout, absoluteX, absoluteY);
     if (clicked && clicked->node) {
         node_t *node = clicked->node;
 
@@ -204,7 +259,7 @@ static void HandleClick(HWND hwnd, int x, int y) {
         if (strcasecmp(node->tag_name, "input") == 0 || strcasecmp(node->tag_name, "textarea") == 0) {
             g_focused_node = node;
             SetFocus(hwnd); // Ensure window has keyboard focus
-            InvalidateRect(hwnd, NULL, TRUE);
+            InvalidateContent(hwnd);
         } else {
             g_focused_node = NULL;
         }
@@ -228,44 +283,236 @@ static void HandleClick(HWND hwnd, int x, int y) {
         }
 
         if (is_submit) {
-            const char *base_url = (g_history && g_history->current) ? g_history->current->url : "about:blank";
-            char target_url[2048];
-            
-            // Show Loading
-            ShowLoading(GetParent(hwnd));
-
-            network_response_t *res = form_submit(node, base_url, target_url, sizeof(target_url));
-            if (res) {
-                ProcessResponse(GetParent(hwnd), res, target_url);
-                network_response_free(res);
+            const char *base_url = g_page_url ? g_page_url : "about:blank";
+            form_request_t req;
+            if (form_build_request(node, base_url, &req)) {
+                StartNavigation(GetParent(hwnd), req.url, req.post_body, 0);
+                free(req.post_body);
             } else {
                 LOG_ERROR("Form submission failed");
             }
+        }
+    }
+}
+
+static void SetPageUrl(const char *url) {
+    free(g_page_url);
+    g_page_url = url ? strdup(url) : NULL;
+}
+
+static int IsFormControl(const node_t *node) {
+    return node->tag_name &&
+           (strcasecmp(node->tag_name, "input") == 0 || strcasecmp(node->tag_name, "textarea") == 0);
+}
 
-            HideLoading();
+// Form controls in document order, iframes included. Returns how many there
+// are; only the first max are stored (out may be NULL to just count).
+static int CollectFormControls(node_t *node, node_t **out, int max, int count) {
+    for (; node; node = node->next_sibling) {
+        if (IsFormControl(node)) {
+            if (out && count < max) out[count] = node;
+            count++;
         }
+        count = CollectFormControls(node->iframe_doc, out, max, count);
+        count = CollectFormControls(node->first_child, out, max, count);
     }
+    return count;
 }
 
-#include "network/loader.h"
+// Move what the user typed on the page on screen, and the focus, onto the
+// next page of the same navigation. Both are clones of one growing document,
+// so the n-th form control of one is the n-th of the other.
+static void CarryFormState(node_t *from, node_t *to) {
+    int count = CollectFormControls(from, NULL, 0, 0);
+    if (count == 0) return;
+    node_t **old_controls = malloc(count * sizeof(node_t*));
+    node_t **new_controls = malloc(count * sizeof(node_t*));
+    if (!old_controls || !new_controls) {
+        free(old_controls);
+        free(new_controls);
+        return;
+    }
+    CollectFormControls(from, old_controls, count, 0);
+    int carried = CollectFormControls(to, new_controls, count, 0);
+    if (carried > count) carried = count;
+
+    node_t *focused = NULL;
+    for (int i = 0; i < carried; i++) {
+        if (old_controls[i]->current_value) {
+            free(new_controls[i]->current_value);
+            new_controls[i]->current_value = old_controls[i]->current_value;
+            old_controls[i]->current_value = NULL;
+        }
+        if (old_controls[i] == g_focused_node) focused = new_controls[i];
+    }
+    g_focused_node = focused;
+    free(old_controls);
+    free(new_controls);
+}
 
-static void LoaderProgressCallback(int current, int total, void *ctx) {
-    HWND hLoadingPanel = (HWND)ctx;
-    HWND hProgress = GetDlgItem(hLoadingPanel, ID_PROG_CTRL);
+static size_t EstimateDomBytes(node_t *node) {
+    size_t bytes = 0;
+    for (; node; node = node->next_sibling) {
+        bytes += sizeof(node_t);
+        if (node->tag_name) bytes += strlen(node->tag_name) + 1;
+        if (node->content) bytes += strlen(node->content) + 1;
+        if (node->current_value) bytes += strlen(node->current_value) + 1;
+        if (node->style) bytes += sizeof(style_t);
+        for (attr_t *a = node->attributes; a; a = a->next) {
+            bytes += sizeof(attr_t) + (a->name ? strlen(a->name) + 1 : 0) + (a->value ? strlen(a->value) + 1 : 0);
+        }
+        // Shared image buffers are counted in full; they are freed with the last page using them
+        bytes += node->image_size + node->bg_image_size;
+        bytes += EstimateDomBytes(node->iframe_doc);
+        bytes += EstimateDomBytes(node->first_child);
+    }
+    return bytes;
+}
 
-    if (total > 0) {
-        SendMessage(hProgress, PBM_SETRANGE, 0, MAKELPARAM(0, total));
-        SendMessage(hProgress, PBM_SETPOS, current, 0);
+static size_t EstimateLayoutBytes(layout_box_t *box) {
+    size_t bytes = 0;
+    for (; box; box = box->next_sibling) {
+        bytes += sizeof(layout_box_t);
+        bytes += EstimateLayoutBytes(box->iframe_root);
+        bytes += EstimateLayoutBytes(box->first_child);
     }
+    return bytes;
+}
+
+static size_t EstimatePageBytes(const cached_page_t *page) {
+    size_t bytes = sizeof(*page) + EstimateDomBytes(page->dom) + EstimateLayoutBytes(page->layout);
+    // Spatial indexes are a few words per entry on top of the arrays they index
+    if (page->display_list) bytes += (size_t)page->display_list->capacity * sizeof(dl_op_t) * 2;
+    if (page->layout_index) bytes += (size_t)page->layout_index->count * sizeof(layout_box_t*) * 4;
+    return bytes;
+}
 
-    // Pump messages to keep UI responsive and ANIMATION playing
-    MSG msg;
-    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+static void FreePage(void *p) {
+    cached_page_t *page = p;
+    if (!page) return;
+    if (page->display_list) display_list_free(page->display_list);
+    if (page->layout_index) layout_index_free(page->layout_index);
+    if (page->layout) layout_free(page->layout);
+    if (page->dom) node_free(page->dom);
+    free(page);
+}
+
+// Move the page on screen into node's back/forward cache slot, leaving
+// nothing displayed. Without a node to keep it on, the page is freed.
+static void StashCurrentPage(history_node_t *node) {
+    if (!g_current_dom && !g_current_layout) return;
+    // A page still loading is not worth coming back to
+    if (g_page_partial) node = NULL;
+    g_page_partial = 0;
+
+    cached_page_t *page = calloc(1, sizeof(cached_page_t));
+    if (page) {
+        page->dom = g_current_dom;
+        page->layout = g_current_layout;
+        page->display_list = g_display_list;
+        page->layout_index = g_layout_index;
+        page->layout_width = g_layout_width;
+        page->content_width = g_content_width;
+        page->content_height = g_content_height;
+        page->scroll_x = g_scroll_x;
+        page->scroll_y = g_scroll_y;
+        if (node) history_store_page(g_history, node, page, EstimatePageBytes(page));
+        else FreePage(page);
+    } else {
+        if (g_display_list) display_list_free(g_display_list);
+        if (g_layout_index) layout_index_free(g_layout_index);
+        if (g_current_layout) layout_free(g_current_layout);
+        if (g_current_dom) node_free(g_current_dom);
+    }
+
+    g_current_dom = NULL;
+    g_current_layout = NULL;
+    g_display_list = NULL;
+    g_layout_index = NULL;
+    g_focused_node = NULL;
+    g_content_height = 0;
+    g_content_width = 0;
+}
+
+// Lay out g_current_dom at the current width of the content window
+static void BuildLayout(HWND hwnd) {
+    if (g_display_list) display_list_free(g_display_list);
+    g_display_list = NULL;
+    if (g_layout_index) layout_index_free(g_layout_index);
+    g_layout_index = NULL;
+    if (g_current_layout) layout_free(g_current_layout);
+    g_current_layout = NULL;
+
+    RECT rc;
+    GetClientRect(GetDlgItem(hwnd, ID_CONTENT), &rc);
+    // Initialize constraint space properly
+    constraint_space_t space = {0};
+    space.available_width = rc.right - rc.left;
+    space.is_fixed_width = 1;
+
+    g_layout_width = space.available_width;
+    g_current_layout = layout_create_tree(g_current_dom, space.available_width);
+
+    if (g_current_layout) {
+        g_display_list = display_list_build(g_current_layout);
+        g_layout_index = layout_index_create(g_current_layout);
+        g_content_height = g_current_layout->fragment.border_box.height;
+        g_content_width = g_current_layout->fragment.border_box.width;
+    } else {
+        g_content_height = 0;
+        g_content_width = 0;
     }
 }
 
+static void ShowPage(HWND hwnd) {
+    HWND hContent = GetDlgItem(hwnd, ID_CONTENT);
+    UpdateScrollBars(hContent);
+    InvalidateContent(hContent);
+
+    HWND hHistory = GetDlgItem(hwnd, ID_HISTORY);
+    if (hHistory) InvalidateRect(hHistory, NULL, TRUE);
+}
+
+// Put node's cached page back on screen where it was left. Returns 0 if
+// the page is not cached and has to be fetched again.
+static int RestorePage(HWND hwnd, history_node_t *node) {
+    DWORD start = GetTickCount();
+    cached_page_t *page = history_take_page(g_history, node);
+    if (!page) return 0;
+
+    g_current_dom = page->dom;
+    g_current_layout = page->layout;
+    g_display_list = page->display_list;
+    g_layout_index = page->layout_index;
+    g_layout_width = page->layout_width;
+    g_content_width = page->content_width;
+    g_content_height = page->content_height;
+    g_scroll_x = page->scroll_x;
+    g_scroll_y = page->scroll_y;
+    free(page);
+    SetPageUrl(node->url);
+
+    // The window may have been resized since; styles and resources still stand
+    RECT rc;
+    HWND hContent = GetDlgItem(hwnd, ID_CONTENT);
+    GetClientRect(hContent, &rc);
+    if (rc.right - rc.left != g_layout_width) BuildLayout(hwnd);
+
+    int max_y = g_content_height - (rc.bottom - rc.top);
+    int max_x = g_content_width - (rc.right - rc.left);
+    if (g_scroll_y > max_y) g_scroll_y = max_y;
+    if (g_scroll_y < 0) g_scroll_y = 0;
+    if (g_scroll_x > max_x) g_scroll_x = max_x;
+    if (g_scroll_x < 0) g_scroll_x = 0;
+
+    HWND hUrlEdit = GetDlgItem(hwnd, ID_EDIT_URL);
+    if (hUrlEdit) SetWindowText(hUrlEdit, node->url);
+
+    ShowPage(hwnd);
+    LOG_INFO("Restored %s from page cache in %lu ms", node->url, (unsigned long)(GetTickCount() - start));
+    return 1;
+}
+
 static LRESULT CALLBACK HistoryWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
         case WM_LBUTTONDOWN: {
@@ -274,10 +521,15 @@ static LRESULT CALLBACK HistoryWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
             int hitY = HIWORD(lParam);
             history_node_t *node = history_ui_hit_test(g_history, hitX, hitY);
             if (node) {
+                StashCurrentPage(g_history->current);
                 g_history->current = node;
-                g_skip_history = 1;
-                Navigate(GetParent(hwnd), node->url);
-                g_skip_history = 0;
+                if (RestorePage(GetParent(hwnd), node)) {
+                    // Whatever was still loading would replace the restored page
+                    nav_cancel();
+                    HideLoading();
+                } else {
+                    StartNavigation(GetParent(hwnd), node->url, NULL, 1);
+                }
             }
             return 0;
         }
@@ -295,85 +547,132 @@ static LRESULT CALLBACK HistoryWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
     }
 }
 
-static void ProcessResponse(HWND hwnd, network_response_t *res, const char *url) {
-    if (!res || !res->data) {
-        LOG_ERROR("ProcessResponse: No data for %s", url);
-        return;
-    }
-
-    if (!g_skip_history) {
-        history_add(g_history, res->final_url ? res->final_url : url, "Title");
-        history_ui_fetch_favicon(g_history->current);
-    }
-
-    node_t *new_dom = html_parse((char*)res->data);
-    if (new_dom) {
-        // Free old layout and DOM
-        if (g_current_layout) layout_free(g_current_layout);
-        
-        style_compute(new_dom);
-
-        // Fetch resources (Images, etc.)
-        int resource_count = loader_count_resources(new_dom);
-        
-        // Initialize progress bar
-        HWND hProg = GetDlgItem(g_hLoading, ID_PROG_CTRL);
-        if (hProg) {
-            SendMessage(hProg, PBM_SETRANGE, 0, MAKELPARAM(0, resource_count > 0 ? resource_count : 1));
-            SendMessage(hProg, PBM_SETPOS, 0, 0);
-        }
+static void StartNavigation(HWND hwnd, const char *url, const char *post_body, int from_history) {
+    LOG_INFO("Navigating to: %s", url);
 
-        if (resource_count > 0) {
-             int current = 0;
-             loader_fetch_resources(new_dom, res->final_url ? res->final_url : url, LoaderProgressCallback, g_hLoading, &current, resource_count);
-        }
+    HWND hUrlEdit = GetDlgItem(hwnd, ID_EDIT_URL);
+    if (hUrlEdit) SetWindowText(hUrlEdit, url);
 
-        RECT rc;
-        GetClientRect(GetDlgItem(hwnd, ID_CONTENT), &rc);
-        // Initialize constraint space properly
-        constraint_space_t space = {0};
-        space.available_width = rc.right - rc.left;
-        space.is_fixed_width = 1;
-        
-        g_current_layout = layout_create_tree(new_dom, space.available_width);
-
-        if (g_current_layout) {
-            g_content_height = g_current_layout->fragment.border_box.height;
-            g_content_width = g_current_layout->fragment.border_box.width;
-        } else {
-            g_content_height = 0;
-            g_content_width = 0;
-        }
-        g_scroll_y = 0;
-        g_scroll_x = 0;
+    RECT rc;
+    GetClientRect(GetDlgItem(hwnd, ID_CONTENT), &rc);
+
+    nav_request_t req = {0};
+    req.url = url;
+    req.post_body = post_body;
+    req.layout_width = rc.right - rc.left;
+    req.fetch_favicon = !from_history;
+    g_nav_from_history = from_history;
+    g_nav_shown = 0;
+    g_nav_partials = 0;
+    g_nav_start = GetTickCount();
+    g_first_paint_pending = 0;
+
+    // Center and show loading popup; it goes away when the page arrives
+    ShowLoading(hwnd);
+    nav_start(hwnd, &req);
+}
 
-        HWND hContent = GetDlgItem(hwnd, ID_CONTENT);
-        UpdateScrollBars(hContent);
-        InvalidateRect(hContent, NULL, TRUE);
+void Navigate(HWND hwnd, const char *url) {
+    StartNavigation(hwnd, url, NULL, 0);
+}
 
-        HWND hHistory = GetDlgItem(hwnd, ID_HISTORY);
-        if (hHistory) InvalidateRect(hHistory, NULL, TRUE);
+static void OnNavigationStage(nav_stage_t stage) {
+    static const char *text[] = {
+        "Connecting...", "Reading page...", "Downloading resources...", "Laying out page..."
+    };
+    HWND hStatus = GetDlgItem(g_hLoading, ID_STATUS_TEXT);
+    if (hStatus && (int)stage >= 0 && (int)stage < (int)(sizeof(text) / sizeof(text[0]))) {
+        SetWindowText(hStatus, text[stage]);
     }
 }
 
-void Navigate(HWND hwnd, const char *url) {
-    LOG_INFO("Navigating to: %s", url);
-
-    HWND hUrlEdit = GetDlgItem(hwnd, ID_EDIT_URL);
-    if (hUrlEdit) SetWindowText(hUrlEdit, url);
+static void OnNavigationProgress(int current, int total) {
+    HWND hProg = GetDlgItem(g_hLoading, ID_PROG_CTRL);
+    if (hProg) {
+        SendMessage(hProg, PBM_SETRANGE, 0, MAKELPARAM(0, total > 0 ? total : 1));
+        SendMessage(hProg, PBM_SETPOS, current, 0);
+    }
+}
 
-    // Center and show loading popup
-    ShowLoading(hwnd);
+// Put a page built by the worker on screen. The first one of a navigation
+// sends the page it replaces to the back/forward cache and starts at the
+// top; later ones (partial pages, then the finished one) keep the scroll
+// position the user has moved to meanwhile, and what was typed into its
+// forms along with the focus.
+static void AdoptPage(HWND hwnd, nav_result_t *result, int partial) {
+    int first = !g_nav_shown;
+    node_t *focused = NULL;
+    if (!first && g_page_partial && g_current_dom && result->dom) {
+        CarryFormState(g_current_dom, result->dom);
+        focused = g_focused_node;
+    }
+    StashCurrentPage(g_history->current);
+    g_focused_node = focused;
+    SetPageUrl(result->url);
+
+    g_current_dom = result->dom;
+    g_current_layout = result->layout;
+    g_display_list = result->display_list;
+    g_layout_index = result->layout_index;
+    g_layout_width = result->layout_width;
+    if (g_current_layout) {
+        g_content_height = g_current_layout->fragment.border_box.height;
+        g_content_width = g_current_layout->fragment.border_box.width;
+    }
+    result->dom = NULL;
+    result->layout = NULL;
+    result->display_list = NULL;
+    result->layout_index = NULL;
+    g_page_partial = partial;
+    g_nav_shown = 1;
+
+    // The window may have been resized while the page loaded
+    RECT rc;
+    GetClientRect(GetDlgItem(hwnd, ID_CONTENT), &rc);
+    if (rc.right - rc.left != g_layout_width) BuildLayout(hwnd);
 
-    network_response_t *res = network_fetch(url);
-    if (res && res->data) {
-        ProcessResponse(hwnd, res, res->final_url ? res->final_url : url);
-        network_response_free(res);
+    if (first) {
+        g_scroll_y = 0;
+        g_scroll_x = 0;
+        g_first_paint_pending = 1;
     } else {
-        LOG_ERROR("Failed to fetch: %s", url);
+        int max_y = g_content_height - (rc.bottom - rc.top);
+        int max_x = g_content_width - (rc.right - rc.left);
+        if (g_scroll_y > max_y) g_scroll_y = max_y > 0 ? max_y : 0;
+        if (g_scroll_x > max_x) g_scroll_x = max_x > 0 ? max_x : 0;
     }
+    ShowPage(hwnd);
+}
+
+static void OnNavigationPartial(HWND hwnd, nav_result_t *result) {
+    // The popup would cover the page that is coming in
+    if (!g_nav_shown) HideLoading();
+    g_nav_partials++;
+    AdoptPage(hwnd, result, 1);
+    nav_result_free(result);
+}
 
+// The worker finished the page; put it on screen as the current history entry
+static void OnNavigationDone(HWND hwnd, nav_result_t *result) {
     HideLoading();
+    if (!result || !result->ok) {
+        LOG_ERROR("Failed to fetch: %s", result && result->url ? result->url : "(unknown)");
+        nav_result_free(result);
+        return;
+    }
+    LOG_INFO("Loaded %s in %lu ms (%d partial pages shown)", result->url,
+             (unsigned long)(GetTickCount() - g_nav_start), g_nav_partials);
+
+    // Keep the old page for going back to it. A partial page of this
+    // navigation is left for AdoptPage, which carries its form input over.
+    if (!g_nav_shown) StashCurrentPage(g_history->current);
+    if (!g_nav_from_history) {
+        history_add(g_history, result->url, "Title");
+        history_node_set_favicon(g_history->current, result->favicon_data, result->favicon_size);
+        result->favicon_data = NULL;
+    }
+    AdoptPage(hwnd, result, 0);
+    nav_result_free(result);
 }
 
 static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
@@ -381,9 +680,17 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
         case WM_LBUTTONDOWN:
             HandleClick(hwnd, LOWORD(lParam), HIWORD(lParam));
             break;
-        case WM_SIZE:
+        case WM_SIZE: {
+            int width = LOWORD(lParam);
+            int height = HIWORD(lParam);
+            if (!g_backing_store) {
+                g_backing_store = backing_store_create(width, height, GetSysColor(COLOR_WINDOW));
+            } else {
+                backing_store_resize(g_backing_store, width, height);
+            }
             UpdateScrollBars(hwnd);
             return 0;
+        }
         case WM_VSCROLL: {
             int action = LOWORD(wParam);
             int newPos = g_scroll_y;
@@ -400,11 +707,7 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
             if (newPos < 0) newPos = 0;
             if (newPos > g_content_height - (int)page) newPos = g_content_height - (int)page;
             if (newPos < 0) newPos = 0;
-            if (newPos != g_scroll_y) {
-                g_scroll_y = newPos;
-                SetScrollPos(hwnd, SB_VERT, g_scroll_y, TRUE);
-                InvalidateRect(hwnd, NULL, TRUE);
-            }
+            ScrollContent(hwnd, g_scroll_x, newPos);
             return 0;
         }
         case WM_HSCROLL: {
@@ -423,11 +726,7 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
             if (newPos < 0) newPos = 0;
             if (newPos > g_content_width - (int)page) newPos = g_content_width - (int)page;
             if (newPos < 0) newPos = 0;
-            if (newPos != g_scroll_x) {
-                g_scroll_x = newPos;
-                SetScrollPos(hwnd, SB_HORZ, g_scroll_x, TRUE);
-                InvalidateRect(hwnd, NULL, TRUE);
-            }
+            ScrollContent(hwnd, newPos, g_scroll_y);
             return 0;
         }
         case WM_MOUSEWHEEL: {
@@ -439,11 +738,7 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
             if (newPos < 0) newPos = 0;
             if (newPos > max) newPos = max;
             if (newPos < 0) newPos = 0;
-            if (newPos != g_scroll_y) {
-                g_scroll_y = newPos;
-                SetScrollPos(hwnd, SB_VERT, g_scroll_y, TRUE);
-                InvalidateRect(hwnd, NULL, TRUE);
-            }
+            ScrollContent(hwnd, g_scroll_x, newPos);
             return 0;
         }
         case WM_CHAR:
@@ -463,21 +758,50 @@ static LRESULT CALLBACK ContentWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARA
                         g_focused_node->current_value = new_val;
                     }
                 }
-                InvalidateRect(hwnd, NULL, TRUE);
+                InvalidateContent(hwnd);
             }
             break;
+        case WM_ERASEBKGND:
+            // WM_PAINT covers every pixel; erasing first only causes flicker
+            return 1;
+        case WM_TIMER:
+            if (wParam == ID_TIMER_PREFETCH) {
+                int more = 0;
+                if (g_backing_store && g_display_list) {
+                    HDC hdc = GetDC(hwnd);
+                    more = backing_store_prefetch(g_backing_store, hdc, g_display_list,
+                                                  g_scroll_x, g_scroll_y, g_content_height);
+                    ReleaseDC(hwnd, hdc);
+                }
+                if (!more) KillTimer(hwnd, ID_TIMER_PREFETCH);
+            }
+            return 0;
         case WM_PAINT: {
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint(hwnd, &ps);
             // Render content
-            if (g_current_layout) {
-                render_tree(hdc, g_current_layout, -g_scroll_x, -g_scroll_y);
+            if (g_display_list && g_backing_store) {
+                backing_store_paint(g_backing_store, hdc, g_display_list, g_scroll_x, g_scroll_y, &ps.rcPaint);
+            } else if (g_display_list) {
+                FillRect(hdc, &ps.rcPaint, (HBRUSH)(COLOR_WINDOW + 1));
+                render_display_list(hdc, g_display_list, -g_scroll_x, -g_scroll_y, &ps.rcPaint);
             } else {
+                FillRect(hdc, &ps.rcPaint, (HBRUSH)(COLOR_WINDOW + 1));
                 TextOut(hdc, 10, 10, "No content loaded.", 18);
             }
             EndPaint(hwnd, &ps);
+            if (g_first_paint_pending && g_display_list) {
+                g_first_paint_pending = 0;
+                LOG_INFO("First paint %lu ms after navigation started", (unsigned long)(GetTickCount() - g_nav_start));
+            }
             return 0;
         }
+        case WM_DESTROY:
+            KillTimer(hwnd, ID_TIMER_PREFETCH);
+            backing_store_log_stats(g_backing_store);
+            backing_store_free(g_backing_store);
+            g_backing_store = NULL;
+            return 0;
         default:
             return DefWindowProc(hwnd, msg, wParam, lParam);
     }
@@ -535,10 +859,26 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
         case WM_SIZE:
             ResizeChildWindows(hwnd, LOWORD(lParam), HIWORD(lParam));
             break;
+        case WM_NAV_STAGE:
+            if ((unsigned long)wParam == nav_current()) OnNavigationStage((nav_stage_t)lParam);
+            return 0;
+        case WM_NAV_PROGRESS:
+            if ((unsigned long)wParam == nav_current()) OnNavigationProgress(LOWORD(lParam), HIWORD(lParam));
+            return 0;
+        case WM_NAV_PARTIAL:
+            if ((unsigned long)wParam == nav_current()) OnNavigationPartial(hwnd, (nav_result_t *)lParam);
+            else nav_result_free((nav_result_t *)lParam);
+            return 0;
+        case WM_NAV_DONE:
+            if ((unsigned long)wParam == nav_current()) OnNavigationDone(hwnd, (nav_result_t *)lParam);
+            else nav_result_free((nav_result_t *)lParam); // Superseded by a newer navigation
+            return 0;
         case WM_CLOSE:
             DestroyWindow(hwnd);
             break;
         case WM_DESTROY:
+            nav_cancel();
+            history_log_page_stats(g_history);
             if (g_hShell32) FreeLibrary(g_hShell32);
             PostQuitMessage(0);
             break;
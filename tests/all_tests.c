@@ -26,6 +26,7 @@ int main() {
     
     run_network_tests(&total_failed);
     run_core_tests(&total_failed);
+    test_remove_scratch_cache();
     
     printf("\nLaunching UI results viewer...\n");
     test_ui_show();
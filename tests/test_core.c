@@ -5,8 +5,16 @@
 #include "core/html.h"
 #include "core/style.h"
 #include "core/layout.h"
+#include "core/display_list.h"
+#include "core/spatial_index.h"
+#include "core/raster.h"
 #include "core/platform.h"
 #include "core/log.h"
+#include "core/cache.h"
+#include "core/image_sniff.h"
+#include "ui/history.h"
+#include "ui/image_cache.h"
+#include "ui/render.h"
 #include "test_ui.h"
 
 // Note: platform_measure_text is now provided by src/ui/render.c (real Win32 implementation)
@@ -29,6 +37,99 @@ static int test_dom_impl() {
     return 1;
 }
 
+// Structural equality: tags, text, attributes (in order) and children
+static int dom_equal(node_t *a, node_t *b) {
+    for (; a && b; a = a->next_sibling, b = b->next_sibling) {
+        if (a->type != b->type) return 0;
+        if ((a->tag_name || b->tag_name) && (!a->tag_name || !b->tag_name || strcmp(a->tag_name, b->tag_name) != 0)) return 0;
+        if ((a->content || b->content) && (!a->content || !b->content || strcmp(a->content, b->content) != 0)) return 0;
+        attr_t *x = a->attributes, *y = b->attributes;
+        for (; x && y; x = x->next, y = y->next) {
+            if (strcmp(x->name, y->name) != 0) return 0;
+            if ((x->value || y->value) && (!x->value || !y->value || strcmp(x->value, y->value) != 0)) return 0;
+        }
+        if (x || y) return 0;
+        if (!dom_equal(a->first_child, b->first_child)) return 0;
+    }
+    return !a && !b;
+}
+
+static int test_incremental_parse_impl() {
+    const char *html = "<!DOCTYPE html><html><head><title>T</title><style>p > b { color: red; }</style></head>"
+                       "<body><!-- a > comment --><h1 class=\"x\" title='a > b'>Title</h1>"
+                       "<p>Some <b>bold</b> text<br/>and more</p><img src=\"i.png\">"
+                       "<script>if (a < b) { x = \"</p>\"; }</script><p>tail</p></body></html>";
+    node_t *whole = html_parse(html);
+    if (!whole) return 0;
+
+    int ok = 1;
+    size_t len = strlen(html);
+    size_t chunks[] = {1, 3, 7, 64};
+    for (int c = 0; c < 4 && ok; c++) {
+        html_parser_t *parser = html_parser_create();
+        for (size_t off = 0; off < len; off += chunks[c]) {
+            size_t n = len - off < chunks[c] ? len - off : chunks[c];
+            html_parser_feed(parser, html + off, n);
+            // The partial tree is always a prefix of the final one
+            if (!html_parser_root(parser)) ok = 0;
+        }
+        if (html_parser_bytes(parser) != len) ok = 0;
+        node_t *dom = html_parser_finish(parser);
+        if (!dom_equal(whole, dom)) {
+            LOG_ERROR("Tree parsed in %lu-byte chunks differs from a whole parse", (unsigned long)chunks[c]);
+            ok = 0;
+        }
+        node_free(dom);
+    }
+
+    // A large script fed in small chunks comes out whole, without the
+    // parser rescanning it from its start on every chunk
+    size_t script_len = 256 * 1024;
+    char *script = malloc(script_len + 32);
+    if (script) {
+        strcpy(script, "<script>");
+        memset(script + 8, 'x', script_len);
+        strcpy(script + 8 + script_len, "</script><p>end</p>");
+        size_t total = strlen(script);
+        DWORD start = GetTickCount();
+        html_parser_t *big = html_parser_create();
+        for (size_t off = 0; off < total; off += 1000) {
+            html_parser_feed(big, script + off, total - off < 1000 ? total - off : 1000);
+        }
+        node_t *dom = html_parser_finish(big);
+        node_t *el = dom ? dom->first_child : NULL;
+        if (!el || !el->first_child || !el->first_child->content || strlen(el->first_child->content) != script_len ||
+            !el->next_sibling || strcmp(el->next_sibling->tag_name, "p") != 0) {
+            LOG_ERROR("Script fed in chunks was not parsed whole");
+            ok = 0;
+        }
+        LOG_INFO("%lu KB script in 1000-byte chunks parsed in %lu ms", (unsigned long)(script_len / 1024),
+                 (unsigned long)(GetTickCount() - start));
+        node_free(dom);
+        free(script);
+    }
+
+    // A cut in the middle of a tag leaves the tag out until the rest arrives
+    html_parser_t *parser = html_parser_create();
+    html_parser_feed(parser, "<p>one</p><p cla", 16);
+    node_t *root = html_parser_root(parser);
+    if (!root->first_child || root->first_child != root->last_child) {
+        LOG_ERROR("Incomplete tag was added to the partial tree");
+        ok = 0;
+    }
+    html_parser_free(parser);
+
+    node_t *copy = node_clone(whole);
+    if (!dom_equal(whole, copy)) {
+        LOG_ERROR("node_clone does not reproduce the tree");
+        ok = 0;
+    }
+    node_free(copy);
+    node_free(whole);
+    if (ok) LOG_INFO("Incremental parse matches a whole parse for every chunk size");
+    return ok;
+}
+
 static int test_style_impl() {
     const char *html = "<html><body><h1>Title</h1></body></html>";
     node_t *dom = html_parse(html);
@@ -195,9 +296,957 @@ static int test_layout_accuracy_impl() {
     return passed;
 }
 
+static int test_iframe_layout_cache_impl() {
+    // The leading block keeps the iframe in the block flow, where it is laid out directly
+    node_t *dom = html_parse("<html><body><div></div><iframe></iframe></body></html>");
+    if (!dom) return 0;
+    node_t *iframe = dom->first_child->first_child->last_child;
+    if (!iframe || !iframe->tag_name || strcmp(iframe->tag_name, "iframe") != 0) {
+        LOG_ERROR("iframe node not found");
+        node_free(dom);
+        return 0;
+    }
+    iframe->iframe_doc = html_parse("<html><body><p>Embedded</p></body></html>");
+    style_compute(dom);
+    style_compute(iframe->iframe_doc);
+
+    layout_box_t *layout = layout_create_tree(dom, 800);
+    layout_box_t *iframe_box = layout->first_child->first_child->first_child->next_sibling;
+    layout_box_t *first_root = iframe_box ? iframe_box->iframe_root : NULL;
+    if (!first_root) {
+        LOG_ERROR("iframe layout was not created");
+        layout_free(layout);
+        node_free(dom);
+        return 0;
+    }
+
+    // Same width: the nested layout must be reused
+    constraint_space_t space = {800, 0, 1, 0};
+    layout_compute(layout, space);
+    int passed = (iframe_box->iframe_root == first_root);
+    if (!passed) LOG_ERROR("iframe layout rebuilt on relayout with unchanged width");
+
+    // Different content width: the nested layout must be recomputed
+    iframe->style->width = 200;
+    layout_compute(layout, space);
+    if (iframe_box->iframe_layout_width != 200) {
+        LOG_ERROR("iframe layout not recomputed for new width (got %d)", iframe_box->iframe_layout_width);
+        passed = 0;
+    }
+
+    if (passed) LOG_INFO("iframe layout cached across relayouts");
+    layout_free(layout);
+    node_free(dom);
+    return passed;
+}
+
+static int test_display_list_impl() {
+    node_t *dom = html_parse("<html><body><div style=\"background-color: #ff0000; margin-left: 10px\">Text</div>"
+                             "<iframe></iframe></body></html>");
+    if (!dom) return 0;
+    node_t *iframe = dom->first_child->first_child->last_child;
+    iframe->iframe_doc = html_parse("<html><body><p>Embedded</p></body></html>");
+    style_compute(dom);
+    style_compute(iframe->iframe_doc);
+    iframe->style->width = 200;
+    iframe->style->height = 100;
+
+    layout_box_t *layout = layout_create_tree(dom, 800);
+    display_list_t *list = display_list_build(layout);
+    if (!list) {
+        LOG_ERROR("display_list_build returned NULL");
+        layout_free(layout);
+        node_free(dom);
+        return 0;
+    }
+
+    int passed = 1;
+    int fills = 0, texts = 0, depth = 0, max_depth = 0;
+    layout_box_t *div_box = layout->first_child->first_child->first_child;
+    for (int i = 0; i < list->count; i++) {
+        dl_op_t *op = &list->ops[i];
+        if (op->type == DL_OP_RECT_FILL && op->color == 0xFF0000) {
+            fills++;
+            // The fill must use absolute coordinates of the div's border box
+            if (op->rect.x != div_box->fragment.border_box.x + layout->first_child->first_child->fragment.border_box.x +
+                              layout->first_child->fragment.border_box.x) {
+                LOG_ERROR("Fill op x=%d is not absolute", op->rect.x);
+                passed = 0;
+            }
+        }
+        if (op->type == DL_OP_TEXT) texts++;
+        if (op->type == DL_OP_CLIP_PUSH) { depth++; if (depth > max_depth) max_depth = depth; }
+        if (op->type == DL_OP_CLIP_POP) depth--;
+    }
+
+    if (fills != 1) { LOG_ERROR("Expected 1 background fill, got %d", fills); passed = 0; }
+    if (texts != 2) { LOG_ERROR("Expected 2 text runs (page + iframe), got %d", texts); passed = 0; }
+    if (depth != 0 || max_depth != 1) { LOG_ERROR("Unbalanced iframe clip (depth %d, max %d)", depth, max_depth); passed = 0; }
+
+    // Culling: nothing may intersect an area far below the document
+    rect_t offscreen = {0, 100000, 800, 600};
+    for (int i = 0; i < list->count; i++) {
+        if (display_list_op_intersects(&list->ops[i], offscreen)) {
+            LOG_ERROR("Op %d unexpectedly intersects offscreen area", i);
+            passed = 0;
+            break;
+        }
+    }
+
+    if (passed) LOG_INFO("Display list recorded %d ops", list->count);
+    display_list_free(list);
+    layout_free(layout);
+    node_free(dom);
+    return passed;
+}
+
+static int test_spatial_index_impl() {
+    // Compare the index against brute force on a deterministic pseudo-random set
+    enum { RECT_COUNT = 2000, QUERY_COUNT = 200 };
+    rect_t *rects = malloc(sizeof(rect_t) * RECT_COUNT);
+    if (!rects) return 0;
+    unsigned int seed = 12345;
+    for (int i = 0; i < RECT_COUNT; i++) {
+        seed = seed * 1103515245u + 12345u; rects[i].x = (int)((seed >> 8) % 1000);
+        seed = seed * 1103515245u + 12345u; rects[i].y = (int)((seed >> 8) % 50000);
+        seed = seed * 1103515245u + 12345u; rects[i].width = (int)((seed >> 8) % 300);
+        seed = seed * 1103515245u + 12345u; rects[i].height = (int)((seed >> 8) % 2000);
+    }
+
+    spatial_index_t *index = spatial_index_create(rects, RECT_COUNT);
+    if (!index) { free(rects); return 0; }
+
+    int passed = 1;
+    for (int q = 0; q < QUERY_COUNT && passed; q++) {
+        seed = seed * 1103515245u + 12345u;
+        rect_t area = {(int)((seed >> 8) % 1000), (int)((seed >> 4) % 50000), 400, 600};
+
+        int *ids = NULL;
+        int count = spatial_index_query(index, area, &ids);
+        int expected = 0, k = 0;
+        for (int i = 0; i < RECT_COUNT; i++) {
+            rect_t r = rects[i];
+            if (r.width <= 0 || r.height <= 0) continue;
+            if (r.x < area.x + area.width && area.x < r.x + r.width &&
+                r.y < area.y + area.height && area.y < r.y + r.height) {
+                if (k >= count || ids[k] != i) { passed = 0; break; }
+                k++;
+                expected++;
+            }
+        }
+        if (expected != count) passed = 0;
+        if (!passed) LOG_ERROR("Query %d mismatch: index returned %d, brute force %d", q, count, expected);
+        free(ids);
+
+        int px = area.x, py = area.y;
+        int best = -1;
+        for (int i = 0; i < RECT_COUNT; i++) {
+            rect_t r = rects[i];
+            if (px >= r.x && px < r.x + r.width && py >= r.y && py < r.y + r.height) best = i;
+        }
+        if (spatial_index_hit_test(index, px, py) != best) {
+            LOG_ERROR("Hit test mismatch at (%d, %d)", px, py);
+            passed = 0;
+        }
+    }
+
+    if (passed) LOG_INFO("Spatial index matched brute force on %d queries", QUERY_COUNT);
+    spatial_index_free(index);
+    free(rects);
+    return passed;
+}
+
+// The index must pick the same box as the tree walk, including where
+// children overflow a parent that does not contain the point
+static int test_layout_index_hit_test_impl() {
+    node_t *dom = html_parse(
+        "<html><body>"
+        "<div style=\"width: 200px; height: 40px\">"
+        "<div style=\"width: 100px; height: 150px; background-color: #00ff00\"></div>"
+        "</div>"
+        "<div style=\"width: 300px; height: 40px\">After</div>"
+        "</body></html>");
+    if (!dom) return 0;
+    style_compute(dom);
+    layout_box_t *layout = layout_create_tree(dom, 400);
+    layout_index_t *index = layout_index_create(layout);
+    if (!layout || !index) {
+        LOG_ERROR("Layout index test setup failed");
+        layout_index_free(index);
+        layout_free(layout);
+        node_free(dom);
+        return 0;
+    }
+
+    int passed = 1;
+    int height = layout->fragment.border_box.height + 200;
+    for (int y = 0; y < height && passed; y += 3) {
+        for (int x = 0; x < 420 && passed; x += 7) {
+            layout_box_t *walked = layout_hit_test(layout, x, y);
+            layout_box_t *indexed = layout_index_hit_test(index, x, y);
+            if (walked != indexed) {
+                LOG_ERROR("Hit test at (%d, %d): tree walk found <%s>, index <%s>", x, y,
+                          walked ? walked->node->tag_name : "none", indexed ? indexed->node->tag_name : "none");
+                passed = 0;
+            }
+        }
+    }
+
+    // Inside the overflowing child but below its 40px parent: not a hit on the child
+    int inner = -1;
+    for (int i = 0; i < index->count; i++) {
+        const char *style = node_get_attr(index->boxes[i]->node, "style");
+        if (style && strstr(style, "#00ff00")) inner = i;
+    }
+    rect_t r = {0, 0, 0, 0};
+    for (int i = 0; i < index->index->count; i++) {
+        if (index->index->entries[i].id == inner) r = index->index->entries[i].rect;
+    }
+    if (passed && r.height <= 40) {
+        LOG_ERROR("Expected the inner box to overflow its 40px parent");
+        passed = 0;
+    }
+    if (passed && layout_index_hit_test(index, r.x + 5, r.y + 100) == index->boxes[inner]) {
+        LOG_ERROR("Overflowing child hit outside its parent");
+        passed = 0;
+    }
+
+    layout_index_free(index);
+    layout_free(layout);
+    node_free(dom);
+    return passed;
+}
+
+static int test_raster_impl() {
+    node_t *dom = html_parse("<html><body><div style=\"background-color: #ff0000; margin-left: 10px\">Text</div></body></html>");
+    if (!dom) return 0;
+    style_compute(dom);
+    layout_box_t *layout = layout_create_tree(dom, 400);
+    display_list_t *list = display_list_build(layout);
+    raster_surface_t *surface = raster_surface_create(400, 300);
+    if (!list || !surface) {
+        LOG_ERROR("Raster test setup failed");
+        display_list_free(list);
+        raster_surface_free(surface);
+        layout_free(layout);
+        node_free(dom);
+        return 0;
+    }
+
+    int passed = 1;
+    rect_t fill = {0, 0, 0, 0};
+    rect_t text = {0, 0, 0, 0};
+    for (int i = 0; i < list->count; i++) {
+        if (list->ops[i].type == DL_OP_RECT_FILL && list->ops[i].color == 0xFF0000) fill = list->ops[i].rect;
+        if (list->ops[i].type == DL_OP_TEXT) text = list->ops[i].rect;
+    }
+    if (fill.width <= 0 || text.width <= 0) {
+        LOG_ERROR("Expected a background fill and a text run");
+        passed = 0;
+    }
+
+    raster_clear(surface, 0xFFFFFF);
+    raster_render_display_list(surface, list, 0, 0, NULL);
+    uint32_t *px = surface->pixels;
+    // Bottom right corner of the div: clear of the text, which starts top left
+    int corner = (fill.y + fill.height - 1) * surface->stride + fill.x + fill.width - 1;
+    if (passed && px[corner] != 0xFFFF0000u) {
+        LOG_ERROR("Background pixel is 0x%08X, expected red", px[corner]);
+        passed = 0;
+    }
+    if (passed && px[(fill.y + fill.height) * surface->stride + fill.x] != 0xFFFFFFFFu) {
+        LOG_ERROR("Pixel below the div was painted");
+        passed = 0;
+    }
+
+    // The text run must leave ink (black) inside its rect
+    int ink = 0;
+    for (int y = text.y; y < text.y + text.height && y < surface->height; y++) {
+        for (int x = text.x; x < text.x + text.width && x < surface->width; x++) {
+            if (px[y * surface->stride + x] == 0xFF000000u) ink++;
+        }
+    }
+    if (ink == 0) { LOG_ERROR("Text run drew no pixels"); passed = 0; }
+
+    // A dirty rect repaint must not touch anything outside it
+    raster_clear(surface, 0x00FF00);
+    rect_t dirty = {fill.x + fill.width - 4, fill.y + fill.height - 4, 4, 4};
+    raster_render_display_list(surface, list, 0, 0, &dirty);
+    if (px[corner] != 0xFFFF0000u || px[corner - 4] != 0xFF00FF00u ||
+        surface->clip_depth != 0) {
+        LOG_ERROR("Dirty rect repaint leaked outside its clip");
+        passed = 0;
+    }
+
+    // Measurement wraps at the constraint and reports whole lines
+    int w = 0, h = 0, baseline = 0;
+    raster_measure_text("one two three", dom->first_child->style, 60, &w, &h, &baseline);
+    if (w > 60 || h < 3 * baseline) {
+        LOG_ERROR("raster_measure_text wrapped to %dx%d", w, h);
+        passed = 0;
+    }
+
+    if (passed) LOG_INFO("Rasterized %d ops (%d text pixels)", list->count, ink);
+    raster_surface_free(surface);
+    display_list_free(list);
+    layout_free(layout);
+    node_free(dom);
+    return passed;
+}
+
+// Count pixels that differ between two surfaces, ignoring the alpha byte
+// (GDI leaves it zero). The first difference is reported through *at.
+static int raster_diff(raster_surface_t *a, raster_surface_t *b, int *at) {
+    int diffs = 0;
+    for (int y = 0; y < a->height; y++) {
+        for (int x = 0; x < a->width; x++) {
+            uint32_t pa = a->pixels[y * a->stride + x] & 0xFFFFFF;
+            uint32_t pb = b->pixels[y * b->stride + x] & 0xFFFFFF;
+            if (pa != pb && diffs++ == 0) *at = y * a->width + x;
+        }
+    }
+    return diffs;
+}
+
+// The software backend must paint what GDI paints. Text and images are drawn
+// differently on purpose (built-in font, placeholder frames), so the page is
+// fills and borders only. Mismatches are dumped as PPM.
+static int test_raster_matches_gdi_impl() {
+    const int width = 200, height = 150;
+    node_t *dom = html_parse("<html><body>"
+        "<div style=\"width: 120px; height: 40px; background-color: #ff0000; border-width: 3px\"></div>"
+        "<div style=\"width: 80px; height: 30px; margin-left: 20px; background-color: #00ff00\">"
+        "<div style=\"width: 150px; height: 60px; background-color: #0000ff\"></div></div>"
+        "</body></html>");
+    if (!dom) return 0;
+    style_compute(dom);
+    layout_box_t *layout = layout_create_tree(dom, width);
+    display_list_t *list = display_list_build(layout);
+    raster_surface_t *soft = raster_surface_create(width, height);
+
+    // A top-down 32bpp DIB has the raster surface's pixel layout, so the
+    // GDI output can be viewed as a surface too
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    void *bits = NULL;
+    HDC dc = CreateCompatibleDC(NULL);
+    HBITMAP dib = dc ? CreateDIBSection(dc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0) : NULL;
+    if (!list || !soft || !dib || !bits) {
+        LOG_ERROR("GDI comparison setup failed");
+        if (dib) DeleteObject(dib);
+        if (dc) DeleteDC(dc);
+        raster_surface_free(soft);
+        display_list_free(list);
+        layout_free(layout);
+        node_free(dom);
+        return 0;
+    }
+    HGDIOBJ old_bitmap = SelectObject(dc, dib);
+
+    raster_surface_t gdi;
+    memset(&gdi, 0, sizeof(gdi));
+    gdi.pixels = bits;
+    gdi.width = width;
+    gdi.height = height;
+    gdi.stride = width;
+    gdi.clip.width = width;
+    gdi.clip.height = height;
+
+    int passed = 1;
+    int borders = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (list->ops[i].type == DL_OP_BORDER) borders++;
+    }
+    if (borders == 0) {
+        LOG_ERROR("Expected a border in the list");
+        passed = 0;
+    }
+
+    // Full paint, then a dirty rect repaint over a different background,
+    // which clips every op it straddles
+    rect_t dirty = {10, 30, 60, 40};
+    for (int pass = 0; passed && pass < 2; pass++) {
+        uint32_t background = pass == 0 ? 0xFFFFFF : 0x808080;
+        raster_clear(soft, background);
+        raster_clear(&gdi, background);
+        if (pass == 0) {
+            raster_render_display_list(soft, list, 0, 0, NULL);
+            render_display_list(dc, list, 0, 0, NULL);
+        } else {
+            RECT r = {dirty.x, dirty.y, dirty.x + dirty.width, dirty.y + dirty.height};
+            raster_render_display_list(soft, list, 0, 0, &dirty);
+            render_display_list(dc, list, 0, 0, &r);
+        }
+        GdiFlush();
+
+        int at = 0;
+        int diffs = raster_diff(soft, &gdi, &at);
+        if (diffs > 0) {
+            LOG_ERROR("Pass %d: %d pixels differ, first at (%d,%d): software 0x%06X, GDI 0x%06X",
+                      pass, diffs, at % width, at / width,
+                      soft->pixels[at] & 0xFFFFFF, gdi.pixels[at] & 0xFFFFFF);
+            raster_write_ppm(soft, "raster-software.ppm");
+            raster_write_ppm(&gdi, "raster-gdi.ppm");
+            passed = 0;
+        }
+    }
+
+    if (passed) LOG_INFO("Software and GDI paint match over %d ops", list->count);
+    SelectObject(dc, old_bitmap);
+    DeleteObject(dib);
+    DeleteDC(dc);
+    raster_surface_free(soft);
+    display_list_free(list);
+    layout_free(layout);
+    node_free(dom);
+    return passed;
+}
+
+static int test_image_sniff_impl() {
+    // Just enough of each header to give away the size, no more
+    static const unsigned char png[] = {
+        0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A, 0, 0, 0, 13, 'I', 'H', 'D', 'R',
+        0, 0, 0x01, 0x40, 0, 0, 0, 0xF0
+    };
+    static const unsigned char jpeg[] = {
+        0xFF, 0xD8,
+        0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0,  // APP0 ahead of the frame
+        0xFF, 0xC2, 0, 17, 8, 0, 0xF0, 0x01, 0x40                               // Progressive SOF
+    };
+    static const unsigned char gif[] = { 'G', 'I', 'F', '8', '9', 'a', 0x40, 0x01, 0xF0, 0 };
+    static const unsigned char bmp[] = {
+        'B', 'M', 0, 0, 0, 0, 0, 0, 0, 0, 54, 0, 0, 0,
+        40, 0, 0, 0, 0x40, 0x01, 0, 0, 0x10, 0xFF, 0xFF, 0xFF  // Height -240: top-down
+    };
+    static const unsigned char ico[] = {
+        0, 0, 1, 0, 2, 0,
+        16, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0   // 0 = 256
+    };
+    static const unsigned char webp_lossy[] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'E', 'B', 'P', 'V', 'P', '8', ' ', 0, 0, 0, 0,
+        0, 0, 0, 0x9D, 0x01, 0x2A, 0x40, 0x01, 0xF0, 0x00
+    };
+    static const unsigned char webp_lossless[] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'E', 'B', 'P', 'V', 'P', '8', 'L', 0, 0, 0, 0,
+        0x2F, 0x3F, 0xC1, 0x3B, 0x00  // 14-bit width - 1, 14-bit height - 1
+    };
+    static const unsigned char webp_extended[] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'E', 'B', 'P', 'V', 'P', '8', 'X', 0, 0, 0, 0,
+        0, 0, 0, 0, 0x3F, 0x01, 0x00, 0xEF, 0x00, 0x00
+    };
+    static const struct {
+        const char *name;
+        const unsigned char *data;
+        size_t size;
+        image_format_t format;
+        int width, height;
+    } cases[] = {
+        { "PNG", png, sizeof(png), IMAGE_FORMAT_PNG, 320, 240 },
+        { "JPEG", jpeg, sizeof(jpeg), IMAGE_FORMAT_JPEG, 320, 240 },
+        { "GIF", gif, sizeof(gif), IMAGE_FORMAT_GIF, 320, 240 },
+        { "BMP", bmp, sizeof(bmp), IMAGE_FORMAT_BMP, 320, 240 },
+        { "ICO", ico, sizeof(ico), IMAGE_FORMAT_ICO, 256, 256 },
+        { "WebP (VP8)", webp_lossy, sizeof(webp_lossy), IMAGE_FORMAT_WEBP, 320, 240 },
+        { "WebP (VP8L)", webp_lossless, sizeof(webp_lossless), IMAGE_FORMAT_WEBP, 320, 240 },
+        { "WebP (VP8X)", webp_extended, sizeof(webp_extended), IMAGE_FORMAT_WEBP, 320, 240 }
+    };
+
+    int passed = 1;
+    image_info_t info;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (image_sniff(cases[i].data, cases[i].size, &info) != IMAGE_SNIFF_OK ||
+            info.format != cases[i].format || info.width != cases[i].width || info.height != cases[i].height) {
+            LOG_ERROR("%s: sniffed %s %dx%d, expected %dx%d", cases[i].name, image_format_name(info.format),
+                      info.width, info.height, cases[i].width, cases[i].height);
+            passed = 0;
+        }
+        // Every shorter prefix is a download still in progress, not a failure
+        for (size_t n = 0; n < cases[i].size; n++) {
+            image_sniff_result_t r = image_sniff(cases[i].data, n, &info);
+            if (r != IMAGE_SNIFF_NEED_MORE) {
+                LOG_ERROR("%s: %lu of %lu bytes gave %d, expected to need more", cases[i].name,
+                          (unsigned long)n, (unsigned long)cases[i].size, (int)r);
+                passed = 0;
+                break;
+            }
+        }
+    }
+
+    // Not images, or not ones with a size before the scan data
+    static const unsigned char wave[] = { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' };
+    static const unsigned char jpeg_no_frame[] = { 0xFF, 0xD8, 0xFF, 0xDA, 0, 2, 0, 0 };
+    const char *html = "<html><body>Not Found</body></html>";
+    if (image_sniff(html, strlen(html), &info) != IMAGE_SNIFF_FAILED ||
+        image_sniff(wave, sizeof(wave), &info) != IMAGE_SNIFF_FAILED ||
+        image_sniff(jpeg_no_frame, sizeof(jpeg_no_frame), &info) != IMAGE_SNIFF_FAILED) {
+        LOG_ERROR("A non-image or frameless JPEG was not rejected");
+        passed = 0;
+    }
+
+    // A JPEG whose frame header sits past the sniff limit is given up on
+    size_t big_size = IMAGE_SNIFF_MAX_BYTES + 1024;
+    unsigned char *big = calloc(1, big_size);
+    if (big) {
+        size_t pos = 2;
+        big[0] = 0xFF;
+        big[1] = 0xD8;
+        while (pos + 4 <= big_size) {
+            big[pos] = 0xFF;
+            big[pos + 1] = 0xE1;  // APP1, as EXIF data with embedded thumbnails
+            big[pos + 2] = 0xFF;
+            big[pos + 3] = 0xFF;
+            pos += 2 + 0xFFFF;
+        }
+        if (image_sniff(big, big_size, &info) != IMAGE_SNIFF_FAILED) {
+            LOG_ERROR("Oversized JPEG metadata was not given up on");
+            passed = 0;
+        }
+        free(big);
+    }
+
+    return passed;
+}
+
+static int test_image_cache_impl() {
+    // Failed decodes (no bitmap) are cached too, which is all this needs
+    decoded_image_t broken;
+    memset(&broken, 0, sizeof(broken));
+    char *data = malloc(4096);
+    if (!data) return 0;
+    memset(data, 'a', 4096);
+    image_cache_clear();
+    int ok = image_cache_insert(data, 4096, 16, 16, &broken) != NULL && image_cache_lookup(data, 4096, 16, 16) != NULL;
+
+    // The same buffer refilled with another image must miss, even if only
+    // its middle changed
+    data[2048] = 'b';
+    if (ok && image_cache_lookup(data, 4096, 16, 16)) {
+        LOG_ERROR("Image cache returned the surface of bytes no longer there");
+        ok = 0;
+    }
+
+    // The same bytes at another address are the same image
+    char *copy = malloc(4096);
+    if (copy) memcpy(copy, data, 4096);
+    ok = ok && copy && image_cache_insert(data, 4096, 16, 16, &broken) != NULL &&
+         image_cache_lookup(copy, 4096, 16, 16) != NULL && image_cache_lookup(copy, 4096, 32, 32) == NULL;
+    free(copy);
+    free(data);
+    image_cache_clear();
+    return ok;
+}
+
+static int test_disk_cache_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+
+    // Enough entries to grow the index; every URL must get its own body back
+    char url[128], body[128];
+    const int count = 6000;
+    DWORD start = GetTickCount();
+    for (int i = 0; i < count; i++) {
+        snprintf(url, sizeof(url), "http://cache-test.invalid/%d.png?run=%lu", i, (unsigned long)start);
+        snprintf(body, sizeof(body), "body %d", i);
+        if (!cache_store(url, body, strlen(body), &meta)) { LOG_ERROR("cache_store failed at %d", i); return 0; }
+    }
+    DWORD stored = GetTickCount();
+    int bad = 0;
+    for (int i = 0; i < count; i++) {
+        snprintf(url, sizeof(url), "http://cache-test.invalid/%d.png?run=%lu", i, (unsigned long)start);
+        snprintf(body, sizeof(body), "body %d", i);
+        cache_view_t view;
+        if (!cache_open_view(url, &view)) { bad++; continue; }
+        if (view.size != strlen(body) || memcmp(view.data, body, view.size) != 0) bad++;
+        cache_close_view(&view);
+    }
+    LOG_INFO("Disk cache: %d stores in %lu ms, %d lookups in %lu ms", count, (unsigned long)(stored - start),
+             count, (unsigned long)(GetTickCount() - stored));
+    if (bad) { LOG_ERROR("%d lookups returned the wrong entry", bad); return 0; }
+
+    // A replaced entry wins, and a view taken before stays intact
+    snprintf(url, sizeof(url), "http://cache-test.invalid/0.png?run=%lu", (unsigned long)start);
+    cache_view_t old_view;
+    if (!cache_open_view(url, &old_view)) return 0;
+    meta.status_code = 203;
+    strcpy(meta.etag, "\"v2\"");
+    int ok = cache_store(url, "replaced", 8, &meta);
+    size_t size = 0;
+    cache_meta_t got;
+    char *data = ok ? cache_lookup(url, &size, &got) : NULL;
+    ok = data && size == 8 && strcmp(data, "replaced") == 0 && got.status_code == 203 &&
+         old_view.size == 6 && memcmp(old_view.data, "body 0", 6) == 0;
+    free(data);
+    cache_close_view(&old_view);
+
+    // Metadata is rewritten in place; unknown URLs miss
+    meta.expires_at = 12345;
+    if (ok) ok = cache_update_meta(url, &meta) && (data = cache_lookup(url, &size, &got)) != NULL &&
+                 got.expires_at == 12345 && size == 8;
+    free(data);
+    if (ok && cache_lookup("http://cache-test.invalid/never-stored", &size, NULL)) ok = 0;
+    return ok;
+}
+
+static int test_memory_cache_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+    char url[128];
+    snprintf(url, sizeof(url), "http://cache-test.invalid/spacer.gif?run=%lu", (unsigned long)GetTickCount());
+    if (!cache_store(url, "GIF89a", 6, &meta)) return 0;
+    cache_flush();
+
+    // Repeat lookups share one buffer and count as memory hits
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    cache_buffer_t *first = cache_acquire(url, NULL);
+    int ok = first != NULL;
+    for (int i = 0; ok && i < 100; i++) {
+        cache_buffer_t *again = cache_acquire(url, NULL);
+        ok = again == first && strcmp(again->data, "GIF89a") == 0;
+        cache_buffer_release(again);
+    }
+    cache_get_stats(&after);
+    if (ok && after.hits - before.hits != 101) {
+        LOG_ERROR("Expected 101 memory hits, got %lu", after.hits - before.hits);
+        ok = 0;
+    }
+
+    // Shrinking the budget evicts the entry but not the buffer still held
+    cache_set_memory_budget(0);
+    cache_get_stats(&after);
+    if (ok && (after.entries != 0 || after.resident_bytes != 0 || strcmp(first->data, "GIF89a") != 0)) ok = 0;
+    cache_buffer_release(first);
+    cache_set_memory_budget(CACHE_MEMORY_DEFAULT_BUDGET);
+
+    // The next lookup comes from disk and repopulates memory
+    cache_get_stats(&before);
+    cache_buffer_t *reloaded = cache_acquire(url, NULL);
+    cache_get_stats(&after);
+    if (ok) ok = reloaded && reloaded->size == 6 && after.disk_hits - before.disk_hits == 1 && after.entries == 1;
+    cache_buffer_release(reloaded);
+    if (ok) LOG_INFO("Memory tier: %lu KB resident, %d entries", (unsigned long)(after.resident_bytes / 1024), after.entries);
+    return ok;
+}
+
+static int test_cache_eviction_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_clear_all();
+    cache_stats_t stats;
+    cache_get_stats(&stats);
+    if (stats.disk_entries != 0 || stats.disk_bytes != 0) { LOG_ERROR("cache_clear_all left data behind"); return 0; }
+
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+    const unsigned long long budget = 1024 * 1024;
+    cache_set_disk_budget(budget);
+
+    // 400 distinct bodies of 8 KB against a 1 MB budget; the first entry is
+    // read after every store so it stays the most recently used
+    char url[128], body[8192];
+    const int count = 400;
+    cache_view_t view;
+    for (int i = 0; i < count; i++) {
+        snprintf(url, sizeof(url), "http://cache-test.invalid/evict/%d", i);
+        memset(body, 'a' + i % 26, sizeof(body));
+        memcpy(body + 16, &i, sizeof(i));
+        if (!cache_store(url, body, sizeof(body), &meta)) return 0;
+        if (cache_open_view("http://cache-test.invalid/evict/0", &view)) cache_close_view(&view);
+    }
+    cache_flush();
+    int steps = 0;
+    while (cache_maintain() && steps < 1000) steps++;
+    cache_get_stats(&stats);
+    LOG_INFO("Eviction: %u entries, %lu KB live in %lu KB, %lu evicted, %lu compactions, %d steps",
+             stats.disk_entries, (unsigned long)(stats.disk_live_bytes / 1024), (unsigned long)(stats.disk_bytes / 1024),
+             stats.disk_evictions, stats.compactions, steps);
+    // Garbage below the compaction threshold may remain, but no more
+    int ok = stats.disk_live_bytes <= budget && stats.disk_bytes <= 2 * budget &&
+             stats.disk_evictions > 0 && stats.compactions > 0;
+
+    // Survivors keep their bodies after being moved; old entries are gone
+    int found = 0;
+    for (int i = 0; ok && i < count; i++) {
+        snprintf(url, sizeof(url), "http://cache-test.invalid/evict/%d", i);
+        if (!cache_open_view(url, &view)) continue;
+        const char *data = view.data;
+        ok = view.size == sizeof(body) && data[0] == 'a' + i % 26 && data[sizeof(body) - 1] == 'a' + i % 26;
+        cache_close_view(&view);
+        found++;
+    }
+    if (ok && (found != (int)stats.disk_entries || !cache_open_view("http://cache-test.invalid/evict/0", &view))) ok = 0;
+    else if (ok) cache_close_view(&view);
+    if (ok && cache_open_view("http://cache-test.invalid/evict/1", &view)) {
+        cache_close_view(&view);
+        ok = 0;
+    }
+
+    cache_clear_all();
+    cache_get_stats(&stats);
+    if (ok) ok = stats.disk_bytes == 0 && !cache_acquire("http://cache-test.invalid/evict/0", NULL);
+    cache_set_disk_budget(CACHE_DISK_DEFAULT_BUDGET);
+    return ok;
+}
+
+static int test_write_behind_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+    char url[128], body[32];
+    snprintf(url, sizeof(url), "http://cache-test.invalid/write-behind?run=%lu", (unsigned long)GetTickCount());
+
+    // Rapid rewrites of one URL: each is visible at once, and whatever was
+    // still queued is replaced rather than written
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    int ok = 1;
+    for (int i = 0; ok && i < 20; i++) {
+        snprintf(body, sizeof(body), "version %d", i);
+        ok = cache_store(url, body, strlen(body), &meta);
+        cache_buffer_t *got = ok ? cache_acquire(url, NULL) : NULL;
+        ok = got && strcmp(got->data, body) == 0;
+        cache_buffer_release(got);
+    }
+    cache_flush();
+    cache_get_stats(&after);
+    unsigned long queued = after.writes_queued - before.writes_queued;
+    unsigned long coalesced = after.writes_coalesced - before.writes_coalesced;
+    LOG_INFO("Write-behind: 20 stores, %lu queued, %lu coalesced, %lu batches", queued, coalesced,
+             after.write_batches - before.write_batches);
+    if (ok) ok = queued + coalesced == 20 && after.write_queue_bytes == 0 && after.write_batches > before.write_batches;
+
+    // The disk ends up with the last version
+    cache_view_t view;
+    if (ok && cache_open_view(url, &view)) {
+        ok = view.size == strlen(body) && memcmp(view.data, body, view.size) == 0;
+        cache_close_view(&view);
+    } else {
+        ok = 0;
+    }
+
+    // A body the memory tier will not hold is still served while queued
+    cache_set_memory_budget(0);
+    snprintf(url, sizeof(url), "http://cache-test.invalid/write-behind-large?run=%lu", (unsigned long)GetTickCount());
+    if (ok) ok = cache_store(url, "large", 5, &meta);
+    cache_buffer_t *got = ok ? cache_acquire(url, NULL) : NULL;
+    if (ok) ok = got && strcmp(got->data, "large") == 0;
+    cache_buffer_release(got);
+    cache_set_memory_budget(CACHE_MEMORY_DEFAULT_BUDGET);
+    return ok;
+}
+
+static int test_cache_dedup_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_clear_all();
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+
+    // One image under three URLs, and something else
+    const char *urls[] = {"http://cdn1.cache-test.invalid/logo.png", "http://cdn2.cache-test.invalid/logo.png",
+                          "http://cache-test.invalid/logo.png?v=2"};
+    char body[4096];
+    memset(body, 'd', sizeof(body));
+    body[0] = 'D';
+    cache_stats_t before, stats;
+    cache_get_stats(&before);
+    for (int i = 0; i < 3; i++) {
+        if (!cache_store(urls[i], body, sizeof(body), &meta)) return 0;
+    }
+    if (!cache_store("http://cache-test.invalid/other.png", "other", 5, &meta)) return 0;
+
+    // In memory the copies are one buffer
+    cache_buffer_t *a = cache_acquire(urls[0], NULL);
+    cache_buffer_t *b = cache_acquire(urls[2], NULL);
+    int ok = a && a == b;
+    cache_buffer_release(a);
+    cache_buffer_release(b);
+
+    // On disk they are one body
+    cache_flush();
+    cache_get_stats(&stats);
+    LOG_INFO("Dedup: %u entries, %u bodies, %lu KB live, %lu shared on disk", stats.disk_entries, stats.disk_blobs,
+             (unsigned long)(stats.disk_live_bytes / 1024), stats.dedup_hits - before.dedup_hits);
+    if (ok) ok = stats.disk_entries == 4 && stats.disk_blobs == 2 && stats.dedup_hits - before.dedup_hits == 2 &&
+                 stats.disk_live_bytes < 2 * sizeof(body);
+
+    // Bodies read back from disk join the buffer still in use, as do new ones
+    cache_set_memory_budget(0);
+    a = ok ? cache_acquire(urls[0], NULL) : NULL;
+    b = a ? cache_acquire(urls[1], NULL) : NULL;
+    cache_buffer_t *c = cache_buffer_create(body, sizeof(body));
+    if (ok) ok = a && a == b && c == a && a->size == sizeof(body) && memcmp(a->data, body, sizeof(body)) == 0;
+    cache_buffer_release(a);
+    cache_buffer_release(b);
+    cache_buffer_release(c);
+    cache_set_memory_budget(CACHE_MEMORY_DEFAULT_BUDGET);
+
+    // The body stays while any entry uses it
+    if (ok) ok = cache_store(urls[0], "new0", 4, &meta) && cache_store(urls[1], "new1", 4, &meta);
+    cache_flush();
+    cache_view_t view;
+    if (ok && cache_open_view(urls[2], &view)) {
+        ok = view.size == sizeof(body) && memcmp(view.data, body, sizeof(body)) == 0;
+        cache_close_view(&view);
+    } else {
+        ok = 0;
+    }
+    if (ok) ok = cache_store(urls[2], "new2", 4, &meta);
+    cache_flush();
+    cache_get_stats(&stats);
+    if (ok) ok = stats.disk_entries == 4 && stats.disk_blobs == 4 && stats.disk_live_bytes < sizeof(body);
+
+    cache_clear_all();
+    return ok;
+}
+
+static int test_typed_cache_impl() {
+    test_use_scratch_cache();
+    cache_init();
+    cache_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.status_code = 200;
+    meta.stored_at = 1700000000;
+    meta.expires_at = meta.stored_at + 86400;
+    char url[128];
+    snprintf(url, sizeof(url), "http://cache-test.invalid/typed?run=%lu", (unsigned long)GetTickCount());
+
+    // One URL, two types: separate entries. Documents stay fresh for at
+    // most CACHE_DOCUMENT_MAX_TTL whatever the server said.
+    if (!cache_put(CACHE_TYPE_DOCUMENT, url, "<html>", 6, &meta) || !cache_put(CACHE_TYPE_IMAGE, url, "GIF89a", 6, &meta)) return 0;
+    cache_meta_t got;
+    cache_buffer_t *doc = cache_get(CACHE_TYPE_DOCUMENT, url, &got);
+    int ok = doc && strcmp(doc->data, "<html>") == 0 && got.expires_at == meta.stored_at + CACHE_DOCUMENT_MAX_TTL;
+    cache_buffer_release(doc);
+    cache_buffer_t *image = cache_get(CACHE_TYPE_IMAGE, url, &got);
+    if (ok) ok = image && strcmp(image->data, "GIF89a") == 0 && got.expires_at == meta.expires_at;
+    cache_buffer_release(image);
+    cache_buffer_t *untyped = cache_acquire(url, NULL);
+    if (untyped) ok = 0;
+    cache_buffer_release(untyped);
+
+    // Memory-only stylesheets never reach the disk; uncached favicons are refused
+    cache_policy_t saved, policy = {CACHE_STORAGE_MEMORY, 0};
+    cache_get_policy(CACHE_TYPE_STYLESHEET, &saved);
+    cache_set_policy(CACHE_TYPE_STYLESHEET, &policy);
+    cache_stats_t before, after;
+    cache_get_stats(&before);
+    if (ok) ok = cache_put(CACHE_TYPE_STYLESHEET, url, "p{}", 3, &meta);
+    cache_get_stats(&after);
+    cache_buffer_t *sheet = ok ? cache_get(CACHE_TYPE_STYLESHEET, url, NULL) : NULL;
+    if (ok) ok = sheet && strcmp(sheet->data, "p{}") == 0 && after.disk_entries == before.disk_entries;
+    cache_buffer_release(sheet);
+    cache_set_policy(CACHE_TYPE_STYLESHEET, &saved);
+
+    cache_get_policy(CACHE_TYPE_FAVICON, &saved);
+    policy.storage = CACHE_STORAGE_NONE;
+    cache_set_policy(CACHE_TYPE_FAVICON, &policy);
+    if (ok && cache_put(CACHE_TYPE_FAVICON, url, "ico", 3, &meta)) ok = 0;
+    cache_set_policy(CACHE_TYPE_FAVICON, &saved);
+    return ok;
+}
+
+static int g_pages_freed = 0;
+
+static void count_page_free(void *page) {
+    g_pages_freed++;
+    free(page);
+}
+
+static int test_history_page_cache_impl() {
+    history_tree_t *tree = history_create();
+    if (!tree) return 0;
+    history_set_page_cache(tree, 3, 1000, count_page_free);
+    g_pages_freed = 0;
+
+    history_node_t *nodes[4];
+    const char *urls[4] = {"http://a/", "http://b/", "http://c/", "http://d/"};
+    for (int i = 0; i < 4; i++) {
+        history_add(tree, urls[i], NULL);
+        nodes[i] = tree->current;
+    }
+
+    // A fourth page pushes out the least recently stored one
+    for (int i = 0; i < 4; i++) history_store_page(tree, nodes[i], malloc(1), 100);
+    history_page_stats_t st;
+    history_get_page_stats(tree, &st);
+    int ok = nodes[0]->page == NULL && nodes[3]->page && st.pages == 3 && st.bytes == 300 &&
+             st.evictions == 1 && g_pages_freed == 1;
+    if (!ok) LOG_ERROR("Count limit: %d pages, %lu bytes, %lu evictions", st.pages, (unsigned long)st.bytes, st.evictions);
+
+    // Bytes: 800 more fits once b goes (count), 500 more needs c, d and a gone
+    history_store_page(tree, nodes[0], malloc(1), 800);
+    history_store_page(tree, nodes[1], malloc(1), 500);
+    history_get_page_stats(tree, &st);
+    if (ok) {
+        ok = nodes[1]->page && !nodes[0]->page && !nodes[2]->page && !nodes[3]->page &&
+             st.pages == 1 && st.bytes == 500 && st.evictions == 5 && g_pages_freed == 5;
+        if (!ok) LOG_ERROR("Byte budget: %d pages, %lu bytes, %lu evictions", st.pages, (unsigned long)st.bytes, st.evictions);
+    }
+
+    // Over the whole budget: freed at once, nothing else touched
+    history_store_page(tree, nodes[2], malloc(1), 2000);
+    history_get_page_stats(tree, &st);
+    if (ok) ok = !nodes[2]->page && nodes[1]->page && st.pages == 1 && st.evictions == 5 && g_pages_freed == 6;
+
+    // Storing over a node's own page replaces it without counting an eviction
+    history_store_page(tree, nodes[1], malloc(1), 300);
+    history_get_page_stats(tree, &st);
+    if (ok) ok = st.pages == 1 && st.bytes == 300 && st.evictions == 5 && g_pages_freed == 7;
+
+    // Taking a page hands it back once; the second look is a miss
+    void *page = history_take_page(tree, nodes[1]);
+    void *again = history_take_page(tree, nodes[1]);
+    history_get_page_stats(tree, &st);
+    if (ok) {
+        ok = page && !again && st.hits == 1 && st.misses == 1 && st.pages == 0 && st.bytes == 0;
+        if (!ok) LOG_ERROR("Take: %lu hits, %lu misses, %d pages", st.hits, st.misses, st.pages);
+    }
+    free(page);
+
+    // Whatever is still cached goes with the tree
+    history_store_page(tree, nodes[3], malloc(1), 10);
+    history_free(tree);
+    if (ok) ok = g_pages_freed == 8;
+    return ok;
+}
+
 void run_core_tests(int *total_failed) {
     run_test_case("DOM Parsing", test_dom_impl, total_failed);
+    run_test_case("Incremental HTML Parsing", test_incremental_parse_impl, total_failed);
     run_test_case("Style Computation", test_style_impl, total_failed);
     run_test_case("Layout Engine", test_layout_impl, total_failed);
     run_test_case("Layout Accuracy (Firefox Reference)", test_layout_accuracy_impl, total_failed);
+    run_test_case("Iframe Layout Cache", test_iframe_layout_cache_impl, total_failed);
+    run_test_case("Display List Recording", test_display_list_impl, total_failed);
+    run_test_case("Spatial Index", test_spatial_index_impl, total_failed);
+    run_test_case("Layout Index Hit Testing", test_layout_index_hit_test_impl, total_failed);
+    run_test_case("Software Rasterizer", test_raster_impl, total_failed);
+    run_test_case("Software vs GDI Paint", test_raster_matches_gdi_impl, total_failed);
+    run_test_case("Image Header Sniffing", test_image_sniff_impl, total_failed);
+    run_test_case("Decoded Image Cache", test_image_cache_impl, total_failed);
+    run_test_case("Packed Disk Cache", test_disk_cache_impl, total_failed);
+    run_test_case("Cache Memory Tier", test_memory_cache_impl, total_failed);
+    run_test_case("Cache Eviction", test_cache_eviction_impl, total_failed);
+    run_test_case("Typed Cache", test_typed_cache_impl, total_failed);
+    run_test_case("Cache Write-Behind", test_write_behind_impl, total_failed);
+    run_test_case("Cache Dedup", test_cache_dedup_impl, total_failed);
+    run_test_case("Back/Forward Page Cache", test_history_page_cache_impl, total_failed);
 }
@@ -1,9 +1,20 @@
+#include <winsock2.h>
 #include <windows.h>
+#include <process.h>
+#include <stdio.h>
 #include <string.h>
+#include <openssl/x509.h>
 #include "network/tls.h"
 #include "network/http.h"
 #include "network/gemini.h"
 #include "network/protocol.h"
+#include "network/loader.h"
+#include "network/content_decoder.h"
+#include "network/http_parser.h"
+#include "network/dns_cache.h"
+#include "network/http_cache.h"
+#include "network/conn_pool.h"
+#include "core/html.h"
 #include "core/log.h"
 #include "test_ui.h"
 
@@ -30,6 +41,491 @@ static int test_tls_impl() {
     return 1;
 }
 
+static int test_tls_resumption_impl() {
+    // The first connection leaves a session behind; the second should offer it
+    tls_connection_t *first = tls_connect("www.google.com", 443);
+    if (!first) return 0;
+    tls_close(first);
+
+    tls_stats_t before, after;
+    tls_get_stats(&before);
+    tls_connection_t *second = tls_connect("www.google.com", 443);
+    if (!second) return 0;
+    tls_close(second);
+    tls_get_stats(&after);
+
+    LOG_INFO("Second handshake: %s", after.resumed_handshakes > before.resumed_handshakes ? "resumed" : "full");
+    return after.sessions_offered > before.sessions_offered &&
+           after.resumed_handshakes > before.resumed_handshakes;
+}
+
+static int test_buffer_sink_impl() {
+    network_buffer_sink_t sink;
+    network_buffer_sink_init(&sink);
+
+    // Unknown length: grows geometrically across many small writes
+    if (!sink.base.on_headers(&sink.base, 200, "text/plain", -1)) return 0;
+    char piece[100];
+    for (int i = 0; i < 2000; i++) {
+        memset(piece, 'a' + i % 26, sizeof(piece));
+        if (!sink.base.on_data(&sink.base, piece, sizeof(piece))) return 0;
+    }
+    int ok = sink.size == 200000 && sink.data[199999] == 'a' + 1999 % 26 && sink.data[200000] == '\0' &&
+             sink.cap < 2 * 200001;
+
+    // Known length: one allocation of exactly that size
+    network_response_t *res = calloc(1, sizeof(network_response_t));
+    sink.base.on_headers(&sink.base, 200, "text/plain", 300000);
+    size_t cap = sink.cap;
+    for (int i = 0; i < 3000; i++) sink.base.on_data(&sink.base, piece, sizeof(piece));
+    ok = ok && cap == 300001 && sink.cap == cap && sink.size == 300000;
+
+    network_buffer_sink_attach(&sink, res);
+    ok = ok && res->size == 300000 && res->data && sink.data == NULL && !res->incomplete;
+    network_response_free(res);
+
+    // Fewer bytes than announced: handed over, but not as the whole body
+    res = calloc(1, sizeof(network_response_t));
+    sink.base.on_headers(&sink.base, 200, "text/plain", 1000);
+    sink.base.on_data(&sink.base, piece, sizeof(piece));
+    network_buffer_sink_attach(&sink, res);
+    ok = ok && res->size == sizeof(piece) && res->incomplete;
+    network_response_free(res);
+
+    // Out of memory part way through
+    res = calloc(1, sizeof(network_response_t));
+    sink.base.on_headers(&sink.base, 200, "text/plain", -1);
+    sink.base.on_data(&sink.base, piece, sizeof(piece));
+    sink.failed = 1;
+    network_buffer_sink_attach(&sink, res);
+    ok = ok && res->incomplete;
+    network_response_free(res);
+    return ok;
+}
+
+// Compress text into packed; returns the compressed size, 0 on failure
+static size_t compress_text(const char *text, size_t len, int window_bits, unsigned char *packed, size_t cap) {
+    z_stream zs = {0};
+    if (deflateInit2(&zs, 9, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+    zs.next_in = (Bytef *)text;
+    zs.avail_in = (uInt)len;
+    zs.next_out = packed;
+    zs.avail_out = (uInt)cap;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t packed_len = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? packed_len : 0;
+}
+
+// Compress with zlib and feed the result through a decoder in small pieces
+static int decode_roundtrip(const char *text, size_t len, int window_bits, content_coding_t coding) {
+    unsigned char packed[8192];
+    size_t packed_len = compress_text(text, len, window_bits, packed, sizeof(packed));
+    if (!packed_len) return 0;
+
+    network_buffer_sink_t out;
+    network_buffer_sink_init(&out);
+    content_decoder_t decoder;
+    if (!content_decoder_init(&decoder, coding, &out.base)) return 0;
+    decoder.base.on_headers(&decoder.base, 200, "text/html", (long long)packed_len);
+    for (size_t pos = 0; pos < packed_len; pos += 37) {
+        size_t n = packed_len - pos < 37 ? packed_len - pos : 37;
+        if (!decoder.base.on_data(&decoder.base, (const char *)packed + pos, n)) break;
+    }
+    int ok = content_decoder_complete(&decoder) && out.size == len && memcmp(out.data, text, len) == 0;
+    content_decoder_end(&decoder);
+    network_buffer_sink_attach(&out, NULL);
+    return ok;
+}
+
+static int test_content_decoding_impl() {
+    char text[20000];
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = "<p>Hello, Gemini!</p>\n"[i % 22];
+
+    if (content_coding_from_header("gzip") != CONTENT_CODING_GZIP ||
+        content_coding_from_header("Deflate") != CONTENT_CODING_DEFLATE ||
+        content_coding_from_header("identity") != CONTENT_CODING_NONE) return 0;
+
+    if (!decode_roundtrip(text, sizeof(text), MAX_WBITS + 16, CONTENT_CODING_GZIP)) return 0;
+    if (!decode_roundtrip(text, sizeof(text), MAX_WBITS, CONTENT_CODING_DEFLATE)) return 0;
+    if (!decode_roundtrip(text, sizeof(text), -MAX_WBITS, CONTENT_CODING_DEFLATE)) return 0;
+
+    // Two gzip members arriving in separate reads decode back to back
+    unsigned char members[2][1024];
+    size_t first_len = compress_text("first member, ", 14, MAX_WBITS + 16, members[0], sizeof(members[0]));
+    size_t second_len = compress_text("second member", 13, MAX_WBITS + 16, members[1], sizeof(members[1]));
+    network_buffer_sink_t joined;
+    network_buffer_sink_init(&joined);
+    content_decoder_t multi;
+    content_decoder_init(&multi, CONTENT_CODING_GZIP, &joined.base);
+    multi.base.on_headers(&multi.base, 200, "text/plain", -1);
+    int members_ok = first_len && second_len &&
+                     multi.base.on_data(&multi.base, (const char *)members[0], first_len) &&
+                     multi.base.on_data(&multi.base, (const char *)members[1], second_len) &&
+                     content_decoder_complete(&multi) && joined.size == 27 &&
+                     memcmp(joined.data, "first member, second member", 27) == 0;
+    content_decoder_end(&multi);
+    network_buffer_sink_attach(&joined, NULL);
+    if (!members_ok) {
+        LOG_ERROR("Second gzip member was dropped");
+        return 0;
+    }
+
+    // A body-less response (204, HEAD) with a Content-Encoding is complete
+    content_decoder_t empty;
+    content_decoder_init(&empty, CONTENT_CODING_GZIP, &joined.base);
+    int empty_ok = content_decoder_complete(&empty);
+    content_decoder_end(&empty);
+    if (!empty_ok) return 0;
+
+    // Bomb guard: 8 MB of zeros compresses to a few KB and must be cut off
+    size_t zeros_len = 8 * 1024 * 1024;
+    char *zeros = calloc(1, zeros_len);
+    unsigned char *packed = malloc(65536);
+    if (!zeros || !packed) {
+        free(zeros);
+        free(packed);
+        return 0;
+    }
+    z_stream zs = {0};
+    deflateInit2(&zs, 9, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (Bytef *)zeros;
+    zs.avail_in = (uInt)zeros_len;
+    zs.next_out = packed;
+    zs.avail_out = 65536;
+    deflate(&zs, Z_FINISH);
+    size_t packed_len = zs.total_out;
+    deflateEnd(&zs);
+
+    network_buffer_sink_t out;
+    network_buffer_sink_init(&out);
+    content_decoder_t decoder;
+    content_decoder_init(&decoder, CONTENT_CODING_GZIP, &out.base);
+    decoder.max_output = 1024 * 1024;
+    decoder.base.on_headers(&decoder.base, 200, "text/html", -1);
+    int accepted = decoder.base.on_data(&decoder.base, (const char *)packed, packed_len);
+    int ok = !accepted && decoder.failed && out.size <= decoder.max_output;
+    LOG_INFO("Bomb of %lu compressed bytes stopped after %lu decoded", (unsigned long)packed_len, (unsigned long)out.size);
+    content_decoder_end(&decoder);
+    network_buffer_sink_attach(&out, NULL);
+    free(zeros);
+    free(packed);
+    return ok;
+}
+
+typedef struct {
+    char body[256];
+    size_t body_len;
+    int headers_seen;
+} parse_capture_t;
+
+static int capture_headers(http_parser_t *parser, void *user) {
+    (void)parser;
+    ((parse_capture_t *)user)->headers_seen++;
+    return 1;
+}
+
+static int capture_body(http_parser_t *parser, const char *data, size_t len, void *user) {
+    parse_capture_t *cap = user;
+    (void)parser;
+    if (cap->body_len + len > sizeof(cap->body)) return 0;
+    memcpy(cap->body + cap->body_len, data, len);
+    cap->body_len += len;
+    return 1;
+}
+
+static const http_parser_callbacks_t g_capture_callbacks = {capture_headers, capture_body};
+
+// Parse a canned response fed as two pieces split at split; returns 1 if it
+// completes with the expected status, body and reuse signal
+static int parse_split(const char *raw, size_t raw_len, size_t split, int head,
+                       int status, const char *body, size_t body_len, int reusable) {
+    http_parser_t parser;
+    parse_capture_t cap;
+    memset(&cap, 0, sizeof(cap));
+    http_parser_init(&parser, head);
+    size_t used = http_parser_execute(&parser, &g_capture_callbacks, &cap, raw, split);
+    if (used == split) used += http_parser_execute(&parser, &g_capture_callbacks, &cap, raw + split, raw_len - split);
+    if (used == raw_len) http_parser_finish(&parser);
+    int ok = parser.state == HTTP_PARSE_DONE && parser.status_code == status && cap.headers_seen == 1 &&
+             cap.body_len == body_len && memcmp(cap.body, body, body_len) == 0 &&
+             http_parser_reusable(&parser) == reusable;
+    http_parser_free(&parser);
+    return ok;
+}
+
+static int test_http_parser_impl() {
+    static const struct {
+        const char *raw;
+        size_t raw_len;       // 0 = strlen
+        int head;
+        int status;
+        const char *body;
+        size_t body_len;
+        int reusable;
+    } cases[] = {
+        {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello", 0, 0, 200, "hello", 5, 1},
+        // Binary chunk data with NULs, an extension and a trailer
+        {"HTTP/1.1 200 OK\r\ntransfer-encoding: chunked\r\n\r\n3;ext=1\r\na\0b\r\n2\r\n\r\n\r\n0\r\nX-Sum: 1\r\n\r\n",
+         83, 0, 200, "a\0b\r\n", 5, 1},
+        {"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok", 0, 0, 201, "ok", 2, 1},
+        {"HTTP/1.1 200 OK\r\nConnection: Keep-Alive, Close\r\nContent-Length: 2\r\n\r\nhi", 0, 0, 200, "hi", 2, 0},
+        {"HTTP/1.0 200 OK\nServer: old\n\nuntil eof", 0, 0, 200, "until eof", 9, 0},
+        {"HTTP/1.0 200 OK\r\nConnection: keep-alive\r\nContent-Length: 0\r\n\r\n", 0, 0, 200, "", 0, 1},
+        {"HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n", 0, 1, 200, "", 0, 1},
+        {"HTTP/1.1 304 Not Modified\r\nETag: \"x\"\r\n\r\n", 0, 0, 304, "", 0, 1},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t len = cases[i].raw_len ? cases[i].raw_len : strlen(cases[i].raw);
+        for (size_t split = 0; split <= len; split++) {
+            if (!parse_split(cases[i].raw, len, split, cases[i].head, cases[i].status,
+                             cases[i].body, cases[i].body_len, cases[i].reusable)) {
+                LOG_ERROR("HTTP parser: case %lu failed when split at %lu", (unsigned long)i, (unsigned long)split);
+                return 0;
+            }
+        }
+    }
+
+    // Header table: case-insensitive, repeated fields and obsolete folding merged
+    const char *raw = "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nX-Long: one\r\n  two\r\n"
+                      "cache-control: no-store\r\nContent-Length: 3, 3\r\n\r\nabc";
+    http_parser_t parser;
+    http_parser_init(&parser, 0);
+    http_parser_execute(&parser, NULL, NULL, raw, strlen(raw));
+    const char *cc = http_parser_header(&parser, "CACHE-CONTROL");
+    const char *folded = http_parser_header(&parser, "x-long");
+    int ok = parser.state == HTTP_PARSE_DONE && parser.content_length == 3 &&
+             cc && strcmp(cc, "no-cache, no-store") == 0 && folded && strcmp(folded, "one two") == 0 &&
+             http_parser_header(&parser, "Location") == NULL;
+    http_parser_free(&parser);
+    if (!ok) return 0;
+
+    // Malformed input must fail cleanly
+    const char *bad[] = {
+        "HTTP/2 200 OK\r\n\r\n",
+        "HTTP/1.1 2x0 OK\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nNoColon\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5, 6\r\n\r\nhello",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nab\r\n",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        http_parser_init(&parser, 0);
+        http_parser_execute(&parser, NULL, NULL, bad[i], strlen(bad[i]));
+        ok = parser.state == HTTP_PARSE_ERROR;
+        http_parser_free(&parser);
+        if (!ok) {
+            LOG_ERROR("HTTP parser: malformed case %lu accepted", (unsigned long)i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Random byte mutations of a canned response, then throughput on a large
+// chunked body
+static int test_http_parser_fuzz_impl() {
+    const char *seed = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nTransfer-Encoding: chunked\r\n"
+                       "Set-Cookie: a=1\r\n\r\n5\r\nhello\r\n6;x\r\n world\r\n0\r\n\r\n";
+    size_t seed_len = strlen(seed);
+    char mutated[256];
+    unsigned int rng = 12345;
+    for (int iter = 0; iter < 20000; iter++) {
+        memcpy(mutated, seed, seed_len);
+        for (int m = 0; m < 4; m++) {
+            rng = rng * 1103515245u + 12345u;
+            size_t at = (rng >> 8) % seed_len;
+            rng = rng * 1103515245u + 12345u;
+            mutated[at] = (char)(rng >> 16);
+        }
+        http_parser_t parser;
+        parse_capture_t cap;
+        memset(&cap, 0, sizeof(cap));
+        http_parser_init(&parser, 0);
+        size_t split = (rng >> 4) % seed_len;
+        size_t used = http_parser_execute(&parser, &g_capture_callbacks, &cap, mutated, split);
+        if (used == split) used += http_parser_execute(&parser, &g_capture_callbacks, &cap, mutated + split, seed_len - split);
+        http_parser_finish(&parser);
+        int sane = used <= seed_len && cap.body_len <= seed_len && parser.state >= HTTP_PARSE_DONE;
+        http_parser_free(&parser);
+        if (!sane) return 0;
+    }
+
+    // 4 MB of 4 KB chunks, parsed from 16 KB reads
+    size_t chunk = 4096, chunks = 1024;
+    size_t cap_len = 128 + chunks * (chunk + 16);
+    char *big = malloc(cap_len);
+    if (!big) return 0;
+    size_t len = (size_t)sprintf(big, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (size_t i = 0; i < chunks; i++) {
+        len += (size_t)sprintf(big + len, "%lx\r\n", (unsigned long)chunk);
+        memset(big + len, 'a' + (int)(i % 26), chunk);
+        len += chunk;
+        memcpy(big + len, "\r\n", 2);
+        len += 2;
+    }
+    len += (size_t)sprintf(big + len, "0\r\n\r\n");
+
+    int rounds = 200, ok = 1;
+    DWORD start = GetTickCount();
+    for (int r = 0; r < rounds && ok; r++) {
+        http_parser_t parser;
+        http_parser_init(&parser, 0);
+        for (size_t pos = 0; pos < len; pos += 16384) {
+            size_t n = len - pos < 16384 ? len - pos : 16384;
+            http_parser_execute(&parser, NULL, NULL, big + pos, n);
+        }
+        ok = parser.state == HTTP_PARSE_DONE && parser.body_bytes == chunk * chunks;
+        http_parser_free(&parser);
+    }
+    DWORD elapsed = GetTickCount() - start;
+    LOG_INFO("HTTP parser: %lu MB in %lu ms (%lu MB/s)", (unsigned long)(len * rounds >> 20), (unsigned long)elapsed,
+             elapsed ? (unsigned long)(((unsigned long long)len * rounds >> 20) * 1000 / elapsed) : 0);
+    free(big);
+    return ok;
+}
+
+static int test_dns_cache_impl() {
+    dns_cache_clear();
+    dns_cache_stats_t before, after;
+    dns_cache_get_stats(&before);
+
+    // Second lookup is a hit, with the port of that call
+    dns_result_t result;
+    if (!dns_resolve("localhost", 443, &result) || !dns_resolve("localhost", 8080, &result)) return 0;
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)&result.addrs[0].addr;
+    if (result.count < 1 || ntohs(sin->sin_port) != 8080) return 0;
+
+    // Failures are cached too (.invalid never resolves)
+    if (dns_resolve("gem32-test.invalid", 443, &result) || dns_resolve("gem32-test.invalid", 443, &result)) return 0;
+
+    // A resolve racing a prefetch waits for it rather than looking up again
+    dns_prefetch("127.0.0.1");
+    if (!dns_resolve("127.0.0.1", 1965, &result)) return 0;
+
+    dns_cache_get_stats(&after);
+    LOG_INFO("DNS cache: %lu hits, %lu misses, %lu negative hits", after.hits - before.hits,
+             after.misses - before.misses, after.negative_hits - before.negative_hits);
+    return after.hits - before.hits == 2 && after.misses - before.misses == 2 &&
+           after.negative_hits - before.negative_hits == 1 && after.prefetches - before.prefetches == 1;
+}
+
+static int test_http_cache_impl() {
+    // The three HTTP-date forms of the same instant; "0" is an invalid date
+    if (http_cache_parse_date("Sun, 06 Nov 1994 08:49:37 GMT") != 784111777 ||
+        http_cache_parse_date("Sunday, 06-Nov-94 08:49:37 GMT") != 784111777 ||
+        http_cache_parse_date("Sun Nov  6 08:49:37 1994") != 784111777 ||
+        http_cache_parse_date("0") != -1) {
+        LOG_ERROR("HTTP-date parsing failed");
+        return 0;
+    }
+
+    const char *url = "http://127.0.0.1/gem32-http-cache-test.txt";
+    long long now = 1700000000;
+    char body[] = "cached body";
+    network_response_t res;
+    cache_meta_t meta;
+
+    // max-age wins over Expires; without either, 10% of the Last-Modified age
+    memset(&res, 0, sizeof(res));
+    res.status_code = 200;
+    res.data = body;
+    res.size = strlen(body);
+    res.cache_control = "public, max-age=60";
+    res.expires = "Tue, 14 Nov 2023 22:23:20 GMT"; // now + 600
+    if (!http_cache_meta_from_response(url, &res, now, &meta) || meta.expires_at != now + 60) return 0;
+    res.cache_control = NULL;
+    if (!http_cache_meta_from_response(url, &res, now, &meta) || meta.expires_at != now + 600) return 0;
+    res.expires = NULL;
+    res.last_modified = "Sun, 06 Nov 1994 08:49:37 GMT";
+    if (!http_cache_meta_from_response(url, &res, 784111777 + 1000, &meta) || meta.expires_at != 784111777 + 1100) return 0;
+
+    // no-store is never kept, nor is a response with no freshness and no validators
+    res.cache_control = "no-store";
+    if (http_cache_meta_from_response(url, &res, now, &meta)) return 0;
+    res.cache_control = NULL;
+    res.last_modified = NULL;
+    if (http_cache_meta_from_response(url, &res, now, &meta)) return 0;
+
+    // A stale entry is revalidated and a 304 brings back the stored body,
+    // fresh again for the 304's max-age
+    test_use_scratch_cache();
+    cache_init();
+    http_cache_stats_t before, after;
+    http_cache_get_stats(&before);
+    res.etag = "\"v1\"";
+    res.cache_control = "no-cache";
+    if (!http_cache_meta_from_response(url, &res, now, &meta) || !cache_put(CACHE_TYPE_IMAGE, url, body, strlen(body), &meta)) return 0;
+
+    http_cache_entry_t entry;
+    if (http_cache_begin(CACHE_TYPE_IMAGE, url, &entry) || !entry.buffer || strcmp(entry.meta.etag, "\"v1\"") != 0) return 0;
+    network_response_t *not_modified = calloc(1, sizeof(network_response_t));
+    if (!not_modified) return 0;
+    not_modified->status_code = 304;
+    network_response_set_validators(not_modified, NULL, NULL, "max-age=60", NULL);
+    network_response_t *out = http_cache_finish(url, &entry, not_modified);
+    int ok = out && out->status_code == 200 && out->size == strlen(body) && memcmp(out->data, body, out->size) == 0;
+    network_response_free(out);
+
+    if (ok && http_cache_begin(CACHE_TYPE_IMAGE, url, &entry)) {
+        out = http_cache_finish(url, &entry, NULL);
+        ok = out && out->size == strlen(body);
+        network_response_free(out);
+    } else {
+        http_cache_finish(url, &entry, NULL);
+        ok = 0;
+    }
+
+    // A body cut short reaches the caller but never the cache, however fresh it claims to be
+    char cut_url[96];
+    snprintf(cut_url, sizeof(cut_url), "http://127.0.0.1/gem32-http-cache-cut-%lu.txt", (unsigned long)GetTickCount());
+    network_response_t *cut = calloc(1, sizeof(network_response_t));
+    if (!cut || http_cache_begin(CACHE_TYPE_IMAGE, cut_url, &entry)) return 0;
+    cut->status_code = 200;
+    cut->data = strdup(body);
+    cut->size = strlen(body);
+    cut->incomplete = 1;
+    network_response_set_validators(cut, NULL, NULL, "max-age=600", NULL);
+    out = http_cache_finish(cut_url, &entry, cut);
+    ok = ok && out == cut;
+    network_response_free(out);
+    if (http_cache_begin(CACHE_TYPE_IMAGE, cut_url, &entry) || entry.buffer) {
+        LOG_ERROR("Truncated body was cached");
+        ok = 0;
+    }
+    http_cache_finish(cut_url, &entry, NULL);
+
+    // A 304 marked no-store still serves the stored body, then drops it
+    char gone_url[96];
+    snprintf(gone_url, sizeof(gone_url), "http://127.0.0.1/gem32-http-cache-no-store-%lu.txt", (unsigned long)GetTickCount());
+    res.cache_control = "no-cache";
+    if (!http_cache_meta_from_response(gone_url, &res, now, &meta) ||
+        !cache_put(CACHE_TYPE_IMAGE, gone_url, body, strlen(body), &meta)) return 0;
+    if (http_cache_begin(CACHE_TYPE_IMAGE, gone_url, &entry) || !entry.buffer) return 0;
+    not_modified = calloc(1, sizeof(network_response_t));
+    if (!not_modified) return 0;
+    not_modified->status_code = 304;
+    network_response_set_validators(not_modified, NULL, NULL, "no-store", NULL);
+    out = http_cache_finish(gone_url, &entry, not_modified);
+    ok = ok && out && out->size == strlen(body) && memcmp(out->data, body, out->size) == 0;
+    network_response_free(out);
+    if (http_cache_begin(CACHE_TYPE_IMAGE, gone_url, &entry) || entry.buffer) {
+        LOG_ERROR("Entry revalidated as no-store was kept");
+        ok = 0;
+    }
+    http_cache_finish(gone_url, &entry, NULL);
+    cache_flush();
+    cache_buffer_t *gone = cache_get(CACHE_TYPE_IMAGE, gone_url, NULL);
+    if (gone) ok = 0;
+    cache_buffer_release(gone);
+
+    http_cache_get_stats(&after);
+    LOG_INFO("HTTP cache: %lu revalidated, %lu fresh hits", after.revalidated - before.revalidated,
+             after.fresh_hits - before.fresh_hits);
+    return ok && after.revalidated - before.revalidated == 2 && after.fresh_hits - before.fresh_hits == 1;
+}
+
 static int test_http_impl() {
     network_response_t *res = network_fetch("http://google.com");
     int ok = (res && res->status_code >= 200 && res->status_code < 400);
@@ -57,9 +553,541 @@ static int test_gemini_impl() {
     return ok;
 }
 
+// --- Local image server for loader benchmarks ---
+
+#define BENCH_IMAGE_COUNT 32
+#define BENCH_LATENCY_MS 50
+
+// 1x1 transparent GIF
+static const unsigned char g_bench_gif[] = {
+    0x47,0x49,0x46,0x38,0x39,0x61,0x01,0x00,0x01,0x00,0x80,0x00,0x00,0x00,0x00,0x00,
+    0xFF,0xFF,0xFF,0x21,0xF9,0x04,0x01,0x00,0x00,0x00,0x00,0x2C,0x00,0x00,0x00,0x00,
+    0x01,0x00,0x01,0x00,0x00,0x02,0x02,0x44,0x01,0x00,0x3B
+};
+
+static unsigned __stdcall bench_client_thread(void *arg) {
+    SOCKET client = (SOCKET)(UINT_PTR)arg;
+    char request[2048];
+    int total = 0;
+    while (total < (int)sizeof(request) - 1) {
+        int n = recv(client, request + total, sizeof(request) - 1 - total, 0);
+        if (n <= 0) break;
+        total += n;
+        request[total] = '\0';
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+
+    Sleep(BENCH_LATENCY_MS); // Simulated round trip
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Type: image/gif\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+        (int)sizeof(g_bench_gif));
+    send(client, header, header_len, 0);
+    send(client, (const char *)g_bench_gif, sizeof(g_bench_gif), 0);
+    closesocket(client);
+    return 0;
+}
+
+static unsigned __stdcall bench_server_thread(void *arg) {
+    SOCKET listener = (SOCKET)(UINT_PTR)arg;
+    for (;;) {
+        SOCKET client = accept(listener, NULL, NULL);
+        if (client == INVALID_SOCKET) break; // Listener closed
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, bench_client_thread, (void *)(UINT_PTR)client, 0, NULL);
+        if (thread) CloseHandle(thread);
+        else closesocket(client);
+    }
+    return 0;
+}
+
+static int count_loaded_images(node_t *node) {
+    if (!node) return 0;
+    int count = (node->image_data && node->image_size == sizeof(g_bench_gif)) ? 1 : 0;
+    for (node_t *child = node->first_child; child; child = child->next_sibling) {
+        count += count_loaded_images(child);
+    }
+    return count;
+}
+
+static int test_loader_concurrency_impl() {
+    test_use_scratch_cache(); // The loader stores what it fetches
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return 0;
+
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0; // Any free port
+    int addr_len = sizeof(addr);
+    if (listener == INVALID_SOCKET ||
+        bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) != 0) {
+        LOG_ERROR("Failed to start local image server");
+        if (listener != INVALID_SOCKET) closesocket(listener);
+        WSACleanup();
+        return 0;
+    }
+    HANDLE server = (HANDLE)_beginthreadex(NULL, 0, bench_server_thread, (void *)(UINT_PTR)listener, 0, NULL);
+
+    int passed = 1;
+    const int worker_counts[] = {1, 4, 8};
+    DWORD elapsed[3] = {0};
+    for (int run = 0; run < 3 && passed; run++) {
+        // Unique URLs per run so the disk cache never answers
+        char html[BENCH_IMAGE_COUNT * 96 + 64];
+        int len = snprintf(html, sizeof(html), "<html><body>");
+        for (int i = 0; i < BENCH_IMAGE_COUNT; i++) {
+            len += snprintf(html + len, sizeof(html) - len,
+                            "<img src=\"http://127.0.0.1:%d/img%d.gif?run=%lu-%d\">",
+                            ntohs(addr.sin_port), i, (unsigned long)GetTickCount(), run);
+        }
+        snprintf(html + len, sizeof(html) - len, "</body></html>");
+
+        node_t *dom = html_parse(html);
+        if (!dom) { passed = 0; break; }
+        int total = loader_count_resources(dom);
+        int current = 0;
+
+        loader_set_concurrency(worker_counts[run], 8);
+        DWORD start = GetTickCount();
+        loader_fetch_resources(dom, "http://127.0.0.1", NULL, NULL, NULL, &current, total);
+        elapsed[run] = GetTickCount() - start;
+
+        int loaded = count_loaded_images(dom);
+        if (loaded != BENCH_IMAGE_COUNT) {
+            LOG_ERROR("%d workers: %d of %d images attached", worker_counts[run], loaded, BENCH_IMAGE_COUNT);
+            passed = 0;
+        }
+        LOG_INFO("%d images at %d ms latency: %lu ms with %d worker(s)",
+                 BENCH_IMAGE_COUNT, BENCH_LATENCY_MS, (unsigned long)elapsed[run], worker_counts[run]);
+        node_free(dom);
+    }
+
+    // The figures to quote for the pool: speedup over one worker, in tenths
+    if (passed && elapsed[1] && elapsed[2]) {
+        LOG_INFO("Loader speedup over 1 worker: %lu.%lux with 4, %lu.%lux with 8",
+                 (unsigned long)(elapsed[0] * 10 / elapsed[1] / 10), (unsigned long)(elapsed[0] * 10 / elapsed[1] % 10),
+                 (unsigned long)(elapsed[0] * 10 / elapsed[2] / 10), (unsigned long)(elapsed[0] * 10 / elapsed[2] % 10));
+    }
+
+    // 8 workers must beat a single worker by a wide margin
+    if (passed && elapsed[2] * 3 > elapsed[0]) {
+        LOG_ERROR("No concurrency speedup (1 worker %lu ms, 8 workers %lu ms)",
+                  (unsigned long)elapsed[0], (unsigned long)elapsed[2]);
+        passed = 0;
+    }
+
+    loader_set_concurrency(LOADER_DEFAULT_WORKERS, LOADER_DEFAULT_PER_HOST);
+    closesocket(listener);
+    if (server) {
+        WaitForSingleObject(server, 5000);
+        CloseHandle(server);
+    }
+    WSACleanup();
+    return passed;
+}
+
+// --- Local server with canned replies, for tests of misbehaving servers ---
+
+typedef struct {
+    SOCKET listener;
+    int port;
+    const char *volatile reply;  // Sent to each connection after its request, which is then closed
+    HANDLE thread;
+} canned_server_t;
+
+static unsigned __stdcall canned_server_thread(void *arg) {
+    canned_server_t *server = arg;
+    for (;;) {
+        SOCKET client = accept(server->listener, NULL, NULL);
+        if (client == INVALID_SOCKET) break; // Listener closed
+        char request[2048];
+        int total = 0;
+        while (total < (int)sizeof(request) - 1) {
+            int n = recv(client, request + total, sizeof(request) - 1 - total, 0);
+            if (n <= 0) break;
+            total += n;
+            request[total] = '\0';
+            if (strstr(request, "\r\n\r\n")) break;
+        }
+        const char *reply = server->reply;
+        if (reply) send(client, reply, (int)strlen(reply), 0);
+        shutdown(client, SD_SEND);
+        closesocket(client);
+    }
+    return 0;
+}
+
+static int canned_server_start(canned_server_t *server) {
+    memset(server, 0, sizeof(*server));
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return 0;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(addr);
+    server->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server->listener == INVALID_SOCKET ||
+        bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listener, SOMAXCONN) != 0 ||
+        getsockname(server->listener, (struct sockaddr *)&addr, &addr_len) != 0 ||
+        !(server->thread = (HANDLE)_beginthreadex(NULL, 0, canned_server_thread, server, 0, NULL))) {
+        LOG_ERROR("Failed to start local server");
+        if (server->listener != INVALID_SOCKET) closesocket(server->listener);
+        WSACleanup();
+        return 0;
+    }
+    server->port = ntohs(addr.sin_port);
+    return 1;
+}
+
+static void canned_server_stop(canned_server_t *server) {
+    closesocket(server->listener);
+    WaitForSingleObject(server->thread, 5000);
+    CloseHandle(server->thread);
+    WSACleanup();
+}
+
+static int test_truncated_response_impl() {
+    canned_server_t server;
+    if (!canned_server_start(&server)) return 0;
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", server.port);
+
+    int passed = 1;
+    server.reply = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\nConnection: close\r\n\r\n0123456789";
+    network_response_t *res = http_fetch(url);
+    if (!res || res->incomplete || res->size != 10) {
+        LOG_ERROR("Complete body came back %s", res ? "flagged or short" : "NULL");
+        passed = 0;
+    }
+    network_response_free(res);
+
+    // The connection closes 990 bytes early
+    server.reply = "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\nConnection: close\r\n\r\n0123456789";
+    res = http_fetch(url);
+    if (!res || !res->incomplete) {
+        LOG_ERROR("Truncated body came back %s", res ? "as complete" : "NULL");
+        passed = 0;
+    }
+    network_response_free(res);
+
+    canned_server_stop(&server);
+    return passed;
+}
+
+// --- Local keep-alive HTTPS server, for connection pool tests ---
+
+typedef struct {
+    SOCKET listener;
+    int port;
+    SSL_CTX *ctx;
+    volatile LONG accepted;           // Connections accepted so far
+    volatile LONG close_after_reply;  // Close each connection once it has answered
+    volatile LONG requests_per_conn;  // Later requests on a connection are dropped unanswered; 0 = no limit
+    HANDLE thread;
+} pool_server_t;
+
+typedef struct {
+    SOCKET client;
+    SSL_CTX *ctx;
+    int close_after_reply;
+    int requests_per_conn;
+} pool_client_t;
+
+static unsigned __stdcall pool_client_thread(void *arg) {
+    pool_client_t *c = arg;
+    SSL *ssl = SSL_new(c->ctx);
+    if (ssl && SSL_set_fd(ssl, (int)c->client) && SSL_accept(ssl) == 1) {
+        const char reply[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok";
+        for (int served = 0;; served++) {
+            char request[2048];
+            int total = 0;
+            request[0] = '\0';
+            while (total < (int)sizeof(request) - 1 && !strstr(request, "\r\n\r\n")) {
+                int n = SSL_read(ssl, request + total, (int)sizeof(request) - 1 - total);
+                if (n <= 0) break;
+                total += n;
+                request[total] = '\0';
+            }
+            if (!strstr(request, "\r\n\r\n")) break; // Client closed the connection
+            // Hang up without a word, as a server timing out the connection would
+            if (c->requests_per_conn && served >= c->requests_per_conn) break;
+            if (SSL_write(ssl, reply, (int)strlen(reply)) <= 0) break;
+            if (c->close_after_reply) {
+                SSL_shutdown(ssl);
+                break;
+            }
+        }
+    }
+    SSL_free(ssl);
+    closesocket(c->client);
+    free(c);
+    return 0;
+}
+
+static unsigned __stdcall pool_server_thread(void *arg) {
+    pool_server_t *server = arg;
+    for (;;) {
+        SOCKET client = accept(server->listener, NULL, NULL);
+        if (client == INVALID_SOCKET) break; // Listener closed
+        InterlockedIncrement(&server->accepted);
+        // Each connection keeps the settings it was accepted under
+        pool_client_t *c = calloc(1, sizeof(pool_client_t));
+        HANDLE thread = NULL;
+        if (c) {
+            c->client = client;
+            c->ctx = server->ctx;
+            c->close_after_reply = server->close_after_reply;
+            c->requests_per_conn = server->requests_per_conn;
+            thread = (HANDLE)_beginthreadex(NULL, 0, pool_client_thread, c, 0, NULL);
+        }
+        if (thread) {
+            CloseHandle(thread);
+        } else {
+            free(c);
+            closesocket(client);
+        }
+    }
+    return 0;
+}
+
+// A throwaway P-256 key and self-signed certificate; the client does not verify it
+static SSL_CTX* pool_server_context(void) {
+    SSL_CTX *ctx = NULL;
+    EVP_PKEY *key = NULL;
+    X509 *cert = X509_new();
+    EVP_PKEY_CTX *keygen = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    if (cert && keygen && EVP_PKEY_keygen_init(keygen) > 0 &&
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen, NID_X9_62_prime256v1) > 0 &&
+        EVP_PKEY_keygen(keygen, &key) > 0) {
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME *name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"127.0.0.1", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        if (X509_sign(cert, key, EVP_sha256()) > 0) ctx = SSL_CTX_new(TLS_server_method());
+        if (ctx && (SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1)) {
+            SSL_CTX_free(ctx);
+            ctx = NULL;
+        }
+    }
+    EVP_PKEY_CTX_free(keygen);
+    EVP_PKEY_free(key);
+    X509_free(cert);
+    return ctx;
+}
+
+static int pool_server_start(pool_server_t *server) {
+    memset(server, 0, sizeof(*server));
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) return 0;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(addr);
+    server->ctx = pool_server_context();
+    server->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (!server->ctx || server->listener == INVALID_SOCKET ||
+        bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listener, SOMAXCONN) != 0 ||
+        getsockname(server->listener, (struct sockaddr *)&addr, &addr_len) != 0 ||
+        !(server->thread = (HANDLE)_beginthreadex(NULL, 0, pool_server_thread, server, 0, NULL))) {
+        LOG_ERROR("Failed to start local HTTPS server");
+        if (server->listener != INVALID_SOCKET) closesocket(server->listener);
+        if (server->ctx) SSL_CTX_free(server->ctx);
+        WSACleanup();
+        return 0;
+    }
+    server->port = ntohs(addr.sin_port);
+    return 1;
+}
+
+// Connections still open hold their own reference to the context
+static void pool_server_stop(pool_server_t *server) {
+    closesocket(server->listener);
+    WaitForSingleObject(server->thread, 5000);
+    CloseHandle(server->thread);
+    SSL_CTX_free(server->ctx);
+    WSACleanup();
+}
+
+static int pool_fetch_ok(const char *url) {
+    network_response_t *res = http_fetch(url);
+    int ok = res && res->status_code == 200 && !res->incomplete && res->size == 2 && memcmp(res->data, "ok", 2) == 0;
+    if (!ok) LOG_ERROR("Fetch of %s failed", url);
+    network_response_free(res);
+    return ok;
+}
+
+static int test_conn_pool_impl() {
+    pool_server_t server;
+    if (!pool_server_start(&server)) return 0;
+    char url[64];
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d/", server.port);
+    conn_pool_clear();
+
+    // The second request reuses the first one's connection
+    conn_pool_stats_t before, after;
+    conn_pool_get_stats(&before);
+    int passed = pool_fetch_ok(url) && pool_fetch_ok(url);
+    conn_pool_get_stats(&after);
+    if (passed && (server.accepted != 1 || after.reused - before.reused != 1)) {
+        LOG_ERROR("Two requests took %ld connections", (long)server.accepted);
+        passed = 0;
+    }
+
+    // The server closes each connection after answering: the dead one is
+    // never handed out (or, if its close lands late, the request is retried)
+    conn_pool_clear();
+    server.close_after_reply = 1;
+    LONG accepted = server.accepted;
+    conn_pool_get_stats(&before);
+    passed = passed && pool_fetch_ok(url);
+    Sleep(100); // Let the close arrive
+    passed = passed && pool_fetch_ok(url);
+    conn_pool_get_stats(&after);
+    if (passed && (server.accepted - accepted != 2 ||
+                   (after.expired - before.expired) + (after.retried - before.retried) != 1)) {
+        LOG_ERROR("Connection closed by the server was not replaced");
+        passed = 0;
+    }
+
+    // The server hangs up on the reused connection without answering: the
+    // request is retried on a fresh one
+    conn_pool_clear();
+    server.close_after_reply = 0;
+    server.requests_per_conn = 1;
+    accepted = server.accepted;
+    conn_pool_get_stats(&before);
+    passed = passed && pool_fetch_ok(url) && pool_fetch_ok(url);
+    conn_pool_get_stats(&after);
+    if (passed && (server.accepted - accepted != 2 || after.retried - before.retried != 1)) {
+        LOG_ERROR("Stale pooled connection was not retried (%lu retries)", after.retried - before.retried);
+        passed = 0;
+    }
+
+    // A connection idle past the timeout is closed, not reused
+    conn_pool_clear();
+    server.requests_per_conn = 0;
+    conn_pool_set_idle_timeout(100);
+    accepted = server.accepted;
+    conn_pool_get_stats(&before);
+    passed = passed && pool_fetch_ok(url);
+    Sleep(300);
+    passed = passed && pool_fetch_ok(url);
+    conn_pool_get_stats(&after);
+    if (passed && (server.accepted - accepted != 2 || after.reused != before.reused || after.expired - before.expired != 1)) {
+        LOG_ERROR("Idle-expired connection was handed out");
+        passed = 0;
+    }
+    conn_pool_set_idle_timeout(CONN_POOL_IDLE_TIMEOUT_MS);
+
+    conn_pool_clear();
+    pool_server_stop(&server);
+    return passed;
+}
+
+// ip is dotted IPv4, or NULL for 100::1 (inet_pton is not available on XP)
+static void add_test_address(dns_result_t *result, const char *ip, int port) {
+    dns_address_t *a = &result->addrs[result->count++];
+    memset(a, 0, sizeof(*a));
+    if (!ip) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&a->addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((u_short)port);
+        in6->sin6_addr.s6_addr[0] = 0x01;
+        in6->sin6_addr.s6_addr[15] = 0x01;
+        a->family = AF_INET6;
+        a->addr_len = sizeof(*in6);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&a->addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((u_short)port);
+        in->sin_addr.s_addr = inet_addr(ip);
+        a->family = AF_INET;
+        a->addr_len = sizeof(*in);
+    }
+}
+
+// Connect through addresses that go nowhere: 100::1 is in the IPv6 discard
+// prefix and 192.0.2.1 in TEST-NET-1, so either fails at once (no route) or
+// never answers, depending on the machine's routes
+static int test_happy_eyeballs_impl() {
+    canned_server_t server;
+    if (!canned_server_start(&server)) return 0;
+    int passed = 1;
+
+    // The listener comes third, after an attempt delay on each dead address at most
+    dns_result_t resolved = {0};
+    add_test_address(&resolved, NULL, server.port);
+    add_test_address(&resolved, "192.0.2.1", server.port);
+    add_test_address(&resolved, "127.0.0.1", server.port);
+    DWORD start = GetTickCount();
+    SOCKET s = tls_connect_addresses("fallback.test", server.port, &resolved, TLS_CONNECT_TIMEOUT_MS);
+    DWORD elapsed = GetTickCount() - start;
+    if (s == INVALID_SOCKET || elapsed > 2 * TLS_CONNECT_ATTEMPT_DELAY_MS + 500) {
+        LOG_ERROR("Fallback to the local listener %s after %lu ms", s == INVALID_SOCKET ? "failed" : "succeeded",
+                  (unsigned long)elapsed);
+        passed = 0;
+    }
+    if (s != INVALID_SOCKET) closesocket(s);
+
+    // Refused: nothing listens on the port once the server is gone
+    int port = server.port;
+    canned_server_stop(&server);
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+    memset(&resolved, 0, sizeof(resolved));
+    add_test_address(&resolved, "127.0.0.1", port);
+    start = GetTickCount();
+    s = tls_connect_addresses("refused.test", port, &resolved, TLS_CONNECT_TIMEOUT_MS);
+    elapsed = GetTickCount() - start;
+    if (s != INVALID_SOCKET || elapsed >= TLS_CONNECT_TIMEOUT_MS) {
+        LOG_ERROR("Refused connect %s after %lu ms", s == INVALID_SOCKET ? "waited for the timeout" : "succeeded",
+                  (unsigned long)elapsed);
+        passed = 0;
+    }
+    if (s != INVALID_SOCKET) closesocket(s);
+
+    // Black hole (or unreachable): gives up within the timeout given
+    memset(&resolved, 0, sizeof(resolved));
+    add_test_address(&resolved, "192.0.2.1", port);
+    start = GetTickCount();
+    s = tls_connect_addresses("blackhole.test", port, &resolved, 1000);
+    elapsed = GetTickCount() - start;
+    if (s != INVALID_SOCKET || elapsed > 1500) {
+        LOG_ERROR("Unroutable connect %s after %lu ms", s == INVALID_SOCKET ? "failed late" : "succeeded",
+                  (unsigned long)elapsed);
+        passed = 0;
+    }
+    if (s != INVALID_SOCKET) closesocket(s);
+    WSACleanup();
+
+    return passed;
+}
+
 void run_network_tests(int *total_failed) {
     run_test_case("TLS Handshake (www.google.com)", test_tls_impl, total_failed);
+    run_test_case("TLS Session Resumption (www.google.com)", test_tls_resumption_impl, total_failed);
+    run_test_case("Buffered Response Sink", test_buffer_sink_impl, total_failed);
+    run_test_case("Content Decoding (gzip/deflate)", test_content_decoding_impl, total_failed);
+    run_test_case("HTTP Response Parser", test_http_parser_impl, total_failed);
+    run_test_case("HTTP Parser Fuzz and Throughput", test_http_parser_fuzz_impl, total_failed);
+    run_test_case("DNS Cache", test_dns_cache_impl, total_failed);
+    run_test_case("HTTP Cache Validation", test_http_cache_impl, total_failed);
     run_test_case("HTTP Fetch (google.com)", test_http_impl, total_failed);
     run_test_case("HTTPS Fetch (www.google.com)", test_https_impl, total_failed);
     run_test_case("Gemini Fetch (geminiprotocol.net)", test_gemini_impl, total_failed);
+    run_test_case("Concurrent Resource Loading (local server)", test_loader_concurrency_impl, total_failed);
+    run_test_case("Truncated Response (local server)", test_truncated_response_impl, total_failed);
+    run_test_case("Connection Pool (local server)", test_conn_pool_impl, total_failed);
+    run_test_case("Happy Eyeballs Connect (local server)", test_happy_eyeballs_impl, total_failed);
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include "test_ui.h"
 #include "core/log.h"
+#include "core/cache.h"
 #include <commctrl.h>
 #include <stdio.h>
+#include <string.h>
 
 #define MAX_TESTS 64
 static test_result_t g_results[MAX_TESTS];
@@ -27,6 +29,37 @@ void run_test_case(const char *name, test_func_t func, int *total_failed) {
     test_ui_add_result(name, passed, logs);
 }
 
+static char g_scratch_cache[MAX_PATH];
+
+void test_use_scratch_cache(void) {
+    if (!g_scratch_cache[0]) {
+        char temp[MAX_PATH];
+        DWORD len = GetTempPathA(sizeof(temp), temp);
+        if (len == 0 || len >= sizeof(temp)) strcpy(temp, ".\\");
+        snprintf(g_scratch_cache, sizeof(g_scratch_cache), "%sgem32-test-cache-%lu", temp,
+                 (unsigned long)GetCurrentProcessId());
+    }
+    cache_set_directory(g_scratch_cache);
+}
+
+void test_remove_scratch_cache(void) {
+    if (!g_scratch_cache[0]) return;
+    cache_cleanup();
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s\\*", g_scratch_cache);
+    WIN32_FIND_DATAA file;
+    HANDLE find = FindFirstFileA(path, &file);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            snprintf(path, sizeof(path), "%s\\%s", g_scratch_cache, file.cFileName);
+            DeleteFileA(path);
+        } while (FindNextFileA(find, &file));
+        FindClose(find);
+    }
+    RemoveDirectoryA(g_scratch_cache);
+}
+
 void test_ui_add_result(const char *name, int passed, const char *logs) {
     if (g_test_count < MAX_TESTS) {
         g_results[g_test_count].name = name;
@@ -16,4 +16,10 @@ void test_ui_show(void);
 typedef int (*test_func_t)(void);
 void run_test_case(const char *name, test_func_t func, int *total_failed);
 
+// Point the disk cache at a per-run directory under %TEMP%, so tests never
+// read, fill or clear the browser's own cache in the working directory
+void test_use_scratch_cache(void);
+// Close the cache and delete that directory
+void test_remove_scratch_cache(void);
+
 #endif
\ No newline at end of file